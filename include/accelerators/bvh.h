@@ -4,16 +4,39 @@
 #include <memory>
 #include <vector>
 #include <array>
+#include <atomic>
+#include <cstdio>
 #include "linalg/ray.h"
+#include "linalg/ray_packet.h"
 #include "linalg/util.h"
 #include "geometry/bbox.h"
 #include "geometry/differential_geometry.h"
+#include "accelerators/triangle_leaves.h"
+#include "accelerators/primitive_leaves.h"
+#include "aligned_allocator.h"
 
 /*
  * Different methods that can be used to partition the space
- * when building the BVH
+ * when building the BVH. LBVH sorts the geometry along a Morton curve
+ * and emits the tree from the sorted codes, trading some tree quality for
+ * a much faster build. The top levels of the LBVH are built with the SAH
+ * SBVH extends SAH with spatial splits that can split geometry references
+ * between both children, giving tighter nodes on meshes with long overlapping
+ * triangles at the cost of some duplicated references
  */
-enum class SPLIT_METHOD { MIDDLE, EQUAL, SAH };
+enum class SPLIT_METHOD { MIDDLE, EQUAL, SAH, LBVH, SBVH };
+/*
+ * Node layouts the BVH can be flattened into for traversal. BINARY is the
+ * PBR style flat binary tree while WIDE4 and WIDE8 collapse the tree into
+ * 4 or 8 wide nodes whose children are tested together with a SIMD slab test
+ * COMPRESSED4 and COMPRESSED8 are wide layouts that store the children's bounds
+ * quantized to 8 bits relative to their parent, shrinking the nodes to cut the
+ * memory traffic of traversal at the cost of decoding the bounds
+ * TREELET is the binary tree with siblings stored together in a cache line and the
+ * sibling pairs ordered in a van Emde Boas layout, so the upper levels of the tree
+ * are contiguous and each step of traversal touches fewer cache lines
+ */
+enum class BVH_LAYOUT { BINARY, WIDE4, WIDE8, COMPRESSED4, COMPRESSED8, TREELET };
 
 class Geometry;
 
@@ -31,29 +54,10 @@ class BVH {
 
 		GeomInfo(int i, const BBox &b);
 	};
-	//Node used when constructing the BVH tree
-	struct BuildNode {
-		//Node's children, null if a leaf node
-		std::array<std::unique_ptr<BuildNode>, 2> children;
-		//Offset to the first geometry in this node and # of geometry in it
-		//ngeom = 0 if this is an interior node
-		int geom_offset, ngeom;
-		BBox bounds;
-		//Which axis was split to form this node's children
-		AXIS split;
-
-		/*
-		 * Construct a leaf node
-		 */
-		BuildNode(int geom_offset, int ngeom, const BBox &bounds);
-		/*
-		 * Construct an interior node, where a & b are the node's children
-		 */
-		BuildNode(AXIS split, std::unique_ptr<BuildNode> a, std::unique_ptr<BuildNode> b);
-	};
 	/*
 	 * Nodes used to store the final flattened BVH structure, the first child
 	 * is right after the parent but the second child is at some offset further down
+	 * In the treelet layout both children are stored together, starting at second_child
 	 */
 	struct FlatNode {
 		BBox bounds;
@@ -67,6 +71,63 @@ class BVH {
 		uint16_t ngeom;
 		uint16_t axis;
 	};
+	/*
+	 * Bounds of the N children of a wide node in SoA layout so they can be tested at once
+	 * Unused child slots have inverted bounds so they're never hit
+	 */
+	template<int N>
+	struct WideBounds {
+		std::array<float, N> min_x, min_y, min_z, max_x, max_y, max_z;
+
+		//Get the bounds of child i
+		BBox box(int i) const;
+		//Get the bounds of all the children
+		BBox bounds() const;
+	};
+	/*
+	 * Nodes used to store the collapsed N-wide BVH structure. Unused child slots
+	 * have no geometry and refer to the root, which can't be anyone's child
+	 */
+	template<int N>
+	struct WideNode : WideBounds<N> {
+		static const int WIDTH = N;
+		//For interior children the index of the child node, for leaves the
+		//offset to the leaf's geometry
+		std::array<int, N> child;
+		//Number of geometry stored in each child, 0 if interior
+		std::array<uint16_t, N> ngeom;
+
+		WideNode();
+		void set_child(int i, const BBox &b, int c, int n);
+		//Set the bounds of all the used children
+		void set_bounds(const std::array<BBox, N> &bounds);
+		//Get the children's bounds for traversal, wide nodes store them directly
+		const WideBounds<N>& decode(WideBounds<N>&) const;
+	};
+	/*
+	 * Wide nodes with their children's bounds quantized to 8 bits on a grid covering the node.
+	 * The grid's cells are a power of 2 in size so decoding is exact up to adding the origin,
+	 * the quantized bounds are rounded outwards so the decoded bounds always contain the child
+	 * Unused child slots decode to inverted bounds
+	 */
+	template<int N>
+	struct CompressedNode {
+		static const int WIDTH = N;
+		//Origin of the quantization grid and the exponents of its cell size along each axis
+		std::array<float, 3> origin;
+		std::array<int8_t, 3> exponent;
+		std::array<uint8_t, N> qmin_x, qmin_y, qmin_z, qmax_x, qmax_y, qmax_z;
+		std::array<int, N> child;
+		std::array<uint16_t, N> ngeom;
+
+		//Compress the wide node
+		CompressedNode(const WideNode<N> &node);
+		//Quantize the bounds of all the used children
+		void set_bounds(const std::array<BBox, N> &bounds);
+		BBox bounds() const;
+		//Decode the children's bounds into bounds and return them
+		const WideBounds<N>& decode(WideBounds<N> &bounds) const;
+	};
 	//Bucket used for SAH split method
 	struct SAHBucket {
 		int count;
@@ -74,58 +135,382 @@ class BVH {
 
 		SAHBucket();
 	};
+	//Bin used to find SBVH spatial splits, entries and exits count the references
+	//starting and ending in the bin
+	struct SpatialBin {
+		BBox bounds;
+		int entries, exits;
+
+		SpatialBin();
+	};
+	//The best spatial split found for some SBVH node
+	struct SpatialSplit {
+		float cost, pos;
+		AXIS axis;
+		//Bounds and reference counts of each side of the split
+		BBox left, right;
+		int nleft, nright;
+	};
+	//Morton code of some geometry's center and its index in the build geometry, used by the LBVH builder
+	struct MortonGeom {
+		uint64_t code;
+		int geom;
+	};
+	//The threads a subtree is built with, split between its two children at each level down
+	struct BuildThreads {
+		//Threads used to bin and partition the subtree's geometry
+		int threads;
+		//Number of subtrees the subtree can be split into to build in parallel, more than the
+		//threads so the uneven subtrees can be balanced
+		int tasks;
+
+		/*
+		 * Get the threads for the whole tree
+		 */
+		static BuildThreads root();
+		/*
+		 * Get the threads for each of the subtree's children
+		 */
+		BuildThreads child() const;
+	};
+
+	//Node arrays are aligned to cache lines
+	template<typename T>
+	using NodeVector = std::vector<T, AlignedAllocator<T>>;
 
 	SPLIT_METHOD split;
 	unsigned max_geom;
+	BVH_LAYOUT layout;
+	//Fraction of the geometry count SBVH spatial splits can add in duplicate references
+	float dup_budget;
+	//If the build and refit times aren't printed, eg. for meshes loaded while rendering
+	bool quiet;
 	//The geometry being stored in this BVH
 	std::vector<Geometry*> geometry;
-	//The final flatted BVH structure
-	std::vector<FlatNode> flat_nodes;
+	//The final flatted BVH structure, only one of these is filled
+	//depending on the layout selected
+	NodeVector<FlatNode> flat_nodes;
+	NodeVector<WideNode<4>> wide4_nodes;
+	NodeVector<WideNode<8>> wide8_nodes;
+	NodeVector<CompressedNode<4>> compressed4_nodes;
+	NodeVector<CompressedNode<8>> compressed8_nodes;
+	//If the BVH holds moving geometry the flat nodes' bounds are their bounds when the shutter
+	//opens and these are their bounds when it closes, rays test the nodes against the bounds
+	//interpolated to the ray's time
+	std::vector<BBox> end_bounds;
+	//Surface area of each flat node when it was built, used to find subtrees that have degraded
+	//after being refit. Wide layouts only track the cost of the whole tree when it was built
+	std::vector<float> built_area;
+	float built_cost;
+	//SoA copies of the geometry used by the leaves if the BVH is over a mesh's triangles
+	TriangleLeaves tri_leaves;
+	//SoA copies of the nodes used by the leaves if the BVH is over the scene's nodes
+	PrimitiveLeaves prim_leaves;
 
 public:
 	/*
 	 * Construct the BVH to create a hierarchy of the refined geometry passed in
 	 * using the desird split method. max_geom specifies the maximum geometry that
-	 * can be stored per node, default is 128, max is 256
+	 * can be stored per node, default is 128, max is 256. layout selects the node
+	 * layout the tree is flattened into for traversal. dup_budget limits the
+	 * duplicate references the SBVH can create to that fraction of the geometry count
+	 * If quiet is set the build time isn't printed, nor are the times of later refits
 	 * The defaults for the empty constructor will build an empty BVH
 	 */
 	BVH(const std::vector<Geometry*> &geom = std::vector<Geometry*>{},
-		SPLIT_METHOD split = SPLIT_METHOD::SAH, unsigned max_geom = 128);
+		SPLIT_METHOD split = SPLIT_METHOD::SAH, unsigned max_geom = 128,
+		BVH_LAYOUT layout = BVH_LAYOUT::BINARY, float dup_budget = 0.3f, bool quiet = false);
 	/*
 	 * Get the bounds for the BVH
 	 */
 	BBox bounds() const;
 	/*
-	 * Perform an intersection test on the geometry stored in the BVH
+	 * Update the node bounds after the geometry in the BVH has moved or deformed, eg. for the next
+	 * frame of an animation. The tree is kept and its bounds are recomputed bottom up, subtrees whose
+	 * surface area has grown more than rebuild_ratio times as much as the whole tree's since they were
+	 * built are rebuilt. Wide layouts are rebuilt entirely if the whole tree degrades this much
+	 */
+	void refit(float rebuild_ratio = 2);
+	/*
+	 * Write the flattened tree to the file so it can be restored with read instead of being rebuilt.
+	 * The geometry is stored by its index in prims, which should be the geometry the BVH was built
+	 * over. Only BVHs in the binary layout over static geometry can be written, returns false if the
+	 * BVH can't be written
+	 */
+	bool write(std::FILE *f, const std::vector<Geometry*> &prims) const;
+	/*
+	 * Restore a tree written by write from the file, flattening it into the layout. prims must be
+	 * the same geometry passed to write. Returns false and leaves the BVH unchanged if the stored tree
+	 * is from an older version, wasn't built with the split method and duplication budget requested
+	 * or doesn't match the geometry
+	 */
+	bool read(std::FILE *f, const std::vector<Geometry*> &prims, SPLIT_METHOD split, BVH_LAYOUT layout,
+		float dup_budget);
+	/*
+	 * Read just the bounds of a tree written by write from the file without restoring it,
+	 * returns false if there's no tree in the current format stored
+	 */
+	static bool read_bounds(std::FILE *f, BBox &bounds);
+	/*
+	 * Find the closest hit with the geometry stored in the BVH, only the hit is
+	 * recorded in diff_geom, see Geometry::intersect_hit
 	 */
 	bool intersect(Ray &ray, DifferentialGeometry &diff_geom) const;
+	/*
+	 * Test if the ray hits any of the geometry stored in the BVH, stopping
+	 * at the first hit found
+	 */
+	bool occluded(const Ray &ray) const;
+	/*
+	 * Perform an intersection test on the geometry stored in the BVH for the rays
+	 * in the packet from first on, the packet is traversed together and nodes are
+	 * culled against the packet's bounds. See Geometry::intersect_packet
+	 */
+	uint64_t intersect(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const;
+	/*
+	 * Pack the geometry into SoA triangle leaves so the leaves are tested with SIMD
+	 * instead of calling each geometry's intersect. All of the geometry in the BVH
+	 * must be Triangles
+	 */
+	void build_triangle_leaves();
+	/*
+	 * Group the geometry in each leaf by type and pack it into typed SoA leaves so runs of
+	 * spheres, disks and planes are tested with SIMD instead of calling each node's intersect
+	 * All of the geometry in the BVH must be Nodes or Triangles of meshes baked into world space
+	 */
+	void build_primitive_leaves();
 
 private:
 	/*
-	 * Construct a subtree of the BVH for the build_geom from [start, end)
-	 * and return the root of this subtree. The geometry is placed in the child
-	 * nodes is partitioned into ordered geom for easier look up later
-	 * Also returns the total nodes in this subtree, for use later when flattening
-	 * the BVH
+	 * Construct a subtree of the BVH for the build_geom from [start, end), appending its
+	 * nodes to nodes in depth first order and returning the index of the subtree's root.
+	 * The geometry is partitioned in place so each leaf refers to the range of build_geom
+	 * it was built from. Large subtrees near the top of the tree are built in parallel,
+	 * splitting the subtree's threads between them
+	 */
+	int build(std::vector<GeomInfo> &build_geom, int start, int end, std::vector<FlatNode> &nodes,
+		BuildThreads budget);
+	/*
+	 * Partition the build_geom in [start, end) along the axis using the split method, mid is
+	 * set to the start of the second half. Returns false if it's cheaper to make a leaf
+	 */
+	bool partition(std::vector<GeomInfo> &build_geom, int start, int end, const BBox &box,
+		const BBox &centroids, AXIS axis, int threads, int &mid) const;
+	/*
+	 * Bin the build_geom in [start, end) into the SAH buckets along the axis and find the cheapest
+	 * split, returns the bucket to split after and sets cost to the cost of splitting there
+	 */
+	int sah_split(const std::vector<GeomInfo> &build_geom, int start, int end, const BBox &box,
+		const BBox &centroids, AXIS axis, int threads, float &cost) const;
+	/*
+	 * Get the SAH bucket the geometry falls into along the axis
+	 */
+	static int sah_bucket(const GeomInfo &geom, const BBox &centroids, AXIS axis);
+	/*
+	 * Build the BVH over build_geom with the LBVH builder into nodes. The geometry is sorted by
+	 * the Morton code of its center and treelets are emitted for each cluster of geometry sharing the
+	 * top bits of its code, the clusters are then joined by a tree built with the SAH
+	 */
+	void build_lbvh(std::vector<GeomInfo> &build_geom, std::vector<FlatNode> &nodes);
+	/*
+	 * Emit the LBVH subtree for the Morton sorted geometry in [start, end), which all share the
+	 * code bits above bit, to nodes and return the index of the subtree's root. depth is the depth
+	 * of the subtree's root in the final tree, deep subtrees are median split to bound the tree's depth
+	 */
+	int emit_lbvh(const std::vector<MortonGeom> &morton, const std::vector<GeomInfo> &build_geom,
+		int start, int end, int bit, int depth, std::vector<FlatNode> &nodes) const;
+	/*
+	 * Build the SAH tree over the LBVH clusters in [start, end), appending its nodes to nodes. The
+	 * leaves of this tree are the cluster's treelets which are moved in to nodes. depth is the depth
+	 * of this subtree, deep subtrees are median split to stay within LBVH_CLUSTER_DEPTH
+	 */
+	int build_clusters(std::vector<GeomInfo> &clusters, int start, int end, int depth,
+		const std::vector<std::vector<FlatNode>> &treelets, std::vector<FlatNode> &nodes) const;
+	/*
+	 * Build a subtree of the SBVH over the geometry references in refs, which are consumed by the
+	 * build. The subtree's nodes are appended to nodes and the references in its leaves to leaf_refs,
+	 * spatial splits take the duplicate references they create from spare_refs. root_area is the
+	 * surface area of the whole tree, it's computed by the root when depth is 0. Large subtrees are
+	 * built in parallel like in build
 	 */
-	std::unique_ptr<BuildNode> build(std::vector<GeomInfo> &build_geom, std::vector<Geometry*> &ordered_geom,
-		int start, int end, int &total_nodes);
+	int build_sbvh(std::vector<GeomInfo> &refs, std::vector<GeomInfo> &leaf_refs, std::vector<FlatNode> &nodes,
+		std::atomic<int> &spare_refs, float root_area, int depth, BuildThreads budget) const;
 	/*
-	 * Build a leaf node in the tree using the geometry passed and push the ordered geometry for the
-	 * leaf into ordered_geom
+	 * Bin the references along the axis, splitting them between the bins they overlap, and find
+	 * the cheapest spatial split of the box
 	 */
-	std::unique_ptr<BuildNode> build_leaf(std::vector<GeomInfo> &build_geom, std::vector<Geometry*> &ordered_geom,
-		int start, int end, const BBox &box);
+	SpatialSplit find_spatial_split(const std::vector<GeomInfo> &refs, const BBox &box, AXIS axis, int threads) const;
 	/*
-	 * Recursively flatten the BVH tree into the flat nodes vector
-	 * offset tracks the current offset into the flat nodes vector
+	 * Split the references between left and right about the spatial split, references straddling the
+	 * split are clipped and placed in both unless it's cheaper to place the whole reference on one side.
+	 * Returns the number of duplicate references created
 	 */
-	uint32_t flatten_tree(const std::unique_ptr<BuildNode> &node, uint32_t &offset);
+	int spatial_partition(const std::vector<GeomInfo> &refs, const SpatialSplit &spatial,
+		std::vector<GeomInfo> &left, std::vector<GeomInfo> &right) const;
+	/*
+	 * Sort the Morton codes with a parallel LSD radix sort
+	 */
+	static void radix_sort(std::vector<MortonGeom> &morton);
+	/*
+	 * Append a leaf node for the build geometry in [start, end) to nodes
+	 */
+	int build_leaf(std::vector<FlatNode> &nodes, int start, int end, const BBox &box) const;
+	/*
+	 * Recompute the bounds of the flat node and its subtree from the geometry in its leaves,
+	 * along with their shutter close bounds if the BVH holds moving geometry. Subtrees near
+	 * the top are refit in parallel, splitting the threads available between them
+	 */
+	void refit_flat(int node, int threads);
+	/*
+	 * Recompute the bounds of the wide node's children and return the node's bounds, see refit_flat
+	 */
+	template<typename Node>
+	BBox refit_wide(NodeVector<Node> &nodes, int node, int threads);
+	/*
+	 * Refit the wide nodes and return the SAH traversal cost of the tree relative to its
+	 * cost when it was built
+	 */
+	template<typename Node>
+	float refit_wide_tree(NodeVector<Node> &nodes);
+	/*
+	 * Compute the SAH traversal cost of the wide nodes, relative to the root's surface area
+	 */
+	template<typename Node>
+	float wide_cost(const NodeVector<Node> &nodes) const;
+	/*
+	 * Rebuild the refit flat subtrees whose area grew by more than rebuild_ratio times as
+	 * much as the whole tree, returns true if any were rebuilt
+	 */
+	bool rebuild_degraded(float rebuild_ratio);
+	/*
+	 * Mark the subtrees under node whose area grew by more than max_growth since they were built
+	 * and find the range of geometry the leaves of each subtree refer to, ranges are set to -1 if
+	 * the leaves don't refer to a contiguous range. Returns true if any subtree was marked
+	 */
+	bool mark_degraded(int node, float max_growth, std::vector<std::array<int, 2>> &ranges,
+		std::vector<bool> &degraded) const;
+	/*
+	 * Append the flat subtree under node to nodes and its built areas to areas, degraded
+	 * subtrees are rebuilt over their range of geometry as they're emitted
+	 */
+	void emit_rebuilt(int node, const std::vector<std::array<int, 2>> &ranges, const std::vector<bool> &degraded,
+		std::vector<FlatNode> &nodes, std::vector<float> &areas);
+	/*
+	 * Collapse the flat binary nodes into wide nodes if a wide layout was selected, or reorder
+	 * them if the treelet layout was selected
+	 */
+	void collapse_layout();
+	/*
+	 * Reorder the depth first flat nodes into the treelet layout. Sibling nodes are placed together
+	 * in a cache line and the sibling pairs are ordered in a van Emde Boas layout, the root is
+	 * stored in a pair of its own with an unused node
+	 */
+	void treelet_order();
+	/*
+	 * Order the sibling pairs of the subtree under pair, which is identified by the parent of the
+	 * siblings or -1 for the root, in a van Emde Boas layout: the top half of its levels are placed
+	 * first followed by each of the subtrees below them, each laid out the same way
+	 */
+	void veb_order(int pair, int height, std::vector<int> &order) const;
+	/*
+	 * Append the pairs of siblings below the pair to children, see veb_order
+	 */
+	void child_pairs(int pair, std::vector<int> &children) const;
+	/*
+	 * Get the height of the tree of sibling pairs under the pair, see veb_order
+	 */
+	int pair_height(int pair) const;
+	/*
+	 * Append the subtree under node to nodes in depth first order, used to return the treelet
+	 * layout to the order the refit and file writing work on
+	 */
+	void flatten_depth_first(int node, std::vector<FlatNode> &nodes) const;
+	/*
+	 * Get the indices of the interior flat node's children in the layout
+	 */
+	std::array<int, 2> flat_children(int node) const;
+	/*
+	 * Get the [start, end) ranges of the geometry referred to by each leaf in the layout
+	 */
+	std::vector<std::array<int, 2>> leaf_ranges() const;
+	/*
+	 * Rebuild the whole BVH over its geometry with the same settings
+	 */
+	void rebuild();
+	/*
+	 * Get the bounds of the ngeom geometry starting at offset
+	 */
+	BBox geometry_bounds(int offset, int ngeom) const;
+	/*
+	 * Check if any of the geometry in the BVH is moving while the shutter is open
+	 */
+	bool has_moving_geometry() const;
+	/*
+	 * Get the bounds of the flat node at the time, for BVHs with moving geometry
+	 * these are interpolated into box and box is returned
+	 */
+	const BBox& node_bounds(int node, float time, BBox &box) const;
+	/*
+	 * Get the number of threads to use when building the BVH
+	 */
+	static int build_threads();
+	/*
+	 * Recursively collapse the flat binary nodes into N-wide nodes, pulling up the grandchildren
+	 * with the largest surface area until each node has N children
+	 * Returns the index of the node created for the subtree under flat_node
+	 */
+	template<int N>
+	int collapse_tree(int flat_node, NodeVector<WideNode<N>> &nodes);
+	/*
+	 * Traverse the BVH with the ray, calling leaf(geom_offset, ngeom) for each leaf hit to test
+	 * its geometry. If leaf returns true traversal stops and true is returned, the leaf test can
+	 * update the ray's max_t to have traversal skip nodes beyond the closest hit
+	 */
+	template<typename F>
+	bool traverse(const Ray &ray, const F &leaf) const;
+	/*
+	 * Traverse the flat binary nodes, see traverse
+	 */
+	template<typename F>
+	bool traverse_binary(const Ray &ray, const F &leaf) const;
+	/*
+	 * Traverse the wide or compressed wide nodes, see traverse
+	 */
+	template<typename Node, typename F>
+	bool traverse_wide(const NodeVector<Node> &nodes, const Ray &ray, const F &leaf) const;
+	/*
+	 * Traverse the flat binary nodes with the packet, see intersect
+	 */
+	uint64_t intersect_packet_binary(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const;
+	/*
+	 * Traverse the wide or compressed wide nodes with the packet, see intersect
+	 */
+	template<typename Node>
+	uint64_t intersect_packet_wide(const NodeVector<Node> &nodes, RayPacket &packet, int first,
+		DifferentialGeometry *diff_geom) const;
+	/*
+	 * Test the geometry in a leaf against the packet's rays from first on
+	 */
+	uint64_t intersect_packet_leaf(int offset, int ngeom, RayPacket &packet, int first,
+		DifferentialGeometry *diff_geom) const;
+	/*
+	 * Find the first ray in the packet from first on that hits the box, returns packet.size if
+	 * none of them do and sets t_near to where the ray enters the box. Boxes that the whole packet
+	 * misses are culled with an interval arithmetic test against the packet's bounds
+	 */
+	static int packet_box_intersect(const BBox &box, const RayPacket &packet, int first, float &t_near);
 	/*
 	 * A specialized fast bbox intersection test for the BVH traversal
 	 * Based on the optimized multiple box test from http://people.csail.mit.edu/amy/papers/box-jgt.pdf
 	 */
 	bool fast_box_intersect(const BBox &bounds, const Ray &r, const Vector &inv_dir, const std::array<int, 3> &neg_dir) const;
+	/*
+	 * Test the ray against all children of a wide node with a single slab test, returns a
+	 * bitmask of the children hit and the distance the ray enters each child in t_near
+	 */
+	template<int N>
+	int wide_box_intersect(const WideBounds<N> &node, const Ray &r, const Vector &inv_dir,
+		const std::array<int, 3> &neg_dir, std::array<float, N> &t_near) const;
 };
 
 #endif
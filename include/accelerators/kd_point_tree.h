@@ -67,6 +67,10 @@ public:
 	 */
 	template<typename Callback>
 	void query(const Point &p, float &max_dist_sqr, Callback &callback) const;
+	/*
+	 * Get the points stored in the tree, in the tree's order
+	 */
+	const std::vector<P>& get_points() const;
 	
 private:
 	/*
@@ -98,6 +102,10 @@ KdPointTree<P>::KdPointTree(const std::vector<P> &points){
 	build(0, 0, points.size(), build_data);
 }
 template<typename P>
+const std::vector<P>& KdPointTree<P>::get_points() const {
+	return data;
+}
+template<typename P>
 uint32_t KdPointTree<P>::build(uint32_t node_id, int start, int end, std::vector<const P*> &build_data){
 	//If we've hit the bottom make a leaf node
 	if (start + 1 == end){
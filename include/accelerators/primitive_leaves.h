@@ -0,0 +1,87 @@
+#ifndef PRIMITIVE_LEAVES_H
+#define PRIMITIVE_LEAVES_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include "linalg/ray.h"
+#include "linalg/ray_packet.h"
+#include "geometry/differential_geometry.h"
+#include "accelerators/triangle_leaves.h"
+
+class Geometry;
+class Node;
+
+/*
+ * The scene's nodes packed by the type of their geometry for the leaves of the scene's BVH.
+ * Nodes placing a sphere, disk or plane with a static transform have the affine part of their
+ * world to object transform and the shape's parameters stored in SoA arrays so runs of the same
+ * type in a leaf are tested 4 at a time with SIMD, instead of transforming the ray and calling
+ * intersect on each node. Triangles of meshes baked into world space are placed in the BVH
+ * directly and are packed in SoA triangle leaves. Other nodes are tested through the node as before
+ */
+class PrimitiveLeaves {
+	enum class PRIM_TYPE : uint8_t { OTHER, SPHERE, DISK, PLANE, TRIANGLE };
+
+	//The type of each node, in the same order as the BVH's geometry
+	std::vector<PRIM_TYPE> types;
+	//Rows of the top 3x4 part of each node's world to object transform, element [4 * r + c]
+	//is row r column c. The arrays are padded so a block of 4 can be loaded from any node
+	std::array<std::vector<float>, 12> to_obj;
+	//Radius and inner radius of spheres and disks
+	std::vector<float> radius, inner_radius;
+	//Triangles of baked meshes, packed in the same order as the nodes
+	TriangleLeaves tri_leaves;
+	std::vector<const Geometry*> prims;
+
+public:
+	PrimitiveLeaves();
+	/*
+	 * Pack the nodes in the BVH's ordered geometry, geometry that isn't a Node or a Triangle
+	 * of a mesh baked into world space, eg. an InstanceSet, is tested through its intersect
+	 */
+	PrimitiveLeaves(const std::vector<Geometry*> &geom);
+	/*
+	 * Reorder the nodes in [begin, end) so the nodes of each type are stored together,
+	 * used to group the nodes in each leaf by their type
+	 */
+	static void group(std::vector<Geometry*>::iterator begin, std::vector<Geometry*>::iterator end);
+	/*
+	 * Check if no nodes are stored
+	 */
+	bool empty() const;
+	/*
+	 * Find the closest hit for the ray with the ngeom nodes starting at offset, the hit is
+	 * recorded in diff_geom as done by Node::intersect_hit
+	 */
+	bool intersect(Ray &ray, DifferentialGeometry &diff_geom, int offset, int ngeom) const;
+	/*
+	 * Test if the ray hits any of the ngeom nodes starting at offset
+	 */
+	bool occluded(const Ray &ray, int offset, int ngeom) const;
+	/*
+	 * Test the packet's rays from first on against the ngeom nodes starting at offset, returning
+	 * the bitmask of rays hit. See Geometry::intersect_packet
+	 */
+	uint64_t intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom,
+		int offset, int ngeom) const;
+
+private:
+	/*
+	 * Get the type the node or baked triangle is packed as
+	 */
+	static PRIM_TYPE node_type(const Geometry *geom);
+	/*
+	 * Get the number of nodes of the same type starting at i, stopping at end
+	 */
+	int run_length(int i, int end) const;
+	/*
+	 * Test the ray against the 4 nodes starting at i, of which the first n are used. All of the
+	 * nodes must be spheres, disks or planes of the type. Returns a bitmask of the nodes hit in
+	 * the ray's range and fills out the hit distances for each node
+	 */
+	int intersect_block(PRIM_TYPE type, const Ray &ray, int i, int n, std::array<float, 4> &t) const;
+};
+
+#endif
+
@@ -0,0 +1,60 @@
+#ifndef TRIANGLE_LEAVES_H
+#define TRIANGLE_LEAVES_H
+
+#include <array>
+#include <vector>
+#include "linalg/ray.h"
+#include "geometry/differential_geometry.h"
+
+class Geometry;
+class Triangle;
+
+/*
+ * Triangles packed in SoA layout for the leaves of a BVH built over a mesh's triangles, the
+ * triangles in a leaf are tested 4 at a time with SIMD instead of through a virtual call on
+ * each one. The Triangle objects are only used to compute the surface information of the
+ * final hit
+ */
+class TriangleLeaves {
+	//The first vertex and the two edges from it of each triangle, in the same order as the
+	//BVH's geometry. The arrays are padded so a block of 4 can be loaded from any triangle
+	std::array<std::vector<float>, 3> v0, e0, e1;
+	std::vector<const Triangle*> tris;
+
+public:
+	TriangleLeaves();
+	/*
+	 * Pack the triangles in the BVH's ordered geometry, all of the geometry must be Triangles
+	 */
+	TriangleLeaves(const std::vector<Geometry*> &geom);
+	/*
+	 * Pack the triangles, null entries are left as degenerate triangles that are never hit
+	 * so the triangles can be packed in the order of geometry that isn't all Triangles
+	 */
+	TriangleLeaves(const std::vector<const Triangle*> &triangles);
+	/*
+	 * Check if no triangles are stored
+	 */
+	bool empty() const;
+	/*
+	 * Find the closest hit for the ray with the ngeom triangles starting at offset, the hit is
+	 * recorded in diff_geom as done by Triangle::intersect_hit
+	 */
+	bool intersect(Ray &ray, DifferentialGeometry &diff_geom, int offset, int ngeom) const;
+	/*
+	 * Test if the ray hits any of the ngeom triangles starting at offset
+	 */
+	bool occluded(const Ray &ray, int offset, int ngeom) const;
+
+private:
+	/*
+	 * Test the ray against the 4 triangles starting at i, of which the first n are used.
+	 * Returns a bitmask of the triangles hit in the ray's range and fills out the hit distances
+	 * and barycentric coordinates for each triangle
+	 */
+	int intersect_block(const Ray &ray, int i, int n, std::array<float, 4> &t, std::array<float, 4> &bary0,
+		std::array<float, 4> &bary1) const;
+};
+
+#endif
+
@@ -0,0 +1,48 @@
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+/*
+ * An allocator that aligns allocations to ALIGN bytes, eg. to start arrays
+ * on a cache line so small nodes never straddle two lines. The memory is over
+ * allocated and the offset to the start of the original allocation is stored
+ * just before the aligned pointer so it can be freed
+ */
+template<typename T, size_t ALIGN = 64>
+struct AlignedAllocator {
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind {
+		typedef AlignedAllocator<U, ALIGN> other;
+	};
+
+	AlignedAllocator() = default;
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, ALIGN>&){}
+	T* allocate(size_t n){
+		char *mem = static_cast<char*>(::operator new(n * sizeof(T) + ALIGN + sizeof(uint32_t)));
+		const uintptr_t start = reinterpret_cast<uintptr_t>(mem) + sizeof(uint32_t);
+		char *aligned = mem + sizeof(uint32_t) + (ALIGN - start % ALIGN) % ALIGN;
+		*reinterpret_cast<uint32_t*>(aligned - sizeof(uint32_t)) = aligned - mem;
+		return reinterpret_cast<T*>(aligned);
+	}
+	void deallocate(T *p, size_t){
+		char *aligned = reinterpret_cast<char*>(p);
+		::operator delete(aligned - *reinterpret_cast<uint32_t*>(aligned - sizeof(uint32_t)));
+	}
+};
+template<typename T, typename U, size_t ALIGN>
+bool operator==(const AlignedAllocator<T, ALIGN>&, const AlignedAllocator<U, ALIGN>&){
+	return true;
+}
+template<typename T, typename U, size_t ALIGN>
+bool operator!=(const AlignedAllocator<T, ALIGN>&, const AlignedAllocator<U, ALIGN>&){
+	return false;
+}
+
+#endif
+
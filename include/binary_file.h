@@ -0,0 +1,24 @@
+#ifndef BINARY_FILE_H
+#define BINARY_FILE_H
+
+#include <cstdio>
+#include <cstdint>
+
+/*
+ * Get the number of bytes left to read in the file, or 0 if its size can't be found. Used to
+ * check the counts read from binary files against what's actually in them before allocating
+ */
+inline uint64_t bytes_left(std::FILE *f){
+	const long pos = std::ftell(f);
+	if (pos < 0 || std::fseek(f, 0, SEEK_END) != 0){
+		return 0;
+	}
+	const long end = std::ftell(f);
+	if (std::fseek(f, pos, SEEK_SET) != 0 || end < pos){
+		return 0;
+	}
+	return static_cast<uint64_t>(end - pos);
+}
+
+#endif
+
@@ -4,31 +4,159 @@
 #include <chrono>
 #include <memory>
 #include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
 #include "samplers/sampler.h"
+#include "film/render_target.h"
+#include "checkpoint.h"
 
 /*
  * A queue that hands out blocks of pixels to be worked on
  * by threads in the form of samplers for the block of pixels
+ * Each worker has its own deque of blocks which it works through
+ * in Morton order, once it runs out it steals a block from the back
+ * of another worker's deque, splitting it in half so the end of the
+ * render is shared by smaller blocks instead of waiting on a few big ones
+ * In progressive mode the queue makes repeated passes over the image, each
+ * pass taking the sampler's samples per pixel again in the blocks that
+ * haven't reached the target error, until the time budget runs out
+ * Finished blocks are added to the render target through the queue so it can take
+ * a consistent snapshot of the film and the unfinished blocks to checkpoint the render
+ * A frame can be split among processes by giving each a tile range, a contiguous run in
+ * Morton order of the fixed size cells the image is divided into, and only rendering its cells
  */
 class BlockQueue {
-	std::vector<std::unique_ptr<Sampler>> samplers;
-	//The index of the next sampler to be handed out
-	std::atomic_uint sampler_idx, loops;
+	struct WorkerBlocks {
+		std::mutex mutex;
+		std::deque<std::unique_ptr<Sampler>> blocks;
+		//The block the worker is working on, freed when it takes its next one
+		std::unique_ptr<Sampler> current;
+	};
+
+	const Sampler &sampler;
+	RenderTarget &target;
+	std::vector<std::unique_ptr<WorkerBlocks>> workers;
+	int block_width, block_height;
+	//If the block size is picked by the queue, it's picked again for the tile range's pixels
+	bool auto_block;
+	//The range of cells rendered is [tile_index, tile_index + 1) out of tile_count equal runs
+	int tile_index, tile_count;
+	//Blocks smaller than this along both dimensions aren't split when stolen
+	int min_block;
+	//Workers that have run out of blocks in the current pass wait for the others
+	//to finish their blocks, the last one to finish starts the next pass
+	std::mutex pass_mutex;
+	std::condition_variable pass_cv;
+	int pass, idle;
+	std::atomic_bool finished;
+	//Held shared while blocks move between the deques, workers and render target
+	//and exclusively while a checkpoint takes the unfinished blocks
+	std::shared_timed_mutex state_mutex;
+	//While a checkpoint copies the film the tiles of blocks finished meanwhile are kept
+	//here, and added to the film once it's copied
+	std::mutex deferred_mutex;
+	bool copying_film;
+	std::vector<FilmTile> deferred_tiles;
+	//Progressive rendering settings, the error is checked on the target's pixels
+	bool progressive;
+	float target_error;
+	std::chrono::milliseconds time_budget;
+	std::chrono::time_point<std::chrono::high_resolution_clock> start_time;
+	//Render time spent before the render was resumed from a checkpoint
+	std::chrono::milliseconds resumed_time;
+	//Number of pixels in the blocks handed out so far and in the whole pass
+	std::atomic<uint64_t> pixels_started;
+	uint64_t total_pixels;
+	//The next tenth of the pixels to report progress at
+	std::atomic_uint next_report;
 	//Total time and previous time we printed out timing info
 	std::chrono::milliseconds total_time;
 	std::chrono::time_point<std::chrono::high_resolution_clock> prev;
 
 public:
 	/*
-	 * Create a queue of work blocks by subsampling the sampler
-	 * into blocks subsamplers
+	 * Create a queue of work blocks for nworkers workers by subsampling the sampler
+	 * into blocks subsamplers, which are rendered to the target. If the block width or
+	 * height is not positive a block size is picked for the image size and number of workers
+	 */
+	BlockQueue(const Sampler &sampler, RenderTarget &target, int nworkers, int bwidth = -1, int bheight = -1);
+	/*
+	 * Render progressively, making passes over the image until each pixel's relative error
+	 * is below target_error or time_budget seconds have passed since start was called. If
+	 * either is 0 it's not used and if both are the passes continue until the render is canceled
+	 */
+	void set_progressive(float time_budget, float target_error);
+	/*
+	 * Only render the index'th of count tile ranges of the image, so count processes can each render
+	 * one and their films can be merged. The ranges are the same whatever the number of workers or
+	 * block size, must be called before the render is started or resumed
+	 */
+	void set_tile_range(int index, int count);
+	/*
+	 * Mark the start of rendering, the time budget and timing info are counted from here
+	 */
+	void start();
+	/*
+	 * Return the next block for the worker to work on, returns nullptr
+	 * when all samplers have been completed. The worker must have finished the
+	 * block returned previously with finish_block, which frees it
+	 */
+	Sampler* get_block(int worker);
+	/*
+	 * Add the tile of the worker's finished block to the render target and free the block
+	 */
+	void finish_block(int worker, const FilmTile &tile);
+	/*
+	 * Take a snapshot of the film and the blocks that aren't finished. Workers only wait
+	 * while the unfinished blocks are collected, the tiles of blocks they finish while the
+	 * film is copied are added to it after. Workers waiting for the next pass wait for the copy
+	 */
+	void checkpoint(Checkpoint &cp);
+	/*
+	 * Continue the render from the checkpoint, replacing the blocks queued with its unfinished
+	 * blocks. The film and renderer should be restored from it separately
+	 */
+	void resume(const Checkpoint &cp);
+	/*
+	 * Stop handing out blocks and wake any workers waiting for the next pass
+	 */
+	void cancel();
+
+private:
+	/*
+	 * Queue the blocks for the next pass over the image, returns false if rendering is done.
+	 * Must be called with the pass mutex held while all workers are waiting
+	 */
+	bool next_pass();
+	/*
+	 * Partition the image, or the cells in the tile range, into blocks to render the pass with,
+	 * each seeded by the pass and its position
+	 */
+	std::vector<std::unique_ptr<Sampler>> make_blocks(int block_pass) const;
+	/*
+	 * Deal the blocks out to the workers' deques, each worker gets a contiguous run of the
+	 * blocks in Morton order so its blocks are near each other
+	 */
+	void distribute(std::vector<std::unique_ptr<Sampler>> &blocks);
+	/*
+	 * Get the render time spent so far, including time before the render was resumed
+	 */
+	std::chrono::milliseconds elapsed() const;
+	/*
+	 * Take a block from the back of another worker's deque, returns nullptr if there are none left
+	 */
+	std::unique_ptr<Sampler> steal(int worker);
+	/*
+	 * Check if the time budget has run out
 	 */
-	BlockQueue(const Sampler &sampler, int bwidth, int bheight);
+	bool out_of_time() const;
 	/*
-	 * Return the next block to be worked on, returns nullptrt
-	 * when all samplers have been completed
+	 * Print out the render progress once the blocks handed out pass the next tenth of the pass
 	 */
-	Sampler* get_block();
+	void report_progress(const Sampler &block);
 };
 
 #endif
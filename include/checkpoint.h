@@ -0,0 +1,56 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "film/render_target.h"
+#include "renderer/renderer.h"
+
+class Scene;
+
+/*
+ * A block of pixels in [x_start, x_end) x [y_start, y_end) stored in a checkpoint
+ */
+struct BlockRect {
+	int32_t x_start, x_end, y_start, y_end;
+};
+
+/*
+ * A snapshot of a render in progress that can be written to a compact binary file and
+ * read back to resume the render. The film only holds the samples of the blocks that were
+ * finished, the blocks that weren't are stored so the resumed render takes them from the start.
+ * The file has a header of the magic, version, image size, pass, render time and number of
+ * unfinished blocks, then the film's pixels and sample statistics, the unfinished blocks and
+ * finally the renderer's preprocessed state, eg. photon maps
+ */
+class Checkpoint {
+public:
+	uint32_t width, height;
+	//The pass being rendered when the checkpoint was taken, see BlockQueue
+	uint32_t pass;
+	//Milliseconds spent rendering so far
+	uint64_t elapsed_ms;
+	//The r, g, b and weight of each pixel and the statistics of their samples
+	std::vector<float> film;
+	std::vector<PixelStats> stats;
+	//The blocks of the pass that haven't been added to the film
+	std::vector<BlockRect> pending;
+
+	Checkpoint();
+	/*
+	 * Write the checkpoint and the renderer's state to the file. It's written to a temporary
+	 * file first and renamed over the file once complete so an interrupted write never
+	 * replaces the last good checkpoint
+	 */
+	bool write(const std::string &file, const Renderer &renderer) const;
+	/*
+	 * Read the checkpoint from the file, restoring the renderer's state for the scene
+	 * in place of preprocessing it. Fails if the file is shorter than its header claims
+	 * or has unfinished blocks outside the image
+	 */
+	bool read(const std::string &file, Renderer &renderer, const Scene &scene);
+};
+
+#endif
+
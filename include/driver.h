@@ -1,9 +1,13 @@
 #ifndef DRIVER_H
 #define DRIVER_H
 
+#include <string>
 #include <vector>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "scene.h"
 #include "geometry/geometry.h"
 #include "linalg/ray.h"
@@ -19,6 +23,8 @@ enum STATUS { NOT_STARTED, WORKING, DONE, CANCELED, JOINED };
 class Worker {
 	Scene &scene;
 	BlockQueue &queue;
+	//Index of the worker's blocks in the queue
+	int id;
 
 public:
 	//The thread the worker is on
@@ -27,10 +33,10 @@ public:
 	std::atomic_int status;
 
 	/*
-	 * Create the worker to get samplers from the sampler
+	 * Create the worker to get samplers from its blocks in the queue
 	 * and use them to render the scene
 	 */
-	Worker(Scene &scene, BlockQueue &queue);
+	Worker(Scene &scene, BlockQueue &queue, int id);
 	Worker(Worker &&w);
 	void render();
 };
@@ -45,14 +51,44 @@ class Driver {
 	Scene &scene;
 	//Queue of blocks of pixels to be worked on
 	BlockQueue queue;
+	//Checkpoints are written to the file periodically by their own thread
+	std::string checkpoint_file;
+	std::chrono::milliseconds checkpoint_interval;
+	std::thread checkpoint_thread;
+	std::mutex checkpoint_mutex;
+	std::condition_variable checkpoint_cv;
+	bool stop_checkpoints;
+	//If the render was resumed from a checkpoint, which restored the renderer's preprocessed state
+	bool resumed;
 
 public:
 	/*
 	 * Create a driver to render the scene with some number of worker threads
-	 * to work on the scene partitioned into blocks with the desired dimensions
+	 * to work on the scene partitioned into blocks with the desired dimensions,
+	 * if they're not positive the block size is picked by the queue
 	 */
 	Driver(Scene &scene, int nworkers, int bwidth, int bheight);
 	~Driver();
+	/*
+	 * Render progressively, making repeated passes over the image until the time budget in
+	 * seconds runs out or every pixel's relative error is below the target, see BlockQueue
+	 */
+	void set_progressive(float time_budget, float target_error);
+	/*
+	 * Only render the index'th of count tile ranges of the image, see BlockQueue
+	 */
+	void set_tile_range(int index, int count);
+	/*
+	 * Write a checkpoint of the render to the file every interval seconds while rendering
+	 * and once more when the render finishes or is canceled
+	 */
+	void set_checkpoint(const std::string &file, float interval);
+	/*
+	 * Resume the render from the checkpoint file, restoring the image and the renderer's state,
+	 * returns false if the checkpoint can't be read or is for a different image size.
+	 * Must be called before render
+	 */
+	bool resume(const std::string &file);
 	void render();
 	bool done();
 	/*
@@ -63,6 +99,17 @@ public:
 	 * Get the scene being rendered
 	 */
 	const Scene& get_scene() const;
+
+private:
+	/*
+	 * Write checkpoints every interval until told to stop
+	 */
+	void checkpoint_loop();
+	/*
+	 * Stop the checkpoint thread and write the final checkpoint
+	 */
+	void stop_checkpointing();
+	void write_checkpoint();
 };
 
 #endif
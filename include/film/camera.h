@@ -34,6 +34,13 @@ public:
 	 * be in raster space
 	 */
 	RayDifferential generate_raydifferential(const Sample &sample) const;
+
+private:
+	/*
+	 * Get the time a ray cast for the sample is at, as a fraction of the shutter
+	 * interval from the shutter opening at 0 to closing at 1
+	 */
+	float shutter_time(const Sample &sample) const;
 };
 
 #endif
@@ -9,13 +9,14 @@
 
 //Since we fwrite this struct directly and PPM only takes RGB (24 bits)
 //we can't allow any padding to be added onto the end
-#pragma pack(1)
+#pragma pack(push, 1)
 struct Color24 {
 	uint8_t r, g, b;
 
 	Color24(uint8_t r = 0, uint8_t g = 0, uint8_t b = 0);
 	uint8_t& operator[](int i);
 };
+#pragma pack(pop)
 
 /*
  * A struct representing a sample value for a spectrum at some wavelength
@@ -0,0 +1,42 @@
+#ifndef FILM_TILE_H
+#define FILM_TILE_H
+
+#include <vector>
+#include "color.h"
+#include "filters/filter.h"
+
+/*
+ * A worker's private piece of the image that the samples of a block are
+ * filtered into without any synchronization. The tile covers the block padded
+ * by the filter's extent, clamped to the image, so every pixel the block's samples
+ * touch is in the tile. Once the block is done the tile is merged into the
+ * render target, see RenderTarget::merge_tile
+ */
+class FilmTile {
+	struct TilePixel {
+		float r, g, b, weight;
+		//Count, sum and squared sum of the luminance of the samples taken in the pixel
+		float count, lum, lum_sqr;
+	};
+
+	int x_start, x_end, y_start, y_end;
+	const Filter *filter;
+	const float *filter_table;
+	std::vector<TilePixel> pixels;
+
+	friend class RenderTarget;
+
+public:
+	/*
+	 * Create a tile covering the pixels in [x_start, x_end) x [y_start, y_end) which
+	 * filters samples with the filter and its pre-computed table, see RenderTarget
+	 */
+	FilmTile(int x_start, int x_end, int y_start, int y_end, const Filter &filter, const float *filter_table);
+	/*
+	 * Write a color value to the tile at pixel(x, y)
+	 */
+	void write_pixel(float x, float y, const Colorf &c);
+};
+
+#endif
+
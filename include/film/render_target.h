@@ -6,6 +6,7 @@
 #include <atomic>
 #include <memory>
 #include "color.h"
+#include "film_tile.h"
 #include "filters/filter.h"
 
 const int FILTER_TABLE_SIZE = 16;
@@ -23,6 +24,17 @@ struct Pixel {
 	Pixel(const Pixel &p);
 };
 
+/*
+ * Statistics of the luminance of the samples taken in a pixel, used to estimate how
+ * noisy the pixel still is. A pixel's samples are only taken by the one block covering
+ * it at a time, so only that block's tile updates them when merged and they're updated
+ * without synchronization. Neighboring tiles reach the pixel through their filter padding
+ * but have no samples in it and leave its stats alone
+ */
+struct PixelStats {
+	float count, sum, sum_sqr;
+};
+
 /*
  * The render target where pixel data is stored for the rendered scene
  * along with for some reason a depth buffer is required for proj1?
@@ -31,6 +43,7 @@ class RenderTarget {
 	size_t width, height;
 	std::unique_ptr<Filter> filter;
 	std::vector<Pixel> pixels;
+	std::vector<PixelStats> stats;
 	//Pre-computed filter values to save time when storing pixels
 	std::array<float, FILTER_TABLE_SIZE * FILTER_TABLE_SIZE> filter_table;
 
@@ -45,8 +58,49 @@ public:
 	 * Write a color value to the image at pixel(x, y)
 	 */
 	void write_pixel(float x, float y, const Colorf &c);
-	//Save the image or depth buffer to the desired file
+	/*
+	 * Get a tile to filter the samples of the block of pixels in [x_start, x_end) x [y_start, y_end)
+	 * into, the tile is padded by the filter's extent so it covers all the pixels the samples touch
+	 */
+	FilmTile get_tile(int x_start, int x_end, int y_start, int y_end) const;
+	/*
+	 * Add the samples filtered into the tile to the image. Each pixel is only added once per
+	 * tile so the threads only contend on the pixels shared by neighboring tiles
+	 */
+	void merge_tile(const FilmTile &tile);
+	/*
+	 * Estimate the relative error of the pixel's value from the samples taken in it so far,
+	 * the standard error of the mean of their luminance divided by the mean. Pixels with
+	 * fewer than 2 samples have infinite error
+	 */
+	float relative_error(int x, int y) const;
+	/*
+	 * Get the largest relative error of the pixels in [x_start, x_end) x [y_start, y_end)
+	 */
+	float max_relative_error(int x_start, int x_end, int y_start, int y_end) const;
+	/*
+	 * Copy out the accumulated pixel values and sample statistics, eg. to checkpoint the render.
+	 * film gets the r, g, b and weight of each pixel
+	 */
+	void snapshot(std::vector<float> &film, std::vector<PixelStats> &pixel_stats) const;
+	/*
+	 * Replace the accumulated pixel values and sample statistics with ones taken by snapshot,
+	 * returns false if they're not the size of the image
+	 */
+	bool restore(const std::vector<float> &film, const std::vector<PixelStats> &pixel_stats);
+	//Save the image or depth buffer to the desired file, a .film file stores the
+	//raw pixel accumulators instead, see save_film
 	bool save_image(const std::string &file) const;
+	/*
+	 * Add the pixel accumulators and sample statistics saved in the film file to the image,
+	 * eg. to merge the films of a frame split among processes. Returns false if the file
+	 * can't be read or is for a different image size
+	 */
+	bool add_film(const std::string &file);
+	/*
+	 * Read the image size of the film file, returns false if it isn't a film file
+	 */
+	static bool read_film_size(const std::string &file, size_t &width, size_t &height);
 	size_t get_width() const;
 	size_t get_height() const;
 	/*
@@ -68,6 +122,13 @@ private:
 	 * file format (eg. starting at bottom left)
 	 */
 	bool save_bmp(const std::string &file, const uint8_t *data) const;
+	/*
+	 * Save the weighted rgb sums and weights of the pixels and their sample statistics
+	 * unresolved to the film file so films rendered separately can be added together.
+	 * The file holds a header of the magic, version, width and height as uint32, then the
+	 * r, g, b and weight floats of each pixel and then the pixels' PixelStats
+	 */
+	bool save_film(const std::string &file) const;
 };
 
 #endif
@@ -52,6 +52,24 @@ struct BBox {
 			std::max(u.max.z, p.z)};
 		return u;
 	}
+	/*
+	 * Get a box representing the intersection of this box and another, if they
+	 * don't overlap the box will be empty
+	 */
+	inline BBox box_intersection(const BBox &b) const {
+		BBox u = *this;
+		u.min = Point{std::max(u.min.x, b.min.x), std::max(u.min.y, b.min.y),
+			std::max(u.min.z, b.min.z)};
+		u.max = Point{std::min(u.max.x, b.max.x), std::min(u.max.y, b.max.y),
+			std::min(u.max.z, b.max.z)};
+		return u;
+	}
+	/*
+	 * Check if the box is empty, eg. the default constructed box or the intersection of disjoint boxes
+	 */
+	inline bool empty() const {
+		return min.x > max.x || min.y > max.y || min.z > max.z;
+	}
 	inline bool overlaps(const BBox &b) const {
 		bool x = max.x >= b.min.x && min.x <= b.max.x;
 		bool y = max.y >= b.min.y && min.y <= b.max.y;
@@ -15,7 +15,9 @@ public:
 	 * Construct the cone with some radius and height
 	 */
 	Cone(float radius = 1, float height = 1);
-	bool intersect(Ray &ray, DifferentialGeometry &dg) const override;
+	bool intersect_hit(Ray &ray, DifferentialGeometry &dg) const override;
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &dg) const override;
+	bool occluded(const Ray &ray) const override;
 	BBox bound() const override;
 	void refine(std::vector<Geometry*> &prims) override;
 	/*
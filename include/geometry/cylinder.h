@@ -14,7 +14,9 @@ public:
 	 * Construct the cylinder with some radius and height
 	 */
 	Cylinder(float radius = 1, float height = 1);
-	bool intersect(Ray &ray, DifferentialGeometry &dg) const override;
+	bool intersect_hit(Ray &ray, DifferentialGeometry &dg) const override;
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &dg) const override;
+	bool occluded(const Ray &ray) const override;
 	BBox bound() const override;
 	void refine(std::vector<Geometry*> &prims) override;
 	/*
@@ -22,11 +22,18 @@ struct DifferentialGeometry {
 	Normal normal, geom_normal;
 	const Node *node;
 	const Geometry *geom;
+	//The instance hit if the geometry was placed by an InstanceSet
+	const Geometry *instance;
+	//Index of the primitive hit in geometry storing its primitives without a Geometry
+	//for each of them, eg. the sphere hit in a SphereCloud
+	int prim;
 	HITSIDE hit_side;
 	//Various derivatives and info we need for texture mapping and filtering
 	Vector dp_du, dp_dv, dp_dx, dp_dy;
 	Normal dn_du, dn_dv;
 	float u, v, du_dx, dv_dx, du_dy, dv_dy;
+	//Time of the ray that hit the geometry, rays cast from the hit should be at the same time
+	float time;
 
 	DifferentialGeometry();
 	DifferentialGeometry(const Point &point, const Vector &dp_du, const Vector &dp_dv,
@@ -16,7 +16,9 @@ public:
 	 * Construct the disk with some radius and inner radius
 	 */
 	Disk(float radius = 1, float inner_radius = 0);
-	bool intersect(Ray &ray, DifferentialGeometry &dg) const override;
+	bool intersect_hit(Ray &ray, DifferentialGeometry &dg) const override;
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &dg) const override;
+	bool occluded(const Ray &ray) const override;
 	BBox bound() const override;
 	void refine(std::vector<Geometry*> &prims) override;
 	/*
@@ -28,6 +30,8 @@ public:
 	 */
 	Point sample(const GeomSample &gs, Normal &normal) const override;
 	bool attach_light(const Transform &to_world) override;
+	float get_radius() const;
+	float get_inner_radius() const;
 };
 
 #endif
@@ -5,7 +5,9 @@
 #include <string>
 #include <memory>
 #include "linalg/ray.h"
+#include "linalg/ray_packet.h"
 #include "linalg/transform.h"
+#include "linalg/animated_transform.h"
 #include "material/material.h"
 #include "accelerators/bvh.h"
 #include "cache.h"
@@ -21,6 +23,8 @@ struct GeomSample {
 	float comp;
 };
 
+class Node;
+
 /*
  * Interface the must be implemented by all geometry
  */
@@ -34,17 +38,58 @@ public:
 	 * geometry struct will be filled with information about the hit.
 	 * Data stored in diff_geom will be returned in object space
 	 * If no hit occurs the ray and hitinfo are left unmodified
+	 * This finds the hit with intersect_hit and then computes the surface
+	 * information for it with compute_shading_geometry
+	 */
+	bool intersect(Ray &ray, DifferentialGeometry &diff_geom) const;
+	/*
+	 * Find the ray's closest hit with the geometry like intersect but only record the hit:
+	 * the ray's max_t, the primitive hit in diff_geom.geom and its parameterization of the
+	 * hit in diff_geom.u and v, eg. barycentric coordinates for triangles. Closer hits may
+	 * be found many times while traversing the scene so the rest of the surface information
+	 * is only computed for the final hit with compute_shading_geometry
+	 */
+	virtual bool intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const = 0;
+	/*
+	 * Fill out the surface information for the hit recorded in diff_geom by intersect_hit,
+	 * the ray is the one passed to intersect_hit with its max_t at the hit
+	 */
+	virtual void compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const = 0;
+	/*
+	 * Test if the ray hits the geometry anywhere in its [min_t, max_t] range.
+	 * The ray should have been previously transformed into object space
+	 * Unlike intersect this stops at the first hit found and doesn't compute
+	 * any information about the hit, it's used for shadow and visibility rays
+	 */
+	virtual bool occluded(const Ray &ray) const = 0;
+	/*
+	 * Test the rays in the packet from first on for intersection with the geometry. Rays with
+	 * a hit nearer than their previous ones have their max_t updated and the hit recorded in
+	 * diff_geom[i] as done by intersect_hit, the returned bitmask marks which rays were hit
+	 * The default implementation tests each ray on its own with intersect_hit
 	 */
-	virtual bool intersect(Ray &ray, DifferentialGeometry &diff_geom) const = 0;
+	virtual uint64_t intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const;
 	/*
 	 * Get the object-space AABB for the object
 	 */
 	virtual BBox bound() const = 0;
+	/*
+	 * For moving geometry get bounds at the start and end of the shutter that contain the
+	 * geometry at any time in between when linearly interpolated, bound() should return
+	 * the union of the bounds over the shutter. Returns false if the geometry doesn't move,
+	 * which the default assumes
+	 */
+	virtual bool linear_motion_bound(BBox &start, BBox &end) const;
 	/*
 	 * Request that the primitive fully refine itself into
 	 * its component geometric primitives and fill prims with them
 	 */
 	virtual void refine(std::vector<Geometry*> &prims) = 0;
+	/*
+	 * Get the object-space AABB of the part of the geometry inside box, used to split
+	 * geometry between BVH nodes. The default just clips the geometry's AABB to the box
+	 */
+	virtual BBox clipped_bound(const BBox &box) const;
 	/*
 	 * Compute the surface area of the sphere
 	 */
@@ -72,6 +117,13 @@ public:
 	 * returns true if the light can be attached, false if a light can't be attached
 	 */
 	virtual bool attach_light(const Transform &to_world);
+	/*
+	 * Move the geometry into world space by the transform of the only node placing it so its
+	 * primitives can be placed directly in the scene's BVH, hits on them are recorded on the node
+	 * Baking again moves the geometry from the transform it was last baked with to the new one
+	 * Returns false if the geometry can't be baked, which the default assumes
+	 */
+	virtual bool bake_transform(const Transform &to_world, const Node &node);
 };
 
 typedef Cache<Geometry> GeometryCache;
@@ -87,8 +139,14 @@ class Node : public Geometry {
 	//Non-owning reference to some material in the cache
 	Material *material;
 	Transform transform, inv_transform;
+	//Set if the node moves while the shutter is open, interpolating from transform
+	//at the shutter's open to the end transform at its close
+	std::unique_ptr<AnimatedTransform> motion;
 	std::string name;
 	AreaLight *area_light;
+	//Set if the node's geometry has been baked into world space, the node's transform is then
+	//the identity and the geometry's primitives are placed directly in the scene's BVH
+	bool baked;
 	//BVH is created for the root node of the scene only
 	std::unique_ptr<BVH> bvh;
 
@@ -101,24 +159,65 @@ public:
 	 * Attach an area light to the geometry with some intensity
 	 */
 	void attach_light(AreaLight *light);
+	/*
+	 * Have the node move while the shutter is open, going from its transform when the shutter
+	 * opens to end_transform when it closes. Rays are tested against the node placed by the
+	 * transform interpolated at the ray's time. Should be set after the node's transform is final
+	 */
+	void set_motion(const Transform &end_transform);
+	/*
+	 * Move the node to a new transform, eg. for the next frame of an animation. Any motion set
+	 * is cleared and should be set again after. The scene's BVH must be refit before rendering
+	 * Baked nodes move their geometry to the new transform instead, returns false if the
+	 * geometry can't be baked with the new transform, in which case it isn't moved
+	 */
+	bool set_transform(const Transform &t);
+	/*
+	 * Bake the node's transform into its geometry, used for geometry that only this node places
+	 * Moving nodes and nodes with area lights aren't baked, returns true if the node was baked
+	 */
+	bool bake_transform();
+	/*
+	 * Refit the node's BVH after its children have moved, see BVH::refit
+	 */
+	void refit(float rebuild_ratio = 2);
 	/*
 	 * Instruct the node to flatten its children into a vector and build a BVH for them
 	 * to accelerate intersection tests. Child transforms will also be brought up into
-	 * world space so that the BVH can be built
+	 * world space so that the BVH can be built. The BVH will be flattened into the node
+	 * layout passed
+	 */
+	void flatten_children(BVH_LAYOUT layout = BVH_LAYOUT::BINARY);
+	/*
+	 * Find the ray's closest hit with this node and its children, the node
+	 * hit is recorded in diff_geom.node
+	 */
+	bool intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	/*
+	 * Compute the world space surface information for the hit recorded
+	 * by intersect_hit on this node or its children
+	 */
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const override;
+	/*
+	 * Test if the ray hits this node or its children
 	 */
-	void flatten_children();
+	bool occluded(const Ray &ray) const override;
 	/*
-	 * Test the ray for intersection agains this node and its children
+	 * Test the packet for intersection against this node and its children
 	 */
-	bool intersect(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	uint64_t intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const override;
 	/*
 	 * Get the world space bound for the object
 	 * Returns degenerate box if the node doesn't have geometry attached
 	 */
 	BBox bound() const override;
 	/*
-	 * Request that the primitive fully refine itself into
-	 * its component geometric primitives and fill prims with them
+	 * Get the world space bounds at the start and end of the shutter if the node is moving
+	 */
+	bool linear_motion_bound(BBox &start, BBox &end) const override;
+	/*
+	 * Request that the primitive fully refine itself into its component geometric primitives
+	 * and fill prims with them. Nodes with baked geometry add the geometry's primitives
 	 */
 	void refine(std::vector<Geometry*> &prims) override;
 	/*
@@ -154,6 +253,11 @@ private:
 	 * The nodes being flattened in will also clear their children
 	 */
 	void flatten_children(std::vector<std::shared_ptr<Node>> &nodes);
+	/*
+	 * Transform the world space ray into the node's space, for moving nodes
+	 * this uses the node's transform at the ray's time
+	 */
+	void to_node_space(const Ray &ray, Ray &node_space) const;
 };
 
 #endif
@@ -0,0 +1,126 @@
+#ifndef INSTANCE_SET_H
+#define INSTANCE_SET_H
+
+#include <vector>
+#include <array>
+#include <string>
+#include <memory>
+#include "linalg/ray.h"
+#include "material/material.h"
+#include "accelerators/bvh.h"
+#include "geometry.h"
+#include "tri_mesh.h"
+
+/*
+ * A single compact instance of a mesh in an InstanceSet, storing just the affine part of its
+ * world to object transform and non-owning pointers to the mesh it places and the set's node for
+ * its material. Unlike a Node this is only 72 bytes, so millions of them can be placed
+ */
+class Instance : public Geometry {
+	//Rows of the top 3x4 part of the world to object transform, element [4 * r + c] is row r column c
+	std::array<float, 12> to_obj;
+	const TriMesh *mesh;
+	const Node *node;
+
+public:
+	/*
+	 * Place the mesh by the affine object to world transform, hits are recorded on the node
+	 */
+	Instance(const Transform &to_world, const TriMesh *mesh, const Node *node);
+	/*
+	 * Find the ray's hit with the instanced mesh, the instance is recorded in diff_geom.instance
+	 * and the node for its material in diff_geom.node
+	 */
+	bool intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	/*
+	 * Compute the world space surface information for the hit recorded by intersect_hit
+	 */
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const override;
+	bool occluded(const Ray &ray) const override;
+	BBox bound() const override;
+	void refine(std::vector<Geometry*> &prims) override;
+	/*
+	 * Move the instance by the transform, applied after its current object to world transform
+	 */
+	void apply_transform(const Transform &t);
+
+private:
+	/*
+	 * Get the instance's world to object transform
+	 */
+	Transform world_to_object() const;
+	/*
+	 * Transform the ray into the instance's object space
+	 */
+	void to_object(const Ray &ray, Ray &obj) const;
+};
+
+/*
+ * A large set of instances of a few meshes loaded from a binary instance file, with its own BVH
+ * over the instances. The file starts with a uint32 count of the instances, followed by a record
+ * for each one: the top 3x4 part of its object to world transform as 12 row-major floats, then the
+ * uint32 indices of its mesh and material in the lists passed. The set must be baked into world
+ * space by the node placing it, see Node::bake_transform, so it's placed directly in the scene's
+ * BVH and the material of each instance is recorded for its hits
+ */
+class InstanceSet : public Geometry {
+	std::vector<const TriMesh*> meshes;
+	//A node for each material the instances use, hits on an instance are recorded on the
+	//node for its material so it can be found by the integrators like for any other node
+	std::vector<std::unique_ptr<Node>> material_nodes;
+	std::vector<Instance> instances;
+	BVH bvh;
+	BVH_LAYOUT bvh_layout;
+	//The node the set was baked into world space for and the transform it was baked by
+	const Node *baked_node;
+	Transform baked_transform;
+
+public:
+	/*
+	 * Create an empty set whose instances' mesh and material indices refer to the meshes
+	 * and materials passed. The instance BVH is flattened into the node layout passed
+	 */
+	InstanceSet(const std::vector<TriMesh*> &meshes, const std::vector<Material*> &materials,
+		const std::string &name, BVH_LAYOUT layout = BVH_LAYOUT::BINARY);
+	/*
+	 * Load the instances from the binary instance file, instances referring to missing meshes
+	 * or materials are skipped. Returns false if the file can't be opened or is shorter than
+	 * its count says
+	 */
+	bool load(const std::string &file);
+	bool intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	/*
+	 * Compute the surface information for the hit on the instance recorded by intersect_hit
+	 */
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const override;
+	bool occluded(const Ray &ray) const override;
+	uint64_t intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const override;
+	BBox bound() const override;
+	/*
+	 * The set is placed as a whole in the BVH it's refined into, its instances are
+	 * kept in the set's own BVH
+	 */
+	void refine(std::vector<Geometry*> &prims) override;
+	/*
+	 * Move the instances into world space, see Geometry::bake_transform. A set can
+	 * only be baked for one node
+	 */
+	bool bake_transform(const Transform &to_world, const Node &node) override;
+	/*
+	 * Get the number of instances in the set
+	 */
+	size_t size() const;
+	/*
+	 * Get the meshes the instances place, missing meshes are null
+	 */
+	const std::vector<const TriMesh*>& get_meshes() const;
+
+private:
+	/*
+	 * Build the BVH over the instances
+	 */
+	void build_bvh();
+};
+
+#endif
+
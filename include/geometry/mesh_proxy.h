@@ -0,0 +1,109 @@
+#ifndef MESH_PROXY_H
+#define MESH_PROXY_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "accelerators/bvh.h"
+#include "geometry.h"
+#include "tri_mesh.h"
+
+class MeshProxy;
+
+/*
+ * Tracks the meshes loaded by the scene's mesh proxies and evicts the least recently used ones
+ * once the memory they take exceeds the budget. Proxies are stamped with the count of meshes
+ * loaded so far when they're used, so the victim is the mesh that's gone unused for the most loads
+ */
+class MeshProxyCache {
+	size_t budget, resident_bytes;
+	std::mutex mutex;
+	std::vector<const MeshProxy*> resident;
+	std::atomic<uint64_t> loads;
+
+public:
+	/*
+	 * Create the cache with a budget in bytes for the loaded meshes
+	 */
+	MeshProxyCache(size_t budget = SIZE_MAX);
+	void set_budget(size_t budget);
+	size_t get_budget() const;
+	/*
+	 * Get the current stamp to mark a proxy as used with
+	 */
+	uint64_t stamp() const;
+	/*
+	 * Record that the proxy has loaded its mesh, evicting the least recently
+	 * used meshes until the resident meshes fit in the budget again
+	 */
+	void loaded(const MeshProxy *proxy);
+};
+
+/*
+ * Geometry standing in for a preprocessed binary mesh that's only loaded when a ray first enters its
+ * bounds, which are read from the BVH stored in the binary mesh. The mesh can be evicted by the cache
+ * to stay in the memory budget and is loaded again the next time it's hit. Hits on the mesh refer to
+ * its triangles so the mesh is kept alive by the thread that hit it until the thread calls release_pinned
+ */
+class MeshProxy : public Geometry {
+	std::string file;
+	SPLIT_METHOD bvh_split;
+	float bvh_dup_budget;
+	BVH_LAYOUT bvh_layout;
+	BBox bounds;
+	//Approximate memory taken by the mesh when it's loaded
+	size_t bytes;
+	MeshProxyCache *cache;
+	//The loaded mesh, or null if it isn't loaded. It's accessed atomically since rays
+	//take references to it while the cache may evict it
+	mutable std::shared_ptr<const TriMesh> mesh;
+	mutable std::mutex load_mutex;
+	mutable std::atomic<uint64_t> last_used;
+
+public:
+	/*
+	 * Create a proxy for the mesh in the obj file, which must have been preprocessed into a binary
+	 * mesh. The BVH parameters are those the mesh is loaded with, see TriMesh
+	 */
+	MeshProxy(const std::string &file, MeshProxyCache &cache, SPLIT_METHOD split = SPLIT_METHOD::SAH,
+		float dup_budget = 0.3f, BVH_LAYOUT layout = BVH_LAYOUT::BINARY);
+	bool intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const override;
+	bool occluded(const Ray &ray) const override;
+	BBox bound() const override;
+	void refine(std::vector<Geometry*> &prims) override;
+	/*
+	 * Drop the calling thread's references to the meshes it's hit, which it should do once it's done
+	 * with the hits it's found, eg. after each batch of paths. Evicted meshes are freed once no thread
+	 * refers to them
+	 */
+	static void release_pinned();
+	/*
+	 * Get the approximate memory taken by the proxy's mesh when it's loaded
+	 */
+	size_t memory_size() const;
+	/*
+	 * Get when the proxy was last used, see MeshProxyCache::stamp
+	 */
+	uint64_t get_last_used() const;
+	/*
+	 * Drop the proxy's reference to its mesh, the mesh is freed once no thread refers to it
+	 */
+	void evict() const;
+
+private:
+	/*
+	 * Get the mesh, loading it if it isn't loaded
+	 */
+	std::shared_ptr<const TriMesh> acquire() const;
+	/*
+	 * Read the mesh's bounds and size from the binary mesh, returns false if the file can't be read
+	 */
+	bool read_header(const std::string &bobj_file);
+};
+
+#endif
+
@@ -0,0 +1,20 @@
+#ifndef MESH_SIMPLIFY_H
+#define MESH_SIMPLIFY_H
+
+#include <vector>
+#include "linalg/vector.h"
+#include "linalg/point.h"
+
+/*
+ * Simplify the indexed triangle mesh in place with quadric error edge collapses (Garland & Heckbert,
+ * Surface Simplification Using Quadric Error Metrics) until it has at most target_tris triangles or no
+ * more edges can be collapsed. Each collapse moves the edge to whichever of its end points or midpoint
+ * has the least error, carrying the texcoords and normals along. Boundary edges are constrained to
+ * keep the mesh's outline and collapses that would flip faces or pinch the surface are skipped.
+ * The unused vertices are removed from the arrays
+ */
+void simplify_mesh(std::vector<Point> &verts, std::vector<Point> &texcoords, std::vector<Normal> &normals,
+	std::vector<int> &indices, size_t target_tris);
+
+#endif
+
@@ -9,7 +9,9 @@
  */
 class Plane : public Geometry {
 public:
-	bool intersect(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	bool intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const override;
+	bool occluded(const Ray &ray) const override;
 	BBox bound() const override;
 	void refine(std::vector<Geometry*> &prims) override;
 };
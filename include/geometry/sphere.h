@@ -16,7 +16,9 @@ public:
 	 * Construct the sphere with some radius
 	 */
 	Sphere(float radius = 1);
-	bool intersect(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	bool intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const override;
+	bool occluded(const Ray &ray) const override;
 	BBox bound() const override;
 	void refine(std::vector<Geometry*> &prims) override;
 	/*
@@ -37,6 +39,7 @@ public:
 	 */
 	float pdf(const Point &p, const Vector &w_i) const override;
 	bool attach_light(const Transform &to_world) override;
+	float get_radius() const;
 };
 
 #endif
@@ -0,0 +1,112 @@
+#ifndef SPHERE_CLOUD_H
+#define SPHERE_CLOUD_H
+
+#include <vector>
+#include <array>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include "linalg/ray.h"
+#include "material/material.h"
+#include "geometry.h"
+
+/*
+ * A large cloud of spheres, eg. the particles of a simulation, loaded from a binary particle file
+ * The centers, radii and material ids of the spheres are stored in SoA arrays in world space, taking
+ * 18 bytes per sphere, and the cloud builds its own compact BVH over them whose leaves are tested
+ * 4 spheres at a time with SIMD. The file starts with a uint32 count of the spheres, followed by a
+ * record for each: its center and radius as 4 floats then the uint32 index of its material in the
+ * list passed. Like an InstanceSet the cloud must be baked into world space by the node placing it
+ */
+class SphereCloud : public Geometry {
+	/*
+	 * Nodes of the cloud's flattened binary BVH, the first child is right after
+	 * the parent and the second is at second_child
+	 */
+	struct CloudNode {
+		BBox bounds;
+		union {
+			//Used for leaves to locate the spheres
+			int offset;
+			//Used for interiors to locate the second child
+			int second_child;
+		};
+		//Number of spheres in the node, 0 if interior
+		uint16_t count;
+		uint16_t axis;
+	};
+
+	//Centers and radii of the spheres, in the order of the BVH's leaves. The arrays
+	//are padded so a block of 4 can be loaded from any sphere
+	std::vector<float> x, y, z, radius;
+	std::vector<uint16_t> material;
+	//A node for each material the spheres use, see InstanceSet
+	std::vector<std::unique_ptr<Node>> material_nodes;
+	std::vector<CloudNode> nodes;
+	//The node the cloud was baked into world space for and the transform it was baked by
+	const Node *baked_node;
+	Transform baked_transform;
+
+public:
+	/*
+	 * Create an empty cloud whose spheres' material indices refer to the materials passed
+	 */
+	SphereCloud(const std::vector<Material*> &materials, const std::string &name);
+	/*
+	 * Load the spheres from the binary particle file, spheres referring to missing materials
+	 * are skipped. Returns false if the file can't be opened or is shorter than its count says
+	 */
+	bool load(const std::string &file);
+	/*
+	 * Find the ray's closest hit with the spheres, the sphere hit is recorded in diff_geom.prim
+	 * and the node for its material in diff_geom.node
+	 */
+	bool intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const override;
+	bool occluded(const Ray &ray) const override;
+	BBox bound() const override;
+	/*
+	 * The cloud is placed as a whole in the BVH it's refined into
+	 */
+	void refine(std::vector<Geometry*> &prims) override;
+	/*
+	 * Move the spheres into world space, see Geometry::bake_transform. The transform can only
+	 * scale uniformly since the spheres must stay spheres and a cloud can only be baked for one node
+	 */
+	bool bake_transform(const Transform &to_world, const Node &node) override;
+	/*
+	 * Get the number of spheres in the cloud
+	 */
+	size_t size() const;
+
+private:
+	/*
+	 * Build the BVH over the spheres and reorder them to match its leaves
+	 */
+	void build_bvh();
+	/*
+	 * Build the subtree over the spheres in [start, end) of order with the SAH, appending its
+	 * nodes to nodes and returning the index of its root. order is partitioned in place so each
+	 * leaf refers to the range of order it was built from. depth is the depth of the subtree's
+	 * root, deep subtrees are split at the median so the tree fits the traversal stack
+	 */
+	int build(std::vector<uint32_t> &order, int start, int end, int depth);
+	/*
+	 * Get the bounds of the sphere
+	 */
+	BBox sphere_bound(uint32_t i) const;
+	/*
+	 * Traverse the BVH with the ray, calling leaf(offset, count) for each leaf hit. If leaf
+	 * returns true traversal stops and true is returned, see BVH::traverse
+	 */
+	template<typename F>
+	bool traverse(const Ray &ray, const F &leaf) const;
+	/*
+	 * Test the ray against the 4 spheres starting at i, of which the first n are used. Returns
+	 * a bitmask of the spheres hit in the ray's range and fills out the hit distances for each
+	 */
+	int intersect_block(const Ray &ray, int i, int n, std::array<float, 4> &t) const;
+};
+
+#endif
+
@@ -2,6 +2,7 @@
 #define TRI_MESH_H
 
 #include <vector>
+#include <array>
 #include <string>
 #include "linalg/vector.h"
 #include "linalg/point.h"
@@ -24,9 +25,31 @@ class Triangle : public Geometry {
 
 public:
 	Triangle(int a = 0, int b = 0, int c = 0, const TriMesh *mesh = nullptr);
-	bool intersect(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	/*
+	 * Find the ray's hit with the triangle, the barycentric coordinates of the hit are
+	 * recorded in diff_geom.u and v, with u weighting the second vertex and v the third
+	 */
+	bool intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const override;
+	bool occluded(const Ray &ray) const override;
+	/*
+	 * Test the triangle against the packet's rays in SIMD lanes
+	 */
+	uint64_t intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const override;
+	/*
+	 * Get the positions of the triangle's vertices
+	 */
+	std::array<Point, 3> vertices() const;
+	/*
+	 * Get the mesh the triangle is a part of
+	 */
+	const TriMesh* get_mesh() const;
 	BBox bound() const override;
 	void refine(std::vector<Geometry*> &prims) override;
+	/*
+	 * Clip the triangle to the box and get the bounds of the clipped polygon
+	 */
+	BBox clipped_bound(const BBox &box) const override;
 	/*
 	 * Compute the surface area of the sphere
 	 */
@@ -69,7 +92,23 @@ class TriMesh : public Geometry {
 	//since we hand out references to them
 	std::vector<Triangle> tris;
 	//The BVH used to accelerate ray-triangle intersection tests on the mesh
+	//and the split method, SBVH duplication budget and node layout it's built with
 	BVH bvh;
+	SPLIT_METHOD bvh_split;
+	float bvh_dup_budget;
+	BVH_LAYOUT bvh_layout;
+	//If loading the mesh and building its BVH doesn't print progress, for meshes
+	//loaded while rendering or generated from another mesh
+	bool quiet;
+	//If the mesh has been baked into world space the node placing it, and the transform
+	//the vertices were moved to world space by when baked or when an area light was attached
+	const Node *baked_node;
+	Transform baked_transform;
+	//Simplified levels of detail of the mesh, each a quarter of the triangles of the one before,
+	//and the ray depth they start being used at. Each deeper bounce uses the next coarser level,
+	//except that rays cast from a level's surface are tested against that level
+	std::vector<std::unique_ptr<TriMesh>> lods;
+	int lod_depth;
 
 	//Friends with the meshprocessor so it's able to get the data needed
 	//to serialize the binary mesh
@@ -83,14 +122,26 @@ public:
 	 * Can optionally request that any binary obj files found are ignored
 	 * This is only used by the mesh preprocessor to not load & process any
 	 * existing binary files
+	 * The mesh's BVH will be built with the split method passed and flattened into the node layout passed,
+	 * dup_budget is the fraction of the triangle count the SBVH can add in duplicate references
+	 * If quiet is set only errors are printed while loading the mesh
 	 */
-	TriMesh(const std::string &file, bool no_bobj = false);
+	TriMesh(const std::string &file, bool no_bobj = false, SPLIT_METHOD split = SPLIT_METHOD::SAH,
+		float dup_budget = 0.3f, BVH_LAYOUT layout = BVH_LAYOUT::BINARY, bool quiet = false);
 	/*
 	 * Explicitly specify the mesh information for the model
 	 */
 	TriMesh(const std::vector<Point> &verts, const std::vector<Point> &tex,
-		const std::vector<Normal> &norm, const std::vector<int> vert_idx);
-	bool intersect(Ray &ray, DifferentialGeometry &diff_geom) const override;
+		const std::vector<Normal> &norm, const std::vector<int> vert_idx,
+		SPLIT_METHOD split = SPLIT_METHOD::SAH, float dup_budget = 0.3f,
+		BVH_LAYOUT layout = BVH_LAYOUT::BINARY, bool quiet = false);
+	bool intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const override;
+	/*
+	 * Compute the surface information for the hit on the triangle recorded by intersect_hit
+	 */
+	void compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const override;
+	bool occluded(const Ray &ray) const override;
+	uint64_t intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const override;
 	BBox bound() const override;
 	void refine(std::vector<Geometry*> &prims) override;
 	/*
@@ -126,29 +177,73 @@ public:
 	 * returns true if the light can be attached, false if a light can't be attached
 	 */
 	bool attach_light(const Transform &to_world) override;
+	/*
+	 * Move the mesh's vertices and normals into world space, see Geometry::bake_transform
+	 */
+	bool bake_transform(const Transform &to_world, const Node &node) override;
+	/*
+	 * Get the node the mesh was baked into world space for, or null if it hasn't been baked
+	 */
+	const Node* get_baked_node() const;
+	/*
+	 * Replace the mesh's vertex positions and optionally its normals, eg. for the next frame of
+	 * a deforming mesh, and refit the mesh's BVH. The faces are kept so the new vertices must
+	 * match the existing ones, returns false if the counts differ. Vertices are in the mesh's
+	 * object space, baked meshes and meshes with an area light attached move them to world space
+	 * by the transform they were moved with and recompute the light's triangle areas
+	 */
+	bool set_vertices(const std::vector<Point> &verts, const std::vector<Normal> &norms = std::vector<Normal>{},
+		float rebuild_ratio = 2);
+	/*
+	 * Generate up to levels simplified levels of detail for the mesh with quadric error decimation, each
+	 * with its own BVH. Rays at depth start_depth and deeper are tested against the levels instead of the
+	 * full mesh, with each deeper bounce using the next coarser level, so deep indirect bounces on large
+	 * meshes are cheaper. Meshes with levels of detail aren't baked into world space
+	 */
+	void generate_lods(int levels, int start_depth);
 
 private:
+	/*
+	 * Get the level of detail the ray should be tested against
+	 */
+	const TriMesh& select_lod(const Ray &ray) const;
+	/*
+	 * Check if the geometry is one of the mesh's triangles
+	 */
+	bool owns_triangle(const Geometry *geom) const;
+	/*
+	 * Apply the transform to the mesh's vertices and normals and refit its BVH
+	 */
+	void transform_mesh(const Transform &t);
 	/*
 	 * Refine the mesh down to its component triangles by computing them
 	 * and cacheing them
 	 */
 	void refine_tris();
+	/*
+	 * Build the BVH over the mesh's triangles, the triangles are also packed into
+	 * the BVH's SoA triangle leaves for intersection
+	 */
+	void build_bvh();
 	/*
 	 * Load the model from a wavefront obj file or a binary obj file
 	 * depending on what's available, preferring binary obj files
 	 * bobj indicates if we want to ignore any binary object files
 	 * only used by the mesh preprocessor to not load & process any
 	 * existing binary files
+	 * Returns true if the mesh's BVH was restored from the binary file
 	 */
-	void load_model(const std::string &file, bool no_bobj = false);
+	bool load_model(const std::string &file, bool no_bobj = false);
 	/*
 	 * Load the mesh data from a wavefront obj file
 	 */
 	void load_wobj(const std::string &file);
 	/*
-	 * Load the mesh data from a preprocessed binary obj file
+	 * Load the mesh data from a preprocessed binary obj file, if restore_bvh is set the
+	 * BVH stored in the file is also restored if it was built the way the mesh wants.
+	 * Returns true if the BVH was restored, the mesh's triangles will have been refined
 	 */
-	void load_bobj(const std::string &file);
+	bool load_bobj(const std::string &file, bool restore_bvh);
 };
 
 #endif
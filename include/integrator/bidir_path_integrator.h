@@ -1,6 +1,8 @@
 #ifndef BIDIR_PATH_INTEGRATOR_H
 #define BIDIR_PATH_INTEGRATOR_H
 
+#include <array>
+#include <vector>
 #include "surface_integrator.h"
 #include "renderer/renderer.h"
 
@@ -24,6 +26,18 @@ class BidirPathIntegrator : public SurfaceIntegrator {
 		int num_specular_comp;
 		Colorf throughput;
 	};
+	/*
+	 * A camera or light path being traced, the ray to find the next vertex, the throughput
+	 * of the path so far and the vertices found along with the samples for each bounce
+	 */
+	struct SubPath {
+		RayDifferential ray;
+		Colorf throughput;
+		PathVertex *vertices;
+		int len;
+		std::array<float, 2> *samples_u;
+		float *samples_comp;
+	};
 
 public:
 	/*
@@ -37,16 +51,47 @@ public:
 	 */
 	Colorf illumination(const Scene &scene, const Renderer &renderer, const RayDifferential &ray,
 		DifferentialGeometry &dg, Sampler &sampler, MemoryPool &pool) const override;
+	/*
+	 * Compute the illumination for the batch of rays, the camera paths and then the light paths
+	 * of the batch are traced a bounce at a time with the rays for each bounce sorted for coherence
+	 * See SurfaceIntegrator::illumination
+	 */
+	void illumination(const Scene &scene, const Renderer &renderer, const RayDifferential *rays,
+		DifferentialGeometry **hits, int n, Colorf *illum, Sampler &sampler, MemoryPool &pool) const override;
 
 private:
 	/*
-	 * Generate a path of length at least min_depth and at most max_depth, returning the actual
-	 * length of the path generated and filling out the path vertex array passed. There must be
-	 * room for at least max_depth vertices in the array. Weight is the starting weight of the
-	 * path, eg. weight from the camera or light source generating the ray
+	 * Start a path along the ray, allocating room for max_depth vertices and generating the samples
+	 * it needs. Weight is the starting weight of the path, eg. weight from the camera or light
+	 * source generating the ray
+	 */
+	void start_path(SubPath &path, const RayDifferential &ray, const Colorf &weight, Sampler &sampler,
+		MemoryPool &pool) const;
+	/*
+	 * Generate a path of length at least min_depth and at most max_depth, the path's length
+	 * is set to the actual length of the path generated
+	 */
+	void trace_path(SubPath &path, const Scene &scene, const Renderer &renderer, Sampler &sampler,
+		MemoryPool &pool) const;
+	/*
+	 * Generate all the paths together, tracing the rays for each bounce of the paths sorted
+	 * by origin and direction. See trace_path
+	 */
+	void trace_paths(std::vector<SubPath> &paths, const Scene &scene, const Renderer &renderer,
+		Sampler &sampler, MemoryPool &pool) const;
+	/*
+	 * Add the vertex hit by the path's ray to the path, the hit should have been found into the
+	 * geometry of the vertex after the path's last one. Returns true and sets the path's ray to
+	 * the next ray to trace if the path continues
+	 */
+	bool extend_path(SubPath &path, const Scene &scene, const Renderer &renderer, Sampler &sampler,
+		MemoryPool &pool) const;
+	/*
+	 * Uniformly select a light and sample a ray leaving it at the time to start a light path
+	 * Returns false if the light would have no contribution
 	 */
-	int trace_path(const Scene &scene, const Renderer &renderer, const RayDifferential &ray, const Colorf &weight,
-		Sampler &sampler, MemoryPool &pool, PathVertex *path_vertices) const;
+	bool sample_light_ray(const Scene &scene, float time, Sampler &sampler, MemoryPool &pool,
+		RayDifferential &ray, Colorf &weight) const;
 	/*
 	 * Compute the luminance along the camera path using the regular camera path tracing lighting
 	 * computation but with the path vertices for path of length path_len provided in path_vertices
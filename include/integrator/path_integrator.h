@@ -1,6 +1,7 @@
 #ifndef PATH_INTEGRATOR_H
 #define PATH_INTEGRATOR_H
 
+#include <array>
 #include "surface_integrator.h"
 #include "renderer/renderer.h"
 
@@ -10,6 +11,22 @@
 class PathIntegrator : public SurfaceIntegrator {
 	const int min_depth, max_depth;
 
+	/*
+	 * State of a path being traced, the samples for each bounce, the path throughput and
+	 * illumination found so far, the ray to find the next vertex and the geometry it hit
+	 */
+	struct PathState {
+		std::array<float, 2> *l_samples_u, *bsdf_samples_u, *path_samples_u;
+		float *l_samples_comp, *bsdf_samples_comp, *path_samples_comp;
+		//Path throughput is the current product of bsdf values and geometry terms so far,
+		//divided by their pdfs. illum is the current illumination along the path
+		Colorf throughput, illum;
+		RayDifferential ray;
+		DifferentialGeometry dg;
+		//If the last bounce was a specular one
+		bool specular_bounce;
+	};
+
 public:
 	/*
 	 * Create the path tracing integrator and set the min and max depth for paths
@@ -22,6 +39,25 @@ public:
 	 */
 	Colorf illumination(const Scene &scene, const Renderer &renderer, const RayDifferential &ray,
 		DifferentialGeometry &dg, Sampler &sampler, MemoryPool &pool) const override;
+	/*
+	 * Compute the illumination for the batch of rays, the paths are traced a bounce at a time
+	 * with the rays for each bounce sorted for coherence, see SurfaceIntegrator::illumination
+	 */
+	void illumination(const Scene &scene, const Renderer &renderer, const RayDifferential *rays,
+		DifferentialGeometry **hits, int n, Colorf *illum, Sampler &sampler, MemoryPool &pool) const override;
+
+private:
+	/*
+	 * Start the path along the ray that hit dg, generating the samples it needs
+	 */
+	void start_path(PathState &path, const RayDifferential &ray, const DifferentialGeometry &dg,
+		Sampler &sampler, MemoryPool &pool) const;
+	/*
+	 * Shade the vertex the path's ray hit and sample the direction to continue the path in.
+	 * Returns true and sets the path's ray to the next ray to trace if the path continues
+	 */
+	bool shade_vertex(PathState &path, int bounce, const Scene &scene, const Renderer &renderer,
+		Sampler &sampler, MemoryPool &pool) const;
 };
 
 #endif
@@ -145,6 +145,11 @@ public:
 	 * Pre-process the scene and build the photon maps needed for rendering
 	 */
 	void preprocess(const Scene &scene) override;
+	/*
+	 * Save or restore the photon maps and the number of paths traced to fill them
+	 */
+	bool save_state(std::FILE *f) const override;
+	bool load_state(std::FILE *f, const Scene &scene) override;
 	/*
 	 * Compute the illumination at a point on the surface in the scene
 	 */
@@ -165,6 +170,16 @@ private:
 	void shoot_photons(std::vector<Photon> &caustic_photons, std::vector<Photon> &indirect_photons,
 		std::vector<Photon> &direct_photons, std::vector<RadiancePhoton> &radiance_photons,
 		std::vector<Colorf> &radiance_reflectance, std::vector<Colorf> &radiance_transmittance, const Scene &scene);
+	/*
+	 * Write the photons in the map to the file, a null map is written as an empty one
+	 */
+	template<typename P>
+	static void write_map(std::FILE *f, const KdPointTree<P> *map);
+	/*
+	 * Read a map written by write_map, an empty map is read as null
+	 */
+	template<typename P>
+	static bool read_map(std::FILE *f, std::unique_ptr<KdPointTree<P>> &map);
 	/*
 	 * Compute the irradiance the hemisphere at the point (centered about the normal) using
 	 * the photons in the map provided
@@ -1,6 +1,7 @@
 #ifndef SURFACE_INTEGRATOR_H
 #define SURFACE_INTEGRATOR_H
 
+#include <cstdio>
 #include "samplers/sampler.h"
 #include "renderer/renderer.h"
 #include "linalg/ray.h"
@@ -24,11 +25,30 @@ public:
 	 * does nothing
 	 */
 	virtual void preprocess(const Scene &scene);
+	/*
+	 * Write the state built by preprocess to a render checkpoint so a resumed render can
+	 * restore it instead of preprocessing again. The default implementation writes nothing
+	 */
+	virtual bool save_state(std::FILE *f) const;
+	/*
+	 * Restore the state written by save_state in place of preprocessing the scene, returns false
+	 * if it can't be read. The default implementation just preprocesses the scene
+	 */
+	virtual bool load_state(std::FILE *f, const Scene &scene);
 	/*
 	 * Compute the illumination at a point on the surface in the scene
 	 */
 	virtual Colorf illumination(const Scene &scene, const Renderer &renderer, const RayDifferential &ray,
 		DifferentialGeometry &dg, Sampler &sampler, MemoryPool &pool) const = 0;
+	/*
+	 * Compute the illumination for a batch of n rays that have already been traced through the scene,
+	 * hits[i] is the geometry hit by rays[i] or null if it missed and the illumination is written
+	 * to illum[i], rays that missed are set to black. Integrators that trace paths can override this
+	 * to trace each bounce of all the paths together, sorted for coherence. The default implementation
+	 * computes the illumination for each ray on its own
+	 */
+	virtual void illumination(const Scene &scene, const Renderer &renderer, const RayDifferential *rays,
+		DifferentialGeometry **hits, int n, Colorf *illum, Sampler &sampler, MemoryPool &pool) const;
 	/*
 	 * Utility function to compute the specularly reflected light off of
 	 * some geometry we hit
@@ -11,6 +11,8 @@
  * PBR
  */
 class AnimatedTransform {
+	//Number of times the transform is sampled at when bounding motion
+	static const int MOTION_SAMPLES = 128;
 	const float start_time, end_time;
 	const bool animated;
 	Transform start_transform, end_transform;
@@ -35,6 +37,15 @@ public:
 	 * Compute the bounds the BBox covers when animated with this transformation
 	 */
 	BBox motion_bound(const BBox &b) const;
+	/*
+	 * Compute bounds for the box at the start and end times such that linearly
+	 * interpolating them gives a box containing the animated box at any time in between
+	 */
+	void linear_motion_bound(const BBox &b, BBox &start, BBox &end) const;
+	/*
+	 * Check if the start and end transformations differ
+	 */
+	bool is_animated() const;
 	Point operator()(float t, const Point &p) const;
 	void operator()(float t, const Point &p, Point &out) const;
 	Vector operator()(float t, const Vector &v) const;
@@ -7,6 +7,7 @@
 #include "point.h"
 
 class DifferentialGeometry;
+class Geometry;
 
 /*
  * A ray in 3D space starting at o and in direction d
@@ -19,10 +20,14 @@ struct Ray {
 	//recursion depth of this ray, needed for some algorithms
 	int depth;
 	float time;
+	//The primitive the ray was cast from if it was cast from a surface. Meshes with levels of
+	//detail test the ray against the level the primitive is on, so rays leaving a level's surface
+	//don't hit a finer or coarser copy of it
+	const Geometry *origin_geom;
 
 	inline Ray(const Point &o = Point{}, const Vector &d = Vector{}, float min_t = 0,
 		float max_t = std::numeric_limits<float>::infinity(), int depth = 0, float time = 0)
-		: o(o), d(d), min_t(min_t), max_t(max_t), depth(depth), time(time)
+		: o(o), d(d), min_t(min_t), max_t(max_t), depth(depth), time(time), origin_geom(nullptr)
 	{}
 	/*
 	 * Use to indicate that some ray has spawned this one,
@@ -30,7 +35,8 @@ struct Ray {
 	 */
 	inline Ray(const Point &o, const Vector &d, const Ray &parent, float min_t = 0,
 		float max_t = std::numeric_limits<float>::infinity())
-		: o(o), d(d), min_t(min_t), max_t(max_t), depth(parent.depth + 1), time(parent.time)
+		: o(o), d(d), min_t(min_t), max_t(max_t), depth(parent.depth + 1), time(parent.time),
+		origin_geom(nullptr)
 	{}
 	//Get a point at some t along the ray
 	inline Point operator()(float t) const {
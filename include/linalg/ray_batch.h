@@ -0,0 +1,43 @@
+#ifndef RAY_BATCH_H
+#define RAY_BATCH_H
+
+#include <vector>
+#include <cstdint>
+#include "point.h"
+#include "ray.h"
+
+/*
+ * A batch of rays for the same bounce of many paths, eg. the second bounce of all the
+ * paths in a block. Incoherent secondary rays are traced much faster if rays that will take
+ * similar paths through the scene are traced one after another, so the rays are sorted
+ * by the octant of their direction and then along a Morton curve through their origins
+ * Rays are identified by the id they were queued with so the results can be scattered
+ * back to the paths they came from
+ */
+class RayBatch {
+	struct Entry {
+		uint64_t key;
+		Point o;
+		int octant, id;
+	};
+	std::vector<Entry> entries;
+
+public:
+	/*
+	 * Queue the ray to be traced in the batch
+	 */
+	void push(const Ray &ray, int id);
+	/*
+	 * Remove all the rays in the batch
+	 */
+	void clear();
+	bool empty() const;
+	size_t size() const;
+	/*
+	 * Sort the queued rays and set order to the ids of the rays in the order they should be traced
+	 */
+	void sort(std::vector<int> &order);
+};
+
+#endif
+
@@ -0,0 +1,50 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <array>
+#include <cstdint>
+#include "vector.h"
+#include "point.h"
+#include "ray.h"
+
+/*
+ * A packet of coherent rays, eg. the primary rays for a few neighboring pixels, that are
+ * traced through the scene together. The rays are stored in SoA layout so they can be
+ * tested in SIMD lanes and the bounds on the rays' origins and reciprocal directions are
+ * kept so nodes that none of the rays could hit can be culled with a single test
+ * Rays in the packet are identified by their index, sets of rays by a bitmask
+ */
+struct RayPacket {
+	static const int MAX_RAYS = 64;
+	int size;
+	//Origin, direction and reciprocal direction components of each ray, indexed by axis then ray
+	alignas(32) std::array<std::array<float, MAX_RAYS>, 3> o, d, inv_d;
+	alignas(32) std::array<float, MAX_RAYS> min_t, max_t, time;
+	//Bounds on the rays' origins and reciprocal directions along each axis
+	Point o_min, o_max;
+	Vector inv_min, inv_max;
+	//Bounds on the rays' t ranges
+	float min_t_bound, max_t_bound;
+
+	RayPacket();
+	/*
+	 * Set the ray at index i in the packet, compute_bounds should be called
+	 * once all the rays have been set
+	 */
+	void set_ray(int i, const Ray &r);
+	/*
+	 * Get the ray at index i in the packet
+	 */
+	Ray ray(int i) const;
+	/*
+	 * Compute the reciprocal directions and the bounds on the packet's rays
+	 */
+	void compute_bounds();
+	/*
+	 * Update the bound on the rays' max_t after some rays have found closer hits
+	 */
+	void update_max_t_bound();
+};
+
+#endif
+
@@ -4,6 +4,7 @@
 #include "point.h"
 #include "vector.h"
 #include "ray.h"
+#include "ray_packet.h"
 #include "matrix4.h"
 #include "geometry/bbox.h"
 #include "geometry/differential_geometry.h"
@@ -72,6 +73,7 @@ struct Transform {
 	void operator()(const Ray &in, Ray &out) const;
 	RayDifferential operator()(const RayDifferential &r) const;
 	void operator()(const RayDifferential &in, RayDifferential &out) const;
+	void operator()(const RayPacket &in, RayPacket &out) const;
 	Matrix4 operator()(const Matrix4 &m) const;
 	void operator()(const Matrix4 &in, Matrix4 &out) const;
 	BBox operator()(const BBox &b) const;
@@ -2,6 +2,7 @@
 #define LINALG_UTIL_H
 
 #include <cmath>
+#include <cstdint>
 #include <array>
 #include <algorithm>
 #include "vector.h"
@@ -106,6 +107,49 @@ inline bool solve_linear2x2(const std::array<float, 4> &mat, const std::array<fl
 	}
 	return true;
 }
+/*
+ * Spread the low 16 bits of x out to the even bits of the result, used to build 2D Morton codes
+ * Fabian Giesen's Morton code generation
+ * See: http://fgiesen.wordpress.com/2009/12/13/decoding-morton-codes/
+ */
+inline uint32_t part1_by1(uint32_t x){
+	// x = ---- ---- ---- ---- fedc ba98 7654 3210
+	x &= 0x0000ffff;
+	// x = ---- ---- fedc ba98 ---- ---- 7654 3210
+	x = (x ^ (x << 8)) & 0x00ff00ff;
+	// x = ---- fedc ---- ba98 ---- 7654 ---- 3210
+	x = (x ^ (x << 4)) & 0x0f0f0f0f;
+	// x = --fe --dc --ba --98 --76 --54 --32 --10
+	x = (x ^ (x << 2)) & 0x33333333;
+	// x = -f-e -d-c -b-a -9-8 -7-6 -5-4 -3-2 -1-0
+	x = (x ^ (x << 1)) & 0x55555555;
+	return x;
+}
+/*
+ * Compute the 32 bit 2D Morton code of x, y
+ */
+inline uint32_t morton2(uint32_t x, uint32_t y){
+	return (part1_by1(y) << 1) + part1_by1(x);
+}
+/*
+ * Spread the low 21 bits of x out to every third bit of the result, used to build 3D Morton codes
+ */
+inline uint64_t part1_by2(uint64_t x){
+	x &= 0x1fffff;
+	x = (x ^ (x << 32)) & 0x1f00000000ffff;
+	x = (x ^ (x << 16)) & 0x1f0000ff0000ff;
+	x = (x ^ (x << 8)) & 0x100f00f00f00f00f;
+	x = (x ^ (x << 4)) & 0x10c30c30c30c30c3;
+	x = (x ^ (x << 2)) & 0x1249249249249249;
+	return x;
+}
+/*
+ * Compute the 63 bit 3D Morton code of x, y, z. Each coordinate should be
+ * at most 21 bits, bit i of the code comes from axis i % 3
+ */
+inline uint64_t morton3(uint64_t x, uint64_t y, uint64_t z){
+	return (part1_by2(z) << 2) | (part1_by2(y) << 1) | part1_by2(x);
+}
 /*
  * Compute a local coordinate system from a single vector
  */
@@ -21,6 +21,14 @@ void batch_process(char **argv, int argc);
  * [float]: 3 * num verts texcoords
  * [float]: 3 * num verts normals
  * [int]: 3 * num tris indices
+ * followed by the mesh's SAH BVH, so it can be restored instead of rebuilt:
+ * uint32: section tag, the bytes !BVH
+ * uint32: section version, bumped whenever the layout changes
+ * uint32: split method, max geometry per leaf
+ * uint32: number of triangles, nodes and triangle references
+ * float: SBVH duplication budget
+ * [FlatNode]: num nodes flattened binary BVH nodes
+ * [uint32]: num references triangle indices in leaf order
  */
 bool process_wobj(const std::string &file);
 
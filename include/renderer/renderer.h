@@ -2,6 +2,7 @@
 #define RENDERER_H
 
 #include <memory>
+#include <cstdio>
 #include "samplers/sampler.h"
 #include "linalg/ray.h"
 #include "memory_pool.h"
@@ -9,6 +10,7 @@
 class SurfaceIntegrator;
 class VolumeIntegrator;
 class Scene;
+struct DifferentialGeometry;
 
 /*
  * Interface for renderers, given a ray to trace and a scene
@@ -24,12 +26,33 @@ public:
 	 * Have the renderer and its integrators perform any needed pre-processing of the scene
 	 */
 	void preprocess(const Scene &scene);
+	/*
+	 * Save the state built when preprocessing to a render checkpoint or restore it in place
+	 * of preprocessing the scene, see SurfaceIntegrator::save_state
+	 */
+	bool save_state(std::FILE *f) const;
+	bool load_state(std::FILE *f, const Scene &scene);
 	/*
 	 * Compute the incident radiance along the ray in the scene
 	 * The default implementation simply calls the surface integrator on
 	 * the hit geometry to compute the illumination
 	 */
 	virtual Colorf illumination(RayDifferential &ray, const Scene &scene, Sampler &sampler, MemoryPool &pool) const;
+	/*
+	 * Compute the incident radiance along a ray that has already been traced through the scene
+	 * dg is the geometry hit by the ray or null if it didn't hit anything, this lets the ray be
+	 * traced along with others in a packet before shading
+	 */
+	virtual Colorf illumination(RayDifferential &ray, DifferentialGeometry *dg, const Scene &scene,
+		Sampler &sampler, MemoryPool &pool) const;
+	/*
+	 * Compute the incident radiance along a batch of n rays that have already been traced through the
+	 * scene, hits[i] is the geometry hit by rays[i] or null and the radiance is written to illum[i]
+	 * The surface integrator shades the batch together so it can trace the later bounces of the
+	 * rays' paths together as well
+	 */
+	virtual void illumination(RayDifferential *rays, DifferentialGeometry **hits, int n, const Scene &scene,
+		Sampler &sampler, MemoryPool &pool, Colorf *illum) const;
 	/*
 	 * Compute the beam transmittance for line segment along the ray from min_t to max_t using the
 	 * volume integrator, if any. If no volume integrator is being used, simply returns 1 (eg. air)
@@ -53,12 +53,17 @@ public:
 	 */
 	bool report_results(const std::vector<Sample> &samples,
 		const std::vector<RayDifferential> &rays, const std::vector<Colorf> &colors) override;
+	/*
+	 * The adaptive sampler uses the reported results to decide if it should supersample
+	 */
+	bool uses_feedback() const override;
 	/*
 	 * Get subsamplers that divide the space to be sampled
 	 * into count disjoint subsections where each samples a w x h
 	 * section of the original sampler
 	 */
 	std::vector<std::unique_ptr<Sampler>> get_subsamplers(int w, int h) const override;
+	std::unique_ptr<Sampler> get_subsampler(int x_start, int x_end, int y_start, int y_end, int seed) const override;
 
 private:
 	/*
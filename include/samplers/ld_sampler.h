@@ -43,6 +43,7 @@ public:
 	 * section of the original sampler
 	 */
 	std::vector<std::unique_ptr<Sampler>> get_subsamplers(int w, int h) const override;
+	std::unique_ptr<Sampler> get_subsampler(int x_start, int x_end, int y_start, int y_end, int seed) const override;
 	/*
 	 * Generate a 1d pattern of low discrepancy samples and return them
 	 * sample values will be normalized between [0, 1)
@@ -52,6 +52,11 @@ public:
 	 * Optionally specify an offset index to start sample generation at
 	 */
 	virtual void get_samples(float *samples, int n_samples, int offset = 0) = 0;
+	/*
+	 * Reseed the sampler's rng, eg. so a block sampled again in another
+	 * pass over the image takes different samples
+	 */
+	void reseed(int seed);
 	/*
 	 * Get a random float in the range [0, 1)
 	 */
@@ -68,6 +73,13 @@ public:
 	 */
 	virtual bool report_results(const std::vector<Sample> &samples,
 		const std::vector<RayDifferential> &rays, const std::vector<Colorf> &colors);
+	/*
+	 * Returns true if the sampler uses the results reported to decide which samples to
+	 * take next, eg. to supersample a pixel. Samples from samplers that don't can be
+	 * gathered over multiple pixels before being traced together
+	 * The default implementation returns false
+	 */
+	virtual bool uses_feedback() const;
 	/*
 	 * Returns true if we haven't exhausted the sample space for
 	 * the sampler yet
@@ -80,10 +92,15 @@ public:
 	int height() const;
 	/*
 	 * Get subsamplers that divide the space to be sampled
-	 * into count disjoint subsections where each samples a w x h
+	 * into count disjoint subsections where each samples about a w x h
 	 * section of the original sampler
 	 */
 	virtual std::vector<std::unique_ptr<Sampler>> get_subsamplers(int w, int h) const = 0;
+	/*
+	 * Get a subsampler for the region [x_start, x_end) x [y_start, y_end)
+	 * of the original sampler, seeded with the seed passed
+	 */
+	virtual std::unique_ptr<Sampler> get_subsampler(int x_start, int x_end, int y_start, int y_end, int seed) const = 0;
 };
 
 #endif
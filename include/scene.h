@@ -4,6 +4,7 @@
 #include <memory>
 #include <string>
 #include "geometry/geometry.h"
+#include "geometry/mesh_proxy.h"
 #include "volume/volume_node.h"
 #include "material/material.h"
 #include "textures/texture.h"
@@ -19,6 +20,8 @@
  * Describes a scene that we're rendering
  */
 class Scene {
+	//Held by pointer so the proxies in the geometry cache can refer to it when the scene is moved
+	std::unique_ptr<MeshProxyCache> proxy_cache;
 	GeometryCache geom_cache;
 	MaterialCache mat_cache;
 	TextureCache tex_cache;
@@ -31,6 +34,8 @@ class Scene {
 	Node root;
 	std::unique_ptr<VolumeNode> volume_root;
 	Texture *background, *environment;
+	//Node layout to use for the scene's top level BVH
+	BVH_LAYOUT bvh_layout;
 
 public:
 	/*
@@ -46,6 +51,10 @@ public:
 	LightCache& get_light_cache();
 	const LightCache& get_light_cache() const;
 	VolumeCache& get_volume_cache();
+	/*
+	 * Get the cache tracking the meshes loaded by the scene's mesh proxies
+	 */
+	MeshProxyCache& get_proxy_cache();
 	Camera& get_camera();
 	RenderTarget& get_render_target();
 	const RenderTarget& get_render_target() const;
@@ -69,6 +78,26 @@ public:
 	void set_environment(Texture *t);
 	const Texture* get_background() const;
 	const Texture* get_environment() const;
+	void set_bvh_layout(BVH_LAYOUT layout);
+	BVH_LAYOUT get_bvh_layout() const;
+	/*
+	 * Find the node with the name in the scene graph, returns nullptr if there's none
+	 */
+	Node* find_node(const std::string &name);
+	/*
+	 * Apply per-frame updates to the already loaded scene, moving the named node to a new
+	 * transform or replacing the vertices of the named mesh, see TriMesh::set_vertices.
+	 * Returns false if the node or mesh can't be found or updated. Once all the frame's updates
+	 * are made update_bvh should be called before rendering
+	 */
+	bool set_node_transform(const std::string &name, const Transform &t);
+	bool set_mesh_vertices(const std::string &name, const std::vector<Point> &verts,
+		const std::vector<Normal> &norms = std::vector<Normal>{});
+	/*
+	 * Refit the scene's BVH to the updated nodes and meshes instead of rebuilding it, rebuilding
+	 * the parts that have degraded too much, see BVH::refit
+	 */
+	void update_bvh(float rebuild_ratio = 2);
 };
 
 #endif
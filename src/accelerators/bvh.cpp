@@ -2,29 +2,264 @@
 #include <algorithm>
 #include <memory>
 #include <cmath>
+#include <cstring>
 #include <vector>
 #include <array>
+#include <limits>
+#include <future>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <cstdio>
+#include <unordered_map>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
 #include "linalg/ray.h"
+#include "linalg/ray_packet.h"
 #include "linalg/util.h"
 #include "geometry/geometry.h"
 #include "geometry/bbox.h"
 #include "accelerators/bvh.h"
 
+//SIMD versions of the wide node slab test, others use the generic scalar version
+#if defined(__SSE__) || defined(_M_X64)
+template<>
+int BVH::wide_box_intersect<4>(const WideBounds<4> &node, const Ray &r, const Vector &inv_dir,
+	const std::array<int, 3> &neg_dir, std::array<float, 4> &t_near) const;
+#endif
+#if defined(__AVX__)
+template<>
+int BVH::wide_box_intersect<8>(const WideBounds<8> &node, const Ray &r, const Vector &inv_dir,
+	const std::array<int, 3> &neg_dir, std::array<float, 8> &t_near) const;
+#endif
+//SIMD versions of decoding the compressed nodes' bounds
+#if defined(__SSE4_1__)
+template<>
+const BVH::WideBounds<4>& BVH::CompressedNode<4>::decode(WideBounds<4> &bounds) const;
+#endif
+#if defined(__AVX2__)
+template<>
+const BVH::WideBounds<8>& BVH::CompressedNode<8>::decode(WideBounds<8> &bounds) const;
+#endif
+
+//Ranges of geometry larger than this are split into chunks processed in parallel when
+//binning, and subtrees larger than the subtree size are built on their own thread
+const static int PARALLEL_BIN_SIZE = 128 * 1024;
+const static int PARALLEL_SUBTREE_SIZE = 4 * 1024;
+//Tag and version of the BVH section written to files, the version must be bumped
+//whenever the layout of the nodes or the section changes
+const static uint32_t BVH_CACHE_MAGIC = 0x48564221;
+const static uint32_t BVH_CACHE_VERSION = 1;
+//Number of buckets considered when finding SAH splits
+const static int SAH_BUCKETS = 12;
+//Number of cells along each axis the LBVH quantizes geometry centers to for the 63 bit Morton codes
+const static float MORTON_CELLS = 1 << 21;
+//The LBVH clusters geometry by the top 12 bits of its Morton code and emits leaves
+//once there's at most LBVH_LEAF_GEOM primitives left
+const static int CLUSTER_SHIFT = 63 - 12;
+const static unsigned LBVH_LEAF_GEOM = 4;
+//The traversal stacks hold 64 nodes so the LBVH is kept within this depth, the SAH tree joining
+//the clusters is given the top LBVH_CLUSTER_DEPTH levels and the treelets the rest. Subtrees
+//fall back to median splits when splitting on the Morton code would go past the limit
+const static int LBVH_MAX_DEPTH = 62;
+const static int LBVH_CLUSTER_DEPTH = 24;
+//Number of bins considered when finding SBVH spatial splits
+const static int SPATIAL_BINS = 32;
+//SBVH spatial splits are only tried if the children of the best object split overlap by more
+//than this fraction of the tree's surface area, and only above the max depth to keep the tree shallow
+const static float SBVH_MIN_OVERLAP = 1e-5f;
+const static int SBVH_MAX_DEPTH = 48;
+//Largest quantized coordinate of the compressed nodes, the bounds of unused child slots are
+//stored as [QUANT_MAX, 0] so they decode to inverted boxes
+const static int QUANT_MAX = 255;
+
+/*
+ * Split [start, end) into chunks processed by f(chunk_start, chunk_end) on up to
+ * threads threads and return the result for each chunk. Small ranges are run on
+ * the calling thread as a single chunk
+ */
+template<typename F>
+static auto parallel_chunks(int start, int end, int threads, const F &f) -> std::vector<decltype(f(start, end))> {
+	std::vector<decltype(f(start, end))> results;
+	if (end - start <= PARALLEL_BIN_SIZE || threads < 2){
+		results.push_back(f(start, end));
+		return results;
+	}
+	int chunk_size = (end - start + threads - 1) / threads;
+	std::vector<std::future<decltype(f(start, end))>> chunks;
+	for (int s = start + chunk_size; s < end; s += chunk_size){
+		chunks.push_back(std::async(std::launch::async, f, s, std::min(s + chunk_size, end)));
+	}
+	results.push_back(f(start, start + chunk_size));
+	for (auto &c : chunks){
+		results.push_back(c.get());
+	}
+	return results;
+}
+
+/*
+ * Compute 2^e for e in [-126, 127] by building the float directly
+ */
+static inline float exp2i(int e){
+	const uint32_t bits = static_cast<uint32_t>(e + 127) << 23;
+	float f;
+	std::memcpy(&f, &bits, sizeof(float));
+	return f;
+}
+
+/*
+ * Get the number of levels of median splits needed to split n items into
+ * leaves of at most leaf_size items
+ */
+static int median_split_depth(unsigned n, unsigned leaf_size){
+	int depth = 0;
+	for (; n > leaf_size; n = (n + 1) / 2){
+		++depth;
+	}
+	return depth;
+}
+
 BVH::GeomInfo::GeomInfo(int i, const BBox &b) : geom_idx(i), center(b.lerp(0.5, 0.5, 0.5)), bounds(b){}
 
-BVH::BuildNode::BuildNode(int geom_offset, int ngeom, const BBox &bounds)
-	: children({nullptr, nullptr}), geom_offset(geom_offset), ngeom(ngeom), bounds(bounds)
-{}
-BVH::BuildNode::BuildNode(AXIS split, std::unique_ptr<BuildNode> a, std::unique_ptr<BuildNode> b)
-	: children({std::move(a), std::move(b)}), geom_offset(0), ngeom(0),
-	bounds(children[0]->bounds.box_union(children[1]->bounds)), split(split)
-{}
+template<int N>
+BBox BVH::WideBounds<N>::box(int i) const {
+	return BBox{Point{min_x[i], min_y[i], min_z[i]}, Point{max_x[i], max_y[i], max_z[i]}};
+}
+template<int N>
+BBox BVH::WideBounds<N>::bounds() const {
+	BBox box;
+	box.min = Point{*std::min_element(min_x.begin(), min_x.end()), *std::min_element(min_y.begin(), min_y.end()),
+		*std::min_element(min_z.begin(), min_z.end())};
+	box.max = Point{*std::max_element(max_x.begin(), max_x.end()), *std::max_element(max_y.begin(), max_y.end()),
+		*std::max_element(max_z.begin(), max_z.end())};
+	return box;
+}
+
+template<int N>
+BVH::WideNode<N>::WideNode() : child{}, ngeom{} {
+	this->min_x.fill(std::numeric_limits<float>::infinity());
+	this->min_y.fill(std::numeric_limits<float>::infinity());
+	this->min_z.fill(std::numeric_limits<float>::infinity());
+	this->max_x.fill(-std::numeric_limits<float>::infinity());
+	this->max_y.fill(-std::numeric_limits<float>::infinity());
+	this->max_z.fill(-std::numeric_limits<float>::infinity());
+}
+template<int N>
+void BVH::WideNode<N>::set_child(int i, const BBox &b, int c, int n){
+	this->min_x[i] = b.min.x;
+	this->min_y[i] = b.min.y;
+	this->min_z[i] = b.min.z;
+	this->max_x[i] = b.max.x;
+	this->max_y[i] = b.max.y;
+	this->max_z[i] = b.max.z;
+	child[i] = c;
+	ngeom[i] = n;
+}
+template<int N>
+void BVH::WideNode<N>::set_bounds(const std::array<BBox, N> &bounds){
+	for (int i = 0; i < N; ++i){
+		if (ngeom[i] > 0 || child[i] != 0){
+			set_child(i, bounds[i], child[i], ngeom[i]);
+		}
+	}
+}
+template<int N>
+const BVH::WideBounds<N>& BVH::WideNode<N>::decode(WideBounds<N>&) const {
+	return *this;
+}
+
+template<int N>
+BVH::CompressedNode<N>::CompressedNode(const WideNode<N> &node) : child(node.child), ngeom(node.ngeom){
+	std::array<BBox, N> bounds;
+	for (int i = 0; i < N; ++i){
+		bounds[i] = node.box(i);
+	}
+	set_bounds(bounds);
+}
+template<int N>
+void BVH::CompressedNode<N>::set_bounds(const std::array<BBox, N> &bounds){
+	BBox node_box;
+	for (int i = 0; i < N; ++i){
+		if (ngeom[i] > 0 || child[i] != 0){
+			node_box = node_box.box_union(bounds[i]);
+		}
+	}
+	std::array<std::array<uint8_t, N>*, 3> qmin = {&qmin_x, &qmin_y, &qmin_z};
+	std::array<std::array<uint8_t, N>*, 3> qmax = {&qmax_x, &qmax_y, &qmax_z};
+	for (int a = 0; a < 3; ++a){
+		origin[a] = node_box.min[a];
+		//Pick the smallest power of 2 cell size that fits the node's extent in the grid, rounding in
+		//the decoded coordinates can push the max of a child off the end in which case we try the next size
+		int e = 0;
+		std::frexp((node_box.max[a] - node_box.min[a]) / QUANT_MAX, &e);
+		for (e = clamp(e, -126, 127);; ++e){
+			const float scale = exp2i(e);
+			bool fits = true;
+			for (int i = 0; i < N && fits; ++i){
+				if (ngeom[i] == 0 && child[i] == 0){
+					(*qmin[a])[i] = QUANT_MAX;
+					(*qmax[a])[i] = 0;
+					continue;
+				}
+				//Round the child's bounds outwards onto the grid, so the decoded box always contains it
+				int lo = clamp(static_cast<int>(std::floor((bounds[i].min[a] - origin[a]) / scale)), 0, QUANT_MAX);
+				while (lo > 0 && origin[a] + lo * scale > bounds[i].min[a]){
+					--lo;
+				}
+				int hi = clamp(static_cast<int>(std::ceil((bounds[i].max[a] - origin[a]) / scale)), 0, QUANT_MAX);
+				while (hi <= QUANT_MAX && origin[a] + hi * scale < bounds[i].max[a]){
+					++hi;
+				}
+				fits = hi <= QUANT_MAX || e == 127;
+				(*qmin[a])[i] = lo;
+				(*qmax[a])[i] = std::min(hi, QUANT_MAX);
+			}
+			if (fits){
+				exponent[a] = e;
+				break;
+			}
+		}
+	}
+}
+template<int N>
+BBox BVH::CompressedNode<N>::bounds() const {
+	WideBounds<N> decoded;
+	return decode(decoded).bounds();
+}
+template<int N>
+const BVH::WideBounds<N>& BVH::CompressedNode<N>::decode(WideBounds<N> &bounds) const {
+	//The cell sizes are powers of 2 so the quantized offsets are scaled exactly and the decoded
+	//coordinates match those checked when quantizing
+	const float scale_x = exp2i(exponent[0]);
+	const float scale_y = exp2i(exponent[1]);
+	const float scale_z = exp2i(exponent[2]);
+	for (int i = 0; i < N; ++i){
+		bounds.min_x[i] = origin[0] + qmin_x[i] * scale_x;
+		bounds.min_y[i] = origin[1] + qmin_y[i] * scale_y;
+		bounds.min_z[i] = origin[2] + qmin_z[i] * scale_z;
+		bounds.max_x[i] = origin[0] + qmax_x[i] * scale_x;
+		bounds.max_y[i] = origin[1] + qmax_y[i] * scale_y;
+		bounds.max_z[i] = origin[2] + qmax_z[i] * scale_z;
+	}
+	return bounds;
+}
 
 BVH::SAHBucket::SAHBucket() : count(0){}
 
-BVH::BVH(const std::vector<Geometry*> &geom, SPLIT_METHOD split, unsigned max_geom)
-	: split(split), max_geom(std::min(256u, max_geom))
+BVH::SpatialBin::SpatialBin() : entries(0), exits(0){}
+
+BVH::BVH(const std::vector<Geometry*> &geom, SPLIT_METHOD split, unsigned max_geom, BVH_LAYOUT layout,
+	float dup_budget, bool quiet)
+	: split(split), max_geom(std::min(256u, max_geom)), layout(layout), dup_budget(dup_budget), quiet(quiet),
+	built_cost(0)
 {
+	auto build_start = std::chrono::high_resolution_clock::now();
 	for (Geometry *g : geom){
 		g->refine(geometry);
 	}
@@ -35,48 +270,345 @@ BVH::BVH(const std::vector<Geometry*> &geom, SPLIT_METHOD split, unsigned max_ge
 	//Get bounds and index info together for the geometry we're storing
 	std::vector<GeomInfo> build_geom;
 	build_geom.reserve(geometry.size());
-	for (size_t i = 0; i < geometry.size(); ++i){
-		build_geom.emplace_back(i, geometry[i]->bound());
+	auto info_chunks = parallel_chunks(0, geometry.size(), build_threads(),
+		[this](int start, int end){
+			std::vector<GeomInfo> info;
+			info.reserve(end - start);
+			for (int i = start; i < end; ++i){
+				info.emplace_back(i, geometry[i]->bound());
+			}
+			return info;
+		});
+	for (const auto &c : info_chunks){
+		build_geom.insert(build_geom.end(), c.begin(), c.end());
+	}
+	std::vector<FlatNode> nodes;
+	if (split == SPLIT_METHOD::LBVH){
+		build_lbvh(build_geom, nodes);
+	}
+	else if (split == SPLIT_METHOD::SBVH){
+		std::atomic<int> spare_refs{static_cast<int>(geometry.size() * dup_budget)};
+		std::vector<GeomInfo> leaf_refs;
+		build_sbvh(build_geom, leaf_refs, nodes, spare_refs, 0, 0, BuildThreads::root());
+		build_geom.swap(leaf_refs);
+	}
+	else {
+		build(build_geom, 0, geometry.size(), nodes, BuildThreads::root());
+	}
+	flat_nodes.assign(nodes.begin(), nodes.end());
+	//The build geometry was partitioned in place so the leaves refer to ranges of it, swap
+	//out our unordered geometry list for one in the same order. SBVH leaves may refer to
+	//the same geometry multiple times so the list can grow
+	const size_t nprims = geometry.size();
+	std::vector<Geometry*> ordered_geom(build_geom.size());
+	for (size_t i = 0; i < build_geom.size(); ++i){
+		ordered_geom[i] = geometry[build_geom[i].geom_idx];
 	}
-
-	std::vector<Geometry*> ordered_geom;
-	ordered_geom.reserve(geometry.size());
-	int total_nodes = 0;
-	std::unique_ptr<BuildNode> root = build(build_geom, ordered_geom, 0, geometry.size(), total_nodes);
-	//Our BVH structure refers to the ordered geometry so swap out our unordered list for
-	//the correctly ordered one
 	geometry.swap(ordered_geom);
 
-	//Recursively flatten the tree for faster traversal
-	flat_nodes.resize(total_nodes);
-	uint32_t offset = 0;
-	flatten_tree(root, offset);
+	//Moving geometry needs nodes that store bounds for both ends of the shutter, the wide nodes
+	//don't have room for these so BVHs over moving geometry are kept in the binary layout
+	if (has_moving_geometry()){
+		end_bounds.resize(flat_nodes.size());
+		refit_flat(0, build_threads());
+		this->layout = BVH_LAYOUT::BINARY;
+	}
+	collapse_layout();
+	if (quiet){
+		return;
+	}
+	auto elapsed = std::chrono::high_resolution_clock::now() - build_start;
+	std::cout << "BVH build over " << nprims << " primitives";
+	if (geometry.size() != nprims){
+		std::cout << " (" << geometry.size() << " references)";
+	}
+	std::cout << " took " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms\n";
 }
 BBox BVH::bounds() const {
-	return !flat_nodes.empty() ? flat_nodes[0].bounds : BBox{};
+	switch (layout){
+		case BVH_LAYOUT::WIDE4:
+			return !wide4_nodes.empty() ? wide4_nodes[0].bounds() : BBox{};
+		case BVH_LAYOUT::WIDE8:
+			return !wide8_nodes.empty() ? wide8_nodes[0].bounds() : BBox{};
+		case BVH_LAYOUT::COMPRESSED4:
+			return !compressed4_nodes.empty() ? compressed4_nodes[0].bounds() : BBox{};
+		case BVH_LAYOUT::COMPRESSED8:
+			return !compressed8_nodes.empty() ? compressed8_nodes[0].bounds() : BBox{};
+		default:
+			if (flat_nodes.empty()){
+				return BBox{};
+			}
+			//Interpolated bounds are always inside the union of the shutter open and close bounds
+			return !end_bounds.empty() ? flat_nodes[0].bounds.box_union(end_bounds[0]) : flat_nodes[0].bounds;
+	}
+}
+bool BVH::write(std::FILE *f, const std::vector<Geometry*> &prims) const {
+	//Only the binary tree is stored in depth first order, other layouts are made from it when read
+	if ((layout != BVH_LAYOUT::BINARY && layout != BVH_LAYOUT::TREELET) || !end_bounds.empty()){
+		return false;
+	}
+	std::vector<FlatNode> nodes;
+	nodes.reserve(flat_nodes.size());
+	flatten_depth_first(0, nodes);
+	std::unordered_map<const Geometry*, uint32_t> prim_index;
+	for (size_t i = 0; i < prims.size(); ++i){
+		prim_index[prims[i]] = i;
+	}
+	std::vector<uint32_t> refs(geometry.size());
+	for (size_t i = 0; i < geometry.size(); ++i){
+		auto fnd = prim_index.find(geometry[i]);
+		if (fnd == prim_index.end()){
+			return false;
+		}
+		refs[i] = fnd->second;
+	}
+	const uint32_t header[] = {BVH_CACHE_MAGIC, BVH_CACHE_VERSION, static_cast<uint32_t>(split), max_geom,
+		static_cast<uint32_t>(prims.size()), static_cast<uint32_t>(nodes.size()),
+		static_cast<uint32_t>(refs.size())};
+	std::fwrite(header, sizeof(uint32_t), 7, f);
+	std::fwrite(&dup_budget, sizeof(float), 1, f);
+	std::fwrite(nodes.data(), sizeof(FlatNode), nodes.size(), f);
+	std::fwrite(refs.data(), sizeof(uint32_t), refs.size(), f);
+	return std::ferror(f) == 0;
+}
+bool BVH::read(std::FILE *f, const std::vector<Geometry*> &prims, SPLIT_METHOD split, BVH_LAYOUT layout,
+	float dup_budget)
+{
+	std::array<uint32_t, 7> header;
+	float stored_dup_budget = 0;
+	if (std::fread(header.data(), sizeof(uint32_t), 7, f) != 7 || std::fread(&stored_dup_budget, sizeof(float), 1, f) != 1){
+		return false;
+	}
+	//Trees from an older format or built differently than requested have to be rebuilt
+	if (header[0] != BVH_CACHE_MAGIC || header[1] != BVH_CACHE_VERSION || header[2] != static_cast<uint32_t>(split)
+		|| header[4] != prims.size() || (split == SPLIT_METHOD::SBVH && stored_dup_budget != dup_budget))
+	{
+		return false;
+	}
+	NodeVector<FlatNode> nodes(header[5]);
+	std::vector<uint32_t> refs(header[6]);
+	if (nodes.empty() || std::fread(nodes.data(), sizeof(FlatNode), nodes.size(), f) != nodes.size()
+		|| std::fread(refs.data(), sizeof(uint32_t), refs.size(), f) != refs.size())
+	{
+		return false;
+	}
+	//Make sure the tree only refers to nodes and geometry that exist in case the file is damaged
+	for (size_t i = 0; i < nodes.size(); ++i){
+		if (nodes[i].ngeom > 0 ? nodes[i].geom_offset < 0 || nodes[i].geom_offset + nodes[i].ngeom > static_cast<int>(refs.size())
+			: nodes[i].second_child <= static_cast<int>(i) || nodes[i].second_child >= static_cast<int>(nodes.size()))
+		{
+			return false;
+		}
+	}
+	std::vector<Geometry*> ordered_geom(refs.size());
+	for (size_t i = 0; i < refs.size(); ++i){
+		if (refs[i] >= prims.size()){
+			return false;
+		}
+		ordered_geom[i] = prims[refs[i]];
+	}
+	*this = BVH{std::vector<Geometry*>{}, split, 128, layout, 0.3f, quiet};
+	this->split = split;
+	this->max_geom = header[3];
+	this->layout = layout;
+	this->dup_budget = stored_dup_budget;
+	geometry.swap(ordered_geom);
+	flat_nodes.swap(nodes);
+	collapse_layout();
+	return true;
+}
+bool BVH::read_bounds(std::FILE *f, BBox &bounds){
+	std::array<uint32_t, 7> header;
+	float stored_dup_budget = 0;
+	FlatNode root;
+	if (std::fread(header.data(), sizeof(uint32_t), 7, f) != 7 || std::fread(&stored_dup_budget, sizeof(float), 1, f) != 1
+		|| header[0] != BVH_CACHE_MAGIC || header[1] != BVH_CACHE_VERSION || header[5] == 0
+		|| std::fread(&root, sizeof(FlatNode), 1, f) != 1)
+	{
+		return false;
+	}
+	bounds = root.bounds;
+	return true;
+}
+void BVH::refit(float rebuild_ratio){
+	if (geometry.empty()){
+		return;
+	}
+	auto refit_start = std::chrono::high_resolution_clock::now();
+	//Geometry that started or stopped moving changes which nodes and layout the BVH needs
+	if (has_moving_geometry() != !end_bounds.empty()){
+		rebuild();
+		return;
+	}
+	bool rebuilt = false;
+	if (layout == BVH_LAYOUT::BINARY || layout == BVH_LAYOUT::TREELET){
+		//The treelet layout is refit in depth first order and reordered after
+		if (layout == BVH_LAYOUT::TREELET){
+			std::vector<FlatNode> nodes;
+			nodes.reserve(flat_nodes.size());
+			flatten_depth_first(0, nodes);
+			flat_nodes.assign(nodes.begin(), nodes.end());
+		}
+		//The nodes have the bounds they were built with until the first refit, these are
+		//recorded to measure how much each subtree degrades over the sequence
+		if (built_area.empty()){
+			built_area.reserve(flat_nodes.size());
+			for (const auto &n : flat_nodes){
+				built_area.push_back(n.bounds.surface_area());
+			}
+		}
+		refit_flat(0, build_threads());
+		if (rebuild_degraded(rebuild_ratio)){
+			//The rebuilt subtrees were built over the geometry's bounds for the whole shutter
+			if (!end_bounds.empty()){
+				end_bounds.resize(flat_nodes.size());
+				refit_flat(0, build_threads());
+			}
+			rebuilt = true;
+		}
+		if (layout == BVH_LAYOUT::TREELET){
+			treelet_order();
+		}
+	}
+	else {
+		//Wide nodes can't be rebuilt in place so the whole tree is rebuilt if it has degraded
+		float degradation = 1;
+		switch (layout){
+			case BVH_LAYOUT::WIDE4:
+				degradation = refit_wide_tree(wide4_nodes);
+				break;
+			case BVH_LAYOUT::WIDE8:
+				degradation = refit_wide_tree(wide8_nodes);
+				break;
+			case BVH_LAYOUT::COMPRESSED4:
+				degradation = refit_wide_tree(compressed4_nodes);
+				break;
+			default:
+				degradation = refit_wide_tree(compressed8_nodes);
+				break;
+		}
+		if (degradation > rebuild_ratio){
+			rebuild();
+			return;
+		}
+	}
+	//The SoA leaves hold copies of the triangles so they're repacked with the new positions
+	if (!tri_leaves.empty()){
+		build_triangle_leaves();
+	}
+	if (!prim_leaves.empty()){
+		build_primitive_leaves();
+	}
+	if (quiet){
+		return;
+	}
+	auto elapsed = std::chrono::high_resolution_clock::now() - refit_start;
+	std::cout << "BVH refit over " << geometry.size() << " references";
+	if (rebuilt){
+		std::cout << " (rebuilt degraded subtrees)";
+	}
+	std::cout << " took " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms\n";
 }
 bool BVH::intersect(Ray &r, DifferentialGeometry &diff_geom) const {
+	bool hit = false;
+	//Test all the geometry in each leaf we visit, as closer hits are found the ray's max_t
+	//is reduced so the traversal will skip nodes behind them
+	traverse(r, [this, &r, &diff_geom, &hit](int offset, int ngeom){
+		if (!tri_leaves.empty()){
+			hit = tri_leaves.intersect(r, diff_geom, offset, ngeom) || hit;
+			return false;
+		}
+		if (!prim_leaves.empty()){
+			hit = prim_leaves.intersect(r, diff_geom, offset, ngeom) || hit;
+			return false;
+		}
+		for (int i = 0; i < ngeom; ++i){
+			if (geometry[offset + i]->intersect_hit(r, diff_geom)){
+				hit = true;
+			}
+		}
+		return false;
+	});
+	return hit;
+}
+bool BVH::occluded(const Ray &r) const {
+	//Any hit is enough to know the ray is occluded so stop traversing at the first one
+	return traverse(r, [this, &r](int offset, int ngeom){
+		if (!tri_leaves.empty()){
+			return tri_leaves.occluded(r, offset, ngeom);
+		}
+		if (!prim_leaves.empty()){
+			return prim_leaves.occluded(r, offset, ngeom);
+		}
+		for (int i = 0; i < ngeom; ++i){
+			if (geometry[offset + i]->occluded(r)){
+				return true;
+			}
+		}
+		return false;
+	});
+}
+uint64_t BVH::intersect(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const {
+	switch (layout){
+		case BVH_LAYOUT::WIDE4:
+			return intersect_packet_wide(wide4_nodes, packet, first, diff_geom);
+		case BVH_LAYOUT::WIDE8:
+			return intersect_packet_wide(wide8_nodes, packet, first, diff_geom);
+		case BVH_LAYOUT::COMPRESSED4:
+			return intersect_packet_wide(compressed4_nodes, packet, first, diff_geom);
+		case BVH_LAYOUT::COMPRESSED8:
+			return intersect_packet_wide(compressed8_nodes, packet, first, diff_geom);
+		default:
+			return intersect_packet_binary(packet, first, diff_geom);
+	}
+}
+void BVH::build_triangle_leaves(){
+	tri_leaves = TriangleLeaves{geometry};
+}
+void BVH::build_primitive_leaves(){
+	//The order of the geometry within a leaf doesn't matter so each leaf is sorted by
+	//type, letting the leaf test dispatch once for each run of a type
+	for (const auto &r : leaf_ranges()){
+		PrimitiveLeaves::group(geometry.begin() + r[0], geometry.begin() + r[1]);
+	}
+	prim_leaves = PrimitiveLeaves{geometry};
+}
+template<typename F>
+bool BVH::traverse(const Ray &r, const F &leaf) const {
+	switch (layout){
+		case BVH_LAYOUT::WIDE4:
+			return traverse_wide(wide4_nodes, r, leaf);
+		case BVH_LAYOUT::WIDE8:
+			return traverse_wide(wide8_nodes, r, leaf);
+		case BVH_LAYOUT::COMPRESSED4:
+			return traverse_wide(compressed4_nodes, r, leaf);
+		case BVH_LAYOUT::COMPRESSED8:
+			return traverse_wide(compressed8_nodes, r, leaf);
+		default:
+			return traverse_binary(r, leaf);
+	}
+}
+template<typename F>
+bool BVH::traverse_binary(const Ray &r, const F &leaf) const {
 	if (flat_nodes.empty()){
 		return false;
 	}
-	bool hit = false;
 	Vector inv_dir{1 / r.d.x, 1 / r.d.y, 1 / r.d.z};
 	std::array<int, 3> neg_dir = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
 	//Stack of nodes to be visited and the current node being visited. todo_offset is the top of stack
 	std::array<int, 64> todo;
 	int todo_offset = 0, current = 0;
 	//Step through the BVH visiting the current node and pushing on nodes that need to be visited
+	BBox box;
 	while (true){
 		const FlatNode &fnode = flat_nodes[current];
 		//Check if we hit this node, fast_box_interesect is a faster specialized intersection
 		//for this traversal
-		if (fast_box_intersect(fnode.bounds, r, inv_dir, neg_dir)){
+		if (fast_box_intersect(node_bounds(current, r.time, box), r, inv_dir, neg_dir)){
 			//If it's a leaf node check the geometry
 			if (fnode.ngeom > 0){
-				for (uint32_t i = 0; i < fnode.ngeom; ++i){
-					if (geometry[fnode.geom_offset + i]->intersect(r, diff_geom)){
-						hit = true;
-					}
+				if (leaf(fnode.geom_offset, fnode.ngeom)){
+					return true;
 				}
 				if (todo_offset == 0){
 					break;
@@ -87,13 +619,14 @@ bool BVH::intersect(Ray &r, DifferentialGeometry &diff_geom) const {
 			else {
 				//Figure out which node is further along the ray and push it onto the stack
 				//and traverse the nearer one
+				const std::array<int, 2> children = flat_children(current);
 				if (neg_dir[fnode.axis]){
-					todo[todo_offset++] = current + 1;
-					current = fnode.second_child;
+					todo[todo_offset++] = children[0];
+					current = children[1];
 				}
 				else {
-					todo[todo_offset++] = fnode.second_child;
-					++current;
+					todo[todo_offset++] = children[1];
+					current = children[0];
 				}
 			}
 		}
@@ -105,45 +638,234 @@ bool BVH::intersect(Ray &r, DifferentialGeometry &diff_geom) const {
 			current = todo[--todo_offset];
 		}
 	}
-	return hit;
+	return false;
 }
-std::unique_ptr<BVH::BuildNode> BVH::build(std::vector<GeomInfo> &build_geom, std::vector<Geometry*> &ordered_geom,
-	int start, int end, int &total_nodes)
-{
-	++total_nodes;
-	//Find total bounds for the geometry we're trying to store
+uint64_t BVH::intersect_packet_binary(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const {
+	if (flat_nodes.empty() || first >= packet.size){
+		return 0;
+	}
+	//Stack of nodes to be visited along with the first ray in the packet that was active
+	//when they were pushed, rays before it are known to miss the node
+	struct StackEntry {
+		int node, first;
+	};
+	std::array<StackEntry, 64> todo;
+	int todo_offset = 0;
+	todo[todo_offset++] = StackEntry{0, first};
+	uint64_t hits = 0;
+	float t_near;
 	BBox box;
-	for (int i = start; i < end; ++i){
-		box = box.box_union(build_geom[i].bounds);
+	while (todo_offset > 0){
+		const StackEntry entry = todo[--todo_offset];
+		const FlatNode &fnode = flat_nodes[entry.node];
+		//The packet's rays can be at different times so with moving geometry they're culled
+		//against the node's bounds over the whole shutter, the leaves test each ray at its time
+		const BBox *bounds = &fnode.bounds;
+		if (!end_bounds.empty()){
+			box = fnode.bounds.box_union(end_bounds[entry.node]);
+			bounds = &box;
+		}
+		const int active = packet_box_intersect(*bounds, packet, entry.first, t_near);
+		if (active == packet.size){
+			continue;
+		}
+		if (fnode.ngeom > 0){
+			hits |= intersect_packet_leaf(fnode.geom_offset, fnode.ngeom, packet, active, diff_geom);
+		}
+		//Visit the child nearer to the first active ray first, rays in a coherent packet
+		//will mostly agree on this ordering
+		else {
+			const std::array<int, 2> children = flat_children(entry.node);
+			if (packet.d[fnode.axis][active] < 0){
+				todo[todo_offset++] = StackEntry{children[0], active};
+				todo[todo_offset++] = StackEntry{children[1], active};
+			}
+			else {
+				todo[todo_offset++] = StackEntry{children[1], active};
+				todo[todo_offset++] = StackEntry{children[0], active};
+			}
+		}
+	}
+	return hits;
+}
+uint64_t BVH::intersect_packet_leaf(int offset, int ngeom, RayPacket &packet, int first,
+	DifferentialGeometry *diff_geom) const
+{
+	uint64_t hits = 0;
+	if (!prim_leaves.empty()){
+		hits = prim_leaves.intersect_packet(packet, first, diff_geom, offset, ngeom);
+	}
+	else {
+		for (int i = 0; i < ngeom; ++i){
+			hits |= geometry[offset + i]->intersect_packet(packet, first, diff_geom);
+		}
+	}
+	//Closer hits let us cull more nodes against the packet's bounds
+	if (hits){
+		packet.update_max_t_bound();
+	}
+	return hits;
+}
+int BVH::packet_box_intersect(const BBox &box, const RayPacket &packet, int first, float &t_near){
+	//Test the first active ray, if it's still hitting nodes then most others are as well
+	auto ray_hits = [&box, &packet, &t_near](int i){
+		float tmin = packet.min_t[i];
+		float tmax = packet.max_t[i];
+		for (int a = 0; a < 3; ++a){
+			float t0 = (box.min[a] - packet.o[a][i]) * packet.inv_d[a][i];
+			float t1 = (box.max[a] - packet.o[a][i]) * packet.inv_d[a][i];
+			tmin = std::max(tmin, std::min(t0, t1));
+			tmax = std::min(tmax, std::max(t0, t1));
+		}
+		t_near = tmin;
+		return tmin <= tmax;
+	};
+	if (ray_hits(first)){
+		return first;
+	}
+	//Bound the t values of the slabs for all rays in the packet using interval arithmetic on
+	//the origin and reciprocal direction bounds, if the interval where the packet could be inside
+	//the box is empty none of the rays hit it. Axes where the rays point in different directions
+	//give unbounded slabs so we skip them
+	float near = packet.min_t_bound;
+	float far = packet.max_t_bound;
+	for (int a = 0; a < 3; ++a){
+		const float inv_min = packet.inv_min[a];
+		const float inv_max = packet.inv_max[a];
+		if ((inv_min < 0) != (inv_max < 0) || !std::isfinite(inv_min) || !std::isfinite(inv_max)){
+			continue;
+		}
+		const float lo_min = box.min[a] - packet.o_max[a];
+		const float lo_max = box.min[a] - packet.o_min[a];
+		const float hi_min = box.max[a] - packet.o_max[a];
+		const float hi_max = box.max[a] - packet.o_min[a];
+		const float lo_t0 = std::min(std::min(lo_min * inv_min, lo_min * inv_max),
+			std::min(lo_max * inv_min, lo_max * inv_max));
+		const float hi_t0 = std::min(std::min(hi_min * inv_min, hi_min * inv_max),
+			std::min(hi_max * inv_min, hi_max * inv_max));
+		const float lo_t1 = std::max(std::max(lo_min * inv_min, lo_min * inv_max),
+			std::max(lo_max * inv_min, lo_max * inv_max));
+		const float hi_t1 = std::max(std::max(hi_min * inv_min, hi_min * inv_max),
+			std::max(hi_max * inv_min, hi_max * inv_max));
+		near = std::max(near, std::min(lo_t0, hi_t0));
+		far = std::min(far, std::max(lo_t1, hi_t1));
+	}
+	if (near > far){
+		return packet.size;
+	}
+	//Some rays may hit so find the first remaining one that does
+	int i = first + 1;
+#if defined(__SSE__) || defined(_M_X64)
+	const __m128 b_min[3] = {_mm_set1_ps(box.min.x), _mm_set1_ps(box.min.y), _mm_set1_ps(box.min.z)};
+	const __m128 b_max[3] = {_mm_set1_ps(box.max.x), _mm_set1_ps(box.max.y), _mm_set1_ps(box.max.z)};
+	for (i &= ~3; i < packet.size; i += 4){
+		__m128 tmin = _mm_load_ps(&packet.min_t[i]);
+		__m128 tmax = _mm_load_ps(&packet.max_t[i]);
+		for (int a = 0; a < 3; ++a){
+			const __m128 o = _mm_load_ps(&packet.o[a][i]);
+			const __m128 inv = _mm_load_ps(&packet.inv_d[a][i]);
+			const __m128 t0 = _mm_mul_ps(_mm_sub_ps(b_min[a], o), inv);
+			const __m128 t1 = _mm_mul_ps(_mm_sub_ps(b_max[a], o), inv);
+			tmin = _mm_max_ps(tmin, _mm_min_ps(t0, t1));
+			tmax = _mm_min_ps(tmax, _mm_max_ps(t0, t1));
+		}
+		//Mask off the lanes for rays before first, unused lanes at the end never hit
+		int mask = _mm_movemask_ps(_mm_cmple_ps(tmin, tmax)) & (~0u << std::max(0, first + 1 - i));
+		if (mask){
+			alignas(16) std::array<float, 4> t;
+			_mm_store_ps(t.data(), tmin);
+			int lane = 0;
+			for (; !(mask & (1 << lane)); ++lane);
+			t_near = t[lane];
+			return i + lane;
+		}
+	}
+#else
+	for (; i < packet.size; ++i){
+		if (ray_hits(i)){
+			return i;
+		}
+	}
+#endif
+	return packet.size;
+}
+int BVH::build(std::vector<GeomInfo> &build_geom, int start, int end, std::vector<FlatNode> &nodes,
+	BuildThreads budget)
+{
+	const int threads = budget.threads;
+	//Find total bounds for the geometry we're trying to store and the bounds of their centroids
+	//so we can figure out which axis to split on
+	auto chunk_bounds = parallel_chunks(start, end, threads,
+		[&build_geom](int s, int e){
+			std::array<BBox, 2> b;
+			for (int i = s; i < e; ++i){
+				b[0] = b[0].box_union(build_geom[i].bounds);
+				b[1] = b[1].box_union(build_geom[i].center);
+			}
+			return b;
+		});
+	BBox box, centroids;
+	for (const auto &b : chunk_bounds){
+		box = box.box_union(b[0]);
+		centroids = centroids.box_union(b[1]);
 	}
 	int ngeom = end - start;
 	//Build and return a leaf node for the geometry
 	if (ngeom == 1){
-		return build_leaf(build_geom, ordered_geom, start, end, box);
-	}
-	//Need to build an interior node
-	//Figure out which axis to split on by bounding the various geometry's centroids
-	//and picking the one with the most variation
-	BBox centroids;
-	for (int i = start; i < end; ++i){
-		centroids = centroids.box_union(build_geom[i].center);
+		return build_leaf(nodes, start, end, box);
 	}
+	//Need to build an interior node, pick the axis with the most variation in the centroids
 	AXIS axis = centroids.max_extent();
-	//We can now partition the primitives along this axis
 	int mid = (start + end) / 2;
 	//If all the geometry's centers are on the same point we can't partition
 	if (centroids.max[axis] == centroids.min[axis]){
 		//Check that we can fit all the geometry into a single leaf node, if not we need
 		//to force a split
 		if (ngeom < max_geom){
-			return build_leaf(build_geom, ordered_geom, start, end, box);
+			return build_leaf(nodes, start, end, box);
 		}
-		else {
-			return std::make_unique<BuildNode>(axis,
-				build(build_geom, ordered_geom, start, mid, total_nodes),
-				build(build_geom, ordered_geom, mid, end, total_nodes));
+	}
+	else if (!partition(build_geom, start, end, box, centroids, axis, threads, mid)){
+		return build_leaf(nodes, start, end, box);
+	}
+	assert(start != mid && mid != end);
+
+	int node = nodes.size();
+	nodes.emplace_back();
+	nodes[node].bounds = box;
+	nodes[node].axis = axis;
+	nodes[node].ngeom = 0;
+	//Large subtrees near the top of the tree have their second child built on another thread
+	//while we build the first, its nodes are then moved in after the first child's subtree
+	const BuildThreads child_threads = budget.child();
+	if (ngeom > PARALLEL_SUBTREE_SIZE && budget.tasks > 1){
+		auto second = std::async(std::launch::async, [this, &build_geom, mid, end, child_threads](){
+			std::vector<FlatNode> subtree;
+			build(build_geom, mid, end, subtree, child_threads);
+			return subtree;
+		});
+		build(build_geom, start, mid, nodes, child_threads);
+		std::vector<FlatNode> subtree = second.get();
+		int offset = nodes.size();
+		for (auto &n : subtree){
+			if (n.ngeom == 0){
+				n.second_child += offset;
+			}
 		}
+		nodes.insert(nodes.end(), subtree.begin(), subtree.end());
+		nodes[node].second_child = offset;
+	}
+	else {
+		build(build_geom, start, mid, nodes, child_threads);
+		int second = build(build_geom, mid, end, nodes, child_threads);
+		nodes[node].second_child = second;
 	}
+	return node;
+}
+bool BVH::partition(std::vector<GeomInfo> &build_geom, int start, int end, const BBox &box,
+	const BBox &centroids, AXIS axis, int threads, int &mid) const
+{
+	int ngeom = end - start;
 	//Partition the primitives base on split method chosen
 	switch (split){
 		case SPLIT_METHOD::MIDDLE: {
@@ -168,6 +890,9 @@ std::unique_ptr<BVH::BuildNode> BVH::build(std::vector<GeomInfo> &build_geom, st
 				});
 			break;
 		}
+		//The LBVH and SBVH have their own builders but both are SAH based
+		case SPLIT_METHOD::LBVH:
+		case SPLIT_METHOD::SBVH:
 		case SPLIT_METHOD::SAH: {
 			//If there's only a few primitives just use EQUAL and break
 			if (ngeom < 5){
@@ -179,87 +904,900 @@ std::unique_ptr<BVH::BuildNode> BVH::build(std::vector<GeomInfo> &build_geom, st
 					});
 				break;
 			}
-			//We're just going to consider the possibilities of splitting along 12 bucket boundaries
-			std::array<SAHBucket, 12> buckets;
-			//Place the various geometry we're partitioning into the appropriate bucket, scale
-			//the position along the axis into a bucket index
-			for (int i = start; i < end; ++i){
-				int b = (build_geom[i].center[axis] - centroids.min[axis])
-					/ (centroids.max[axis] - centroids.min[axis]) * buckets.size();
-				b = b == buckets.size() ? b - 1 : b;
-				++buckets[b].count;
-				buckets[b].bounds = buckets[b].bounds.box_union(build_geom[i].bounds);
-			}
-			//Use the SAH to compute the costs of splitting at each bucket except the last
-			std::array<float, 11> cost;
-			for (int i = 0; i < cost.size(); ++i){
-				SAHBucket left, right;
-				for (int j = 0; j <= i; ++j){
-					left.bounds = left.bounds.box_union(buckets[j].bounds);
-					left.count += buckets[j].count;
-				}
-				for (int j = i + 1; j < buckets.size(); ++j){
-					right.bounds = right.bounds.box_union(buckets[j].bounds);
-					right.count += buckets[j].count;
-				}
-				//cost: cost of traversel + (cost of hitting in left + cost of hitting in right) / total area of node
-				cost[i] = .125f + (left.count * left.bounds.surface_area()
-					+ right.count * right.bounds.surface_area()) / box.surface_area();
-			}
-			//Find the lowest cost split we can make here
-			auto min_cost = std::min_element(cost.begin(), cost.end());
-			int min_cost_idx = std::distance(cost.begin(), min_cost);
+			float min_cost;
+			int split_bucket = sah_split(build_geom, start, end, box, centroids, axis, threads, min_cost);
 			//If we're forced to split by the amount of geometry here or it's cheaper to split then do so
-			if (ngeom > max_geom || *min_cost < ngeom){
+			if (ngeom > max_geom || min_cost < ngeom){
 				//Partition the geometry about the splitting bucket
 				auto mid_ptr = std::partition(build_geom.begin() + start, build_geom.begin() + end,
-					[min_cost_idx, axis, centroids](const GeomInfo &g){
-						int b = (g.center[axis] - centroids.min[axis])
-							/ (centroids.max[axis] - centroids.min[axis]) * 12;
-						b = b == 12 ? b - 1 : b;
-						return b <= min_cost_idx;
+					[split_bucket, &centroids, axis](const GeomInfo &g){
+						return sah_bucket(g, centroids, axis) <= split_bucket;
 					});
 				mid = std::distance(build_geom.begin(), mid_ptr);
 			}
 			else {
-				return build_leaf(build_geom, ordered_geom, start, end, box);
+				return false;
 			}
 			break;
 		}
 	}
+	return true;
+}
+int BVH::sah_split(const std::vector<GeomInfo> &build_geom, int start, int end, const BBox &box,
+	const BBox &centroids, AXIS axis, int threads, float &split_cost) const
+{
+	//Place the various geometry we're partitioning into the appropriate bucket,
+	//large ranges are binned in parallel and the buckets merged after
+	auto chunk_buckets = parallel_chunks(start, end, threads,
+		[&build_geom, &centroids, axis](int s, int e){
+			std::array<SAHBucket, SAH_BUCKETS> buckets;
+			for (int i = s; i < e; ++i){
+				int b = sah_bucket(build_geom[i], centroids, axis);
+				++buckets[b].count;
+				buckets[b].bounds = buckets[b].bounds.box_union(build_geom[i].bounds);
+			}
+			return buckets;
+		});
+	std::array<SAHBucket, SAH_BUCKETS> buckets;
+	for (const auto &c : chunk_buckets){
+		for (int i = 0; i < SAH_BUCKETS; ++i){
+			buckets[i].count += c[i].count;
+			buckets[i].bounds = buckets[i].bounds.box_union(c[i].bounds);
+		}
+	}
+	//Sweep in from the right to find what's on the right of each split, then sweep in
+	//from the left and use the SAH to compute the costs of splitting at each bucket except the last
+	std::array<SAHBucket, SAH_BUCKETS - 1> right;
+	SAHBucket sweep;
+	for (int i = SAH_BUCKETS - 2; i >= 0; --i){
+		sweep.bounds = sweep.bounds.box_union(buckets[i + 1].bounds);
+		sweep.count += buckets[i + 1].count;
+		right[i] = sweep;
+	}
+	std::array<float, SAH_BUCKETS - 1> cost;
+	SAHBucket left;
+	for (int i = 0; i < SAH_BUCKETS - 1; ++i){
+		left.bounds = left.bounds.box_union(buckets[i].bounds);
+		left.count += buckets[i].count;
+		//cost: cost of traversel + (cost of hitting in left + cost of hitting in right) / total area of node
+		cost[i] = .125f + (left.count * left.bounds.surface_area()
+			+ right[i].count * right[i].bounds.surface_area()) / box.surface_area();
+	}
+	//Find the lowest cost split we can make here
+	auto min_cost = std::min_element(cost.begin(), cost.end());
+	split_cost = *min_cost;
+	return std::distance(cost.begin(), min_cost);
+}
+int BVH::sah_bucket(const GeomInfo &geom, const BBox &centroids, AXIS axis){
+	//Scale the position along the axis into a bucket index
+	int b = (geom.center[axis] - centroids.min[axis])
+		/ (centroids.max[axis] - centroids.min[axis]) * SAH_BUCKETS;
+	return b == SAH_BUCKETS ? b - 1 : b;
+}
+void BVH::build_lbvh(std::vector<GeomInfo> &build_geom, std::vector<FlatNode> &nodes){
+	const int threads = build_threads();
+	auto chunk_centroids = parallel_chunks(0, build_geom.size(), threads,
+		[&build_geom](int s, int e){
+			BBox b;
+			for (int i = s; i < e; ++i){
+				b = b.box_union(build_geom[i].center);
+			}
+			return b;
+		});
+	BBox centroids;
+	for (const auto &b : chunk_centroids){
+		centroids = centroids.box_union(b);
+	}
+	//Quantize the centers to the 21 bits per axis available in the Morton code, flat axes all map to 0
+	std::array<float, 3> scale;
+	for (int i = 0; i < 3; ++i){
+		float extent = centroids.max[i] - centroids.min[i];
+		scale[i] = extent > 0 ? MORTON_CELLS / extent : 0;
+	}
+	auto code_chunks = parallel_chunks(0, build_geom.size(), threads,
+		[&build_geom, &centroids, &scale](int s, int e){
+			std::vector<MortonGeom> codes;
+			codes.reserve(e - s);
+			for (int i = s; i < e; ++i){
+				std::array<uint64_t, 3> q;
+				for (int j = 0; j < 3; ++j){
+					q[j] = std::min(MORTON_CELLS - 1.f, (build_geom[i].center[j] - centroids.min[j]) * scale[j]);
+				}
+				codes.push_back(MortonGeom{morton3(q[0], q[1], q[2]), i});
+			}
+			return codes;
+		});
+	std::vector<MortonGeom> morton;
+	morton.reserve(build_geom.size());
+	for (const auto &c : code_chunks){
+		morton.insert(morton.end(), c.begin(), c.end());
+	}
+	radix_sort(morton);
+	//Put the build geometry in Morton order so the leaves can refer to ranges of it
+	std::vector<GeomInfo> sorted_geom;
+	sorted_geom.reserve(build_geom.size());
+	for (auto &m : morton){
+		sorted_geom.push_back(build_geom[m.geom]);
+		m.geom = sorted_geom.size() - 1;
+	}
+	build_geom.swap(sorted_geom);
+
+	//Find the clusters of geometry sharing the top bits of their Morton code
+	std::vector<std::array<int, 2>> cluster_ranges;
+	for (int start = 0, end = 1; end <= static_cast<int>(morton.size()); ++end){
+		if (end == static_cast<int>(morton.size())
+			|| (morton[start].code >> CLUSTER_SHIFT) != (morton[end].code >> CLUSTER_SHIFT))
+		{
+			cluster_ranges.push_back({start, end});
+			start = end;
+		}
+	}
+	//Emit the treelets for each cluster, the clusters vary a lot in size so the threads
+	//pull the next cluster to build off a shared counter
+	std::vector<std::vector<FlatNode>> treelets(cluster_ranges.size());
+	std::atomic<int> next_cluster{0};
+	auto emit_treelets = [&](){
+		for (int c = next_cluster++; c < static_cast<int>(cluster_ranges.size()); c = next_cluster++){
+			emit_lbvh(morton, build_geom, cluster_ranges[c][0], cluster_ranges[c][1],
+				CLUSTER_SHIFT - 1, LBVH_CLUSTER_DEPTH, treelets[c]);
+		}
+	};
+	std::vector<std::future<void>> workers;
+	if (build_geom.size() > PARALLEL_SUBTREE_SIZE){
+		for (int i = 1; i < threads; ++i){
+			workers.push_back(std::async(std::launch::async, emit_treelets));
+		}
+	}
+	emit_treelets();
+	for (auto &w : workers){
+		w.get();
+	}
+	//Join the clusters with a SAH tree
+	std::vector<GeomInfo> clusters;
+	clusters.reserve(treelets.size());
+	for (size_t i = 0; i < treelets.size(); ++i){
+		clusters.emplace_back(i, treelets[i][0].bounds);
+	}
+	build_clusters(clusters, 0, clusters.size(), 0, treelets, nodes);
+}
+int BVH::emit_lbvh(const std::vector<MortonGeom> &morton, const std::vector<GeomInfo> &build_geom,
+	int start, int end, int bit, int depth, std::vector<FlatNode> &nodes) const
+{
+	const unsigned ngeom = end - start;
+	//Once only median splits fit in the remaining depth we stop splitting on the code
+	if (bit >= 0 && LBVH_MAX_DEPTH - depth <= median_split_depth(ngeom, max_geom)){
+		bit = -1;
+	}
+	//Make a leaf once there's only a few primitives left or if we've run out of bits to split
+	//on and the remaining geometry fits in a leaf
+	if (ngeom <= std::min(LBVH_LEAF_GEOM, max_geom) || (bit < 0 && ngeom <= max_geom)){
+		BBox box;
+		for (int i = start; i < end; ++i){
+			box = box.box_union(build_geom[i].bounds);
+		}
+		return build_leaf(nodes, start, end, box);
+	}
+	//If all the geometry has the same code but there's too much for a leaf we just split it in the middle
+	int mid = (start + end) / 2;
+	if (bit >= 0){
+		uint64_t mask = uint64_t{1} << bit;
+		//If all the codes are on the same side of this bit there's nothing to split here, move on to the next bit
+		if ((morton[start].code & mask) == (morton[end - 1].code & mask)){
+			return emit_lbvh(morton, build_geom, start, end, bit - 1, depth, nodes);
+		}
+		//The codes are sorted so we can find the first one with the bit set with a binary search
+		mid = std::distance(morton.begin(), std::partition_point(morton.begin() + start, morton.begin() + end,
+			[mask](const MortonGeom &m){
+				return (m.code & mask) == 0;
+			}));
+	}
 	assert(start != mid && mid != end);
-	return std::make_unique<BuildNode>(axis,
-		build(build_geom, ordered_geom, start, mid, total_nodes),
-		build(build_geom, ordered_geom, mid, end, total_nodes));
+
+	int node = nodes.size();
+	nodes.emplace_back();
+	//Bit i of the Morton code comes from axis i % 3
+	nodes[node].axis = bit >= 0 ? bit % 3 : 0;
+	nodes[node].ngeom = 0;
+	int first = emit_lbvh(morton, build_geom, start, mid, bit - 1, depth + 1, nodes);
+	int second = emit_lbvh(morton, build_geom, mid, end, bit - 1, depth + 1, nodes);
+	nodes[node].second_child = second;
+	nodes[node].bounds = nodes[first].bounds.box_union(nodes[second].bounds);
+	return node;
 }
-std::unique_ptr<BVH::BuildNode> BVH::build_leaf(std::vector<GeomInfo> &build_geom, std::vector<Geometry*> &ordered_geom,
-	int start, int end, const BBox &box)
+int BVH::build_clusters(std::vector<GeomInfo> &clusters, int start, int end, int depth,
+	const std::vector<std::vector<FlatNode>> &treelets, std::vector<FlatNode> &nodes) const
 {
-	int ngeom = end - start;
-	//Store the offset to this leaf's geometry then push it on
-	int geom_offset = ordered_geom.size();
+	//The leaves of the upper tree are the cluster treelets, move the treelet in after offsetting its child links
+	if (end - start == 1){
+		int node = nodes.size();
+		for (FlatNode n : treelets[clusters[start].geom_idx]){
+			if (n.ngeom == 0){
+				n.second_child += node;
+			}
+			nodes.push_back(n);
+		}
+		return node;
+	}
+	BBox box, centroids;
 	for (int i = start; i < end; ++i){
-		ordered_geom.push_back(geometry[build_geom[i].geom_idx]);
+		box = box.box_union(clusters[i].bounds);
+		centroids = centroids.box_union(clusters[i].center);
+	}
+	AXIS axis = centroids.max_extent();
+	int mid = (start + end) / 2;
+	//We always split down to single clusters, if their centers are on the same point just split in the middle.
+	//If the SAH splits could take us past the depth given to this tree we split at the median center instead
+	if (LBVH_CLUSTER_DEPTH - depth <= median_split_depth(end - start, 1)){
+		std::nth_element(clusters.begin() + start, clusters.begin() + mid, clusters.begin() + end,
+			[axis](const GeomInfo &a, const GeomInfo &b){
+				return a.center[axis] < b.center[axis];
+			});
+	}
+	else if (centroids.max[axis] != centroids.min[axis]){
+		float cost;
+		int split_bucket = sah_split(clusters, start, end, box, centroids, axis, 1, cost);
+		auto mid_ptr = std::partition(clusters.begin() + start, clusters.begin() + end,
+			[split_bucket, &centroids, axis](const GeomInfo &g){
+				return sah_bucket(g, centroids, axis) <= split_bucket;
+			});
+		mid = std::distance(clusters.begin(), mid_ptr);
+	}
+	assert(start != mid && mid != end);
+
+	int node = nodes.size();
+	nodes.emplace_back();
+	nodes[node].bounds = box;
+	nodes[node].axis = axis;
+	nodes[node].ngeom = 0;
+	build_clusters(clusters, start, mid, depth + 1, treelets, nodes);
+	int second = build_clusters(clusters, mid, end, depth + 1, treelets, nodes);
+	nodes[node].second_child = second;
+	return node;
+}
+int BVH::build_sbvh(std::vector<GeomInfo> &refs, std::vector<GeomInfo> &leaf_refs, std::vector<FlatNode> &nodes,
+	std::atomic<int> &spare_refs, float root_area, int depth, BuildThreads budget) const
+{
+	const int threads = budget.threads;
+	auto chunk_bounds = parallel_chunks(0, refs.size(), threads,
+		[&refs](int s, int e){
+			std::array<BBox, 2> b;
+			for (int i = s; i < e; ++i){
+				b[0] = b[0].box_union(refs[i].bounds);
+				b[1] = b[1].box_union(refs[i].center);
+			}
+			return b;
+		});
+	BBox box, centroids;
+	for (const auto &b : chunk_bounds){
+		box = box.box_union(b[0]);
+		centroids = centroids.box_union(b[1]);
+	}
+	if (depth == 0){
+		root_area = box.surface_area();
+	}
+	//Leaves take their references out of refs and into leaf_refs
+	auto make_leaf = [&](){
+		int start = leaf_refs.size();
+		leaf_refs.insert(leaf_refs.end(), refs.begin(), refs.end());
+		refs = std::vector<GeomInfo>{};
+		return build_leaf(nodes, start, leaf_refs.size(), box);
+	};
+	const unsigned nrefs = refs.size();
+	if (nrefs == 1){
+		return make_leaf();
+	}
+	AXIS axis = centroids.max_extent();
+	std::vector<GeomInfo> left, right;
+	//If all the centers are on the same point we can't partition, if there's too many to
+	//fit in a leaf we split them in the middle
+	if (centroids.max[axis] == centroids.min[axis]){
+		if (nrefs < max_geom){
+			return make_leaf();
+		}
+		left.assign(refs.begin(), refs.begin() + nrefs / 2);
+		right.assign(refs.begin() + nrefs / 2, refs.end());
+	}
+	//If there's only a few references just split them equally
+	else if (nrefs < 5){
+		std::nth_element(refs.begin(), refs.begin() + nrefs / 2, refs.end(),
+			[axis](const GeomInfo &a, const GeomInfo &b){
+				return a.center[axis] < b.center[axis];
+			});
+		left.assign(refs.begin(), refs.begin() + nrefs / 2);
+		right.assign(refs.begin() + nrefs / 2, refs.end());
+	}
+	else {
+		float object_cost;
+		int split_bucket = sah_split(refs, 0, nrefs, box, centroids, axis, threads, object_cost);
+		//Spatial splits only help if the children of the object split overlap, and can only
+		//be made if we've still got room in the duplication budget
+		SpatialSplit spatial;
+		spatial.cost = std::numeric_limits<float>::infinity();
+		if (depth < SBVH_MAX_DEPTH && spare_refs.load(std::memory_order_relaxed) > 0){
+			BBox object_left, object_right;
+			for (const auto &r : refs){
+				if (sah_bucket(r, centroids, axis) <= split_bucket){
+					object_left = object_left.box_union(r.bounds);
+				}
+				else {
+					object_right = object_right.box_union(r.bounds);
+				}
+			}
+			BBox overlap = object_left.box_intersection(object_right);
+			if (!overlap.empty() && overlap.surface_area() > SBVH_MIN_OVERLAP * root_area){
+				spatial = find_spatial_split(refs, box, box.max_extent(), threads);
+			}
+		}
+		//If it's cheaper to not split and the references fit in a leaf make one
+		if (nrefs <= max_geom && std::min(object_cost, spatial.cost) >= nrefs){
+			return make_leaf();
+		}
+		//Take the duplicates the spatial split will make out of the budget, if there isn't room
+		//or the split ends up not partitioning the references we fall back to the object split
+		bool use_spatial = false;
+		if (spatial.cost < object_cost){
+			int max_dups = spatial.nleft + spatial.nright - nrefs;
+			if (spare_refs.fetch_sub(max_dups) >= max_dups){
+				int dups = spatial_partition(refs, spatial, left, right);
+				spare_refs += max_dups - dups;
+				use_spatial = !left.empty() && !right.empty();
+				if (use_spatial){
+					axis = spatial.axis;
+				}
+				else {
+					spare_refs += dups;
+					left.clear();
+					right.clear();
+				}
+			}
+			else {
+				spare_refs += max_dups;
+			}
+		}
+		if (!use_spatial){
+			auto mid = std::partition(refs.begin(), refs.end(),
+				[split_bucket, &centroids, axis](const GeomInfo &g){
+					return sah_bucket(g, centroids, axis) <= split_bucket;
+				});
+			left.assign(refs.begin(), mid);
+			right.assign(mid, refs.end());
+		}
+	}
+	refs = std::vector<GeomInfo>{};
+
+	int node = nodes.size();
+	nodes.emplace_back();
+	nodes[node].bounds = box;
+	nodes[node].axis = axis;
+	nodes[node].ngeom = 0;
+	//Large subtrees near the top of the tree have their second child built on another thread, its
+	//nodes and leaf references are moved in after the first child's
+	const BuildThreads child_threads = budget.child();
+	if (nrefs > PARALLEL_SUBTREE_SIZE && budget.tasks > 1){
+		auto second = std::async(std::launch::async,
+			[this, &right, &spare_refs, root_area, depth, child_threads](){
+				std::pair<std::vector<FlatNode>, std::vector<GeomInfo>> subtree;
+				build_sbvh(right, subtree.second, subtree.first, spare_refs, root_area, depth + 1, child_threads);
+				return subtree;
+			});
+		build_sbvh(left, leaf_refs, nodes, spare_refs, root_area, depth + 1, child_threads);
+		auto subtree = second.get();
+		int node_offset = nodes.size();
+		int ref_offset = leaf_refs.size();
+		for (auto &n : subtree.first){
+			if (n.ngeom == 0){
+				n.second_child += node_offset;
+			}
+			else {
+				n.geom_offset += ref_offset;
+			}
+		}
+		nodes.insert(nodes.end(), subtree.first.begin(), subtree.first.end());
+		leaf_refs.insert(leaf_refs.end(), subtree.second.begin(), subtree.second.end());
+		nodes[node].second_child = node_offset;
+	}
+	else {
+		build_sbvh(left, leaf_refs, nodes, spare_refs, root_area, depth + 1, child_threads);
+		int second = build_sbvh(right, leaf_refs, nodes, spare_refs, root_area, depth + 1, child_threads);
+		nodes[node].second_child = second;
+	}
+	return node;
+}
+BVH::SpatialSplit BVH::find_spatial_split(const std::vector<GeomInfo> &refs, const BBox &box, AXIS axis,
+	int threads) const
+{
+	const float bin_width = (box.max[axis] - box.min[axis]) / SPATIAL_BINS;
+	auto bin_idx = [&box, axis, bin_width](float x){
+		int b = (x - box.min[axis]) / bin_width;
+		return clamp(b, 0, SPATIAL_BINS - 1);
+	};
+	//Chop each reference into the bins it overlaps, clipping the geometry to each bin
+	//so the bins get tight bounds for the part of the reference inside them
+	auto chunk_bins = parallel_chunks(0, refs.size(), threads,
+		[this, &refs, &box, axis, bin_width, &bin_idx](int s, int e){
+			std::array<SpatialBin, SPATIAL_BINS> bins;
+			for (int i = s; i < e; ++i){
+				const GeomInfo &r = refs[i];
+				int first = bin_idx(r.bounds.min[axis]);
+				int last = bin_idx(r.bounds.max[axis]);
+				BBox rest = r.bounds;
+				for (int b = first; b < last; ++b){
+					float plane = box.min[axis] + bin_width * (b + 1);
+					BBox in_bin = rest;
+					in_bin.max[axis] = plane;
+					bins[b].bounds = bins[b].bounds.box_union(geometry[r.geom_idx]->clipped_bound(in_bin));
+					rest.min[axis] = plane;
+					rest = geometry[r.geom_idx]->clipped_bound(rest);
+				}
+				bins[last].bounds = bins[last].bounds.box_union(rest);
+				++bins[first].entries;
+				++bins[last].exits;
+			}
+			return bins;
+		});
+	std::array<SpatialBin, SPATIAL_BINS> bins;
+	for (const auto &c : chunk_bins){
+		for (int i = 0; i < SPATIAL_BINS; ++i){
+			bins[i].bounds = bins[i].bounds.box_union(c[i].bounds);
+			bins[i].entries += c[i].entries;
+			bins[i].exits += c[i].exits;
+		}
+	}
+	//Sweep in from the right to find the references ending on the right of each split then
+	//sweep in from the left and find the cheapest split, as with the SAH object split
+	std::array<SpatialBin, SPATIAL_BINS - 1> right;
+	SpatialBin sweep;
+	for (int i = SPATIAL_BINS - 2; i >= 0; --i){
+		sweep.bounds = sweep.bounds.box_union(bins[i + 1].bounds);
+		sweep.exits += bins[i + 1].exits;
+		right[i] = sweep;
+	}
+	SpatialSplit best;
+	best.cost = std::numeric_limits<float>::infinity();
+	best.axis = axis;
+	SpatialBin left;
+	for (int i = 0; i < SPATIAL_BINS - 1; ++i){
+		left.bounds = left.bounds.box_union(bins[i].bounds);
+		left.entries += bins[i].entries;
+		if (left.entries == 0 || right[i].exits == 0){
+			continue;
+		}
+		float cost = .125f + (left.entries * left.bounds.surface_area()
+			+ right[i].exits * right[i].bounds.surface_area()) / box.surface_area();
+		if (cost < best.cost){
+			best.cost = cost;
+			best.pos = box.min[axis] + bin_width * (i + 1);
+			best.left = left.bounds;
+			best.right = right[i].bounds;
+			best.nleft = left.entries;
+			best.nright = right[i].exits;
+		}
+	}
+	return best;
+}
+int BVH::spatial_partition(const std::vector<GeomInfo> &refs, const SpatialSplit &spatial,
+	std::vector<GeomInfo> &left, std::vector<GeomInfo> &right) const
+{
+	const AXIS axis = spatial.axis;
+	const float left_area = spatial.left.surface_area();
+	const float right_area = spatial.right.surface_area();
+	const float split_cost = left_area * spatial.nleft + right_area * spatial.nright;
+	int dups = 0;
+	for (const auto &r : refs){
+		if (r.bounds.max[axis] <= spatial.pos){
+			left.push_back(r);
+			continue;
+		}
+		if (r.bounds.min[axis] >= spatial.pos){
+			right.push_back(r);
+			continue;
+		}
+		BBox left_part = r.bounds;
+		left_part.max[axis] = spatial.pos;
+		left_part = geometry[r.geom_idx]->clipped_bound(left_part);
+		BBox right_part = r.bounds;
+		right_part.min[axis] = spatial.pos;
+		right_part = geometry[r.geom_idx]->clipped_bound(right_part);
+		//The reference's bounds may straddle the split while the geometry itself doesn't
+		if (left_part.empty()){
+			right.push_back(r);
+			continue;
+		}
+		if (right_part.empty()){
+			left.push_back(r);
+			continue;
+		}
+		//See if it's cheaper to unsplit the reference and put all of it on one side
+		float left_cost = spatial.left.box_union(r.bounds).surface_area() * spatial.nleft
+			+ right_area * (spatial.nright - 1);
+		float right_cost = left_area * (spatial.nleft - 1)
+			+ spatial.right.box_union(r.bounds).surface_area() * spatial.nright;
+		if (left_cost < split_cost && left_cost <= right_cost){
+			left.push_back(r);
+		}
+		else if (right_cost < split_cost){
+			right.push_back(r);
+		}
+		else {
+			left.emplace_back(r.geom_idx, left_part);
+			right.emplace_back(r.geom_idx, right_part);
+			++dups;
+		}
+	}
+	return dups;
+}
+void BVH::radix_sort(std::vector<MortonGeom> &morton){
+	const int bits_per_pass = 11;
+	const int nbuckets = 1 << bits_per_pass;
+	//The Morton codes only use the low 63 bits
+	const int npasses = (63 + bits_per_pass - 1) / bits_per_pass;
+	const int nchunks = morton.size() > PARALLEL_BIN_SIZE ? build_threads() : 1;
+	const int chunk_size = (morton.size() + nchunks - 1) / nchunks;
+	//Run f(chunk, chunk_start, chunk_end) for each chunk of the codes, the first on the calling thread
+	auto for_chunks = [&morton, nchunks, chunk_size](const auto &f){
+		std::vector<std::future<void>> chunks;
+		for (int c = 1; c < nchunks; ++c){
+			int s = std::min(c * chunk_size, static_cast<int>(morton.size()));
+			int e = std::min(s + chunk_size, static_cast<int>(morton.size()));
+			chunks.push_back(std::async(std::launch::async, [&f, c, s, e](){ f(c, s, e); }));
+		}
+		f(0, 0, std::min(chunk_size, static_cast<int>(morton.size())));
+		for (auto &c : chunks){
+			c.get();
+		}
+	};
+	std::vector<MortonGeom> sorted(morton.size());
+	std::vector<std::array<int, nbuckets>> offsets(nchunks);
+	for (int pass = 0; pass < npasses; ++pass){
+		const int shift = pass * bits_per_pass;
+		//Count the occurances of each digit in each chunk
+		for_chunks([&morton, &offsets, shift](int c, int s, int e){
+			offsets[c].fill(0);
+			for (int i = s; i < e; ++i){
+				++offsets[c][(morton[i].code >> shift) & (nbuckets - 1)];
+			}
+		});
+		//Find where each chunk's codes with each digit start in the output, for the sort to be stable
+		//the chunks write their codes for a digit in order
+		int total = 0;
+		for (int b = 0; b < nbuckets; ++b){
+			for (int c = 0; c < nchunks; ++c){
+				int count = offsets[c][b];
+				offsets[c][b] = total;
+				total += count;
+			}
+		}
+		for_chunks([&morton, &sorted, &offsets, shift](int c, int s, int e){
+			for (int i = s; i < e; ++i){
+				sorted[offsets[c][(morton[i].code >> shift) & (nbuckets - 1)]++] = morton[i];
+			}
+		});
+		morton.swap(sorted);
 	}
-	return std::make_unique<BuildNode>(geom_offset, ngeom, box);
 }
-uint32_t BVH::flatten_tree(const std::unique_ptr<BuildNode> &node, uint32_t &offset){
-	FlatNode &fnode = flat_nodes[offset];
-	fnode.bounds = node->bounds;
-	uint32_t node_offset = offset++;
-	//If the node has geometry we're creating a leaf
-	if (node->ngeom > 0){
-		fnode.geom_offset = node->geom_offset;
-		fnode.ngeom = node->ngeom;
+int BVH::build_leaf(std::vector<FlatNode> &nodes, int start, int end, const BBox &box) const {
+	int node = nodes.size();
+	nodes.emplace_back();
+	nodes[node].bounds = box;
+	nodes[node].geom_offset = start;
+	nodes[node].ngeom = end - start;
+	return node;
+}
+void BVH::refit_flat(int node, int threads){
+	FlatNode &fnode = flat_nodes[node];
+	const bool moving = !end_bounds.empty();
+	if (fnode.ngeom > 0){
+		BBox start, end;
+		for (int i = fnode.geom_offset; i < fnode.geom_offset + fnode.ngeom; ++i){
+			BBox geom_start, geom_end;
+			if (!moving || !geometry[i]->linear_motion_bound(geom_start, geom_end)){
+				geom_start = geometry[i]->bound();
+				geom_end = geom_start;
+			}
+			start = start.box_union(geom_start);
+			end = end.box_union(geom_end);
+		}
+		fnode.bounds = start;
+		if (moving){
+			end_bounds[node] = end;
+		}
+		return;
+	}
+	//Near the top of large trees the second child's subtree is refit on another thread
+	if (threads > 1 && flat_nodes.size() > PARALLEL_SUBTREE_SIZE){
+		auto second = std::async(std::launch::async, [this, &fnode, threads](){
+			refit_flat(fnode.second_child, threads / 2);
+		});
+		refit_flat(node + 1, threads / 2);
+		second.get();
 	}
-	//Otherwise we're making an interior node
 	else {
-		fnode.axis = node->split;
-		fnode.ngeom = 0;
-		flatten_tree(node->children[0], offset);
-		fnode.second_child = flatten_tree(node->children[1], offset);
+		refit_flat(node + 1, 1);
+		refit_flat(fnode.second_child, 1);
+	}
+	fnode.bounds = flat_nodes[node + 1].bounds.box_union(flat_nodes[fnode.second_child].bounds);
+	if (moving){
+		end_bounds[node] = end_bounds[node + 1].box_union(end_bounds[fnode.second_child]);
 	}
-	return node_offset;
+}
+bool BVH::rebuild_degraded(float rebuild_ratio){
+	//Subtrees are compared against how much the whole tree has grown so moving or scaling
+	//everything together doesn't trigger rebuilds
+	const float max_growth = rebuild_ratio * flat_nodes[0].bounds.surface_area() / built_area[0];
+	std::vector<std::array<int, 2>> ranges(flat_nodes.size());
+	std::vector<bool> degraded(flat_nodes.size(), false);
+	if (!mark_degraded(0, max_growth, ranges, degraded)){
+		return false;
+	}
+	std::vector<FlatNode> nodes;
+	std::vector<float> areas;
+	nodes.reserve(flat_nodes.size());
+	areas.reserve(flat_nodes.size());
+	emit_rebuilt(0, ranges, degraded, nodes, areas);
+	flat_nodes.assign(nodes.begin(), nodes.end());
+	built_area.swap(areas);
+	return true;
+}
+bool BVH::mark_degraded(int node, float max_growth, std::vector<std::array<int, 2>> &ranges,
+	std::vector<bool> &degraded) const
+{
+	const FlatNode &fnode = flat_nodes[node];
+	if (fnode.ngeom > 0){
+		ranges[node] = {fnode.geom_offset, fnode.geom_offset + fnode.ngeom};
+		return false;
+	}
+	bool found = mark_degraded(node + 1, max_growth, ranges, degraded);
+	found = mark_degraded(fnode.second_child, max_growth, ranges, degraded) || found;
+	//Subtrees are rebuilt over the range of geometry they refer to, so they can only be
+	//rebuilt if their leaves refer to a contiguous range of it
+	const auto &l = ranges[node + 1];
+	const auto &r = ranges[fnode.second_child];
+	if (l[0] == -1 || r[0] == -1 || (l[1] != r[0] && r[1] != l[0])){
+		ranges[node] = {-1, -1};
+		return found;
+	}
+	ranges[node] = {std::min(l[0], r[0]), std::max(l[1], r[1])};
+	if (built_area[node] > 0 && fnode.bounds.surface_area() / built_area[node] > max_growth){
+		degraded[node] = true;
+		return true;
+	}
+	return found;
+}
+void BVH::emit_rebuilt(int node, const std::vector<std::array<int, 2>> &ranges, const std::vector<bool> &degraded,
+	std::vector<FlatNode> &nodes, std::vector<float> &areas)
+{
+	if (!degraded[node]){
+		const int idx = nodes.size();
+		nodes.push_back(flat_nodes[node]);
+		areas.push_back(built_area[node]);
+		if (flat_nodes[node].ngeom == 0){
+			emit_rebuilt(node + 1, ranges, degraded, nodes, areas);
+			nodes[idx].second_child = nodes.size();
+			emit_rebuilt(flat_nodes[node].second_child, ranges, degraded, nodes, areas);
+		}
+		return;
+	}
+	//Rebuild the subtree with the SAH over its range of the geometry, which is reordered to
+	//match the new leaves
+	const int start = ranges[node][0];
+	const int end = ranges[node][1];
+	std::vector<GeomInfo> refs;
+	refs.reserve(end - start);
+	for (int i = start; i < end; ++i){
+		refs.emplace_back(i, geometry[i]->bound());
+	}
+	std::vector<FlatNode> subtree;
+	build(refs, 0, refs.size(), subtree, BuildThreads::root());
+	std::vector<Geometry*> ordered_geom(refs.size());
+	for (size_t i = 0; i < refs.size(); ++i){
+		ordered_geom[i] = geometry[refs[i].geom_idx];
+	}
+	std::copy(ordered_geom.begin(), ordered_geom.end(), geometry.begin() + start);
+	const int offset = nodes.size();
+	for (auto &n : subtree){
+		if (n.ngeom > 0){
+			n.geom_offset += start;
+		}
+		else {
+			n.second_child += offset;
+		}
+		nodes.push_back(n);
+		areas.push_back(n.bounds.surface_area());
+	}
+}
+void BVH::rebuild(){
+	//SBVH leaves can refer to the same geometry multiple times, only build over each once
+	std::vector<Geometry*> prims = geometry;
+	std::sort(prims.begin(), prims.end());
+	prims.erase(std::unique(prims.begin(), prims.end()), prims.end());
+	const bool packed_leaves = !tri_leaves.empty();
+	const bool packed_prims = !prim_leaves.empty();
+	*this = BVH{prims, split, max_geom, layout, dup_budget, quiet};
+	if (packed_leaves){
+		build_triangle_leaves();
+	}
+	if (packed_prims){
+		build_primitive_leaves();
+	}
+}
+std::vector<std::array<int, 2>> BVH::leaf_ranges() const {
+	std::vector<std::array<int, 2>> ranges;
+	auto wide_leaves = [&ranges](const auto &nodes){
+		for (const auto &n : nodes){
+			for (size_t i = 0; i < n.child.size(); ++i){
+				if (n.ngeom[i] > 0){
+					ranges.push_back({n.child[i], n.child[i] + n.ngeom[i]});
+				}
+			}
+		}
+	};
+	switch (layout){
+		case BVH_LAYOUT::WIDE4:
+			wide_leaves(wide4_nodes);
+			break;
+		case BVH_LAYOUT::WIDE8:
+			wide_leaves(wide8_nodes);
+			break;
+		case BVH_LAYOUT::COMPRESSED4:
+			wide_leaves(compressed4_nodes);
+			break;
+		case BVH_LAYOUT::COMPRESSED8:
+			wide_leaves(compressed8_nodes);
+			break;
+		default:
+			for (const auto &n : flat_nodes){
+				if (n.ngeom > 0){
+					ranges.push_back({n.geom_offset, n.geom_offset + n.ngeom});
+				}
+			}
+			break;
+	}
+	return ranges;
+}
+void BVH::collapse_layout(){
+	if (layout == BVH_LAYOUT::WIDE4){
+		collapse_tree(0, wide4_nodes);
+		flat_nodes = NodeVector<FlatNode>{};
+	}
+	else if (layout == BVH_LAYOUT::WIDE8){
+		collapse_tree(0, wide8_nodes);
+		flat_nodes = NodeVector<FlatNode>{};
+	}
+	//Compressed nodes are quantized from the full precision wide nodes once the tree is collapsed
+	else if (layout == BVH_LAYOUT::COMPRESSED4){
+		NodeVector<WideNode<4>> nodes;
+		collapse_tree(0, nodes);
+		compressed4_nodes.assign(nodes.begin(), nodes.end());
+		flat_nodes = NodeVector<FlatNode>{};
+	}
+	else if (layout == BVH_LAYOUT::COMPRESSED8){
+		NodeVector<WideNode<8>> nodes;
+		collapse_tree(0, nodes);
+		compressed8_nodes.assign(nodes.begin(), nodes.end());
+		flat_nodes = NodeVector<FlatNode>{};
+	}
+	else if (layout == BVH_LAYOUT::TREELET){
+		treelet_order();
+	}
+}
+void BVH::treelet_order(){
+	std::vector<int> order;
+	order.reserve(flat_nodes.size() / 2 + 1);
+	veb_order(-1, pair_height(-1), order);
+	//Find where each pair is placed so the parents can be pointed at their children
+	std::vector<int> pair_slot(flat_nodes.size(), -1);
+	for (size_t i = 0; i < order.size(); ++i){
+		if (order[i] != -1){
+			pair_slot[order[i]] = i;
+		}
+	}
+	NodeVector<FlatNode> nodes(2 * order.size());
+	for (size_t i = 0; i < order.size(); ++i){
+		const std::array<int, 2> siblings = order[i] == -1 ? std::array<int, 2>{0, -1}
+			: std::array<int, 2>{order[i] + 1, flat_nodes[order[i]].second_child};
+		for (int s = 0; s < 2 && siblings[s] != -1; ++s){
+			FlatNode &n = nodes[2 * i + s];
+			n = flat_nodes[siblings[s]];
+			if (n.ngeom == 0){
+				n.second_child = 2 * pair_slot[siblings[s]];
+			}
+		}
+	}
+	flat_nodes.swap(nodes);
+}
+void BVH::veb_order(int pair, int height, std::vector<int> &order) const {
+	if (height <= 1){
+		order.push_back(pair);
+		return;
+	}
+	const int top = height / 2;
+	veb_order(pair, top, order);
+	std::vector<int> bottom{pair};
+	for (int i = 0; i < top; ++i){
+		std::vector<int> next;
+		for (int p : bottom){
+			child_pairs(p, next);
+		}
+		bottom.swap(next);
+	}
+	for (int p : bottom){
+		veb_order(p, height - top, order);
+	}
+}
+void BVH::child_pairs(int pair, std::vector<int> &children) const {
+	if (pair == -1){
+		if (flat_nodes[0].ngeom == 0){
+			children.push_back(0);
+		}
+		return;
+	}
+	if (flat_nodes[pair + 1].ngeom == 0){
+		children.push_back(pair + 1);
+	}
+	if (flat_nodes[flat_nodes[pair].second_child].ngeom == 0){
+		children.push_back(flat_nodes[pair].second_child);
+	}
+}
+int BVH::pair_height(int pair) const {
+	std::vector<int> children;
+	child_pairs(pair, children);
+	int height = 0;
+	for (int c : children){
+		height = std::max(height, pair_height(c));
+	}
+	return height + 1;
+}
+void BVH::flatten_depth_first(int node, std::vector<FlatNode> &nodes) const {
+	const int idx = nodes.size();
+	nodes.push_back(flat_nodes[node]);
+	if (flat_nodes[node].ngeom == 0){
+		const std::array<int, 2> children = flat_children(node);
+		flatten_depth_first(children[0], nodes);
+		nodes[idx].second_child = nodes.size();
+		flatten_depth_first(children[1], nodes);
+	}
+}
+std::array<int, 2> BVH::flat_children(int node) const {
+	const FlatNode &fnode = flat_nodes[node];
+	if (layout == BVH_LAYOUT::TREELET){
+		return {fnode.second_child, fnode.second_child + 1};
+	}
+	return {node + 1, fnode.second_child};
+}
+BBox BVH::geometry_bounds(int offset, int ngeom) const {
+	BBox box;
+	for (int i = offset; i < offset + ngeom; ++i){
+		box = box.box_union(geometry[i]->bound());
+	}
+	return box;
+}
+bool BVH::has_moving_geometry() const {
+	return std::any_of(geometry.begin(), geometry.end(), [](const Geometry *g){
+		BBox start, end;
+		return g->linear_motion_bound(start, end);
+	});
+}
+const BBox& BVH::node_bounds(int node, float time, BBox &box) const {
+	if (end_bounds.empty()){
+		return flat_nodes[node].bounds;
+	}
+	const BBox &start = flat_nodes[node].bounds;
+	const BBox &end = end_bounds[node];
+	for (int i = 0; i < 3; ++i){
+		box.min[i] = lerp(time, start.min[i], end.min[i]);
+		box.max[i] = lerp(time, start.max[i], end.max[i]);
+	}
+	return box;
+}
+int BVH::build_threads(){
+	static const int threads = std::max(1u, std::thread::hardware_concurrency());
+	return threads;
+}
+BVH::BuildThreads BVH::BuildThreads::root(){
+	return BuildThreads{build_threads(), 4 * build_threads()};
+}
+BVH::BuildThreads BVH::BuildThreads::child() const {
+	return BuildThreads{std::max(1, threads / 2), std::max(1, tasks / 2)};
 }
 bool BVH::fast_box_intersect(const BBox &bounds, const Ray &r, const Vector &inv_dir, const std::array<int, 3> &neg_dir) const {
 	//Check X & Y intersection
@@ -292,3 +1830,314 @@ bool BVH::fast_box_intersect(const BBox &bounds, const Ray &r, const Vector &inv
 	return tmin < r.max_t && tmax > r.min_t;
 }
 
+template<int N>
+int BVH::collapse_tree(int flat_node, NodeVector<WideNode<N>> &nodes){
+	int node_idx = nodes.size();
+	nodes.emplace_back();
+	//Gather up the children for the wide node, opening the interior child with the largest
+	//surface area until we've got N children or only leaves are left
+	std::array<int, N> children;
+	int nchildren = 0;
+	if (flat_nodes[flat_node].ngeom > 0){
+		children[nchildren++] = flat_node;
+	}
+	else {
+		children[nchildren++] = flat_node + 1;
+		children[nchildren++] = flat_nodes[flat_node].second_child;
+	}
+	while (nchildren < N){
+		int best = -1;
+		float best_area = -1;
+		for (int i = 0; i < nchildren; ++i){
+			const FlatNode &c = flat_nodes[children[i]];
+			if (c.ngeom == 0 && c.bounds.surface_area() > best_area){
+				best = i;
+				best_area = c.bounds.surface_area();
+			}
+		}
+		if (best == -1){
+			break;
+		}
+		int open = children[best];
+		children[best] = open + 1;
+		children[nchildren++] = flat_nodes[open].second_child;
+	}
+	for (int i = 0; i < nchildren; ++i){
+		const FlatNode &c = flat_nodes[children[i]];
+		if (c.ngeom > 0){
+			nodes[node_idx].set_child(i, c.bounds, c.geom_offset, c.ngeom);
+		}
+		else {
+			int child_idx = collapse_tree(children[i], nodes);
+			nodes[node_idx].set_child(i, c.bounds, child_idx, 0);
+		}
+	}
+	return node_idx;
+}
+template<typename Node>
+BBox BVH::refit_wide(NodeVector<Node> &nodes, int node, int threads){
+	const int N = Node::WIDTH;
+	Node &wnode = nodes[node];
+	std::array<std::future<BBox>, N> subtrees;
+	std::array<BBox, N> child_bounds;
+	for (int i = 0; i < N; ++i){
+		if (wnode.ngeom[i] > 0){
+			child_bounds[i] = geometry_bounds(wnode.child[i], wnode.ngeom[i]);
+		}
+		//Unused slots are the only ones with no geometry referring to the root. Near the top
+		//of large trees the interior children are refit on other threads
+		else if (wnode.child[i] != 0){
+			if (threads > 1 && nodes.size() > PARALLEL_SUBTREE_SIZE){
+				subtrees[i] = std::async(std::launch::async, [this, &nodes, &wnode, i, threads](){
+					return refit_wide(nodes, wnode.child[i], threads / N);
+				});
+			}
+			else {
+				child_bounds[i] = refit_wide(nodes, wnode.child[i], 1);
+			}
+		}
+	}
+	for (int i = 0; i < N; ++i){
+		if (subtrees[i].valid()){
+			child_bounds[i] = subtrees[i].get();
+		}
+	}
+	wnode.set_bounds(child_bounds);
+	return wnode.bounds();
+}
+template<typename Node>
+float BVH::refit_wide_tree(NodeVector<Node> &nodes){
+	if (built_cost == 0){
+		built_cost = wide_cost(nodes);
+	}
+	refit_wide(nodes, 0, build_threads());
+	return wide_cost(nodes) / built_cost;
+}
+template<typename Node>
+float BVH::wide_cost(const NodeVector<Node> &nodes) const {
+	float area = 0;
+	WideBounds<Node::WIDTH> decoded;
+	for (const auto &n : nodes){
+		const WideBounds<Node::WIDTH> &b = n.decode(decoded);
+		for (int i = 0; i < Node::WIDTH; ++i){
+			if (n.ngeom[i] > 0 || n.child[i] != 0){
+				area += b.box(i).surface_area();
+			}
+		}
+	}
+	float root_area = nodes[0].bounds().surface_area();
+	return root_area > 0 ? area / root_area : 0;
+}
+template<typename Node, typename F>
+bool BVH::traverse_wide(const NodeVector<Node> &nodes, const Ray &r, const F &leaf) const {
+	const int N = Node::WIDTH;
+	if (nodes.empty()){
+		return false;
+	}
+	Vector inv_dir{1 / r.d.x, 1 / r.d.y, 1 / r.d.z};
+	std::array<int, 3> neg_dir = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
+	//Stack of children to be visited along with the t value where the ray enters them
+	//so we can skip any that are behind the closest hit found so far
+	struct StackEntry {
+		int child, ngeom;
+		float t;
+	};
+	std::array<StackEntry, 64 * N> todo;
+	int todo_offset = 0;
+	todo[todo_offset++] = StackEntry{0, 0, r.min_t};
+	std::array<float, N> t_near;
+	WideBounds<N> decoded;
+	while (todo_offset > 0){
+		const StackEntry entry = todo[--todo_offset];
+		if (entry.t > r.max_t){
+			continue;
+		}
+		//If it's a leaf check the geometry
+		if (entry.ngeom > 0){
+			if (leaf(entry.child, entry.ngeom)){
+				return true;
+			}
+			continue;
+		}
+		//Test all the node's children at once and push the ones we hit so that the nearest
+		//child ends up on the top of the stack
+		const Node &node = nodes[entry.child];
+		int mask = wide_box_intersect<N>(node.decode(decoded), r, inv_dir, neg_dir, t_near);
+		int first = todo_offset;
+		for (int i = 0; i < N; ++i){
+			if (mask & (1 << i)){
+				StackEntry e{node.child[i], node.ngeom[i], t_near[i]};
+				int j = todo_offset++;
+				for (; j > first && todo[j - 1].t < e.t; --j){
+					todo[j] = todo[j - 1];
+				}
+				todo[j] = e;
+			}
+		}
+	}
+	return false;
+}
+template<typename Node>
+uint64_t BVH::intersect_packet_wide(const NodeVector<Node> &nodes, RayPacket &packet, int first,
+	DifferentialGeometry *diff_geom) const
+{
+	const int N = Node::WIDTH;
+	if (nodes.empty() || first >= packet.size){
+		return 0;
+	}
+	//Stack of children to be visited with the first ray in the packet that hits them
+	struct StackEntry {
+		int child, ngeom, first;
+		float t;
+	};
+	std::array<StackEntry, 64 * N> todo;
+	int todo_offset = 0;
+	todo[todo_offset++] = StackEntry{0, 0, first, 0};
+	uint64_t hits = 0;
+	WideBounds<N> decoded;
+	while (todo_offset > 0){
+		const StackEntry entry = todo[--todo_offset];
+		if (entry.ngeom > 0){
+			hits |= intersect_packet_leaf(entry.child, entry.ngeom, packet, entry.first, diff_geom);
+			continue;
+		}
+		//Test each child against the packet and push the ones hit so that the child nearest
+		//to the rays ends up on the top of the stack
+		const Node &node = nodes[entry.child];
+		const WideBounds<N> &bounds = node.decode(decoded);
+		const int stack_start = todo_offset;
+		for (int i = 0; i < N; ++i){
+			//Unused child slots have inverted bounds
+			if (bounds.min_x[i] > bounds.max_x[i]){
+				continue;
+			}
+			const BBox box = bounds.box(i);
+			float t_near;
+			const int active = packet_box_intersect(box, packet, entry.first, t_near);
+			if (active == packet.size){
+				continue;
+			}
+			StackEntry e{node.child[i], node.ngeom[i], active, t_near};
+			int j = todo_offset++;
+			for (; j > stack_start && todo[j - 1].t < e.t; --j){
+				todo[j] = todo[j - 1];
+			}
+			todo[j] = e;
+		}
+	}
+	return hits;
+}
+template<int N>
+int BVH::wide_box_intersect(const WideBounds<N> &node, const Ray &r, const Vector &inv_dir,
+	const std::array<int, 3> &neg_dir, std::array<float, N> &t_near) const
+{
+	int mask = 0;
+	for (int i = 0; i < N; ++i){
+		float tx_near = ((neg_dir[0] ? node.max_x[i] : node.min_x[i]) - r.o.x) * inv_dir.x;
+		float tx_far = ((neg_dir[0] ? node.min_x[i] : node.max_x[i]) - r.o.x) * inv_dir.x;
+		float ty_near = ((neg_dir[1] ? node.max_y[i] : node.min_y[i]) - r.o.y) * inv_dir.y;
+		float ty_far = ((neg_dir[1] ? node.min_y[i] : node.max_y[i]) - r.o.y) * inv_dir.y;
+		float tz_near = ((neg_dir[2] ? node.max_z[i] : node.min_z[i]) - r.o.z) * inv_dir.z;
+		float tz_far = ((neg_dir[2] ? node.min_z[i] : node.max_z[i]) - r.o.z) * inv_dir.z;
+		float tmin = std::max(std::max(tx_near, ty_near), std::max(tz_near, r.min_t));
+		float tmax = std::min(std::min(tx_far, ty_far), std::min(tz_far, r.max_t));
+		t_near[i] = tmin;
+		mask |= (tmin <= tmax) << i;
+	}
+	return mask;
+}
+#if defined(__SSE__) || defined(_M_X64)
+template<>
+int BVH::wide_box_intersect<4>(const WideBounds<4> &node, const Ray &r, const Vector &inv_dir,
+	const std::array<int, 3> &neg_dir, std::array<float, 4> &t_near) const
+{
+	//Pick the near and far planes for each axis based on the ray direction
+	const float *near_x = neg_dir[0] ? node.max_x.data() : node.min_x.data();
+	const float *far_x = neg_dir[0] ? node.min_x.data() : node.max_x.data();
+	const float *near_y = neg_dir[1] ? node.max_y.data() : node.min_y.data();
+	const float *far_y = neg_dir[1] ? node.min_y.data() : node.max_y.data();
+	const float *near_z = neg_dir[2] ? node.max_z.data() : node.min_z.data();
+	const float *far_z = neg_dir[2] ? node.min_z.data() : node.max_z.data();
+	const __m128 o_x = _mm_set1_ps(r.o.x);
+	const __m128 o_y = _mm_set1_ps(r.o.y);
+	const __m128 o_z = _mm_set1_ps(r.o.z);
+	const __m128 inv_x = _mm_set1_ps(inv_dir.x);
+	const __m128 inv_y = _mm_set1_ps(inv_dir.y);
+	const __m128 inv_z = _mm_set1_ps(inv_dir.z);
+	__m128 tmin = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_x), o_x), inv_x),
+		_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_y), o_y), inv_y));
+	tmin = _mm_max_ps(tmin, _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_z), o_z), inv_z),
+		_mm_set1_ps(r.min_t)));
+	__m128 tmax = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_x), o_x), inv_x),
+		_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_y), o_y), inv_y));
+	tmax = _mm_min_ps(tmax, _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_z), o_z), inv_z),
+		_mm_set1_ps(r.max_t)));
+	_mm_storeu_ps(t_near.data(), tmin);
+	return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+}
+#endif
+#if defined(__AVX__)
+template<>
+int BVH::wide_box_intersect<8>(const WideBounds<8> &node, const Ray &r, const Vector &inv_dir,
+	const std::array<int, 3> &neg_dir, std::array<float, 8> &t_near) const
+{
+	//Pick the near and far planes for each axis based on the ray direction
+	const float *near_x = neg_dir[0] ? node.max_x.data() : node.min_x.data();
+	const float *far_x = neg_dir[0] ? node.min_x.data() : node.max_x.data();
+	const float *near_y = neg_dir[1] ? node.max_y.data() : node.min_y.data();
+	const float *far_y = neg_dir[1] ? node.min_y.data() : node.max_y.data();
+	const float *near_z = neg_dir[2] ? node.max_z.data() : node.min_z.data();
+	const float *far_z = neg_dir[2] ? node.min_z.data() : node.max_z.data();
+	const __m256 o_x = _mm256_set1_ps(r.o.x);
+	const __m256 o_y = _mm256_set1_ps(r.o.y);
+	const __m256 o_z = _mm256_set1_ps(r.o.z);
+	const __m256 inv_x = _mm256_set1_ps(inv_dir.x);
+	const __m256 inv_y = _mm256_set1_ps(inv_dir.y);
+	const __m256 inv_z = _mm256_set1_ps(inv_dir.z);
+	__m256 tmin = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_x), o_x), inv_x),
+		_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_y), o_y), inv_y));
+	tmin = _mm256_max_ps(tmin, _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_z), o_z), inv_z),
+		_mm256_set1_ps(r.min_t)));
+	__m256 tmax = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_x), o_x), inv_x),
+		_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_y), o_y), inv_y));
+	tmax = _mm256_min_ps(tmax, _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_z), o_z), inv_z),
+		_mm256_set1_ps(r.max_t)));
+	_mm256_storeu_ps(t_near.data(), tmin);
+	return _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+}
+#endif
+#if defined(__SSE4_1__)
+template<>
+const BVH::WideBounds<4>& BVH::CompressedNode<4>::decode(WideBounds<4> &bounds) const {
+	const std::array<const uint8_t*, 6> quantized = {qmin_x.data(), qmin_y.data(), qmin_z.data(),
+		qmax_x.data(), qmax_y.data(), qmax_z.data()};
+	const std::array<float*, 6> decoded = {bounds.min_x.data(), bounds.min_y.data(), bounds.min_z.data(),
+		bounds.max_x.data(), bounds.max_y.data(), bounds.max_z.data()};
+	for (int i = 0; i < 6; ++i){
+		const int a = i % 3;
+		int32_t q;
+		std::memcpy(&q, quantized[i], sizeof(q));
+		const __m128 offset = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(q)));
+		_mm_storeu_ps(decoded[i], _mm_add_ps(_mm_set1_ps(origin[a]), _mm_mul_ps(offset, _mm_set1_ps(exp2i(exponent[a])))));
+	}
+	return bounds;
+}
+#endif
+#if defined(__AVX2__)
+template<>
+const BVH::WideBounds<8>& BVH::CompressedNode<8>::decode(WideBounds<8> &bounds) const {
+	const std::array<const uint8_t*, 6> quantized = {qmin_x.data(), qmin_y.data(), qmin_z.data(),
+		qmax_x.data(), qmax_y.data(), qmax_z.data()};
+	const std::array<float*, 6> decoded = {bounds.min_x.data(), bounds.min_y.data(), bounds.min_z.data(),
+		bounds.max_x.data(), bounds.max_y.data(), bounds.max_z.data()};
+	for (int i = 0; i < 6; ++i){
+		const int a = i % 3;
+		int64_t q;
+		std::memcpy(&q, quantized[i], sizeof(q));
+		const __m256 offset = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_cvtsi64_si128(q)));
+		_mm256_storeu_ps(decoded[i], _mm256_add_ps(_mm256_set1_ps(origin[a]),
+			_mm256_mul_ps(offset, _mm256_set1_ps(exp2i(exponent[a])))));
+	}
+	return bounds;
+}
+#endif
@@ -0,0 +1,296 @@
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+#include "linalg/ray.h"
+#include "linalg/util.h"
+#include "geometry/differential_geometry.h"
+#include "geometry/geometry.h"
+#include "geometry/sphere.h"
+#include "geometry/disk.h"
+#include "geometry/plane.h"
+#include "geometry/tri_mesh.h"
+#include "accelerators/primitive_leaves.h"
+
+PrimitiveLeaves::PrimitiveLeaves(){}
+PrimitiveLeaves::PrimitiveLeaves(const std::vector<Geometry*> &geom){
+	types.reserve(geom.size());
+	prims.reserve(geom.size());
+	//Pad the arrays with zero transforms and shapes, which are never hit
+	for (auto &row : to_obj){
+		row.resize(geom.size() + 3, 0);
+	}
+	radius.resize(geom.size() + 3, 0);
+	inner_radius.resize(geom.size() + 3, 0);
+	std::vector<const Triangle*> triangles(geom.size(), nullptr);
+	bool has_triangles = false;
+	for (size_t i = 0; i < geom.size(); ++i){
+		prims.push_back(geom[i]);
+		types.push_back(node_type(geom[i]));
+		if (types.back() == PRIM_TYPE::TRIANGLE){
+			triangles[i] = static_cast<const Triangle*>(geom[i]);
+			has_triangles = true;
+		}
+		if (types.back() == PRIM_TYPE::OTHER || types.back() == PRIM_TYPE::TRIANGLE){
+			continue;
+		}
+		const Node *node = static_cast<const Node*>(geom[i]);
+		const Matrix4 &m = node->get_inv_transform().mat;
+		for (int r = 0; r < 3; ++r){
+			for (int c = 0; c < 4; ++c){
+				to_obj[4 * r + c][i] = m[r][c];
+			}
+		}
+		if (types.back() == PRIM_TYPE::SPHERE){
+			radius[i] = static_cast<const Sphere*>(node->get_geometry())->get_radius();
+		}
+		else if (types.back() == PRIM_TYPE::DISK){
+			const Disk *disk = static_cast<const Disk*>(node->get_geometry());
+			radius[i] = disk->get_radius();
+			inner_radius[i] = disk->get_inner_radius();
+		}
+	}
+	if (has_triangles){
+		tri_leaves = TriangleLeaves{triangles};
+	}
+}
+void PrimitiveLeaves::group(std::vector<Geometry*>::iterator begin, std::vector<Geometry*>::iterator end){
+	std::stable_sort(begin, end, [](const Geometry *a, const Geometry *b){
+		return node_type(a) < node_type(b);
+	});
+}
+bool PrimitiveLeaves::empty() const {
+	return prims.empty();
+}
+bool PrimitiveLeaves::intersect(Ray &ray, DifferentialGeometry &diff_geom, int offset, int ngeom) const {
+	std::array<float, 4> t;
+	bool hit = false;
+	//The closest hit found so far on a packed node, hits on other nodes are recorded by the
+	//node as they're found so a packed hit is only recorded once we know it's the closest
+	int packed_hit = -1;
+	const int end = offset + ngeom;
+	for (int i = offset; i < end;){
+		const int run = run_length(i, end);
+		if (types[i] == PRIM_TYPE::OTHER){
+			for (int j = i; j < i + run; ++j){
+				if (prims[j]->intersect_hit(ray, diff_geom)){
+					hit = true;
+					packed_hit = -1;
+				}
+			}
+		}
+		else if (types[i] == PRIM_TYPE::TRIANGLE){
+			if (tri_leaves.intersect(ray, diff_geom, i, run)){
+				diff_geom.node = static_cast<const Triangle*>(diff_geom.geom)->get_mesh()->get_baked_node();
+				hit = true;
+				packed_hit = -1;
+			}
+		}
+		else {
+			for (int j = i; j < i + run; j += 4){
+				int mask = intersect_block(types[i], ray, j, std::min(4, i + run - j), t);
+				for (int k = 0; mask != 0; ++k, mask >>= 1){
+					if ((mask & 1) && t[k] <= ray.max_t){
+						ray.max_t = t[k];
+						packed_hit = j + k;
+					}
+				}
+			}
+		}
+		i += run;
+	}
+	if (packed_hit != -1){
+		const Node *node = static_cast<const Node*>(prims[packed_hit]);
+		diff_geom.node = node;
+		diff_geom.geom = node->get_geometry();
+		return true;
+	}
+	return hit;
+}
+bool PrimitiveLeaves::occluded(const Ray &ray, int offset, int ngeom) const {
+	std::array<float, 4> t;
+	const int end = offset + ngeom;
+	for (int i = offset; i < end;){
+		const int run = run_length(i, end);
+		if (types[i] == PRIM_TYPE::TRIANGLE){
+			if (tri_leaves.occluded(ray, i, run)){
+				return true;
+			}
+			i += run;
+			continue;
+		}
+		for (int j = i; j < i + run; j += types[i] == PRIM_TYPE::OTHER ? 1 : 4){
+			if (types[i] == PRIM_TYPE::OTHER ? prims[j]->occluded(ray)
+				: intersect_block(types[i], ray, j, std::min(4, i + run - j), t) != 0)
+			{
+				return true;
+			}
+		}
+		i += run;
+	}
+	return false;
+}
+uint64_t PrimitiveLeaves::intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom,
+	int offset, int ngeom) const
+{
+	uint64_t hits = 0;
+	for (int i = offset; i < offset + ngeom; ++i){
+		const uint64_t prim_hits = prims[i]->intersect_packet(packet, first, diff_geom);
+		//Baked triangles aren't under a node in the BVH so record the node they're baked for
+		if (prim_hits && types[i] == PRIM_TYPE::TRIANGLE){
+			const Node *node = static_cast<const Triangle*>(prims[i])->get_mesh()->get_baked_node();
+			for (int r = first; r < packet.size; ++r){
+				if (prim_hits & (uint64_t{1} << r)){
+					diff_geom[r].node = node;
+				}
+			}
+		}
+		hits |= prim_hits;
+	}
+	return hits;
+}
+PrimitiveLeaves::PRIM_TYPE PrimitiveLeaves::node_type(const Geometry *geom){
+	if (dynamic_cast<const Triangle*>(geom)){
+		return PRIM_TYPE::TRIANGLE;
+	}
+	//Geometry placed directly in the BVH that isn't a node, eg. instance sets, is tested on its own
+	const Node *node = dynamic_cast<const Node*>(geom);
+	if (!node){
+		return PRIM_TYPE::OTHER;
+	}
+	const Matrix4 &m = node->get_inv_transform().mat;
+	BBox start, end;
+	//Moving nodes and projective transforms can't be applied with the packed affine transform
+	if (!node->get_geometry() || node->linear_motion_bound(start, end) || m[3][0] != 0 || m[3][1] != 0
+		|| m[3][2] != 0 || m[3][3] != 1)
+	{
+		return PRIM_TYPE::OTHER;
+	}
+	if (dynamic_cast<const Sphere*>(node->get_geometry())){
+		return PRIM_TYPE::SPHERE;
+	}
+	if (dynamic_cast<const Disk*>(node->get_geometry())){
+		return PRIM_TYPE::DISK;
+	}
+	if (dynamic_cast<const Plane*>(node->get_geometry())){
+		return PRIM_TYPE::PLANE;
+	}
+	return PRIM_TYPE::OTHER;
+}
+int PrimitiveLeaves::run_length(int i, int end) const {
+	int j = i + 1;
+	while (j < end && types[j] == types[i]){
+		++j;
+	}
+	return j - i;
+}
+int PrimitiveLeaves::intersect_block(PRIM_TYPE type, const Ray &ray, int i, int n, std::array<float, 4> &t) const {
+	//These are the same tests as the Sphere, Disk and Plane intersect run on 4 nodes at once
+#if defined(__SSE__) || defined(_M_X64)
+	//Transform the ray into the object space of each node
+	__m128 o[3], d[3];
+	for (int r = 0; r < 3; ++r){
+		const __m128 m0 = _mm_loadu_ps(&to_obj[4 * r][i]);
+		const __m128 m1 = _mm_loadu_ps(&to_obj[4 * r + 1][i]);
+		const __m128 m2 = _mm_loadu_ps(&to_obj[4 * r + 2][i]);
+		const __m128 m3 = _mm_loadu_ps(&to_obj[4 * r + 3][i]);
+		d[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, _mm_set1_ps(ray.d.x)), _mm_mul_ps(m1, _mm_set1_ps(ray.d.y))),
+			_mm_mul_ps(m2, _mm_set1_ps(ray.d.z)));
+		o[r] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, _mm_set1_ps(ray.o.x)),
+			_mm_mul_ps(m1, _mm_set1_ps(ray.o.y))), _mm_mul_ps(m2, _mm_set1_ps(ray.o.z))), m3);
+	}
+	__m128 dist, hit;
+	if (type == PRIM_TYPE::SPHERE){
+		const __m128 rad = _mm_loadu_ps(&radius[i]);
+		const __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], d[0]), _mm_mul_ps(d[1], d[1])),
+			_mm_mul_ps(d[2], d[2]));
+		const __m128 b = _mm_mul_ps(_mm_set1_ps(2), _mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], o[0]),
+			_mm_mul_ps(d[1], o[1])), _mm_mul_ps(d[2], o[2])));
+		const __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(o[0], o[0]), _mm_mul_ps(o[1], o[1])),
+			_mm_mul_ps(o[2], o[2])), _mm_mul_ps(rad, rad));
+		const __m128 discrim = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_set1_ps(4), _mm_mul_ps(a, c)));
+		hit = _mm_cmpgt_ps(discrim, _mm_setzero_ps());
+		//q = -0.5 * (b + sign(b) * sqrt(discrim)) as in solve_quadratic
+		const __m128 sign_b = _mm_and_ps(b, _mm_set1_ps(-0.f));
+		const __m128 root = _mm_or_ps(_mm_sqrt_ps(_mm_max_ps(discrim, _mm_setzero_ps())), sign_b);
+		const __m128 q = _mm_mul_ps(_mm_set1_ps(-0.5f), _mm_add_ps(b, root));
+		const __m128 t0 = _mm_div_ps(q, a);
+		const __m128 t1 = _mm_div_ps(c, q);
+		const __m128 t_min = _mm_min_ps(t0, t1);
+		const __m128 t_max = _mm_max_ps(t0, t1);
+		//Take the far hit if the near one is before the ray's range
+		const __m128 near_ok = _mm_cmpge_ps(t_min, _mm_set1_ps(ray.min_t));
+		dist = _mm_or_ps(_mm_and_ps(near_ok, t_min), _mm_andnot_ps(near_ok, t_max));
+	}
+	else {
+		//Disks and planes lie in the z = 0 plane, find where the ray hits it and check if that's on the shape
+		const __m128 abs_dz = _mm_andnot_ps(_mm_set1_ps(-0.f), d[2]);
+		hit = _mm_cmpge_ps(abs_dz, _mm_set1_ps(type == PRIM_TYPE::DISK ? 1e-7f : 1e-8f));
+		dist = _mm_div_ps(_mm_sub_ps(_mm_setzero_ps(), o[2]), d[2]);
+		const __m128 x = _mm_add_ps(o[0], _mm_mul_ps(dist, d[0]));
+		const __m128 y = _mm_add_ps(o[1], _mm_mul_ps(dist, d[1]));
+		if (type == PRIM_TYPE::DISK){
+			const __m128 rad = _mm_loadu_ps(&radius[i]);
+			const __m128 inner = _mm_loadu_ps(&inner_radius[i]);
+			const __m128 dist_sqr = _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(dist_sqr, _mm_mul_ps(rad, rad)));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(dist_sqr, _mm_mul_ps(inner, inner)));
+		}
+		else {
+			const __m128 one = _mm_set1_ps(1);
+			hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_andnot_ps(_mm_set1_ps(-0.f), x), one));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_andnot_ps(_mm_set1_ps(-0.f), y), one));
+		}
+	}
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(dist, _mm_set1_ps(ray.min_t)));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(dist, _mm_set1_ps(ray.max_t)));
+	_mm_storeu_ps(t.data(), dist);
+	//Mask off the nodes past the end of the leaf
+	return _mm_movemask_ps(hit) & ((1 << n) - 1);
+#else
+	int mask = 0;
+	for (int j = 0; j < n; ++j){
+		Point o;
+		Vector d;
+		for (int r = 0; r < 3; ++r){
+			d[r] = to_obj[4 * r][i + j] * ray.d.x + to_obj[4 * r + 1][i + j] * ray.d.y
+				+ to_obj[4 * r + 2][i + j] * ray.d.z;
+			o[r] = to_obj[4 * r][i + j] * ray.o.x + to_obj[4 * r + 1][i + j] * ray.o.y
+				+ to_obj[4 * r + 2][i + j] * ray.o.z + to_obj[4 * r + 3][i + j];
+		}
+		if (type == PRIM_TYPE::SPHERE){
+			const Vector v{o};
+			float t0, t1;
+			if (!solve_quadratic(d.length_sqr(), 2 * d.dot(v), v.length_sqr() - radius[i + j] * radius[i + j], t0, t1)){
+				continue;
+			}
+			t[j] = t0 >= ray.min_t ? t0 : t1;
+		}
+		else {
+			if (std::abs(d.z) < (type == PRIM_TYPE::DISK ? 1e-7f : 1e-8f)){
+				continue;
+			}
+			t[j] = -o.z / d.z;
+			const float x = o.x + t[j] * d.x;
+			const float y = o.y + t[j] * d.y;
+			if (type == PRIM_TYPE::DISK){
+				const float dist_sqr = x * x + y * y;
+				if (dist_sqr > radius[i + j] * radius[i + j] || dist_sqr < inner_radius[i + j] * inner_radius[i + j]){
+					continue;
+				}
+			}
+			else if (std::abs(x) > 1 || std::abs(y) > 1){
+				continue;
+			}
+		}
+		if (t[j] >= ray.min_t && t[j] <= ray.max_t){
+			mask |= 1 << j;
+		}
+	}
+	return mask;
+#endif
+}
+
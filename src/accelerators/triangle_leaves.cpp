@@ -0,0 +1,150 @@
+#include <array>
+#include <vector>
+#include <algorithm>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+#include "linalg/ray.h"
+#include "geometry/differential_geometry.h"
+#include "geometry/tri_mesh.h"
+#include "accelerators/triangle_leaves.h"
+
+TriangleLeaves::TriangleLeaves(){}
+TriangleLeaves::TriangleLeaves(const std::vector<Geometry*> &geom){
+	std::vector<const Triangle*> triangles;
+	triangles.reserve(geom.size());
+	for (const Geometry *g : geom){
+		triangles.push_back(static_cast<const Triangle*>(g));
+	}
+	*this = TriangleLeaves{triangles};
+}
+TriangleLeaves::TriangleLeaves(const std::vector<const Triangle*> &triangles) : tris(triangles){
+	//Pad the arrays with degenerate triangles, which are never hit
+	for (int a = 0; a < 3; ++a){
+		v0[a].resize(tris.size() + 3, 0);
+		e0[a].resize(tris.size() + 3, 0);
+		e1[a].resize(tris.size() + 3, 0);
+	}
+	for (size_t i = 0; i < tris.size(); ++i){
+		if (!tris[i]){
+			continue;
+		}
+		const std::array<Point, 3> verts = tris[i]->vertices();
+		const Vector edge0 = verts[1] - verts[0];
+		const Vector edge1 = verts[2] - verts[0];
+		for (int a = 0; a < 3; ++a){
+			v0[a][i] = verts[0][a];
+			e0[a][i] = edge0[a];
+			e1[a][i] = edge1[a];
+		}
+	}
+}
+bool TriangleLeaves::empty() const {
+	return tris.empty();
+}
+bool TriangleLeaves::intersect(Ray &ray, DifferentialGeometry &diff_geom, int offset, int ngeom) const {
+	std::array<float, 4> t, bary0, bary1;
+	int hit = -1;
+	float hit_bary0 = 0, hit_bary1 = 0;
+	for (int i = offset; i < offset + ngeom; i += 4){
+		int mask = intersect_block(ray, i, std::min(4, offset + ngeom - i), t, bary0, bary1);
+		//Take the closest hit in the block, the ray's range is shortened as we go so only
+		//hits closer than ones in earlier blocks are reported
+		for (int j = 0; mask != 0; ++j, mask >>= 1){
+			if ((mask & 1) && t[j] <= ray.max_t){
+				ray.max_t = t[j];
+				hit = i + j;
+				hit_bary0 = bary0[j];
+				hit_bary1 = bary1[j];
+			}
+		}
+	}
+	if (hit != -1){
+		diff_geom.geom = tris[hit];
+		diff_geom.u = hit_bary0;
+		diff_geom.v = hit_bary1;
+		return true;
+	}
+	return false;
+}
+bool TriangleLeaves::occluded(const Ray &ray, int offset, int ngeom) const {
+	std::array<float, 4> t, bary0, bary1;
+	for (int i = offset; i < offset + ngeom; i += 4){
+		if (intersect_block(ray, i, std::min(4, offset + ngeom - i), t, bary0, bary1)){
+			return true;
+		}
+	}
+	return false;
+}
+int TriangleLeaves::intersect_block(const Ray &ray, int i, int n, std::array<float, 4> &t, std::array<float, 4> &bary0,
+	std::array<float, 4> &bary1) const
+{
+	//This is the same test as Triangle::intersect run on 4 triangles at once
+#if defined(__SSE__) || defined(_M_X64)
+	const __m128 d_x = _mm_set1_ps(ray.d.x);
+	const __m128 d_y = _mm_set1_ps(ray.d.y);
+	const __m128 d_z = _mm_set1_ps(ray.d.z);
+	const __m128 e0_x = _mm_loadu_ps(&e0[0][i]);
+	const __m128 e0_y = _mm_loadu_ps(&e0[1][i]);
+	const __m128 e0_z = _mm_loadu_ps(&e0[2][i]);
+	const __m128 e1_x = _mm_loadu_ps(&e1[0][i]);
+	const __m128 e1_y = _mm_loadu_ps(&e1[1][i]);
+	const __m128 e1_z = _mm_loadu_ps(&e1[2][i]);
+	//s0 = d x e1
+	const __m128 s0_x = _mm_sub_ps(_mm_mul_ps(d_y, e1_z), _mm_mul_ps(d_z, e1_y));
+	const __m128 s0_y = _mm_sub_ps(_mm_mul_ps(d_z, e1_x), _mm_mul_ps(d_x, e1_z));
+	const __m128 s0_z = _mm_sub_ps(_mm_mul_ps(d_x, e1_y), _mm_mul_ps(d_y, e1_x));
+	//Degenerate triangles give an infinite div and NaN barycentrics so they're never hit
+	const __m128 div = _mm_div_ps(_mm_set1_ps(1), _mm_add_ps(_mm_add_ps(_mm_mul_ps(s0_x, e0_x),
+		_mm_mul_ps(s0_y, e0_y)), _mm_mul_ps(s0_z, e0_z)));
+	const __m128 o_x = _mm_sub_ps(_mm_set1_ps(ray.o.x), _mm_loadu_ps(&v0[0][i]));
+	const __m128 o_y = _mm_sub_ps(_mm_set1_ps(ray.o.y), _mm_loadu_ps(&v0[1][i]));
+	const __m128 o_z = _mm_sub_ps(_mm_set1_ps(ray.o.z), _mm_loadu_ps(&v0[2][i]));
+	const __m128 b0 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(o_x, s0_x), _mm_mul_ps(o_y, s0_y)),
+		_mm_mul_ps(o_z, s0_z)), div);
+	//s1 = o x e0
+	const __m128 s1_x = _mm_sub_ps(_mm_mul_ps(o_y, e0_z), _mm_mul_ps(o_z, e0_y));
+	const __m128 s1_y = _mm_sub_ps(_mm_mul_ps(o_z, e0_x), _mm_mul_ps(o_x, e0_z));
+	const __m128 s1_z = _mm_sub_ps(_mm_mul_ps(o_x, e0_y), _mm_mul_ps(o_y, e0_x));
+	const __m128 b1 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d_x, s1_x), _mm_mul_ps(d_y, s1_y)),
+		_mm_mul_ps(d_z, s1_z)), div);
+	const __m128 dist = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e1_x, s1_x), _mm_mul_ps(e1_y, s1_y)),
+		_mm_mul_ps(e1_z, s1_z)), div);
+	const __m128 bary_min = _mm_set1_ps(-1e-8f);
+	const __m128 one = _mm_set1_ps(1);
+	__m128 hit = _mm_and_ps(_mm_cmpge_ps(b0, bary_min), _mm_cmple_ps(b0, one));
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(b1, bary_min));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(b0, b1), one));
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(dist, _mm_set1_ps(ray.min_t)));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(dist, _mm_set1_ps(ray.max_t)));
+	_mm_storeu_ps(t.data(), dist);
+	_mm_storeu_ps(bary0.data(), b0);
+	_mm_storeu_ps(bary1.data(), b1);
+	//Mask off the triangles past the end of the leaf
+	return _mm_movemask_ps(hit) & ((1 << n) - 1);
+#else
+	int mask = 0;
+	for (int j = 0; j < n; ++j){
+		const Vector edge0{e0[0][i + j], e0[1][i + j], e0[2][i + j]};
+		const Vector edge1{e1[0][i + j], e1[1][i + j], e1[2][i + j]};
+		const Vector s0 = ray.d.cross(edge1);
+		float div = s0.dot(edge0);
+		if (div == 0){
+			continue;
+		}
+		div = 1.f / div;
+		const Vector d = ray.o - Point{v0[0][i + j], v0[1][i + j], v0[2][i + j]};
+		const Vector s1 = d.cross(edge0);
+		bary0[j] = d.dot(s0) * div;
+		bary1[j] = ray.d.dot(s1) * div;
+		t[j] = edge1.dot(s1) * div;
+		if (bary0[j] >= -1e-8 && bary0[j] <= 1 && bary1[j] >= -1e-8 && bary0[j] + bary1[j] <= 1
+			&& t[j] >= ray.min_t && t[j] <= ray.max_t)
+		{
+			mask |= 1 << j;
+		}
+	}
+	return mask;
+#endif
+}
+
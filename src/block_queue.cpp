@@ -3,64 +3,358 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
 #include "samplers/sampler.h"
+#include "linalg/util.h"
 #include "block_queue.h"
 
-//Fabian Giesen's Morton code generation
-//See: http://fgiesen.wordpress.com/2009/12/13/decoding-morton-codes/
-static uint32_t part1_by1(uint32_t x){
-	// x = ---- ---- ---- ---- fedc ba98 7654 3210
-	x &= 0x0000ffff;
-	// x = ---- ---- fedc ba98 ---- ---- 7654 3210
-	x = (x ^ (x << 8)) & 0x00ff00ff;
-	// x = ---- fedc ---- ba98 ---- 7654 ---- 3210
-	x = (x ^ (x << 4)) & 0x0f0f0f0f;
-	// x = --fe --dc --ba --98 --76 --54 --32 --10
-	x = (x ^ (x << 2)) & 0x33333333;
-	// x = -f-e -d-c -b-a -9-8 -7-6 -5-4 -3-2 -1-0
-	x = (x ^ (x << 1)) & 0x55555555;
-	return x;
-}
-static uint32_t morton2(uint32_t x, uint32_t y){
-	return (part1_by1(y) << 1) + part1_by1(x);
+//Number of blocks per worker to aim for when picking the block size, enough that
+//the work can be balanced without the blocks getting too small to be efficient
+const static int BLOCKS_PER_WORKER = 16;
+const static int MIN_AUTO_BLOCK = 16;
+const static int MAX_AUTO_BLOCK = 64;
+//Smallest block size to split stolen blocks down to
+const static int MIN_SPLIT_BLOCK = 8;
+//Size of the cells tile ranges are made of, blocks are made no bigger so each is in one cell
+const static int TILE_CELL = 64;
+/*
+ * Compute the seed of the block starting at x, y in some pass. Blocks cover the same
+ * pixels each pass so every pass, block position and resumed block must get its own
+ * seed, otherwise the pixels are sampled again with the same sequence
+ */
+static int block_seed(int pass, int x, int y){
+	uint64_t h = (static_cast<uint64_t>(pass) << 40) ^ (static_cast<uint64_t>(x) << 20) ^ static_cast<uint64_t>(y);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return static_cast<int>(h & 0x7fffffff);
 }
+//How long idle workers wait before checking for blocks split off by the others
+const static std::chrono::milliseconds IDLE_WAIT{1};
 
-BlockQueue::BlockQueue(const Sampler &sampler, int bwidth, int bheight)
-	: samplers(sampler.get_subsamplers(bwidth, bheight)), sampler_idx(0), total_time(0)
+BlockQueue::BlockQueue(const Sampler &sampler, RenderTarget &target, int nworkers, int bwidth, int bheight)
+	: sampler(sampler), target(target), auto_block(bwidth <= 0 || bheight <= 0), tile_index(0), tile_count(1),
+	min_block(MIN_SPLIT_BLOCK), pass(0), idle(0), finished(false),
+	copying_film(false), progressive(false), target_error(0), time_budget(0), resumed_time(0), pixels_started(0), total_pixels(0),
+	next_report(0), total_time(0)
 {
+	nworkers = std::max(nworkers, 1);
+	if (bwidth <= 0 || bheight <= 0){
+		const float pixels = static_cast<float>(sampler.width()) * sampler.height();
+		const int size = static_cast<int>(std::sqrt(pixels / (BLOCKS_PER_WORKER * nworkers)));
+		bwidth = clamp(size, MIN_AUTO_BLOCK, MAX_AUTO_BLOCK);
+		bheight = bwidth;
+	}
+	block_width = std::min(bwidth, sampler.width());
+	block_height = std::min(bheight, sampler.height());
+	std::cout << "Partitioning the image into " << block_width << "x" << block_height << " blocks" << std::endl;
+	for (int i = 0; i < nworkers; ++i){
+		workers.emplace_back(std::make_unique<WorkerBlocks>());
+	}
+	auto blocks = make_blocks(pass);
+	distribute(blocks);
+	start_time = std::chrono::high_resolution_clock::now();
+}
+void BlockQueue::set_progressive(float budget, float error){
+	progressive = true;
+	time_budget = std::chrono::milliseconds{static_cast<long long>(budget * 1000)};
+	target_error = error;
+}
+void BlockQueue::set_tile_range(int index, int count){
+	tile_index = index;
+	tile_count = std::max(count, 1);
+	if (auto_block){
+		const float pixels = static_cast<float>(sampler.width()) * sampler.height() / tile_count;
+		const int size = static_cast<int>(std::sqrt(pixels / (BLOCKS_PER_WORKER * workers.size())));
+		block_width = clamp(size, MIN_AUTO_BLOCK, MAX_AUTO_BLOCK);
+		block_height = block_width;
+	}
+	block_width = std::min({block_width, TILE_CELL, sampler.width()});
+	block_height = std::min({block_height, TILE_CELL, sampler.height()});
+	for (auto &w : workers){
+		std::lock_guard<std::mutex> lock{w->mutex};
+		w->blocks.clear();
+	}
+	auto blocks = make_blocks(pass);
+	std::cout << "Rendering tile range " << tile_index + 1 << " of " << tile_count << " in " << blocks.size()
+		<< " " << block_width << "x" << block_height << " blocks" << std::endl;
+	distribute(blocks);
+}
+void BlockQueue::start(){
+	start_time = std::chrono::high_resolution_clock::now();
+}
+Sampler* BlockQueue::get_block(int worker){
+	WorkerBlocks &own = *workers[worker];
+	//The previous block was freed by finish_block, under the state lock so a checkpoint
+	//never sees it change
+	while (true){
+		if (finished.load(std::memory_order_acquire)){
+			return nullptr;
+		}
+		if (out_of_time()){
+			if (!finished.exchange(true, std::memory_order_acq_rel)){
+				std::cout << "Render time budget reached, stopping" << std::endl;
+			}
+			cancel();
+			return nullptr;
+		}
+		{
+			//The block must be in a deque or be our current one whenever a checkpoint is taken
+			std::shared_lock<std::shared_timed_mutex> state_lock{state_mutex};
+			std::unique_ptr<Sampler> block;
+			{
+				std::lock_guard<std::mutex> lock{own.mutex};
+				if (!own.blocks.empty()){
+					block = std::move(own.blocks.front());
+					own.blocks.pop_front();
+				}
+			}
+			if (!block){
+				block = steal(worker);
+			}
+			if (block){
+				report_progress(*block);
+				own.current = std::move(block);
+				return own.current.get();
+			}
+		}
+		//We're out of blocks for this pass, wait for the other workers to finish theirs. The last
+		//one to finish starts the next pass, while the others check back now and then in case
+		//a block was split off that they can steal
+		std::unique_lock<std::mutex> lock{pass_mutex};
+		if (finished.load(std::memory_order_acquire)){
+			return nullptr;
+		}
+		const int p = pass;
+		if (++idle == static_cast<int>(workers.size())){
+			idle = 0;
+			if (!next_pass()){
+				finished.store(true, std::memory_order_release);
+			}
+			++pass;
+			pass_cv.notify_all();
+		}
+		else if (!pass_cv.wait_for(lock, IDLE_WAIT, [&](){
+				return pass != p || finished.load(std::memory_order_acquire);
+			}))
+		{
+			--idle;
+		}
+	}
+}
+void BlockQueue::finish_block(int worker, const FilmTile &tile){
+	std::shared_lock<std::shared_timed_mutex> state_lock{state_mutex};
+	//A checkpoint can only start copying the film once we've released the state lock,
+	//so the film is either copied after the tile is merged or the tile is deferred
+	bool deferred = false;
+	{
+		std::lock_guard<std::mutex> lock{deferred_mutex};
+		if (copying_film){
+			deferred_tiles.push_back(tile);
+			deferred = true;
+		}
+	}
+	if (!deferred){
+		target.merge_tile(tile);
+	}
+	workers[worker]->current.reset();
+}
+void BlockQueue::checkpoint(Checkpoint &cp){
+	//Holding the pass lock keeps the next pass from starting before the deferred tiles are
+	//added, since it looks at the pixels' error
+	std::lock_guard<std::mutex> pass_lock{pass_mutex};
+	{
+		std::unique_lock<std::shared_timed_mutex> state_lock{state_mutex};
+		cp.width = target.get_width();
+		cp.height = target.get_height();
+		cp.pass = pass;
+		cp.elapsed_ms = elapsed().count();
+		cp.pending.clear();
+		for (auto &w : workers){
+			std::lock_guard<std::mutex> lock{w->mutex};
+			if (w->current){
+				cp.pending.push_back(BlockRect{w->current->x_start, w->current->x_end,
+					w->current->y_start, w->current->y_end});
+			}
+			for (const auto &b : w->blocks){
+				cp.pending.push_back(BlockRect{b->x_start, b->x_end, b->y_start, b->y_end});
+			}
+		}
+		std::lock_guard<std::mutex> lock{deferred_mutex};
+		copying_film = true;
+	}
+	//Blocks finished from here on are in the pending blocks, so they're kept out of the film until it's copied
+	target.snapshot(cp.film, cp.stats);
+	std::vector<FilmTile> tiles;
+	{
+		std::lock_guard<std::mutex> lock{deferred_mutex};
+		copying_film = false;
+		tiles.swap(deferred_tiles);
+	}
+	for (const auto &t : tiles){
+		target.merge_tile(t);
+	}
+}
+void BlockQueue::resume(const Checkpoint &cp){
+	std::unique_lock<std::shared_timed_mutex> state_lock{state_mutex};
+	std::lock_guard<std::mutex> pass_lock{pass_mutex};
+	for (auto &w : workers){
+		std::lock_guard<std::mutex> lock{w->mutex};
+		w->blocks.clear();
+		w->current = nullptr;
+	}
+	pass = cp.pass;
+	resumed_time = std::chrono::milliseconds{cp.elapsed_ms};
+	//The unfinished blocks are taken again from the start, seeded by their pass and where
+	//they are so resuming the same checkpoint takes the same samples
+	std::vector<std::unique_ptr<Sampler>> blocks;
+	for (const auto &b : cp.pending){
+		blocks.push_back(sampler.get_subsampler(b.x_start, b.x_end, b.y_start, b.y_end,
+			block_seed(pass, b.x_start, b.y_start)));
+	}
+	std::cout << "Resuming pass " << pass + 1 << " with " << blocks.size() << " unfinished blocks after "
+		<< cp.elapsed_ms << "ms of rendering" << std::endl;
+	distribute(blocks);
+}
+void BlockQueue::cancel(){
+	std::lock_guard<std::mutex> lock{pass_mutex};
+	finished.store(true, std::memory_order_release);
+	pass_cv.notify_all();
+}
+bool BlockQueue::next_pass(){
+	if (!progressive || out_of_time()){
+		return false;
+	}
+	auto blocks = make_blocks(pass + 1);
+	//Only the blocks that still have noisy pixels are sampled again
+	if (target_error > 0){
+		blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+			[&](const std::unique_ptr<Sampler> &b){
+				return target.max_relative_error(b->x_start, b->x_end, b->y_start, b->y_end) <= target_error;
+			}), blocks.end());
+		if (blocks.empty()){
+			std::cout << "All pixels reached the target error after " << pass + 1 << " passes" << std::endl;
+			return false;
+		}
+	}
+	std::cout << "Starting pass " << pass + 2 << " over " << blocks.size() << " blocks" << std::endl;
+	distribute(blocks);
+	return true;
+}
+std::vector<std::unique_ptr<Sampler>> BlockQueue::make_blocks(int block_pass) const {
+	std::vector<std::unique_ptr<Sampler>> blocks;
+	if (tile_count == 1){
+		blocks = sampler.get_subsamplers(block_width, block_height);
+		for (auto &b : blocks){
+			b->reseed(block_seed(block_pass, b->x_start, b->y_start));
+		}
+		return blocks;
+	}
+	//The cells are the same in every process so their Morton order can be split into ranges,
+	//keeping each range's cells near each other
+	auto cells = sampler.get_subsamplers(std::min(TILE_CELL, sampler.width()), std::min(TILE_CELL, sampler.height()));
+	std::sort(cells.begin(), cells.end(),
+		[](const std::unique_ptr<Sampler> &a, const std::unique_ptr<Sampler> &b){
+			return morton2(a->x_start, a->y_start) < morton2(b->x_start, b->y_start);
+		});
+	const size_t begin = tile_index * cells.size() / tile_count;
+	const size_t end = (tile_index + 1) * cells.size() / tile_count;
+	for (size_t i = begin; i < end; ++i){
+		auto cell_blocks = cells[i]->get_subsamplers(block_width, block_height);
+		for (auto &b : cell_blocks){
+			b->reseed(block_seed(block_pass, b->x_start, b->y_start));
+			blocks.push_back(std::move(b));
+		}
+	}
+	return blocks;
+}
+void BlockQueue::distribute(std::vector<std::unique_ptr<Sampler>> &blocks){
 	//Sort the samplers in Morton order
-	std::sort(samplers.begin(), samplers.end(),
+	std::sort(blocks.begin(), blocks.end(),
 		[](const std::unique_ptr<Sampler> &a, const std::unique_ptr<Sampler> &b){
 			return morton2(a->x_start, a->y_start) < morton2(b->x_start, b->y_start);
 		});
+	total_pixels = 0;
+	for (const auto &b : blocks){
+		total_pixels += static_cast<uint64_t>(b->width()) * b->height();
+	}
+	pixels_started.store(0, std::memory_order_release);
+	next_report.store(0, std::memory_order_release);
+	total_time = std::chrono::milliseconds{0};
+	const size_t nworkers = workers.size();
+	for (size_t i = 0; i < nworkers; ++i){
+		std::lock_guard<std::mutex> lock{workers[i]->mutex};
+		const size_t begin = i * blocks.size() / nworkers;
+		const size_t end = (i + 1) * blocks.size() / nworkers;
+		for (size_t s = begin; s < end; ++s){
+			workers[i]->blocks.push_back(std::move(blocks[s]));
+		}
+	}
 }
-Sampler* BlockQueue::get_block(){
-	//I doubt I'll ever run this on an image big enough to make overflowing back to the 1st sampler
-	//a concern here, especially since threads exit after getting a null sampler
-	unsigned int s = sampler_idx.fetch_add(1, std::memory_order_acq_rel);
-	if (s >= samplers.size()){
-		return nullptr;
-	}
-	//Only one thread will get the sampler with this number unless we're running
-	//really fast, so should be ok here
-	if (s % (samplers.size() / 10) == 0){
-		std::cout << "Starting work on block " << s << " of " << samplers.size()
-			<< " : ~" << 100.f * static_cast<float>(s) / samplers.size() << "% of pixels completed"
-			<< std::endl;
-		if (s == 0){
-			prev = std::chrono::high_resolution_clock::now();
+std::unique_ptr<Sampler> BlockQueue::steal(int worker){
+	for (size_t i = 1; i < workers.size(); ++i){
+		WorkerBlocks &victim = *workers[(worker + i) % workers.size()];
+		std::unique_ptr<Sampler> block;
+		{
+			std::lock_guard<std::mutex> lock{victim.mutex};
+			if (victim.blocks.empty()){
+				continue;
+			}
+			block = std::move(victim.blocks.back());
+			victim.blocks.pop_back();
 		}
-		else {
-			auto now = std::chrono::high_resolution_clock::now();
-			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - prev);
-			auto avg_block = (total_time.count() + elapsed.count()) / s;
-			std::cout << "Average block time: " << avg_block << "ms"
-				<< "\nRender time so far: " << total_time.count() << "ms"
-				<< "\nEstimated remaining time: " << avg_block * (samplers.size() - s) << "ms\n";
-			total_time += elapsed;
-			prev = now;
+		//The blocks left are running out so split the block in half along its longer side, keeping
+		//one half and putting the other in our deque where the other workers can steal it
+		if (block->width() >= 2 * min_block || block->height() >= 2 * min_block){
+			auto halves = block->width() >= block->height()
+				? block->get_subsamplers(block->width() / 2, block->height())
+				: block->get_subsamplers(block->width(), block->height() / 2);
+			block = std::move(halves.front());
+			WorkerBlocks &own = *workers[worker];
+			std::lock_guard<std::mutex> lock{own.mutex};
+			for (size_t h = 1; h < halves.size(); ++h){
+				own.blocks.push_back(std::move(halves[h]));
+			}
 		}
+		return block;
+	}
+	return nullptr;
+}
+std::chrono::milliseconds BlockQueue::elapsed() const {
+	return resumed_time + std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::high_resolution_clock::now() - start_time);
+}
+bool BlockQueue::out_of_time() const {
+	return progressive && time_budget.count() > 0 && elapsed() >= time_budget;
+}
+void BlockQueue::report_progress(const Sampler &block){
+	const uint64_t started = pixels_started.fetch_add(static_cast<uint64_t>(block.width()) * block.height(),
+		std::memory_order_acq_rel);
+	unsigned int tenth = static_cast<unsigned int>(10 * started / total_pixels);
+	unsigned int report = next_report.load(std::memory_order_acquire);
+	//Only the worker that moves the report past this tenth prints it
+	if (tenth < report || !next_report.compare_exchange_strong(report, tenth + 1, std::memory_order_acq_rel)){
+		return;
+	}
+	const float done = static_cast<float>(started) / total_pixels;
+	std::cout << "Starting work on block at " << block.x_start << ", " << block.y_start
+		<< " : ~" << 100.f * done << "% of pixels completed" << std::endl;
+	if (started == 0){
+		prev = std::chrono::high_resolution_clock::now();
+	}
+	else {
+		auto now = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - prev);
+		total_time += elapsed;
+		prev = now;
+		const auto remaining = static_cast<long long>(total_time.count() * (1 - done) / done);
+		std::cout << "Render time so far: " << total_time.count() << "ms"
+			<< "\nEstimated remaining time: " << remaining << "ms\n";
 	}
-	return samplers[s].get();
 }
 
@@ -0,0 +1,88 @@
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "scene.h"
+#include "checkpoint.h"
+#include "binary_file.h"
+
+const static uint32_t CHECKPOINT_MAGIC = 0x504b4354;
+const static uint32_t CHECKPOINT_VERSION = 1;
+
+Checkpoint::Checkpoint() : width(0), height(0), pass(0), elapsed_ms(0){}
+bool Checkpoint::write(const std::string &file, const Renderer &renderer) const {
+	const std::string tmp_file = file + ".tmp";
+	std::FILE *f = std::fopen(tmp_file.c_str(), "wb");
+	if (!f){
+		std::cerr << "Checkpoint error: failed to open " << tmp_file << " for writing\n";
+		return false;
+	}
+	const uint32_t header[] = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, width, height, pass,
+		static_cast<uint32_t>(pending.size())};
+	std::fwrite(header, sizeof(uint32_t), 6, f);
+	std::fwrite(&elapsed_ms, sizeof(uint64_t), 1, f);
+	std::fwrite(film.data(), sizeof(float), film.size(), f);
+	std::fwrite(stats.data(), sizeof(PixelStats), stats.size(), f);
+	std::fwrite(pending.data(), sizeof(BlockRect), pending.size(), f);
+	bool ok = renderer.save_state(f) && std::ferror(f) == 0;
+	ok = std::fclose(f) == 0 && ok;
+	//Renaming over an existing file fails on Windows, so fall back to removing it first
+	if (ok && std::rename(tmp_file.c_str(), file.c_str()) != 0){
+		std::remove(file.c_str());
+		ok = std::rename(tmp_file.c_str(), file.c_str()) == 0;
+	}
+	if (!ok){
+		std::cerr << "Checkpoint error: failed to write " << file << "\n";
+		std::remove(tmp_file.c_str());
+		return false;
+	}
+	return true;
+}
+bool Checkpoint::read(const std::string &file, Renderer &renderer, const Scene &scene){
+	std::FILE *f = std::fopen(file.c_str(), "rb");
+	if (!f){
+		std::cerr << "Checkpoint error: failed to open " << file << "\n";
+		return false;
+	}
+	uint32_t header[6];
+	if (std::fread(header, sizeof(uint32_t), 6, f) != 6 || header[0] != CHECKPOINT_MAGIC
+		|| header[1] != CHECKPOINT_VERSION || std::fread(&elapsed_ms, sizeof(uint64_t), 1, f) != 1)
+	{
+		std::cerr << "Checkpoint error: " << file << " is not a checkpoint or is from an older version\n";
+		std::fclose(f);
+		return false;
+	}
+	width = header[2];
+	height = header[3];
+	pass = header[4];
+	//Check the sizes in the header against what's actually in the file before allocating
+	//anything for them in case the file is damaged
+	const uint64_t npixels = static_cast<uint64_t>(width) * height;
+	const uint64_t data_bytes = npixels * (4 * sizeof(float) + sizeof(PixelStats))
+		+ static_cast<uint64_t>(header[5]) * sizeof(BlockRect);
+	if (npixels == 0 || data_bytes > bytes_left(f)){
+		std::cerr << "Checkpoint error: " << file << " is truncated or damaged\n";
+		std::fclose(f);
+		return false;
+	}
+	film.resize(4 * npixels);
+	stats.resize(npixels);
+	pending.resize(header[5]);
+	bool ok = std::fread(film.data(), sizeof(float), film.size(), f) == film.size()
+		&& std::fread(stats.data(), sizeof(PixelStats), stats.size(), f) == stats.size()
+		&& std::fread(pending.data(), sizeof(BlockRect), pending.size(), f) == pending.size();
+	//The unfinished blocks are sampled again when resuming so they must lie within the image
+	for (size_t i = 0; ok && i < pending.size(); ++i){
+		const BlockRect &b = pending[i];
+		ok = b.x_start >= 0 && b.x_start < b.x_end && b.x_end <= static_cast<int64_t>(width)
+			&& b.y_start >= 0 && b.y_start < b.y_end && b.y_end <= static_cast<int64_t>(height);
+	}
+	ok = ok && renderer.load_state(f, scene);
+	std::fclose(f);
+	if (!ok){
+		std::cerr << "Checkpoint error: " << file << " is truncated or damaged\n";
+	}
+	return ok;
+}
+
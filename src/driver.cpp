@@ -1,7 +1,14 @@
+#include <iostream>
+#include <string>
 #include <vector>
 #include <algorithm>
 #include <thread>
 #include <atomic>
+#include <array>
+#include <limits>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "scene.h"
 #include "samplers/sampler.h"
 #include "film/render_target.h"
@@ -10,15 +17,22 @@
 #include "integrator/path_integrator.h"
 #include "integrator/bidir_path_integrator.h"
 #include "geometry/geometry.h"
+#include "geometry/mesh_proxy.h"
 #include "linalg/ray.h"
+#include "linalg/ray_packet.h"
 #include "linalg/transform.h"
 #include "memory_pool.h"
+#include "checkpoint.h"
 #include "driver.h"
 
-Worker::Worker(Scene &scene, BlockQueue &queue)
-	: scene(scene), queue(queue), status(STATUS::NOT_STARTED)
+//Max number of samples traced and shaded together in a batch, the later bounces of the batch's paths
+//are traced together as well so larger batches give more coherent secondary rays
+const static int RAY_BATCH_SIZE = 1024;
+
+Worker::Worker(Scene &scene, BlockQueue &queue, int id)
+	: scene(scene), queue(queue), id(id), status(STATUS::NOT_STARTED)
 {}
-Worker::Worker(Worker &&w) : scene(w.scene), queue(w.queue),
+Worker::Worker(Worker &&w) : scene(w.scene), queue(w.queue), id(w.id),
 	thread(std::move(w.thread)), status(w.status.load(std::memory_order_acquire))
 {}
 void Worker::render(){
@@ -28,69 +42,143 @@ void Worker::render(){
 	Camera &camera = scene.get_camera();
 	const Renderer &renderer = scene.get_renderer();
 	MemoryPool pool;
-	std::vector<Sample> samples;
+	std::vector<Sample> samples, pixel_samples;
 	std::vector<RayDifferential> rays;
 	std::vector<Colorf> colors;
-	//Counter so we can check if we've been canceled, check after every 32 pixels rendered
-	int check_cancel = 0;
+	//Primary rays are traced through the scene in packets and then shaded together as a batch
+	RayPacket packet;
+	std::vector<DifferentialGeometry> hits;
+	std::vector<DifferentialGeometry*> hit_geom;
 	while (true){
-		Sampler *sampler = queue.get_block();
+		Sampler *sampler = queue.get_block(id);
 		if (!sampler){
 			break;
 		}
-		samples.resize(sampler->get_max_spp());
-		rays.reserve(sampler->get_max_spp());
-		colors.reserve(sampler->get_max_spp());
+		samples.reserve(std::max(sampler->get_max_spp(), RAY_BATCH_SIZE));
+		rays.reserve(std::max(sampler->get_max_spp(), RAY_BATCH_SIZE));
+		colors.reserve(std::max(sampler->get_max_spp(), RAY_BATCH_SIZE));
+		//The block's samples are filtered into our own tile and added to the image once it's done
+		FilmTile tile = target.get_tile(sampler->x_start, sampler->x_end, sampler->y_start, sampler->y_end);
 		while (sampler->has_samples()){
-			sampler->get_samples(samples);
+			//Samplers that don't need to see the results of each pixel can have samples for multiple
+			//pixels traced together, giving us full packets of rays and larger batches of paths
+			samples.clear();
+			do {
+				sampler->get_samples(pixel_samples);
+				samples.insert(samples.end(), pixel_samples.begin(), pixel_samples.end());
+			} while (!sampler->uses_feedback() && sampler->has_samples()
+				&& samples.size() + sampler->get_max_spp() <= RAY_BATCH_SIZE);
+
+			const size_t first_ray = rays.size();
 			for (const auto &s : samples){
 				rays.push_back(camera.generate_raydifferential(s));
 				rays.back().scale_differentials(1.f / std::sqrt(sampler->get_max_spp()));
-				colors.push_back(renderer.illumination(rays.back(), scene, *sampler, pool));
-				//If we didn't hit anything and the scene has a background use that
-				if (scene.get_background() && rays.back().max_t == std::numeric_limits<float>::infinity()){
-					DifferentialGeometry dg;
-					dg.u = s.img[0] / target.get_width();
-					dg.v = s.img[1] / target.get_height();
-					colors.back() = scene.get_background()->sample(dg);
+			}
+			hits.resize(samples.size());
+			hit_geom.resize(samples.size());
+			for (size_t p = first_ray; p < rays.size(); p += RayPacket::MAX_RAYS){
+				packet.size = std::min(rays.size() - p, static_cast<size_t>(RayPacket::MAX_RAYS));
+				for (int i = 0; i < packet.size; ++i){
+					packet.set_ray(i, rays[p + i]);
 				}
-				colors.back().normalize();
-
-				++check_cancel;
-				if (check_cancel >= 32){
-					check_cancel = 0;
-					int canceled = STATUS::CANCELED;
-					if (status.compare_exchange_strong(canceled, STATUS::DONE, std::memory_order_acq_rel)){
-						return;
+				packet.compute_bounds();
+				DifferentialGeometry *packet_hits = hits.data() + p - first_ray;
+				const uint64_t hit = root.intersect_packet(packet, 0, packet_hits);
+				for (int i = 0; i < packet.size; ++i){
+					if (hit & (uint64_t{1} << i)){
+						rays[p + i].max_t = packet.max_t[i];
+						root.compute_shading_geometry(rays[p + i], packet_hits[i]);
+						hit_geom[p + i - first_ray] = &packet_hits[i];
+					}
+					else {
+						hit_geom[p + i - first_ray] = nullptr;
 					}
 				}
-				pool.free_blocks();
+			}
+			colors.resize(rays.size());
+			renderer.illumination(rays.data() + first_ray, hit_geom.data(), samples.size(), scene, *sampler, pool,
+				colors.data() + first_ray);
+			for (size_t i = 0; i < samples.size(); ++i){
+				Colorf &color = colors[first_ray + i];
+				//If we didn't hit anything and the scene has a background use that
+				if (scene.get_background() && !hit_geom[i]){
+					DifferentialGeometry dg;
+					dg.u = samples[i].img[0] / target.get_width();
+					dg.v = samples[i].img[1] / target.get_height();
+					color = scene.get_background()->sample(dg);
+				}
+				color.normalize();
+			}
+			pool.free_blocks();
+			//The batch's hits are shaded so the meshes they hit can be evicted
+			MeshProxy::release_pinned();
+			int canceled = STATUS::CANCELED;
+			if (status.compare_exchange_strong(canceled, STATUS::DONE, std::memory_order_acq_rel)){
+				return;
 			}
 			if (sampler->report_results(samples, rays, colors)){
 				for (size_t i = 0; i < samples.size(); ++i){
-					target.write_pixel(samples[i].img[0], samples[i].img[1], colors[i]);
+					tile.write_pixel(samples[i].img[0], samples[i].img[1], colors[i]);
 				}
 				rays.clear();
 				colors.clear();
 			}
 		}
+		queue.finish_block(id, tile);
 	}
 	status.store(STATUS::DONE, std::memory_order_release);
 }
 
 Driver::Driver(Scene &scene, int nworkers, int bwidth, int bheight)
-	: scene(scene), queue(scene.get_sampler(), bwidth, bheight)
+	: scene(scene), queue(scene.get_sampler(), scene.get_render_target(), nworkers, bwidth, bheight),
+	checkpoint_interval(0), stop_checkpoints(false), resumed(false)
 {
-	for (int i = 0; i < nworkers; ++i){
-		workers.emplace_back(Worker{scene, queue});
+	for (int i = 0; i < std::max(nworkers, 1); ++i){
+		workers.emplace_back(Worker{scene, queue, i});
 	}
 }
 Driver::~Driver(){
 	//Tell all the threads to cancel
 	cancel();
 }
+void Driver::set_progressive(float time_budget, float target_error){
+	queue.set_progressive(time_budget, target_error);
+}
+void Driver::set_tile_range(int index, int count){
+	queue.set_tile_range(index, count);
+}
+void Driver::set_checkpoint(const std::string &file, float interval){
+	checkpoint_file = file;
+	checkpoint_interval = std::chrono::milliseconds{static_cast<long long>(interval * 1000)};
+}
+bool Driver::resume(const std::string &file){
+	Checkpoint cp;
+	if (!cp.read(file, scene.get_renderer(), scene)){
+		return false;
+	}
+	RenderTarget &target = scene.get_render_target();
+	if (cp.width != target.get_width() || cp.height != target.get_height()
+		|| !target.restore(cp.film, cp.stats))
+	{
+		std::cerr << "Checkpoint error: " << file << " is for a " << cp.width << "x" << cp.height
+			<< " image but the scene is " << target.get_width() << "x" << target.get_height() << "\n";
+		return false;
+	}
+	queue.resume(cp);
+	resumed = true;
+	return true;
+}
 void Driver::render(){
-	scene.get_renderer().preprocess(scene);
+	//Resuming restored the renderer's preprocessed state along with the image
+	if (!resumed){
+		scene.get_renderer().preprocess(scene);
+	}
+	MeshProxy::release_pinned();
+	queue.start();
+	if (!checkpoint_file.empty() && checkpoint_interval.count() > 0){
+		stop_checkpoints = false;
+		checkpoint_thread = std::thread(&Driver::checkpoint_loop, this);
+	}
 	//Run through and launch each thread
 	for (auto &w : workers){
 		w.thread = std::thread(&Worker::render, std::ref(w));
@@ -110,10 +198,14 @@ bool Driver::done(){
 			all_done = false;
 		}
 	}
+	if (all_done){
+		stop_checkpointing();
+	}
 	return all_done;
 }
 void Driver::cancel(){
-	//Inform all the threads they should quit
+	//Inform all the threads they should quit, waking any waiting for the next pass
+	queue.cancel();
 	for (auto &w : workers){
 		int status = STATUS::WORKING;
 		if (w.status.compare_exchange_strong(status, STATUS::CANCELED, std::memory_order_acq_rel)){
@@ -125,8 +217,37 @@ void Driver::cancel(){
 			w.status.store(STATUS::JOINED, std::memory_order_release);
 		}
 	}
+	stop_checkpointing();
 }
 const Scene& Driver::get_scene() const {
 	return scene;
 }
+void Driver::checkpoint_loop(){
+	std::unique_lock<std::mutex> lock{checkpoint_mutex};
+	while (!checkpoint_cv.wait_for(lock, checkpoint_interval, [&](){ return stop_checkpoints; })){
+		lock.unlock();
+		write_checkpoint();
+		lock.lock();
+	}
+}
+void Driver::stop_checkpointing(){
+	if (!checkpoint_thread.joinable()){
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock{checkpoint_mutex};
+		stop_checkpoints = true;
+	}
+	checkpoint_cv.notify_all();
+	checkpoint_thread.join();
+	write_checkpoint();
+}
+void Driver::write_checkpoint(){
+	Checkpoint cp;
+	queue.checkpoint(cp);
+	if (cp.write(checkpoint_file, scene.get_renderer())){
+		std::cout << "Wrote checkpoint to " << checkpoint_file << " with " << cp.pending.size()
+			<< " unfinished blocks" << std::endl;
+	}
+}
 
@@ -44,7 +44,7 @@ Ray Camera::generate_ray(const Sample &sample) const {
 	raster_cam(px_pos, px_pos);
 	//Shoot ray from origin (camera pos) through the point
 	Ray ray{Point{0}, Vector{px_pos}.normalized()};
-	ray.time = (sample.time - open) / (close - open);
+	ray.time = shutter_time(sample);
 	if (dof > 0){
 		auto lens = concentric_sample_disk(sample.lens);
 		lens[0] *= dof;
@@ -64,7 +64,7 @@ RayDifferential Camera::generate_raydifferential(const Sample &sample) const {
 	raster_cam(px_pos, px_pos);
 	//Shoot ray from origin (camera pos) through the point
 	RayDifferential ray{Point{0}, Vector{px_pos}.normalized()};
-	ray.time = (sample.time - open) / (close - open);
+	ray.time = shutter_time(sample);
 	ray.rx = Ray{ray.o, (Vector{px_pos} + dx).normalized()};
 	ray.ry = Ray{ray.o, (Vector{px_pos} + dy).normalized()};
 	if (dof > 0){
@@ -90,4 +90,9 @@ RayDifferential Camera::generate_raydifferential(const Sample &sample) const {
 	cam_world(ray, ray);
 	return ray;
 }
-
+float Camera::shutter_time(const Sample &sample) const {
+	//Sample times are how far through the shutter interval the ray is cast, which is
+	//what moving nodes interpolate their transforms over. A camera without a shutter
+	//interval sees the scene as it is when the shutter opens
+	return close > open ? sample.time : 0;
+}
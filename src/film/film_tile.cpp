@@ -0,0 +1,53 @@
+#include <array>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "film/render_target.h"
+#include "film/film_tile.h"
+
+FilmTile::FilmTile(int x_start, int x_end, int y_start, int y_end, const Filter &filter, const float *filter_table)
+	: x_start(x_start), x_end(x_end), y_start(y_start), y_end(y_end), filter(&filter), filter_table(filter_table),
+	pixels(std::max(x_end - x_start, 0) * std::max(y_end - y_start, 0), TilePixel{0, 0, 0, 0, 0, 0, 0})
+{}
+void FilmTile::write_pixel(float x, float y, const Colorf &c){
+	const int tile_width = x_end - x_start;
+	//Track the spread of the samples taken in each pixel to estimate its error
+	const int px = static_cast<int>(x), py = static_cast<int>(y);
+	if (px >= x_start && px < x_end && py >= y_start && py < y_end){
+		TilePixel &p = pixels[(py - y_start) * tile_width + px - x_start];
+		const float lum = c.luminance();
+		p.count += 1;
+		p.lum += lum;
+		p.lum_sqr += lum * lum;
+	}
+	//Compute the discrete pixel coordinates which the sample hits
+	float img_x = x - 0.5f;
+	float img_y = y - 0.5f;
+	std::array<int, 2> x_range = {static_cast<int>(std::ceil(img_x - filter->w)),
+		static_cast<int>(std::floor(img_x + filter->w))};
+	std::array<int, 2> y_range = {static_cast<int>(std::ceil(img_y - filter->h)),
+		static_cast<int>(std::floor(img_y + filter->h))};
+	//Keep pixel coordinates in the tile and ignore degenerate ranges
+	x_range[0] = std::max(x_range[0], x_start);
+	x_range[1] = std::min(x_range[1], x_end - 1);
+	y_range[0] = std::max(y_range[0], y_start);
+	y_range[1] = std::min(y_range[1], y_end - 1);
+	if (x_range[1] - x_range[0] < 0 || y_range[1] - y_range[0] < 0){
+		return;
+	}
+	for (int iy = y_range[0]; iy <= y_range[1]; ++iy){
+		float fy = std::abs(iy - img_y) * filter->inv_h * FILTER_TABLE_SIZE;
+		int fy_idx = std::min(static_cast<int>(fy), FILTER_TABLE_SIZE - 1);
+		for (int ix = x_range[0]; ix <= x_range[1]; ++ix){
+			float fx = std::abs(ix - img_x) * filter->inv_w * FILTER_TABLE_SIZE;
+			int fx_idx = std::min(static_cast<int>(fx), FILTER_TABLE_SIZE - 1);
+			float fweight = filter_table[fy_idx * FILTER_TABLE_SIZE + fx_idx];
+			TilePixel &p = pixels[(iy - y_start) * tile_width + ix - x_start];
+			p.r += fweight * c.r;
+			p.g += fweight * c.g;
+			p.b += fweight * c.b;
+			p.weight += fweight;
+		}
+	}
+}
+
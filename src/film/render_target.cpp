@@ -6,9 +6,14 @@
 #include <limits>
 #include <memory>
 #include <cstdio>
+#include <cmath>
+#include <algorithm>
 #include "linalg/util.h"
 #include "film/render_target.h"
 
+const static uint32_t FILM_MAGIC = 0x4d4c4946;
+const static uint32_t FILM_VERSION = 1;
+
 /*
  * Perform an atomic addition to the float via spin-locking
  * on compare_exchange_weak. Memory ordering is release on write
@@ -57,7 +62,8 @@ Pixel::Pixel(const Pixel &p) : r(p.r.load(std::memory_order_consume)), g(p.g.loa
 {}
 
 RenderTarget::RenderTarget(size_t width, size_t height, std::unique_ptr<Filter> f)
-	: width(width), height(height), filter(std::move(f)), pixels(width * height)
+	: width(width), height(height), filter(std::move(f)), pixels(width * height),
+	stats(width * height, PixelStats{0, 0, 0})
 {
 	//Pre-compute the filter table values
 	for (int y = 0; y < FILTER_TABLE_SIZE; ++y){
@@ -102,6 +108,80 @@ void RenderTarget::write_pixel(float x, float y, const Colorf &c){
 		}
 	}
 }
+FilmTile RenderTarget::get_tile(int x_start, int x_end, int y_start, int y_end) const {
+	//Pad the block by the pixels its samples can reach at its edges
+	const int pad_x = static_cast<int>(std::ceil(filter->w));
+	const int pad_y = static_cast<int>(std::ceil(filter->h));
+	return FilmTile{std::max(x_start - pad_x, 0), std::min(x_end + pad_x, static_cast<int>(width)),
+		std::max(y_start - pad_y, 0), std::min(y_end + pad_y, static_cast<int>(height)),
+		*filter, filter_table.data()};
+}
+void RenderTarget::merge_tile(const FilmTile &tile){
+	const int tile_width = tile.x_end - tile.x_start;
+	for (int y = tile.y_start; y < tile.y_end; ++y){
+		for (int x = tile.x_start; x < tile.x_end; ++x){
+			const FilmTile::TilePixel &t = tile.pixels[(y - tile.y_start) * tile_width + x - tile.x_start];
+			if (t.weight == 0 && t.r == 0 && t.g == 0 && t.b == 0 && t.count == 0){
+				continue;
+			}
+			Pixel &p = pixels[y * width + x];
+			atomic_addf(p.r, t.r);
+			atomic_addf(p.g, t.g);
+			atomic_addf(p.b, t.b);
+			atomic_addf(p.weight, t.weight);
+			//Only the block owning the pixel has samples in it, the other tiles overlapping it in
+			//their padding must not touch its stats while the owner may be merging them
+			if (t.count > 0){
+				PixelStats &s = stats[y * width + x];
+				s.count += t.count;
+				s.sum += t.lum;
+				s.sum_sqr += t.lum_sqr;
+			}
+		}
+	}
+}
+float RenderTarget::relative_error(int x, int y) const {
+	const PixelStats &s = stats[y * width + x];
+	if (s.count < 2){
+		return std::numeric_limits<float>::infinity();
+	}
+	const float mean = s.sum / s.count;
+	const float variance = std::max(s.sum_sqr / s.count - mean * mean, 0.f) * s.count / (s.count - 1);
+	//Offset the mean a bit so black pixels don't need an exactly zero error
+	return std::sqrt(variance / s.count) / (mean + 1e-3f);
+}
+float RenderTarget::max_relative_error(int x_start, int x_end, int y_start, int y_end) const {
+	float err = 0;
+	for (int y = y_start; y < y_end; ++y){
+		for (int x = x_start; x < x_end; ++x){
+			err = std::max(err, relative_error(x, y));
+		}
+	}
+	return err;
+}
+void RenderTarget::snapshot(std::vector<float> &film, std::vector<PixelStats> &pixel_stats) const {
+	film.resize(4 * pixels.size());
+	for (size_t i = 0; i < pixels.size(); ++i){
+		film[4 * i] = pixels[i].r.load(std::memory_order_consume);
+		film[4 * i + 1] = pixels[i].g.load(std::memory_order_consume);
+		film[4 * i + 2] = pixels[i].b.load(std::memory_order_consume);
+		film[4 * i + 3] = pixels[i].weight.load(std::memory_order_consume);
+	}
+	pixel_stats = stats;
+}
+bool RenderTarget::restore(const std::vector<float> &film, const std::vector<PixelStats> &pixel_stats){
+	if (film.size() != 4 * pixels.size() || pixel_stats.size() != stats.size()){
+		return false;
+	}
+	for (size_t i = 0; i < pixels.size(); ++i){
+		pixels[i].r.store(film[4 * i], std::memory_order_release);
+		pixels[i].g.store(film[4 * i + 1], std::memory_order_release);
+		pixels[i].b.store(film[4 * i + 2], std::memory_order_release);
+		pixels[i].weight.store(film[4 * i + 3], std::memory_order_release);
+	}
+	stats = pixel_stats;
+	return true;
+}
 bool RenderTarget::save_image(const std::string &file) const {
 	//Compute the correct image from the saved pixel data and write
 	//it to the desired file
@@ -128,9 +208,62 @@ bool RenderTarget::save_image(const std::string &file) const {
 		}
 		return save_bmp(file, &img[0].r);
 	}
+	if (file_ext == "film"){
+		return save_film(file);
+	}
 	std::cout << "Unsupported output image format: " << file_ext << std::endl;
 	return false;
 }
+bool RenderTarget::add_film(const std::string &file){
+	FILE *fp = fopen(file.c_str(), "rb");
+	if (!fp){
+		std::cerr << "RenderTarget::add_film Error: failed to open file " << file << std::endl;
+		return false;
+	}
+	uint32_t header[4];
+	if (fread(header, sizeof(uint32_t), 4, fp) != 4 || header[0] != FILM_MAGIC || header[1] != FILM_VERSION
+		|| header[2] != width || header[3] != height)
+	{
+		std::cerr << "RenderTarget::add_film Error: " << file << " is not a " << width << "x" << height
+			<< " film" << std::endl;
+		fclose(fp);
+		return false;
+	}
+	std::vector<float> film(4 * pixels.size());
+	std::vector<PixelStats> film_stats(stats.size());
+	const bool ok = fread(film.data(), sizeof(float), film.size(), fp) == film.size()
+		&& fread(film_stats.data(), sizeof(PixelStats), film_stats.size(), fp) == film_stats.size();
+	fclose(fp);
+	if (!ok){
+		std::cerr << "RenderTarget::add_film Error: " << file << " is truncated" << std::endl;
+		return false;
+	}
+	for (size_t i = 0; i < pixels.size(); ++i){
+		atomic_addf(pixels[i].r, film[4 * i]);
+		atomic_addf(pixels[i].g, film[4 * i + 1]);
+		atomic_addf(pixels[i].b, film[4 * i + 2]);
+		atomic_addf(pixels[i].weight, film[4 * i + 3]);
+		stats[i].count += film_stats[i].count;
+		stats[i].sum += film_stats[i].sum;
+		stats[i].sum_sqr += film_stats[i].sum_sqr;
+	}
+	return true;
+}
+bool RenderTarget::read_film_size(const std::string &file, size_t &width, size_t &height){
+	FILE *fp = fopen(file.c_str(), "rb");
+	if (!fp){
+		return false;
+	}
+	uint32_t header[4];
+	const bool ok = fread(header, sizeof(uint32_t), 4, fp) == 4 && header[0] == FILM_MAGIC
+		&& header[1] == FILM_VERSION;
+	fclose(fp);
+	if (ok){
+		width = header[2];
+		height = header[3];
+	}
+	return ok;
+}
 size_t RenderTarget::get_width() const {
 	return width;
 }
@@ -202,4 +335,20 @@ bool RenderTarget::save_bmp(const std::string &file, const uint8_t *data) const
 	fclose(fp);
 	return true;
 }
-
+bool RenderTarget::save_film(const std::string &file) const {
+	FILE *fp = fopen(file.c_str(), "wb");
+	if (!fp){
+		std::cerr << "RenderTarget::save_film Error: failed to open file "
+			<< file << std::endl;
+		return false;
+	}
+	const uint32_t header[] = {FILM_MAGIC, FILM_VERSION, static_cast<uint32_t>(width),
+		static_cast<uint32_t>(height)};
+	std::vector<float> film;
+	std::vector<PixelStats> film_stats;
+	snapshot(film, film_stats);
+	const bool ok = fwrite(header, sizeof(uint32_t), 4, fp) == 4
+		&& fwrite(film.data(), sizeof(float), film.size(), fp) == film.size()
+		&& fwrite(film_stats.data(), sizeof(PixelStats), film_stats.size(), fp) == film_stats.size();
+	return fclose(fp) == 0 && ok;
+}
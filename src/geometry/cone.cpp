@@ -5,7 +5,7 @@
 #include "geometry/cone.h"
 
 Cone::Cone(float radius, float height) : radius(radius), height(height){}
-bool Cone::intersect(Ray &ray, DifferentialGeometry &dg) const {
+bool Cone::intersect_hit(Ray &ray, DifferentialGeometry &dg) const {
 	//Compute the cone quadratic coefficients
 	float k = radius / height;
 	k *= k;
@@ -32,10 +32,6 @@ bool Cone::intersect(Ray &ray, DifferentialGeometry &dg) const {
 		}
 	}
 	Point point = ray(t_hit);
-	float phi = std::atan2(point.y, point.x);
-	if (phi < 0){
-		phi += TAU;
-	}
 	//The test is against an infinitely long cone, so check that the hit is in range
 	if (point.z < 0 || point.z > height){
 		if (t_hit == t[1]){
@@ -46,17 +42,21 @@ bool Cone::intersect(Ray &ray, DifferentialGeometry &dg) const {
 			return false;
 		}
 		point = ray(t_hit);
-		phi = std::atan2(point.y, point.x);
-		if (phi < 0){
-			phi += TAU;
-		}
 		if (point.z < 0 || point.z > height){
 			return false;
 		}
 	}
-	dg.point = point;
 	ray.max_t = t_hit;
-
+	dg.geom = this;
+	return true;
+}
+void Cone::compute_shading_geometry(const Ray &ray, DifferentialGeometry &dg) const {
+	const Point point = ray(ray.max_t);
+	float phi = std::atan2(point.y, point.x);
+	if (phi < 0){
+		phi += TAU;
+	}
+	dg.point = point;
 	dg.u = phi / TAU;
 	dg.v = dg.point.z / height;
 	dg.dp_du = Vector{-TAU * point.y, TAU * point.x, 0};
@@ -79,14 +79,33 @@ bool Cone::intersect(Ray &ray, DifferentialGeometry &dg) const {
 		+ (e * F - f * E) * divisor * dg.dp_dv};
 	dg.dn_dv = Normal{(g * F - f * G) * divisor * dg.dp_du
 		+ (f * F - g * E) * divisor * dg.dp_dv};
-	dg.geom = this;
 	if (ray.d.dot(dg.normal) < 0){
 		dg.hit_side = HITSIDE::FRONT;
 	}
 	else {
 		dg.hit_side = HITSIDE::BACK;
 	}
-	return true;
+}
+bool Cone::occluded(const Ray &ray) const {
+	float k = radius / height;
+	k *= k;
+	float a = ray.d.x * ray.d.x + ray.d.y * ray.d.y - k * ray.d.z * ray.d.z;
+	float b = 2 * (ray.d.x * ray.o.x + ray.d.y * ray.o.y - k * ray.d.z * (ray.o.z - height));
+	float c = ray.o.x * ray.o.x + ray.o.y * ray.o.y - k * (ray.o.z - height) * (ray.o.z - height);
+	float t[2];
+	if (!solve_quadratic(a, b, c, t[0], t[1])){
+		return false;
+	}
+	//Check if either hit on the infinite cone is in the ray's range and on the finite cone
+	for (float t_hit : t){
+		if (t_hit >= ray.min_t && t_hit <= ray.max_t){
+			float z = ray(t_hit).z;
+			if (z >= 0 && z <= height){
+				return true;
+			}
+		}
+	}
+	return false;
 }
 BBox Cone::bound() const {
 	return BBox{Point{-radius, -radius, 0}, Point{radius, radius, height}};
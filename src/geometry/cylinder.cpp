@@ -6,7 +6,7 @@
 #include "geometry/cylinder.h"
 
 Cylinder::Cylinder(float radius, float height) : radius(radius), height(height){}
-bool Cylinder::intersect(Ray &ray, DifferentialGeometry &dg) const {
+bool Cylinder::intersect_hit(Ray &ray, DifferentialGeometry &dg) const {
 	//Notes: in PBRT speak my zmin = 0, zmax = height, phimax = 2pi
 	float a = ray.d.x * ray.d.x + ray.d.y * ray.d.y;
     float b = 2 * (ray.d.x * ray.o.x + ray.d.y * ray.o.y);
@@ -31,10 +31,6 @@ bool Cylinder::intersect(Ray &ray, DifferentialGeometry &dg) const {
 		}
 	}
 	Point point = ray(t_hit);
-	float phi = std::atan2(point.y, point.x);
-	if (phi < 0){
-		phi += TAU;
-	}
 	//The hit test is against an infinitely long cylinder so now check that it's actually in
 	//the [0, height] range
 	if (point.z < 0 || point.z > height){
@@ -46,17 +42,21 @@ bool Cylinder::intersect(Ray &ray, DifferentialGeometry &dg) const {
 			return false;
 		}
 		point = ray(t_hit);
-		phi = std::atan2(point.y, point.x);
-		if (phi < 0){
-			phi += TAU;
-		}
 		if (point.z < 0 || point.z > height){
 			return false;
 		}
 	}
-	dg.point = point;
 	ray.max_t = t_hit;
-
+	dg.geom = this;
+	return true;
+}
+void Cylinder::compute_shading_geometry(const Ray &ray, DifferentialGeometry &dg) const {
+	const Point point = ray(ray.max_t);
+	float phi = std::atan2(point.y, point.x);
+	if (phi < 0){
+		phi += TAU;
+	}
+	dg.point = point;
 	dg.u = phi / TAU;
 	dg.v = dg.point.z / height;
 	dg.dp_du = Vector{-TAU * dg.point.y, TAU * dg.point.x, 0};
@@ -78,14 +78,31 @@ bool Cylinder::intersect(Ray &ray, DifferentialGeometry &dg) const {
 		+ (e * F - f * E) * divisor * dg.dp_dv};
 	dg.dn_dv = Normal{(g * F - f * G) * divisor * dg.dp_du
 		+ (f * F - g * E) * divisor * dg.dp_dv};
-	dg.geom = this;
 	if (ray.d.dot(dg.normal) < 0){
 		dg.hit_side = HITSIDE::FRONT;
 	}
 	else {
 		dg.hit_side = HITSIDE::BACK;
 	}
-	return true;
+}
+bool Cylinder::occluded(const Ray &ray) const {
+	float a = ray.d.x * ray.d.x + ray.d.y * ray.d.y;
+	float b = 2 * (ray.d.x * ray.o.x + ray.d.y * ray.o.y);
+	float c = ray.o.x * ray.o.x + ray.o.y * ray.o.y - radius * radius;
+	float t[2];
+	if (!solve_quadratic(a, b, c, t[0], t[1])){
+		return false;
+	}
+	//Check if either hit on the infinite cylinder is in the ray's range and on the finite cylinder
+	for (float t_hit : t){
+		if (t_hit >= ray.min_t && t_hit <= ray.max_t){
+			float z = ray(t_hit).z;
+			if (z >= 0 && z <= height){
+				return true;
+			}
+		}
+	}
+	return false;
 }
 BBox Cylinder::bound() const {
 	return BBox{Point{-radius, -radius, 0}, Point{radius, radius, height}};
@@ -5,13 +5,13 @@
 #include "geometry/geometry.h"
 #include "geometry/differential_geometry.h"
 
-DifferentialGeometry::DifferentialGeometry() : node(nullptr), hit_side(NONE), u(0), v(0), du_dx(0), dv_dx(0),
-	du_dy(0), dv_dy(0)
+DifferentialGeometry::DifferentialGeometry() : node(nullptr), geom(nullptr), instance(nullptr), prim(-1), hit_side(NONE), u(0), v(0), du_dx(0), dv_dx(0),
+	du_dy(0), dv_dy(0), time(0)
 {}
 DifferentialGeometry::DifferentialGeometry(const Point &point, const Vector &dpdu, const Vector &dpdv,
 	const Normal &dn_du, const Normal &dn_dv, const Normal &geom_normal, float u, float v, const Node *node, HITSIDE hit_side)
-	: point(point), normal(dpdu.cross(dpdv).normalized()), geom_normal(geom_normal), node(node), hit_side(hit_side),
-	dp_du(dpdu), dp_dv(dpdv), dn_du(dn_du), dn_dv(dn_dv), u(u), v(v), du_dx(0), dv_dx(0), du_dy(0), dv_dy(0)
+	: point(point), normal(dpdu.cross(dpdv).normalized()), geom_normal(geom_normal), node(node), geom(nullptr), instance(nullptr), prim(-1), hit_side(hit_side),
+	dp_du(dpdu), dp_dv(dpdv), dn_du(dn_du), dn_dv(dn_dv), u(u), v(v), du_dx(0), dv_dx(0), du_dy(0), dv_dy(0), time(0)
 {}
 void DifferentialGeometry::compute_differentials(const RayDifferential &r){
 	if (r.has_differentials()){
@@ -5,7 +5,7 @@
 #include "geometry/disk.h"
 
 Disk::Disk(float radius, float inner_radius) : radius(radius), inner_radius(inner_radius){}
-bool Disk::intersect(Ray &ray, DifferentialGeometry &dg) const {
+bool Disk::intersect_hit(Ray &ray, DifferentialGeometry &dg) const {
 	//We just intersect with the plane the disk lies in and then see if that point is on the disk
 	//If the ray is perpindicular to the normal there's no
 	//way for it to hit the plane
@@ -25,13 +25,18 @@ bool Disk::intersect(Ray &ray, DifferentialGeometry &dg) const {
 	if (dist_sqr > radius * radius || dist_sqr < inner_radius * inner_radius){
 		return false;
 	}
+	ray.max_t = t;
+	dg.geom = this;
+	return true;
+}
+void Disk::compute_shading_geometry(const Ray &ray, DifferentialGeometry &dg) const {
+	const Point hit = ray(ray.max_t);
+	const float dist_sqr = hit.x * hit.x + hit.y * hit.y;
 	float phi = std::atan2(hit.y, hit.x);
 	if (phi < 0){
 		phi += TAU;
 	}
 	dg.point = hit;
-	ray.max_t = t;
-
 	dg.u = phi / TAU;
 	dg.v = 1 - (std::sqrt(dist_sqr) - inner_radius) / (radius - inner_radius);
 	float inv_z = 1 - dg.v > 0 ? 1.f / (1 - dg.v) : 0;
@@ -42,14 +47,24 @@ bool Disk::intersect(Ray &ray, DifferentialGeometry &dg) const {
 	dg.normal = Normal{dg.dp_du.cross(dg.dp_dv).normalized()};
 	dg.dn_du = Normal{0, 0, 0};
 	dg.dn_dv = Normal{0, 0, 0};
-	dg.geom = this;
 	if (ray.d.dot(dg.normal) < 0){
 		dg.hit_side = HITSIDE::FRONT;
 	}
 	else {
 		dg.hit_side = HITSIDE::BACK;
 	}
-	return true;
+}
+bool Disk::occluded(const Ray &ray) const {
+	if (std::abs(ray.d.z) < 1e-7){
+		return false;
+	}
+	float t = -ray.o.z / ray.d.z;
+	if (t < ray.min_t || t > ray.max_t){
+		return false;
+	}
+	Point hit = ray(t);
+	float dist_sqr = hit.x * hit.x + hit.y * hit.y;
+	return dist_sqr <= radius * radius && dist_sqr >= inner_radius * inner_radius;
 }
 BBox Disk::bound() const {
 	return BBox{Point{-radius, -radius, 0}, Point{radius, radius, 0}};
@@ -73,4 +88,10 @@ Point Disk::sample(const GeomSample &gs, Normal &normal) const {
 bool Disk::attach_light(const Transform&){
 	return true;
 }
+float Disk::get_radius() const {
+	return radius;
+}
+float Disk::get_inner_radius() const {
+	return inner_radius;
+}
 
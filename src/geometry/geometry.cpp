@@ -6,11 +6,36 @@
 #include <memory>
 #include "lights/area_light.h"
 #include "linalg/ray.h"
+#include "linalg/ray_packet.h"
 #include "linalg/transform.h"
 #include "accelerators/bvh.h"
 #include "geometry/differential_geometry.h"
 #include "geometry/geometry.h"
 
+bool Geometry::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
+	if (intersect_hit(ray, diff_geom)){
+		compute_shading_geometry(ray, diff_geom);
+		return true;
+	}
+	return false;
+}
+uint64_t Geometry::intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const {
+	uint64_t hits = 0;
+	for (int i = first; i < packet.size; ++i){
+		Ray ray = packet.ray(i);
+		if (intersect_hit(ray, diff_geom[i])){
+			packet.max_t[i] = ray.max_t;
+			hits |= uint64_t{1} << i;
+		}
+	}
+	return hits;
+}
+bool Geometry::linear_motion_bound(BBox&, BBox&) const {
+	return false;
+}
+BBox Geometry::clipped_bound(const BBox &box) const {
+	return bound().box_intersection(box);
+}
 float Geometry::surface_area() const {
 	assert("Unimplemented surface area called");
 	return 0;
@@ -38,9 +63,12 @@ float Geometry::pdf(const Point &p, const Vector &w_i) const {
 bool Geometry::attach_light(const Transform&){
 	return false;
 }
+bool Geometry::bake_transform(const Transform&, const Node&){
+	return false;
+}
 
 Node::Node(Geometry *geom, Material *mat, const Transform &t, const std::string &name)
-	: geometry(geom), material(mat), transform(t), inv_transform(t.inverse()), name(name), area_light(nullptr)
+	: geometry(geom), material(mat), transform(t), inv_transform(t.inverse()), name(name), area_light(nullptr), baked(false)
 {}
 void Node::attach_light(AreaLight *light){
 	area_light = light;
@@ -48,7 +76,15 @@ void Node::attach_light(AreaLight *light){
 		assert("Invalid light attachment");
 	}
 }
-void Node::flatten_children(){
+void Node::set_motion(const Transform &end_transform){
+	if (end_transform != transform){
+		motion = std::make_unique<AnimatedTransform>(transform, 0, end_transform, 1);
+	}
+	else {
+		motion = nullptr;
+	}
+}
+void Node::flatten_children(BVH_LAYOUT layout){
 	std::vector<std::shared_ptr<Node>> flat_children;
 	for (auto &c : children){
 		if (c->geometry){
@@ -59,44 +95,139 @@ void Node::flatten_children(){
 	children = std::move(flat_children);
 	std::vector<Geometry*> prims;
 	refine(prims);
-	bvh = std::make_unique<BVH>(prims, SPLIT_METHOD::SAH, 8);
+	bvh = std::make_unique<BVH>(prims, SPLIT_METHOD::SAH, 8, layout);
+	bvh->build_primitive_leaves();
 }
-bool Node::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
+bool Node::set_transform(const Transform &t){
+	if (baked){
+		return geometry->bake_transform(t, *this);
+	}
+	transform = t;
+	inv_transform = t.inverse();
+	motion = nullptr;
+	return true;
+}
+bool Node::bake_transform(){
+	if (baked){
+		return true;
+	}
+	if (motion || area_light || !geometry || !geometry->bake_transform(transform, *this)){
+		return false;
+	}
+	transform = Transform{};
+	inv_transform = Transform{};
+	baked = true;
+	return true;
+}
+void Node::refit(float rebuild_ratio){
+	if (bvh){
+		bvh->refit(rebuild_ratio);
+	}
+}
+bool Node::intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const {
 	if (bvh){
 		return bvh->intersect(ray, diff_geom);
 	}
 	assert(children.empty());
-	bool hit = false;
+	if (!geometry){
+		return false;
+	}
+	Ray node_space = ray;
+	to_node_space(ray, node_space);
+	if (geometry->intersect_hit(node_space, diff_geom)){
+		diff_geom.node = this;
+		ray.max_t = node_space.max_t;
+		return true;
+	}
+	return false;
+}
+void Node::compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const {
+	//The root's BVH recorded which of its children was hit, so have it fill out the surface
+	if (bvh){
+		diff_geom.node->compute_shading_geometry(ray, diff_geom);
+		return;
+	}
+	diff_geom.time = ray.time;
+	if (baked){
+		geometry->compute_shading_geometry(ray, diff_geom);
+		return;
+	}
 	Ray node_space = ray;
+	if (motion){
+		Transform to_world = motion->interpolate(ray.time);
+		to_world.inverse()(ray, node_space);
+		geometry->compute_shading_geometry(node_space, diff_geom);
+		to_world(diff_geom, diff_geom);
+		return;
+	}
 	inv_transform(ray, node_space);
+	geometry->compute_shading_geometry(node_space, diff_geom);
+	transform(diff_geom, diff_geom);
+}
+bool Node::occluded(const Ray &ray) const {
+	if (bvh){
+		return bvh->occluded(ray);
+	}
+	assert(children.empty());
 	if (geometry){
-		hit = geometry->intersect(node_space, diff_geom);
-		if (hit){
-			diff_geom.node = this;
-		}
+		Ray node_space = ray;
+		to_node_space(ray, node_space);
+		return geometry->occluded(node_space);
 	}
-	if (hit){
-		transform(diff_geom, diff_geom);
-		ray.max_t = node_space.max_t;
+	return false;
+}
+uint64_t Node::intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const {
+	if (bvh){
+		return bvh->intersect(packet, first, diff_geom);
 	}
-	return hit;
+	assert(children.empty());
+	if (!geometry){
+		return 0;
+	}
+	//The rays in the packet are at different times so a moving node would be placed
+	//differently for each of them, test them one by one instead
+	if (motion){
+		return Geometry::intersect_packet(packet, first, diff_geom);
+	}
+	RayPacket node_space;
+	inv_transform(packet, node_space);
+	uint64_t hits = geometry->intersect_packet(node_space, first, diff_geom);
+	for (int i = first; i < packet.size; ++i){
+		if (hits & (uint64_t{1} << i)){
+			diff_geom[i].node = this;
+			packet.max_t[i] = node_space.max_t[i];
+		}
+	}
+	return hits;
 }
 BBox Node::bound() const {
 	if (bvh){
 		return bvh->bounds();
 	}
 	if (geometry){
-		return transform(geometry->bound());
+		return motion ? motion->motion_bound(geometry->bound()) : transform(geometry->bound());
 	}
 	return BBox{};
 }
+bool Node::linear_motion_bound(BBox &start, BBox &end) const {
+	if (!motion || !geometry){
+		return false;
+	}
+	motion->linear_motion_bound(geometry->bound(), start, end);
+	return true;
+}
 void Node::refine(std::vector<Geometry*> &prims){
 	if (geometry){
-		prims.push_back(this);
+		if (baked){
+			geometry->refine(prims);
+		}
+		else {
+			prims.push_back(this);
+		}
 	}
 	for (auto &c : children){
 		if (c->geometry){
-			prims.push_back(c.get());
+			c->refine(prims);
 		}
 	}
 }
@@ -133,6 +264,14 @@ Transform& Node::get_inv_transform(){
 const std::string& Node::get_name() const {
 	return name;
 }
+void Node::to_node_space(const Ray &ray, Ray &node_space) const {
+	if (motion){
+		motion->interpolate(ray.time).inverse()(ray, node_space);
+	}
+	else {
+		inv_transform(ray, node_space);
+	}
+}
 void Node::flatten_children(std::vector<std::shared_ptr<Node>> &nodes){
 	for (auto &c : children){
 		if (c->geometry){
@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include "binary_file.h"
+#include "linalg/matrix4.h"
+#include "linalg/transform.h"
+#include "geometry/instance_set.h"
+
+//Bytes in each instance's record in the instance file
+const static uint64_t INSTANCE_BYTES = 12 * sizeof(float) + 2 * sizeof(uint32_t);
+
+Instance::Instance(const Transform &to_world, const TriMesh *mesh, const Node *node) : mesh(mesh), node(node) {
+	const Matrix4 &m = to_world.inv;
+	for (int r = 0; r < 3; ++r){
+		for (int c = 0; c < 4; ++c){
+			to_obj[4 * r + c] = m[r][c];
+		}
+	}
+}
+bool Instance::intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const {
+	Ray obj;
+	to_object(ray, obj);
+	if (mesh->intersect_hit(obj, diff_geom)){
+		ray.max_t = obj.max_t;
+		diff_geom.node = node;
+		diff_geom.instance = this;
+		return true;
+	}
+	return false;
+}
+void Instance::compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const {
+	const Transform to_obj_space = world_to_object();
+	Ray obj;
+	to_object(ray, obj);
+	mesh->compute_shading_geometry(obj, diff_geom);
+	to_obj_space.inverse()(diff_geom, diff_geom);
+}
+bool Instance::occluded(const Ray &ray) const {
+	Ray obj;
+	to_object(ray, obj);
+	return mesh->occluded(obj);
+}
+BBox Instance::bound() const {
+	return world_to_object().inverse()(mesh->bound());
+}
+void Instance::refine(std::vector<Geometry*> &prims){
+	prims.push_back(this);
+}
+void Instance::apply_transform(const Transform &t){
+	const Matrix4 m = world_to_object().mat * t.inv;
+	for (int r = 0; r < 3; ++r){
+		for (int c = 0; c < 4; ++c){
+			to_obj[4 * r + c] = m[r][c];
+		}
+	}
+}
+Transform Instance::world_to_object() const {
+	Matrix4 m;
+	for (int r = 0; r < 3; ++r){
+		for (int c = 0; c < 4; ++c){
+			m[r][c] = to_obj[4 * r + c];
+		}
+	}
+	return Transform{m};
+}
+void Instance::to_object(const Ray &ray, Ray &obj) const {
+	obj = ray;
+	obj.o.x = to_obj[0] * ray.o.x + to_obj[1] * ray.o.y + to_obj[2] * ray.o.z + to_obj[3];
+	obj.o.y = to_obj[4] * ray.o.x + to_obj[5] * ray.o.y + to_obj[6] * ray.o.z + to_obj[7];
+	obj.o.z = to_obj[8] * ray.o.x + to_obj[9] * ray.o.y + to_obj[10] * ray.o.z + to_obj[11];
+	obj.d.x = to_obj[0] * ray.d.x + to_obj[1] * ray.d.y + to_obj[2] * ray.d.z;
+	obj.d.y = to_obj[4] * ray.d.x + to_obj[5] * ray.d.y + to_obj[6] * ray.d.z;
+	obj.d.z = to_obj[8] * ray.d.x + to_obj[9] * ray.d.y + to_obj[10] * ray.d.z;
+}
+
+InstanceSet::InstanceSet(const std::vector<TriMesh*> &mesh_list, const std::vector<Material*> &materials,
+	const std::string &name, BVH_LAYOUT layout)
+	: meshes(mesh_list.begin(), mesh_list.end()), bvh_layout(layout), baked_node(nullptr)
+{
+	for (size_t i = 0; i < materials.size(); ++i){
+		material_nodes.push_back(std::make_unique<Node>(this, materials[i], Transform{},
+			name + "_" + std::to_string(i)));
+	}
+}
+bool InstanceSet::load(const std::string &file){
+	std::FILE *fin = std::fopen(file.c_str(), "rb");
+	if (!fin){
+		std::cerr << "InstanceSet error: could not open instance file " << file << "\n";
+		return false;
+	}
+	uint32_t count = 0;
+	if (std::fread(&count, sizeof(uint32_t), 1, fin) != 1 || count * INSTANCE_BYTES > bytes_left(fin)){
+		std::cerr << "InstanceSet error: instance file " << file << " is shorter than its "
+			<< count << " instances\n";
+		std::fclose(fin);
+		return false;
+	}
+	instances.reserve(count);
+	uint32_t skipped = 0;
+	for (uint32_t i = 0; i < count; ++i){
+		std::array<float, 12> m;
+		std::array<uint32_t, 2> idx;
+		if (std::fread(m.data(), sizeof(float), 12, fin) != 12
+			|| std::fread(idx.data(), sizeof(uint32_t), 2, fin) != 2)
+		{
+			std::cerr << "InstanceSet error: instance file " << file << " ended after "
+				<< i << " of " << count << " instances\n";
+			std::fclose(fin);
+			return false;
+		}
+		if (idx[0] >= meshes.size() || !meshes[idx[0]] || idx[1] >= material_nodes.size()){
+			++skipped;
+			continue;
+		}
+		Matrix4 to_world;
+		for (int r = 0; r < 3; ++r){
+			for (int c = 0; c < 4; ++c){
+				to_world[r][c] = m[4 * r + c];
+			}
+		}
+		instances.emplace_back(Transform{to_world}, meshes[idx[0]], material_nodes[idx[1]].get());
+	}
+	std::fclose(fin);
+	if (skipped > 0){
+		std::cerr << "InstanceSet warning: skipped " << skipped
+			<< " instances with invalid mesh or material indices in " << file << "\n";
+	}
+	//The instance BVH is built once the set is baked into world space
+	std::cout << "Loaded " << instances.size() << " instances from " << file << std::endl;
+	return true;
+}
+bool InstanceSet::intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const {
+	return bvh.intersect(ray, diff_geom);
+}
+void InstanceSet::compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const {
+	diff_geom.instance->compute_shading_geometry(ray, diff_geom);
+}
+bool InstanceSet::occluded(const Ray &ray) const {
+	return bvh.occluded(ray);
+}
+uint64_t InstanceSet::intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const {
+	return bvh.intersect(packet, first, diff_geom);
+}
+BBox InstanceSet::bound() const {
+	return bvh.bounds();
+}
+void InstanceSet::refine(std::vector<Geometry*> &prims){
+	prims.push_back(this);
+}
+bool InstanceSet::bake_transform(const Transform &to_world, const Node &node){
+	if (baked_node && baked_node != &node){
+		return false;
+	}
+	const Transform t = to_world * baked_transform.inverse();
+	for (Instance &i : instances){
+		i.apply_transform(t);
+	}
+	baked_node = &node;
+	baked_transform = to_world;
+	build_bvh();
+	return true;
+}
+size_t InstanceSet::size() const {
+	return instances.size();
+}
+const std::vector<const TriMesh*>& InstanceSet::get_meshes() const {
+	return meshes;
+}
+void InstanceSet::build_bvh(){
+	std::vector<Geometry*> refs;
+	refs.reserve(instances.size());
+	for (Instance &i : instances){
+		refs.push_back(&i);
+	}
+	bvh = BVH{refs, SPLIT_METHOD::SAH, 8, bvh_layout};
+}
+
@@ -0,0 +1,151 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "linalg/point.h"
+#include "linalg/vector.h"
+#include "geometry/bbox.h"
+#include "geometry/mesh_proxy.h"
+
+//Meshes hit by the thread's rays since it last released them, kept alive until its hits are shaded
+static thread_local std::vector<std::shared_ptr<const TriMesh>> pinned_meshes;
+
+MeshProxyCache::MeshProxyCache(size_t budget) : budget(budget), resident_bytes(0), loads(0) {}
+void MeshProxyCache::set_budget(size_t b){
+	std::lock_guard<std::mutex> lock{mutex};
+	budget = b;
+}
+size_t MeshProxyCache::get_budget() const {
+	return budget;
+}
+uint64_t MeshProxyCache::stamp() const {
+	return loads.load(std::memory_order_relaxed);
+}
+void MeshProxyCache::loaded(const MeshProxy *proxy){
+	std::lock_guard<std::mutex> lock{mutex};
+	resident_bytes += proxy->memory_size();
+	resident.push_back(proxy);
+	loads.fetch_add(1, std::memory_order_relaxed);
+	//The mesh just loaded is at the back and is never evicted for itself
+	while (resident_bytes > budget && resident.size() > 1){
+		auto victim = std::min_element(resident.begin(), resident.end() - 1,
+			[](const MeshProxy *a, const MeshProxy *b){
+				return a->get_last_used() < b->get_last_used();
+			});
+		resident_bytes -= (*victim)->memory_size();
+		(*victim)->evict();
+		resident.erase(victim);
+	}
+}
+
+MeshProxy::MeshProxy(const std::string &file, MeshProxyCache &cache, SPLIT_METHOD split, float dup_budget,
+	BVH_LAYOUT layout)
+	: file(file), bvh_split(split), bvh_dup_budget(dup_budget), bvh_layout(layout), bytes(0), cache(&cache),
+	last_used(0)
+{
+	const std::string file_bin = file.substr(0, file.rfind("obj")) + "bobj";
+	if (!read_header(file_bin)){
+		std::cout << "Error: mesh proxy " << file << " needs a binary mesh file " << file_bin << std::endl;
+		std::exit(1);
+	}
+}
+bool MeshProxy::intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const {
+	if (!bounds.intersect(ray)){
+		return false;
+	}
+	std::shared_ptr<const TriMesh> m = acquire();
+	if (!m->intersect_hit(ray, diff_geom)){
+		return false;
+	}
+	//The hit refers to the mesh's triangles so it must outlive the hit
+	if (std::find(pinned_meshes.begin(), pinned_meshes.end(), m) == pinned_meshes.end()){
+		pinned_meshes.push_back(std::move(m));
+	}
+	return true;
+}
+void MeshProxy::compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const {
+	diff_geom.geom->compute_shading_geometry(ray, diff_geom);
+}
+bool MeshProxy::occluded(const Ray &ray) const {
+	if (!bounds.intersect(ray)){
+		return false;
+	}
+	return acquire()->occluded(ray);
+}
+BBox MeshProxy::bound() const {
+	return bounds;
+}
+void MeshProxy::refine(std::vector<Geometry*> &prims){
+	prims.push_back(this);
+}
+void MeshProxy::release_pinned(){
+	pinned_meshes.clear();
+}
+size_t MeshProxy::memory_size() const {
+	return bytes;
+}
+uint64_t MeshProxy::get_last_used() const {
+	return last_used.load(std::memory_order_relaxed);
+}
+void MeshProxy::evict() const {
+	std::atomic_store(&mesh, std::shared_ptr<const TriMesh>{});
+}
+std::shared_ptr<const TriMesh> MeshProxy::acquire() const {
+	last_used.store(cache->stamp(), std::memory_order_relaxed);
+	std::shared_ptr<const TriMesh> m = std::atomic_load(&mesh);
+	if (m){
+		return m;
+	}
+	//Only one thread loads the mesh, the others hitting it meanwhile wait for it
+	std::lock_guard<std::mutex> lock{load_mutex};
+	m = std::atomic_load(&mesh);
+	if (!m){
+		//Meshes are loaded on the render threads, don't flood the log each time one is reloaded
+		m = std::make_shared<const TriMesh>(file, false, bvh_split, bvh_dup_budget, bvh_layout, true);
+		std::atomic_store(&mesh, m);
+		cache->loaded(this);
+	}
+	return m;
+}
+bool MeshProxy::read_header(const std::string &bobj_file){
+	std::FILE *fin = std::fopen(bobj_file.c_str(), "rb");
+	if (!fin){
+		return false;
+	}
+	uint32_t nverts = 0, ntris = 0;
+	if (std::fread(&nverts, sizeof(uint32_t), 1, fin) != 1 || std::fread(&ntris, sizeof(uint32_t), 1, fin) != 1){
+		std::fclose(fin);
+		return false;
+	}
+	//The mesh's arrays, its triangles and roughly what its BVH and triangle leaves take
+	const size_t vert_bytes = nverts * (2 * sizeof(Point) + sizeof(Normal));
+	const size_t index_bytes = 3 * static_cast<size_t>(ntris) * sizeof(int);
+	bytes = vert_bytes + index_bytes + ntris * (sizeof(Triangle) + 64);
+	//The bounds are the root of the BVH stored after the arrays, if there's none we find them
+	//from the vertices
+	if (std::fseek(fin, 2 * sizeof(uint32_t) + vert_bytes + index_bytes, SEEK_SET) == 0
+		&& BVH::read_bounds(fin, bounds))
+	{
+		std::fclose(fin);
+		return true;
+	}
+	std::fseek(fin, 2 * sizeof(uint32_t), SEEK_SET);
+	std::vector<Point> chunk(4096);
+	bounds = BBox{};
+	for (size_t read = 0; read < nverts;){
+		const size_t n = std::fread(chunk.data(), sizeof(Point), std::min(chunk.size(), nverts - read), fin);
+		if (n == 0){
+			std::fclose(fin);
+			return false;
+		}
+		for (size_t i = 0; i < n; ++i){
+			bounds = bounds.box_union(chunk[i]);
+		}
+		read += n;
+	}
+	std::fclose(fin);
+	return true;
+}
+
@@ -0,0 +1,273 @@
+#include <array>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+#include <cstdint>
+#include "linalg/vector.h"
+#include "linalg/point.h"
+#include "geometry/mesh_simplify.h"
+
+//Weight of the planes constraining boundary edges relative to the surface's planes
+const static double BOUNDARY_WEIGHT = 1000;
+
+/*
+ * The error quadric of a vertex, the sum of the squared distances to the planes
+ * around it stored as the upper triangle of the symmetric 4x4 matrix
+ */
+struct Quadric {
+	std::array<double, 10> q;
+
+	Quadric() : q{} {}
+	/*
+	 * The quadric of the plane ax + by + cz + d = 0 with some weight
+	 */
+	Quadric(double a, double b, double c, double d, double w)
+		: q{w * a * a, w * a * b, w * a * c, w * a * d, w * b * b,
+			w * b * c, w * b * d, w * c * c, w * c * d, w * d * d}
+	{}
+	Quadric& operator+=(const Quadric &o){
+		for (size_t i = 0; i < q.size(); ++i){
+			q[i] += o.q[i];
+		}
+		return *this;
+	}
+	/*
+	 * Compute the error of placing the vertex at p
+	 */
+	double error(const Point &p) const {
+		const double x = p.x, y = p.y, z = p.z;
+		return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+			+ q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+			+ q[7] * z * z + 2 * q[8] * z + q[9];
+	}
+};
+/*
+ * A candidate edge collapse in the queue, the versions of the vertices are those they had
+ * when the collapse was evaluated so collapses made stale by later collapses can be skipped
+ */
+struct Collapse {
+	double cost;
+	int a, b;
+	int version_a, version_b;
+	//Where the collapsed vertex is placed: 0 at a, 1 at b and 2 at the edge's midpoint
+	int placement;
+
+	bool operator>(const Collapse &c) const {
+		return cost > c.cost;
+	}
+};
+
+static uint64_t edge_key(int a, int b){
+	return (static_cast<uint64_t>(std::min(a, b)) << 32) | static_cast<uint32_t>(std::max(a, b));
+}
+static Point midpoint(const Point &a, const Point &b){
+	return Point{(a.x + b.x) / 2, (a.y + b.y) / 2, (a.z + b.z) / 2};
+}
+
+void simplify_mesh(std::vector<Point> &verts, std::vector<Point> &texcoords, std::vector<Normal> &normals,
+	std::vector<int> &indices, size_t target_tris)
+{
+	const size_t nverts = verts.size();
+	const size_t ntris = indices.size() / 3;
+	if (ntris <= target_tris){
+		return;
+	}
+	std::vector<Quadric> quadrics(nverts);
+	std::vector<std::vector<int>> vert_tris(nverts);
+	std::unordered_map<uint64_t, int> edge_tris;
+	for (size_t t = 0; t < ntris; ++t){
+		const int *tri = &indices[3 * t];
+		const Vector n = (verts[tri[1]] - verts[tri[0]]).cross(verts[tri[2]] - verts[tri[0]]);
+		const float len = n.length();
+		for (int i = 0; i < 3; ++i){
+			vert_tris[tri[i]].push_back(t);
+			++edge_tris[edge_key(tri[i], tri[(i + 1) % 3])];
+		}
+		if (len == 0){
+			continue;
+		}
+		//Weight the face's plane by its area
+		const Vector un = n / len;
+		const Quadric q{un.x, un.y, un.z, -un.dot(Vector{verts[tri[0]]}), len / 2};
+		for (int i = 0; i < 3; ++i){
+			quadrics[tri[i]] += q;
+		}
+	}
+	//Constrain the boundary edges to stay on planes through them perpendicular to their face
+	for (size_t t = 0; t < ntris; ++t){
+		const int *tri = &indices[3 * t];
+		const Vector n = (verts[tri[1]] - verts[tri[0]]).cross(verts[tri[2]] - verts[tri[0]]);
+		if (n.length() == 0){
+			continue;
+		}
+		for (int i = 0; i < 3; ++i){
+			const int a = tri[i], b = tri[(i + 1) % 3];
+			if (edge_tris[edge_key(a, b)] != 1){
+				continue;
+			}
+			const Vector e = verts[b] - verts[a];
+			const Vector bn = e.cross(n);
+			const float len = bn.length();
+			if (len == 0){
+				continue;
+			}
+			const Vector ubn = bn / len;
+			const Quadric q{ubn.x, ubn.y, ubn.z, -ubn.dot(Vector{verts[a]}), BOUNDARY_WEIGHT * e.length_sqr()};
+			quadrics[a] += q;
+			quadrics[b] += q;
+		}
+	}
+
+	std::vector<bool> tri_removed(ntris, false), vert_removed(nverts, false);
+	std::vector<int> version(nverts, 0);
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+	auto placement_point = [&](int a, int b, int placement){
+		return placement == 0 ? verts[a] : placement == 1 ? verts[b] : midpoint(verts[a], verts[b]);
+	};
+	auto evaluate = [&](int a, int b){
+		Quadric q = quadrics[a];
+		q += quadrics[b];
+		Collapse c{q.error(verts[a]), a, b, version[a], version[b], 0};
+		for (int p = 1; p < 3; ++p){
+			const double err = q.error(placement_point(a, b, p));
+			if (err < c.cost){
+				c.cost = err;
+				c.placement = p;
+			}
+		}
+		queue.push(c);
+	};
+	for (const auto &e : edge_tris){
+		evaluate(static_cast<int>(e.first >> 32), static_cast<int>(e.first & 0xffffffff));
+	}
+	//Get the vertices sharing a live triangle with v
+	auto neighbors = [&](int v){
+		std::vector<int> n;
+		for (int t : vert_tris[v]){
+			if (tri_removed[t]){
+				continue;
+			}
+			for (int i = 0; i < 3; ++i){
+				if (indices[3 * t + i] != v){
+					n.push_back(indices[3 * t + i]);
+				}
+			}
+		}
+		std::sort(n.begin(), n.end());
+		n.erase(std::unique(n.begin(), n.end()), n.end());
+		return n;
+	};
+	//Check if moving v to p flips any of its triangles that don't also use other, which are removed
+	auto flips = [&](int v, int other, const Point &p){
+		for (int t : vert_tris[v]){
+			const int *tri = &indices[3 * t];
+			if (tri_removed[t] || tri[0] == other || tri[1] == other || tri[2] == other){
+				continue;
+			}
+			std::array<Point, 3> moved{verts[tri[0]], verts[tri[1]], verts[tri[2]]};
+			const Vector before = (moved[1] - moved[0]).cross(moved[2] - moved[0]);
+			for (int i = 0; i < 3; ++i){
+				if (tri[i] == v){
+					moved[i] = p;
+				}
+			}
+			const Vector after = (moved[1] - moved[0]).cross(moved[2] - moved[0]);
+			if (before.dot(after) <= 0){
+				return true;
+			}
+		}
+		return false;
+	};
+
+	size_t live_tris = ntris;
+	while (live_tris > target_tris && !queue.empty()){
+		const Collapse c = queue.top();
+		queue.pop();
+		const int a = c.a, b = c.b;
+		if (vert_removed[a] || vert_removed[b] || version[a] != c.version_a || version[b] != c.version_b){
+			continue;
+		}
+		//The end points can only share the neighbors across the triangles on the edge, otherwise
+		//the collapse would pinch the surface into a non-manifold one
+		const std::vector<int> na = neighbors(a), nb = neighbors(b);
+		std::vector<int> shared;
+		std::set_intersection(na.begin(), na.end(), nb.begin(), nb.end(), std::back_inserter(shared));
+		const int edge_faces = std::count_if(vert_tris[a].begin(), vert_tris[a].end(), [&](int t){
+			const int *tri = &indices[3 * t];
+			return !tri_removed[t] && (tri[0] == b || tri[1] == b || tri[2] == b);
+		});
+		if (static_cast<int>(shared.size()) > edge_faces){
+			continue;
+		}
+		const Point p = placement_point(a, b, c.placement);
+		if (flips(a, b, p) || flips(b, a, p)){
+			continue;
+		}
+		//Collapse b into a
+		if (c.placement == 1){
+			texcoords[a] = texcoords[b];
+			normals[a] = normals[b];
+		}
+		else if (c.placement == 2){
+			texcoords[a] = midpoint(texcoords[a], texcoords[b]);
+			const Normal n{normals[a].x + normals[b].x, normals[a].y + normals[b].y, normals[a].z + normals[b].z};
+			normals[a] = n.length() > 0 ? n.normalized() : normals[a];
+		}
+		verts[a] = p;
+		quadrics[a] += quadrics[b];
+		for (int t : vert_tris[b]){
+			if (tri_removed[t]){
+				continue;
+			}
+			int *tri = &indices[3 * t];
+			if (tri[0] == a || tri[1] == a || tri[2] == a){
+				tri_removed[t] = true;
+				--live_tris;
+				continue;
+			}
+			for (int i = 0; i < 3; ++i){
+				if (tri[i] == b){
+					tri[i] = a;
+				}
+			}
+			vert_tris[a].push_back(t);
+		}
+		vert_removed[b] = true;
+		vert_tris[b].clear();
+		vert_tris[a].erase(std::remove_if(vert_tris[a].begin(), vert_tris[a].end(),
+			[&](int t){ return tri_removed[t]; }), vert_tris[a].end());
+		++version[a];
+		for (int n : neighbors(a)){
+			evaluate(a, n);
+		}
+	}
+
+	//Compact the vertices used by the remaining triangles
+	std::vector<int> remap(nverts, -1);
+	std::vector<Point> new_verts, new_texcoords;
+	std::vector<Normal> new_normals;
+	std::vector<int> new_indices;
+	new_indices.reserve(3 * live_tris);
+	for (size_t t = 0; t < ntris; ++t){
+		if (tri_removed[t]){
+			continue;
+		}
+		for (int i = 0; i < 3; ++i){
+			const int v = indices[3 * t + i];
+			if (remap[v] == -1){
+				remap[v] = new_verts.size();
+				new_verts.push_back(verts[v]);
+				new_texcoords.push_back(texcoords[v]);
+				new_normals.push_back(normals[v]);
+			}
+			new_indices.push_back(remap[v]);
+		}
+	}
+	verts = std::move(new_verts);
+	texcoords = std::move(new_texcoords);
+	normals = std::move(new_normals);
+	indices = std::move(new_indices);
+}
+
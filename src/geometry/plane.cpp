@@ -3,7 +3,7 @@
 #include "linalg/ray.h"
 #include "geometry/plane.h"
 
-bool Plane::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
+bool Plane::intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const {
 	//If the ray is perpindicular to the normal there's no
 	//way for it to hit the plane
 	if (std::abs(ray.d.z) < 1e-8){
@@ -20,31 +20,45 @@ bool Plane::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
 	Point hit = ray(t);
 	if (hit.x >= -1 && hit.x <= 1 && hit.y >= -1 && hit.y <= 1){
 		ray.max_t = t;
-		diff_geom.point = hit;
-		diff_geom.normal = Normal{0, 0, 1};
-		diff_geom.geom_normal = diff_geom.normal;
-		if (ray.d.dot(diff_geom.normal) < 0){
-			diff_geom.hit_side = HITSIDE::FRONT;
-		}
-		else {
-			diff_geom.hit_side = HITSIDE::BACK;
-		}
-		//Compute parameterization of surface and various derivatives for texturing
-		//Plane is parameterized by x and y coords
-		diff_geom.u = (hit.x + 1) / 2;
-		//We flip the y parameterization to put image top-left at the top-left of the plane
-		diff_geom.v = -(hit.y + 1) / 2 + 1;
-		//The change in x/y vs. u/v. Is this correct?
-		diff_geom.dp_du = Vector{2, 0, 0};
-		diff_geom.dp_dv = Vector{0, 2, 0};
-		//Normal doesn't change over the plane so these are trivial
-		diff_geom.dn_du = Normal{0, 0, 0};
-		diff_geom.dn_dv = Normal{0, 0, 0};
 		diff_geom.geom = this;
 		return true;
 	}
 	return false;
 }
+void Plane::compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const {
+	const Point hit = ray(ray.max_t);
+	diff_geom.point = hit;
+	diff_geom.normal = Normal{0, 0, 1};
+	diff_geom.geom_normal = diff_geom.normal;
+	if (ray.d.dot(diff_geom.normal) < 0){
+		diff_geom.hit_side = HITSIDE::FRONT;
+	}
+	else {
+		diff_geom.hit_side = HITSIDE::BACK;
+	}
+	//Compute parameterization of surface and various derivatives for texturing
+	//Plane is parameterized by x and y coords
+	diff_geom.u = (hit.x + 1) / 2;
+	//We flip the y parameterization to put image top-left at the top-left of the plane
+	diff_geom.v = -(hit.y + 1) / 2 + 1;
+	//The change in x/y vs. u/v. Is this correct?
+	diff_geom.dp_du = Vector{2, 0, 0};
+	diff_geom.dp_dv = Vector{0, 2, 0};
+	//Normal doesn't change over the plane so these are trivial
+	diff_geom.dn_du = Normal{0, 0, 0};
+	diff_geom.dn_dv = Normal{0, 0, 0};
+}
+bool Plane::occluded(const Ray &ray) const {
+	if (std::abs(ray.d.z) < 1e-8){
+		return false;
+	}
+	float t = -ray.o.z / ray.d.z;
+	if (t < ray.min_t || t > ray.max_t){
+		return false;
+	}
+	Point hit = ray(t);
+	return hit.x >= -1 && hit.x <= 1 && hit.y >= -1 && hit.y <= 1;
+}
 BBox Plane::bound() const {
 	return BBox{Point{-1, -1, 0}, Point{1, 1, 0}};
 }
@@ -5,7 +5,7 @@
 #include "geometry/sphere.h"
 
 Sphere::Sphere(float radius) : radius(radius){}
-bool Sphere::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
+bool Sphere::intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const {
 	//Compute quadratic sphere coefficients
 	Vector ray_orig{ray.o};
 	float a = ray.d.length_sqr();
@@ -31,7 +31,11 @@ bool Sphere::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
 		}
 	}
 	ray.max_t = t_hit;
-	diff_geom.point = ray(t_hit);
+	diff_geom.geom = this;
+	return true;
+}
+void Sphere::compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const {
+	diff_geom.point = ray(ray.max_t);
 	//For a unit sphere the normal is the same as the point hit
 	diff_geom.normal = Normal{diff_geom.point};
 	diff_geom.geom_normal = diff_geom.normal;
@@ -78,8 +82,18 @@ bool Sphere::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
 		+ (e * F - f * E) * divisor * diff_geom.dp_dv};
 	diff_geom.dn_dv = Normal{(g * F - f * G) * divisor * diff_geom.dp_du
 		+ (f * F - g * E) * divisor * diff_geom.dp_dv};
-	diff_geom.geom = this;
-	return true;
+}
+bool Sphere::occluded(const Ray &ray) const {
+	Vector ray_orig{ray.o};
+	float a = ray.d.length_sqr();
+	float b = 2 * ray.d.dot(ray_orig);
+	float c = ray_orig.length_sqr() - radius * radius;
+	float t[2];
+	if (!solve_quadratic(a, b, c, t[0], t[1])){
+		return false;
+	}
+	//We hit if either of the hits are in the region we're testing
+	return (t[0] >= ray.min_t && t[0] <= ray.max_t) || (t[1] >= ray.min_t && t[1] <= ray.max_t);
 }
 BBox Sphere::bound() const {
 	return BBox{Point{-radius, -radius, -radius},
@@ -128,4 +142,7 @@ float Sphere::pdf(const Point &p, const Vector &w_i) const {
 bool Sphere::attach_light(const Transform&){
 	return true;
 }
+float Sphere::get_radius() const {
+	return radius;
+}
 
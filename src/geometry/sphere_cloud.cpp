@@ -0,0 +1,376 @@
+#include <cstdio>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <string>
+#include <limits>
+#include <numeric>
+#include <iostream>
+#include <algorithm>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+#include "binary_file.h"
+#include "linalg/util.h"
+#include "linalg/transform.h"
+#include "geometry/sphere.h"
+#include "geometry/sphere_cloud.h"
+
+//Number of buckets considered when finding SAH splits
+const static int SAH_BUCKETS = 16;
+//Most spheres the SAH will place in a leaf
+const static int MAX_LEAF_SPHERES = 8;
+//Deepest the BVH can be while fitting in the traversal stack, subtrees are split at
+//the median once SAH splits could take them past it
+const static int MAX_DEPTH = 62;
+//Bytes in each sphere's record in the particle file
+const static uint64_t PARTICLE_BYTES = 4 * sizeof(float) + sizeof(uint32_t);
+
+/*
+ * Reorder the first order.size() values of the array so value i is the value at order[i],
+ * any padding after them is left as is
+ */
+template<typename T>
+static void reorder(std::vector<T> &v, const std::vector<uint32_t> &order){
+	std::vector<T> ordered(v);
+	for (size_t i = 0; i < order.size(); ++i){
+		ordered[i] = v[order[i]];
+	}
+	v = std::move(ordered);
+}
+
+/*
+ * Get the number of levels of median splits needed to split n spheres into leaves
+ */
+static int median_split_depth(int n){
+	int depth = 0;
+	for (; n > MAX_LEAF_SPHERES; n = (n + 1) / 2){
+		++depth;
+	}
+	return depth;
+}
+
+SphereCloud::SphereCloud(const std::vector<Material*> &materials, const std::string &name)
+	: baked_node(nullptr)
+{
+	for (size_t i = 0; i < materials.size(); ++i){
+		material_nodes.push_back(std::make_unique<Node>(this, materials[i], Transform{},
+			name + "_" + std::to_string(i)));
+	}
+}
+bool SphereCloud::load(const std::string &file){
+	std::FILE *fin = std::fopen(file.c_str(), "rb");
+	if (!fin){
+		std::cerr << "SphereCloud error: could not open particle file " << file << "\n";
+		return false;
+	}
+	uint32_t count = 0;
+	if (std::fread(&count, sizeof(uint32_t), 1, fin) != 1 || count * PARTICLE_BYTES > bytes_left(fin)){
+		std::cerr << "SphereCloud error: particle file " << file << " is shorter than its "
+			<< count << " particles\n";
+		std::fclose(fin);
+		return false;
+	}
+	x.reserve(count + 3);
+	y.reserve(count + 3);
+	z.reserve(count + 3);
+	radius.reserve(count + 3);
+	material.reserve(count);
+	uint32_t skipped = 0;
+	for (uint32_t i = 0; i < count; ++i){
+		std::array<float, 4> sphere;
+		uint32_t mat = 0;
+		if (std::fread(sphere.data(), sizeof(float), 4, fin) != 4 || std::fread(&mat, sizeof(uint32_t), 1, fin) != 1){
+			std::cerr << "SphereCloud error: particle file " << file << " ended after "
+				<< i << " of " << count << " particles\n";
+			std::fclose(fin);
+			return false;
+		}
+		if (mat >= material_nodes.size() || mat > std::numeric_limits<uint16_t>::max()){
+			++skipped;
+			continue;
+		}
+		x.push_back(sphere[0]);
+		y.push_back(sphere[1]);
+		z.push_back(sphere[2]);
+		radius.push_back(sphere[3]);
+		material.push_back(static_cast<uint16_t>(mat));
+	}
+	std::fclose(fin);
+	if (skipped > 0){
+		std::cerr << "SphereCloud warning: skipped " << skipped
+			<< " particles with invalid material indices in " << file << "\n";
+	}
+	//Pad the arrays with zero radius spheres, which are never hit
+	x.resize(material.size() + 3, 0);
+	y.resize(material.size() + 3, 0);
+	z.resize(material.size() + 3, 0);
+	radius.resize(material.size() + 3, 0);
+	//The BVH is built once the cloud is baked into world space
+	std::cout << "Loaded " << material.size() << " particles from " << file << std::endl;
+	return true;
+}
+bool SphereCloud::intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const {
+	int hit = -1;
+	traverse(ray, [&](int offset, int count){
+		std::array<float, 4> t;
+		for (int i = offset; i < offset + count; i += 4){
+			const int mask = intersect_block(ray, i, std::min(4, offset + count - i), t);
+			for (int j = 0; j < 4; ++j){
+				if ((mask & (1 << j)) && t[j] < ray.max_t){
+					ray.max_t = t[j];
+					hit = i + j;
+				}
+			}
+		}
+		return false;
+	});
+	if (hit < 0){
+		return false;
+	}
+	diff_geom.geom = this;
+	diff_geom.prim = hit;
+	diff_geom.node = material_nodes[material[hit]].get();
+	return true;
+}
+void SphereCloud::compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const {
+	//Find the surface on the sphere at the origin and move it to the sphere's center
+	const int i = diff_geom.prim;
+	const Vector center{x[i], y[i], z[i]};
+	Ray local = ray;
+	local.o = ray.o - center;
+	Sphere{radius[i]}.compute_shading_geometry(local, diff_geom);
+	diff_geom.point += center;
+	diff_geom.normal = diff_geom.normal.normalized();
+	diff_geom.geom_normal = diff_geom.geom_normal.normalized();
+}
+bool SphereCloud::occluded(const Ray &ray) const {
+	return traverse(ray, [&](int offset, int count){
+		std::array<float, 4> t;
+		for (int i = offset; i < offset + count; i += 4){
+			if (intersect_block(ray, i, std::min(4, offset + count - i), t)){
+				return true;
+			}
+		}
+		return false;
+	});
+}
+BBox SphereCloud::bound() const {
+	return nodes.empty() ? BBox{} : nodes[0].bounds;
+}
+void SphereCloud::refine(std::vector<Geometry*> &prims){
+	prims.push_back(this);
+}
+bool SphereCloud::bake_transform(const Transform &to_world, const Node &node){
+	if (baked_node && baked_node != &node){
+		return false;
+	}
+	const Transform t = to_world * baked_transform.inverse();
+	const float scale = t(Vector{1, 0, 0}).length();
+	if (std::abs(t(Vector{0, 1, 0}).length() - scale) > 1e-3f * scale
+		|| std::abs(t(Vector{0, 0, 1}).length() - scale) > 1e-3f * scale)
+	{
+		return false;
+	}
+	for (size_t i = 0; i < material.size(); ++i){
+		const Point p = t(Point{x[i], y[i], z[i]});
+		x[i] = p.x;
+		y[i] = p.y;
+		z[i] = p.z;
+		radius[i] *= scale;
+	}
+	baked_node = &node;
+	baked_transform = to_world;
+	build_bvh();
+	return true;
+}
+size_t SphereCloud::size() const {
+	return material.size();
+}
+void SphereCloud::build_bvh(){
+	std::vector<uint32_t> order(material.size());
+	std::iota(order.begin(), order.end(), 0);
+	nodes.clear();
+	if (!order.empty()){
+		build(order, 0, order.size(), 0);
+	}
+	nodes.shrink_to_fit();
+	reorder(x, order);
+	reorder(y, order);
+	reorder(z, order);
+	reorder(radius, order);
+	reorder(material, order);
+}
+int SphereCloud::build(std::vector<uint32_t> &order, int start, int end, int depth){
+	const int node = nodes.size();
+	nodes.emplace_back();
+	BBox box, centroids;
+	for (int i = start; i < end; ++i){
+		box = box.box_union(sphere_bound(order[i]));
+		centroids = centroids.box_union(Point{x[order[i]], y[order[i]], z[order[i]]});
+	}
+	nodes[node].bounds = box;
+	const int n = end - start;
+	const AXIS axis = centroids.max_extent();
+	int mid = -1;
+	//Past the point where only median splits fit in the remaining depth we just split in half or make a leaf
+	if (MAX_DEPTH - depth <= median_split_depth(n)){
+		if (n > MAX_LEAF_SPHERES){
+			mid = start + n / 2;
+			std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+				[&](uint32_t a, uint32_t b){
+					return Point{x[a], y[a], z[a]}[axis] < Point{x[b], y[b], z[b]}[axis];
+				});
+		}
+	}
+	else if (n > 1 && centroids.max[axis] > centroids.min[axis]){
+		//Bin the spheres by their centers and find the cheapest split between the buckets
+		const float scale = SAH_BUCKETS / (centroids.max[axis] - centroids.min[axis]);
+		auto bucket = [&](uint32_t s){
+			const Point c{x[s], y[s], z[s]};
+			return std::min(static_cast<int>((c[axis] - centroids.min[axis]) * scale), SAH_BUCKETS - 1);
+		};
+		std::array<int, SAH_BUCKETS> counts{};
+		std::array<BBox, SAH_BUCKETS> bounds;
+		for (int i = start; i < end; ++i){
+			const int b = bucket(order[i]);
+			++counts[b];
+			bounds[b] = bounds[b].box_union(sphere_bound(order[i]));
+		}
+		//The first and last buckets always hold a sphere so neither side of a split is empty
+		std::array<float, SAH_BUCKETS - 1> cost;
+		BBox b;
+		int c = 0;
+		for (int i = 0; i < SAH_BUCKETS - 1; ++i){
+			b = b.box_union(bounds[i]);
+			c += counts[i];
+			cost[i] = c * b.surface_area();
+		}
+		b = BBox{};
+		c = 0;
+		for (int i = SAH_BUCKETS - 1; i > 0; --i){
+			b = b.box_union(bounds[i]);
+			c += counts[i];
+			cost[i - 1] += c * b.surface_area();
+		}
+		const int best = std::min_element(cost.begin(), cost.end()) - cost.begin();
+		const float split_cost = 0.125f + cost[best] / box.surface_area();
+		if (n > MAX_LEAF_SPHERES || split_cost < n){
+			mid = std::partition(order.begin() + start, order.begin() + end,
+				[&](uint32_t s){ return bucket(s) <= best; }) - order.begin();
+		}
+	}
+	else if (n > MAX_LEAF_SPHERES){
+		//All the centers are at the same spot so just split the spheres in half
+		mid = start + n / 2;
+	}
+	if (mid == -1){
+		nodes[node].offset = start;
+		nodes[node].count = n;
+		return node;
+	}
+	nodes[node].count = 0;
+	nodes[node].axis = axis;
+	build(order, start, mid, depth + 1);
+	const int second = build(order, mid, end, depth + 1);
+	nodes[node].second_child = second;
+	return node;
+}
+BBox SphereCloud::sphere_bound(uint32_t i) const {
+	return BBox{Point{x[i] - radius[i], y[i] - radius[i], z[i] - radius[i]},
+		Point{x[i] + radius[i], y[i] + radius[i], z[i] + radius[i]}};
+}
+template<typename F>
+bool SphereCloud::traverse(const Ray &ray, const F &leaf) const {
+	if (nodes.empty()){
+		return false;
+	}
+	const Vector inv_dir{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
+	const std::array<int, 3> neg_dir = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
+	std::array<int, 64> todo;
+	int todo_offset = 0, current = 0;
+	while (true){
+		const CloudNode &node = nodes[current];
+		//Slab test against the node's bounds, as in BVH::fast_box_intersect
+		const BBox &b = node.bounds;
+		float t_min = (b[neg_dir[0]].x - ray.o.x) * inv_dir.x;
+		float t_max = (b[1 - neg_dir[0]].x - ray.o.x) * inv_dir.x;
+		t_min = std::max(t_min, (b[neg_dir[1]].y - ray.o.y) * inv_dir.y);
+		t_max = std::min(t_max, (b[1 - neg_dir[1]].y - ray.o.y) * inv_dir.y);
+		t_min = std::max(t_min, (b[neg_dir[2]].z - ray.o.z) * inv_dir.z);
+		t_max = std::min(t_max, (b[1 - neg_dir[2]].z - ray.o.z) * inv_dir.z);
+		if (t_min <= t_max && t_min < ray.max_t && t_max > ray.min_t){
+			if (node.count > 0){
+				if (leaf(node.offset, node.count)){
+					return true;
+				}
+				if (todo_offset == 0){
+					break;
+				}
+				current = todo[--todo_offset];
+			}
+			else if (neg_dir[node.axis]){
+				todo[todo_offset++] = current + 1;
+				current = node.second_child;
+			}
+			else {
+				todo[todo_offset++] = node.second_child;
+				current = current + 1;
+			}
+		}
+		else {
+			if (todo_offset == 0){
+				break;
+			}
+			current = todo[--todo_offset];
+		}
+	}
+	return false;
+}
+int SphereCloud::intersect_block(const Ray &ray, int i, int n, std::array<float, 4> &t) const {
+	//The same test as Sphere::intersect run on 4 spheres at once, with the ray moved to each center
+#if defined(__SSE__) || defined(_M_X64)
+	const __m128 ox = _mm_sub_ps(_mm_set1_ps(ray.o.x), _mm_loadu_ps(&x[i]));
+	const __m128 oy = _mm_sub_ps(_mm_set1_ps(ray.o.y), _mm_loadu_ps(&y[i]));
+	const __m128 oz = _mm_sub_ps(_mm_set1_ps(ray.o.z), _mm_loadu_ps(&z[i]));
+	const __m128 rad = _mm_loadu_ps(&radius[i]);
+	const __m128 a = _mm_set1_ps(ray.d.length_sqr());
+	const __m128 b = _mm_mul_ps(_mm_set1_ps(2), _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(ray.d.x), ox),
+		_mm_mul_ps(_mm_set1_ps(ray.d.y), oy)), _mm_mul_ps(_mm_set1_ps(ray.d.z), oz)));
+	const __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)),
+		_mm_mul_ps(oz, oz)), _mm_mul_ps(rad, rad));
+	const __m128 discrim = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_set1_ps(4), _mm_mul_ps(a, c)));
+	__m128 hit = _mm_cmpgt_ps(discrim, _mm_setzero_ps());
+	//q = -0.5 * (b + sign(b) * sqrt(discrim)) as in solve_quadratic
+	const __m128 sign_b = _mm_and_ps(b, _mm_set1_ps(-0.f));
+	const __m128 root = _mm_or_ps(_mm_sqrt_ps(_mm_max_ps(discrim, _mm_setzero_ps())), sign_b);
+	const __m128 q = _mm_mul_ps(_mm_set1_ps(-0.5f), _mm_add_ps(b, root));
+	const __m128 t0 = _mm_div_ps(q, a);
+	const __m128 t1 = _mm_div_ps(c, q);
+	const __m128 t_min = _mm_min_ps(t0, t1);
+	const __m128 t_max = _mm_max_ps(t0, t1);
+	//Take the far hit if the near one is before the ray's range
+	const __m128 near_ok = _mm_cmpge_ps(t_min, _mm_set1_ps(ray.min_t));
+	const __m128 dist = _mm_or_ps(_mm_and_ps(near_ok, t_min), _mm_andnot_ps(near_ok, t_max));
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(dist, _mm_set1_ps(ray.min_t)));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(dist, _mm_set1_ps(ray.max_t)));
+	_mm_storeu_ps(t.data(), dist);
+	//Mask off the spheres past the end of the leaf
+	return _mm_movemask_ps(hit) & ((1 << n) - 1);
+#else
+	int mask = 0;
+	for (int j = 0; j < n; ++j){
+		const Vector o{ray.o.x - x[i + j], ray.o.y - y[i + j], ray.o.z - z[i + j]};
+		float t0, t1;
+		if (!solve_quadratic(ray.d.length_sqr(), 2 * ray.d.dot(o), o.length_sqr() - radius[i + j] * radius[i + j], t0, t1)){
+			continue;
+		}
+		t[j] = t0 >= ray.min_t ? t0 : t1;
+		if (t[j] >= ray.min_t && t[j] <= ray.max_t){
+			mask |= 1 << j;
+		}
+	}
+	return mask;
+#endif
+}
+
@@ -1,19 +1,28 @@
+#include <functional>
 #include <regex>
 #include <fstream>
+#include <iostream>
 #include <array>
 #include <map>
 #include <cstdio>
 #include <vector>
+#include <algorithm>
 #include <string>
+#include <sys/stat.h>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
 #include "linalg/vector.h"
 #include "linalg/point.h"
 #include "linalg/util.h"
+#include "linalg/ray_packet.h"
 #include "monte_carlo/util.h"
 #include "monte_carlo/distribution1d.h"
 #include "accelerators/bvh.h"
 #include "geometry/bbox.h"
 #include "geometry/geometry.h"
 #include "geometry/tri_mesh.h"
+#include "geometry/mesh_simplify.h"
 
 //Various capture utilities for loading the wavefront obj format
 static Point capture_point2(const std::string &s);
@@ -23,7 +32,7 @@ static std::vector<std::string> capture_face(const std::string &s);
 static std::array<int, 3> capture_vertex(const std::string &s);
 
 Triangle::Triangle(int a, int b, int c, const TriMesh *mesh) : a(a), b(b), c(c), mesh(mesh){}
-bool Triangle::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
+bool Triangle::intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const {
 	const Point &pa = mesh->vertex(a);
 	const Point &pb = mesh->vertex(b);
 	const Point &pc = mesh->vertex(c);
@@ -40,7 +49,7 @@ bool Triangle::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
 	}
 	div = 1.f / div;
 	Vector d = ray.o - mesh->vertex(a);
-	std::array<float, 3> bary;
+	std::array<float, 2> bary;
 	bary[0] = d.dot(s[0]) * div;
 	//Check that the first barycentric coordinate is in the triangle bounds
 	if (bary[0] < -1e-8 || bary[0] > 1){
@@ -58,9 +67,22 @@ bool Triangle::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
 	if (t < ray.min_t || t > ray.max_t){
 		return false;
 	}
-	bary[2] = 1 - bary[0] - bary[1];
 	ray.max_t = t;
-	diff_geom.point = ray(t);
+	diff_geom.geom = this;
+	diff_geom.u = bary[0];
+	diff_geom.v = bary[1];
+	return true;
+}
+void Triangle::compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const {
+	const Point &pa = mesh->vertex(a);
+	const Point &pb = mesh->vertex(b);
+	const Point &pc = mesh->vertex(c);
+	const std::array<Vector, 2> e{
+		pb - pa,
+		pc - pa
+	};
+	const std::array<float, 3> bary{diff_geom.u, diff_geom.v, 1 - diff_geom.u - diff_geom.v};
+	diff_geom.point = ray(ray.max_t);
 
 	const Normal &na = mesh->normal(a);
 	const Normal &nb = mesh->normal(b);
@@ -106,8 +128,103 @@ bool Triangle::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
 	}
 	diff_geom.u = bary[2] * ta.x + bary[0] * tb.x + bary[1] * tc.x;
 	diff_geom.v = bary[2] * ta.y + bary[0] * tb.y + bary[1] * tc.y;
-	diff_geom.geom = this;
-	return true;
+}
+bool Triangle::occluded(const Ray &ray) const {
+	//Same test as intersect but we can stop once we know the hit is in range
+	const Point &pa = mesh->vertex(a);
+	const Point &pb = mesh->vertex(b);
+	const Point &pc = mesh->vertex(c);
+	const std::array<Vector, 2> e{
+		pb - pa,
+		pc - pa
+	};
+	Vector s0 = ray.d.cross(e[1]);
+	float div = s0.dot(e[0]);
+	if (div == 0){
+		return false;
+	}
+	div = 1.f / div;
+	Vector d = ray.o - pa;
+	float bary0 = d.dot(s0) * div;
+	if (bary0 < -1e-8 || bary0 > 1){
+		return false;
+	}
+	Vector s1 = d.cross(e[0]);
+	float bary1 = ray.d.dot(s1) * div;
+	if (bary1 < -1e-8 || bary0 + bary1 > 1){
+		return false;
+	}
+	float t = e[1].dot(s1) * div;
+	return t >= ray.min_t && t <= ray.max_t;
+}
+uint64_t Triangle::intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const {
+#if defined(__SSE__) || defined(_M_X64)
+	const Point &pa = mesh->vertex(a);
+	const Point &pb = mesh->vertex(b);
+	const Point &pc = mesh->vertex(c);
+	const Vector e0 = pb - pa;
+	const Vector e1 = pc - pa;
+	const __m128 e0_x = _mm_set1_ps(e0.x), e0_y = _mm_set1_ps(e0.y), e0_z = _mm_set1_ps(e0.z);
+	const __m128 e1_x = _mm_set1_ps(e1.x), e1_y = _mm_set1_ps(e1.y), e1_z = _mm_set1_ps(e1.z);
+	const __m128 one = _mm_set1_ps(1);
+	const __m128 bary_min = _mm_set1_ps(-1e-8f);
+	uint64_t hits = 0;
+	//Run the same test as intersect_hit on 4 rays at a time, this is the same arithmetic as the
+	//mesh's SoA triangle leaves use so rays traced in packets and on their own find the same hits
+	//The lanes are aligned so we may test some rays before first as well
+	for (int i = first & ~3; i < packet.size; i += 4){
+		const __m128 d_x = _mm_load_ps(&packet.d[0][i]);
+		const __m128 d_y = _mm_load_ps(&packet.d[1][i]);
+		const __m128 d_z = _mm_load_ps(&packet.d[2][i]);
+		//s0 = d x e1
+		const __m128 s0_x = _mm_sub_ps(_mm_mul_ps(d_y, e1_z), _mm_mul_ps(d_z, e1_y));
+		const __m128 s0_y = _mm_sub_ps(_mm_mul_ps(d_z, e1_x), _mm_mul_ps(d_x, e1_z));
+		const __m128 s0_z = _mm_sub_ps(_mm_mul_ps(d_x, e1_y), _mm_mul_ps(d_y, e1_x));
+		const __m128 div = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(_mm_mul_ps(s0_x, e0_x), _mm_mul_ps(s0_y, e0_y)),
+			_mm_mul_ps(s0_z, e0_z)));
+		const __m128 o_x = _mm_sub_ps(_mm_load_ps(&packet.o[0][i]), _mm_set1_ps(pa.x));
+		const __m128 o_y = _mm_sub_ps(_mm_load_ps(&packet.o[1][i]), _mm_set1_ps(pa.y));
+		const __m128 o_z = _mm_sub_ps(_mm_load_ps(&packet.o[2][i]), _mm_set1_ps(pa.z));
+		const __m128 bary0 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(o_x, s0_x), _mm_mul_ps(o_y, s0_y)),
+			_mm_mul_ps(o_z, s0_z)), div);
+		//s1 = o x e0
+		const __m128 s1_x = _mm_sub_ps(_mm_mul_ps(o_y, e0_z), _mm_mul_ps(o_z, e0_y));
+		const __m128 s1_y = _mm_sub_ps(_mm_mul_ps(o_z, e0_x), _mm_mul_ps(o_x, e0_z));
+		const __m128 s1_z = _mm_sub_ps(_mm_mul_ps(o_x, e0_y), _mm_mul_ps(o_y, e0_x));
+		const __m128 bary1 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d_x, s1_x), _mm_mul_ps(d_y, s1_y)),
+			_mm_mul_ps(d_z, s1_z)), div);
+		const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e1_x, s1_x), _mm_mul_ps(e1_y, s1_y)),
+			_mm_mul_ps(e1_z, s1_z)), div);
+		__m128 hit = _mm_and_ps(_mm_cmpge_ps(bary0, bary_min), _mm_cmple_ps(bary0, one));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(bary1, bary_min));
+		hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(bary0, bary1), one));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(t, _mm_load_ps(&packet.min_t[i])));
+		hit = _mm_and_ps(hit, _mm_cmple_ps(t, _mm_load_ps(&packet.max_t[i])));
+		int mask = _mm_movemask_ps(hit);
+		if (mask == 0){
+			continue;
+		}
+		alignas(16) std::array<float, 4> t_hit, bary0_hit, bary1_hit;
+		_mm_store_ps(t_hit.data(), t);
+		_mm_store_ps(bary0_hit.data(), bary0);
+		_mm_store_ps(bary1_hit.data(), bary1);
+		for (int j = 0; mask != 0; ++j, mask >>= 1){
+			if ((mask & 1) && i + j >= first && i + j < packet.size){
+				packet.max_t[i + j] = t_hit[j];
+				diff_geom[i + j].geom = this;
+				diff_geom[i + j].u = bary0_hit[j];
+				diff_geom[i + j].v = bary1_hit[j];
+				hits |= uint64_t{1} << (i + j);
+			}
+		}
+	}
+	return hits;
+#else
+	return Geometry::intersect_packet(packet, first, diff_geom);
+#endif
+}
+std::array<Point, 3> Triangle::vertices() const {
+	return {mesh->vertex(a), mesh->vertex(b), mesh->vertex(c)};
 }
 BBox Triangle::bound() const {
 	BBox box;
@@ -117,6 +234,44 @@ BBox Triangle::bound() const {
 void Triangle::refine(std::vector<Geometry*> &prims){
 	prims.push_back(this);
 }
+BBox Triangle::clipped_bound(const BBox &box) const {
+	//Clip the triangle against each plane of the box with Sutherland-Hodgman, each
+	//plane can add at most one vertex to the polygon
+	std::array<Point, 9> poly{mesh->vertex(a), mesh->vertex(b), mesh->vertex(c)};
+	std::array<Point, 9> clipped;
+	int nverts = 3;
+	for (int axis = 0; axis < 3 && nverts > 0; ++axis){
+		for (int side = 0; side < 2 && nverts > 0; ++side){
+			const float plane = box[side][axis];
+			auto inside = [axis, side, plane](const Point &p){
+				return side == 0 ? p[axis] >= plane : p[axis] <= plane;
+			};
+			int nclipped = 0;
+			for (int i = 0; i < nverts; ++i){
+				const Point &cur = poly[i];
+				const Point &next = poly[(i + 1) % nverts];
+				if (inside(cur)){
+					clipped[nclipped++] = cur;
+				}
+				//Add the point where the edge crosses the plane
+				if (inside(cur) != inside(next)){
+					float t = (plane - cur[axis]) / (next[axis] - cur[axis]);
+					Point p = cur + t * (next - cur);
+					p[axis] = plane;
+					clipped[nclipped++] = p;
+				}
+			}
+			poly.swap(clipped);
+			nverts = nclipped;
+		}
+	}
+	BBox clip_box;
+	for (int i = 0; i < nverts; ++i){
+		clip_box = clip_box.box_union(poly[i]);
+	}
+	//Make sure floating point error in the clipping doesn't push us out of the box
+	return clip_box.box_intersection(box);
+}
 float Triangle::surface_area() const {
 	const Point &pa = mesh->vertex(a);
 	const Point &pb = mesh->vertex(b);
@@ -137,25 +292,44 @@ Point Triangle::sample(const GeomSample &gs, Normal &normal) const {
 Point Triangle::sample(const Point &p, const GeomSample &gs, Normal &normal) const {
 	return Geometry::sample(p, gs, normal);
 }
+const TriMesh* Triangle::get_mesh() const {
+	return mesh;
+}
 
-TriMesh::TriMesh(const std::string &file, bool no_bobj) : light_info(nullptr){
-	load_model(file, no_bobj);
-	refine_tris();
-	std::vector<Geometry*> ref_tris;
-	refine(ref_tris);
-	bvh = BVH{ref_tris, SPLIT_METHOD::SAH, 32};
+TriMesh::TriMesh(const std::string &file, bool no_bobj, SPLIT_METHOD split, float dup_budget,
+	BVH_LAYOUT layout, bool quiet)
+	: light_info(nullptr), bvh_split(split), bvh_dup_budget(dup_budget), bvh_layout(layout), quiet(quiet),
+	baked_node(nullptr), lod_depth(0)
+{
+	//Binary meshes can restore their BVH from the file instead of building it
+	if (!load_model(file, no_bobj)){
+		if (tris.empty()){
+			refine_tris();
+		}
+		build_bvh();
+	}
 }
 TriMesh::TriMesh(const std::vector<Point> &verts, const std::vector<Point> &tex,
-	const std::vector<Normal> &norm, const std::vector<int> vert_idx) : light_info(nullptr),
-	vertices(verts), texcoords(tex), normals(norm), vert_indices(vert_idx)
+	const std::vector<Normal> &norm, const std::vector<int> vert_idx, SPLIT_METHOD split,
+	float dup_budget, BVH_LAYOUT layout, bool quiet)
+	: light_info(nullptr), vertices(verts), texcoords(tex), normals(norm), vert_indices(vert_idx),
+	bvh_split(split), bvh_dup_budget(dup_budget), bvh_layout(layout), quiet(quiet), baked_node(nullptr),
+	lod_depth(0)
 {
 	refine_tris();
-	std::vector<Geometry*> ref_tris;
-	refine(ref_tris);
-	bvh = BVH{ref_tris, SPLIT_METHOD::SAH, 32};
+	build_bvh();
 }
-bool TriMesh::intersect(Ray &ray, DifferentialGeometry &diff_geom) const {
-	return bvh.intersect(ray, diff_geom);
+bool TriMesh::intersect_hit(Ray &ray, DifferentialGeometry &diff_geom) const {
+	return select_lod(ray).bvh.intersect(ray, diff_geom);
+}
+void TriMesh::compute_shading_geometry(const Ray &ray, DifferentialGeometry &diff_geom) const {
+	diff_geom.geom->compute_shading_geometry(ray, diff_geom);
+}
+bool TriMesh::occluded(const Ray &ray) const {
+	return select_lod(ray).bvh.occluded(ray);
+}
+uint64_t TriMesh::intersect_packet(RayPacket &packet, int first, DifferentialGeometry *diff_geom) const {
+	return bvh.intersect(packet, first, diff_geom);
 }
 BBox TriMesh::bound() const {
 	return bvh.bounds();
@@ -211,31 +385,141 @@ bool TriMesh::attach_light(const Transform &to_world){
 	light_info = std::make_unique<MeshAreaLight>();
 	//Move the mesh into world space so we can get rid of any scaling and have proper
 	//surface area computation
-	for (auto &p : vertices){
-		p = to_world(p);
-	}
-	for (auto &n : normals){
-		n = to_world(n);
-	}
+	transform_mesh(to_world);
+	baked_transform = to_world * baked_transform;
 	light_info->total_area = 0;
 	for (const auto &t : tris){
 		light_info->tri_areas.push_back(t.surface_area());
 		light_info->total_area += light_info->tri_areas.back();
 	}
 	light_info->area_distribution = Distribution1D{light_info->tri_areas};
-	//Re-build the BVH in world space
-	std::vector<Geometry*> ref_tris;
-	refine(ref_tris);
-	bvh = BVH{ref_tris, SPLIT_METHOD::SAH, 32};
 	return true;
 }
+bool TriMesh::bake_transform(const Transform &to_world, const Node &node){
+	//Meshes with lights are already in world space and the triangles of meshes with levels
+	//of detail must be reached through the mesh to select the level
+	if (light_info || !lods.empty()){
+		return false;
+	}
+	transform_mesh(to_world * baked_transform.inverse());
+	baked_transform = to_world;
+	baked_node = &node;
+	return true;
+}
+const Node* TriMesh::get_baked_node() const {
+	return baked_node;
+}
+bool TriMesh::set_vertices(const std::vector<Point> &verts, const std::vector<Normal> &norms, float rebuild_ratio){
+	if (verts.size() != vertices.size() || (!norms.empty() && norms.size() != normals.size())){
+		std::cerr << "TriMesh error: vertex update has " << verts.size() << " vertices and "
+			<< norms.size() << " normals but the mesh has " << vertices.size() << " and "
+			<< normals.size() << "\n";
+		return false;
+	}
+	vertices = verts;
+	if (!norms.empty()){
+		normals = norms;
+	}
+	if (baked_node || light_info){
+		for (auto &p : vertices){
+			p = baked_transform(p);
+		}
+		for (size_t i = 0; i < norms.size(); ++i){
+			normals[i] = baked_transform(normals[i]);
+		}
+	}
+	if (light_info){
+		light_info->total_area = 0;
+		for (size_t i = 0; i < tris.size(); ++i){
+			light_info->tri_areas[i] = tris[i].surface_area();
+			light_info->total_area += light_info->tri_areas[i];
+		}
+		light_info->area_distribution = Distribution1D{light_info->tri_areas};
+	}
+	bvh.refit(rebuild_ratio);
+	//The simplified levels no longer match the mesh so they're simplified again from the new vertices
+	if (!lods.empty()){
+		generate_lods(lods.size(), lod_depth);
+	}
+	return true;
+}
+void TriMesh::generate_lods(int levels, int start_depth){
+	lods.clear();
+	lod_depth = start_depth;
+	for (int i = 0; i < levels; ++i){
+		const TriMesh &prev = lods.empty() ? *this : *lods.back();
+		std::vector<Point> verts = prev.vertices, tex = prev.texcoords;
+		std::vector<Normal> norms = prev.normals;
+		std::vector<int> indices = prev.vert_indices;
+		const size_t prev_tris = indices.size() / 3;
+		simplify_mesh(verts, tex, norms, indices, prev_tris / 4);
+		//Stop once the mesh can't be simplified much further
+		if (indices.empty() || indices.size() / 3 > prev_tris * 0.9f){
+			break;
+		}
+		lods.push_back(std::make_unique<TriMesh>(verts, tex, norms, indices, bvh_split, bvh_dup_budget, bvh_layout,
+			true));
+		if (!quiet){
+			std::cout << "Generated level of detail " << lods.size() << " with " << indices.size() / 3
+				<< " triangles" << std::endl;
+		}
+	}
+}
+const TriMesh& TriMesh::select_lod(const Ray &ray) const {
+	if (lods.empty()){
+		return *this;
+	}
+	//Rays cast from one of the levels' surfaces stay on that level so they don't
+	//hit the slightly offset surface of another level around their origin
+	if (ray.origin_geom){
+		if (owns_triangle(ray.origin_geom)){
+			return *this;
+		}
+		for (const auto &l : lods){
+			if (l->owns_triangle(ray.origin_geom)){
+				return *l;
+			}
+		}
+	}
+	if (ray.depth < lod_depth){
+		return *this;
+	}
+	return *lods[std::min(ray.depth - lod_depth, static_cast<int>(lods.size()) - 1)];
+}
+bool TriMesh::owns_triangle(const Geometry *geom) const {
+	if (tris.empty()){
+		return false;
+	}
+	const std::less<const Geometry*> less;
+	return !less(geom, &tris.front()) && !less(&tris.back(), geom);
+}
+void TriMesh::transform_mesh(const Transform &t){
+	for (auto &p : vertices){
+		p = t(p);
+	}
+	for (auto &n : normals){
+		n = t(n);
+	}
+	//Transforming the mesh keeps the triangles' neighbors the same so the BVH just has to
+	//be refit, parts distorted by the transform are still rebuilt
+	bvh.refit();
+	for (auto &l : lods){
+		l->transform_mesh(t);
+	}
+}
 void TriMesh::refine_tris(){
 	tris.reserve(vert_indices.size());
 	for (int i = 0; i < vert_indices.size(); i += 3){
 		tris.emplace_back(vert_indices[i], vert_indices[i + 1], vert_indices[i + 2], this);
 	}
 }
-void TriMesh::load_model(const std::string &file, bool no_bobj){
+void TriMesh::build_bvh(){
+	std::vector<Geometry*> ref_tris;
+	refine(ref_tris);
+	bvh = BVH{ref_tris, bvh_split, 32, bvh_layout, bvh_dup_budget, quiet};
+	bvh.build_triangle_leaves();
+}
+bool TriMesh::load_model(const std::string &file, bool no_bobj){
 	//First see if a binary obj file is available, if not fall back to wavefront obj
 	std::string file_bin = file.substr(0, file.rfind("obj")) + "bobj";
 	std::ifstream fbin{file_bin};
@@ -244,18 +528,27 @@ void TriMesh::load_model(const std::string &file, bool no_bobj){
 		if (!fin.good()){
 			std::cout << "Error: failed to load model " << file << std::endl;
 			std::exit(1);
-			return;
+			return false;
 		}
 		else {
 			fin.close();
 			load_wobj(file);
+			return false;
 		}
 	}
-	else {
+	if (!quiet){
 		std::cout << "Found optimized binary mesh file " << file_bin << std::endl;
-		fbin.close();
-		load_bobj(file_bin);
 	}
+	fbin.close();
+	//The stored BVH is only trusted if the binary file was written after the obj was last changed
+	struct stat obj_stat, bin_stat;
+	bool restore_bvh = stat(file_bin.c_str(), &bin_stat) == 0
+		&& (stat(file.c_str(), &obj_stat) != 0 || bin_stat.st_mtime >= obj_stat.st_mtime);
+	if (!restore_bvh && !quiet){
+		std::cout << "Binary mesh file " << file_bin << " is older than " << file
+			<< ", its BVH will be rebuilt" << std::endl;
+	}
+	return load_bobj(file_bin, restore_bvh);
 }
 void TriMesh::load_wobj(const std::string &file){
 	std::ifstream fin{file};
@@ -314,7 +607,7 @@ void TriMesh::load_wobj(const std::string &file){
 		}
 	}
 }
-void TriMesh::load_bobj(const std::string &file){
+bool TriMesh::load_bobj(const std::string &file, bool restore_bvh){
 	std::FILE *fin = std::fopen(file.c_str(), "rb");
 	uint32_t nverts = 0, ntris = 0;
 	std::fread(&nverts, sizeof(uint32_t), 1, fin);
@@ -327,7 +620,21 @@ void TriMesh::load_bobj(const std::string &file){
 	std::fread(texcoords.data(), sizeof(Point), nverts, fin);
 	std::fread(normals.data(), sizeof(Normal), nverts, fin);
 	std::fread(vert_indices.data(), sizeof(int), 3 * ntris, fin);
+	bool restored = false;
+	if (restore_bvh){
+		refine_tris();
+		std::vector<Geometry*> ref_tris;
+		refine(ref_tris);
+		restored = bvh.read(fin, ref_tris, bvh_split, bvh_layout, bvh_dup_budget);
+		if (restored){
+			bvh.build_triangle_leaves();
+			if (!quiet){
+				std::cout << "Restored BVH from binary mesh file " << file << std::endl;
+			}
+		}
+	}
 	std::fclose(fin);
+	return restored;
 }
 Point capture_point2(const std::string &s){
 	Point p;
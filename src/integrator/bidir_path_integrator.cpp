@@ -1,4 +1,6 @@
 #include <array>
+#include <vector>
+#include <algorithm>
 #include <cstring>
 #include "scene.h"
 #include "material/material.h"
@@ -7,28 +9,176 @@
 #include "lights/occlusion_tester.h"
 #include "material/bsdf.h"
 #include "renderer/renderer.h"
+#include "linalg/ray_batch.h"
 #include "integrator/bidir_path_integrator.h"
 
 BidirPathIntegrator::BidirPathIntegrator(int min_depth, int max_depth) : min_depth(min_depth), max_depth(max_depth){}
 Colorf BidirPathIntegrator::illumination(const Scene &scene, const Renderer &renderer, const RayDifferential &r,
 	DifferentialGeometry&, Sampler &sampler, MemoryPool &pool) const
 {
+	if (scene.get_light_cache().empty()){
+		return Colorf{0};
+	}
 	//TODO: It would be more efficient to trace the camera path of length max_depth - 1 and start from the
 	//differential geometry the renderer sends us, instead of re-finding the first hit in trace_path here
 	RayDifferential ray = r;
 	ray.max_t = std::numeric_limits<float>::infinity();
-	auto *cam_path = pool.alloc_array<PathVertex>(max_depth);
-	int cam_path_len = trace_path(scene, renderer, ray, Colorf{1}, sampler, pool, cam_path);
+	SubPath cam_path;
+	start_path(cam_path, ray, Colorf{1}, sampler, pool);
+	trace_path(cam_path, scene, renderer, sampler, pool);
 
-	//Now uniformly select a light to sample our light path from
+	//If the light would have no contribution them just do camera path tracing
+	RayDifferential ray_l;
+	Colorf light_weight;
+	if (!sample_light_ray(scene, r.time, sampler, pool, ray_l, light_weight)){
+		return camera_luminance(scene, renderer, cam_path.vertices, cam_path.len, sampler, pool);
+	}
+	//Trace a light path through the scene and then combine it with our camera path to compute
+	//the final illumination along the path
+	SubPath light_path;
+	start_path(light_path, ray_l, light_weight, sampler, pool);
+	trace_path(light_path, scene, renderer, sampler, pool);
+	return bidir_luminance(scene, renderer, cam_path.vertices, cam_path.len, light_path.vertices, light_path.len,
+		sampler, pool);
+}
+void BidirPathIntegrator::illumination(const Scene &scene, const Renderer &renderer, const RayDifferential *rays,
+	DifferentialGeometry **hits, int n, Colorf *illum, Sampler &sampler, MemoryPool &pool) const
+{
+	std::fill(illum, illum + n, Colorf{0});
+	if (scene.get_light_cache().empty()){
+		return;
+	}
+	//Trace all the camera paths together, then start and trace a light path for each of them
+	std::vector<SubPath> cam_paths, light_paths;
+	std::vector<int> cam_ray;
+	for (int i = 0; i < n; ++i){
+		if (hits[i]){
+			RayDifferential ray = rays[i];
+			ray.max_t = std::numeric_limits<float>::infinity();
+			cam_paths.emplace_back();
+			start_path(cam_paths.back(), ray, Colorf{1}, sampler, pool);
+			cam_ray.push_back(i);
+		}
+	}
+	trace_paths(cam_paths, scene, renderer, sampler, pool);
+	std::vector<int> light_path(cam_paths.size(), -1);
+	for (size_t i = 0; i < cam_paths.size(); ++i){
+		RayDifferential ray_l;
+		Colorf light_weight;
+		if (sample_light_ray(scene, rays[cam_ray[i]].time, sampler, pool, ray_l, light_weight)){
+			light_path[i] = light_paths.size();
+			light_paths.emplace_back();
+			start_path(light_paths.back(), ray_l, light_weight, sampler, pool);
+		}
+	}
+	trace_paths(light_paths, scene, renderer, sampler, pool);
+	for (size_t i = 0; i < cam_paths.size(); ++i){
+		const SubPath &cam = cam_paths[i];
+		if (light_path[i] == -1){
+			illum[cam_ray[i]] = camera_luminance(scene, renderer, cam.vertices, cam.len, sampler, pool);
+		}
+		else {
+			const SubPath &light = light_paths[light_path[i]];
+			illum[cam_ray[i]] = bidir_luminance(scene, renderer, cam.vertices, cam.len, light.vertices, light.len,
+				sampler, pool);
+		}
+	}
+}
+void BidirPathIntegrator::start_path(SubPath &path, const RayDifferential &ray, const Colorf &weight,
+	Sampler &sampler, MemoryPool &pool) const
+{
+	path.ray = ray;
+	path.throughput = weight;
+	path.vertices = pool.alloc_array<PathVertex>(max_depth);
+	path.len = 0;
+	path.samples_u = pool.alloc_array<std::array<float, 2>>(max_depth);
+	path.samples_comp = pool.alloc_array<float>(max_depth);
+	sampler.get_samples(path.samples_u, max_depth);
+	sampler.get_samples(path.samples_comp, max_depth);
+}
+void BidirPathIntegrator::trace_path(SubPath &path, const Scene &scene, const Renderer &renderer,
+	Sampler &sampler, MemoryPool &pool) const
+{
+	while (path.len < max_depth && scene.get_root().intersect(path.ray, path.vertices[path.len].dg)){
+		if (!extend_path(path, scene, renderer, sampler, pool)){
+			break;
+		}
+	}
+}
+void BidirPathIntegrator::trace_paths(std::vector<SubPath> &paths, const Scene &scene, const Renderer &renderer,
+	Sampler &sampler, MemoryPool &pool) const
+{
+	RayBatch batch;
+	std::vector<int> order;
+	for (size_t i = 0; i < paths.size(); ++i){
+		if (paths[i].len < max_depth){
+			batch.push(paths[i].ray, i);
+		}
+	}
+	while (!batch.empty()){
+		batch.sort(order);
+		batch.clear();
+		for (int i : order){
+			SubPath &path = paths[i];
+			if (scene.get_root().intersect(path.ray, path.vertices[path.len].dg)
+				&& extend_path(path, scene, renderer, sampler, pool))
+			{
+				batch.push(path.ray, i);
+			}
+		}
+	}
+}
+bool BidirPathIntegrator::extend_path(SubPath &path, const Scene &scene, const Renderer &renderer,
+	Sampler &sampler, MemoryPool &pool) const
+{
+	//This is identical to what we do in the path integrator but we don't do any lighting computation
+	//just save information about the vertices we hit to make the path
+	const int path_len = path.len;
+	PathVertex &v = path.vertices[path_len];
+	if (!v.dg.node->get_material()){
+		return false;
+	}
+	v.throughput = path.throughput;
+	v.dg.compute_differentials(path.ray);
+	BSDF *bsdf = v.dg.node->get_material()->get_bsdf(v.dg, pool);
+	v.bsdf = bsdf;
+	v.w_o = -path.ray.d;
+	float pdf_val = 0;
+	BxDFTYPE sampled_type;
+	Colorf f = bsdf->sample(v.w_o, v.w_i, path.samples_u[path_len], path.samples_comp[path_len],
+		pdf_val, BxDFTYPE::ALL, &sampled_type);
+	v.specular_bounce = (sampled_type & BxDFTYPE::SPECULAR) != 0;
+	v.num_specular_comp = bsdf->num_bxdfs(BxDFTYPE(BxDFTYPE::SPECULAR | BxDFTYPE::REFLECTION | BxDFTYPE::TRANSMISSION));
+	++path.len;
+
+	//If there's no further illumination that will come from this vertex we can stop
+	if (f.is_black() || pdf_val == 0){
+		return false;
+	}
+	//Check if we should terminate the path using Russian roulette after reaching min_depth
+	Colorf survival_weight = f * std::abs(v.w_i.dot(v.bsdf->dg.normal)) / pdf_val;
+	path.throughput *= survival_weight;
+	if (path_len > min_depth){
+		float cont_prob = std::min(1.f, survival_weight.luminance());
+		if (sampler.random_float() > cont_prob){
+			return false;
+		}
+		path.throughput /= cont_prob;
+	}
+	path.throughput *= renderer.transmittance(scene, path.ray, sampler, pool);
+	path.ray = RayDifferential{v.bsdf->dg.point, v.w_i, path.ray, 0.001};
+	path.ray.origin_geom = v.bsdf->dg.geom;
+	return path.len < max_depth;
+}
+bool BidirPathIntegrator::sample_light_ray(const Scene &scene, float time, Sampler &sampler, MemoryPool &pool,
+	RayDifferential &ray, Colorf &weight) const
+{
+	//Uniformly select a light to sample our light path from
 	auto *l_samples_u = pool.alloc_array<std::array<float, 2>>(2);
 	auto *l_samples_comp = pool.alloc_array<float>(2);
 	sampler.get_samples(l_samples_u, 2);
 	sampler.get_samples(l_samples_comp, 2);
 	int n_lights = scene.get_light_cache().size();
-	if (n_lights == 0){
-		return Colorf{0};
-	}
 	int light_num = static_cast<int>(l_samples_comp[0] * n_lights);
 	light_num = std::min(light_num, n_lights - 1);
 	//The unordered map isn't a random access container, so 'find' the light_num light
@@ -41,66 +191,14 @@ Colorf BidirPathIntegrator::illumination(const Scene &scene, const Renderer &ren
 	Ray ray_l;
 	Normal n_l;
 	float pdf_light = 0;
-	Colorf light_weight = light.sample(scene, LightSample{l_samples_u[0], l_samples_comp[1]},
-		l_samples_u[1], ray_l, n_l, pdf_light);
-	//If the light would have no contribution them just do camera path tracing
-	if (light_weight.is_black() || pdf_light == 0){
-		return camera_luminance(scene, renderer, cam_path, cam_path_len, sampler, pool);
-	}
-	//Trace a light path through the scene and then combine it with our camera path to compute
-	//the final illumination along the path
-	light_weight *= std::abs(ray_l.d.dot(n_l.normalized())) / pdf_light;
-	auto *light_path = pool.alloc_array<PathVertex>(max_depth);
-	int light_path_len = trace_path(scene, renderer, RayDifferential{ray_l}, light_weight, sampler, pool, light_path);
-	return bidir_luminance(scene, renderer, cam_path, cam_path_len, light_path, light_path_len, sampler, pool);
-}
-int BidirPathIntegrator::trace_path(const Scene &scene, const Renderer &renderer, const RayDifferential &r, const Colorf &weight,
-	Sampler &sampler, MemoryPool &pool, PathVertex *path_vertices) const
-{
-	//This is identical to what we do in the path integrator but we don't do any lighting computation
-	//just save information about the vertices we hit to make the path
-	auto *path_samples_u = pool.alloc_array<std::array<float, 2>>(max_depth);
-	auto *path_samples_comp = pool.alloc_array<float>(max_depth);
-	sampler.get_samples(path_samples_u, max_depth);
-	sampler.get_samples(path_samples_comp, max_depth);
-	RayDifferential ray{r};
-	Colorf path_throughput{weight};
-	int path_len = 0;
-	for (; path_len < max_depth; ++path_len){
-		PathVertex &v = path_vertices[path_len];
-		if (!scene.get_root().intersect(ray, v.dg) || !v.dg.node->get_material()){
-			break;
-		}
-		v.throughput = path_throughput;
-		v.dg.compute_differentials(ray);
-		BSDF *bsdf = v.dg.node->get_material()->get_bsdf(v.dg, pool);
-		v.bsdf = bsdf;
-		v.w_o = -ray.d;
-		float pdf_val = 0;
-		BxDFTYPE sampled_type;
-		Colorf f = bsdf->sample(v.w_o, v.w_i, path_samples_u[path_len], path_samples_comp[path_len],
-			pdf_val, BxDFTYPE::ALL, &sampled_type);
-		v.specular_bounce = (sampled_type & BxDFTYPE::SPECULAR) != 0;
-		v.num_specular_comp = bsdf->num_bxdfs(BxDFTYPE(BxDFTYPE::SPECULAR | BxDFTYPE::REFLECTION | BxDFTYPE::TRANSMISSION));
-
-		//If there's no further illumination that will come from this vertex we can stop
-		if (f.is_black() || pdf_val == 0){
-			return path_len + 1;
-		}
-		//Check if we should terminate the path using Russian roulette after reaching min_depth
-		Colorf survival_weight = f * std::abs(v.w_i.dot(v.bsdf->dg.normal)) / pdf_val;
-		path_throughput *= survival_weight;
-		if (path_len > min_depth){
-			float cont_prob = std::min(1.f, survival_weight.luminance());
-			if (sampler.random_float() > cont_prob){
-				return path_len + 1;
-			}
-			path_throughput /= cont_prob;
-		}
-		path_throughput *= renderer.transmittance(scene, ray, sampler, pool);
-		ray = RayDifferential{v.bsdf->dg.point, v.w_i, ray, 0.001};
+	weight = light.sample(scene, LightSample{l_samples_u[0], l_samples_comp[1]}, l_samples_u[1], ray_l, n_l, pdf_light);
+	if (weight.is_black() || pdf_light == 0){
+		return false;
 	}
-	return path_len;
+	weight *= std::abs(ray_l.d.dot(n_l.normalized())) / pdf_light;
+	ray_l.time = time;
+	ray = RayDifferential{ray_l};
+	return true;
 }
 Colorf BidirPathIntegrator::camera_luminance(const Scene &scene, const Renderer &renderer, const PathVertex *path_vertices,
 	int path_len, Sampler &sampler, MemoryPool &pool) const
@@ -194,9 +292,9 @@ Colorf BidirPathIntegrator::bidir_luminance(const Scene &scene, const Renderer &
 						continue;
 					}
 					//Visibility test for the vertices on the camera and light path we're trying to connect
-					Ray vis{p_c, p_l - p_c, 0.001, 0.999};
-					DifferentialGeometry dg;
-					if (!scene.get_root().intersect(vis, dg)){
+					Ray vis{p_c, p_l - p_c, 0.001, 0.999, 0, v_c.bsdf->dg.time};
+					vis.origin_geom = v_c.bsdf->dg.geom;
+					if (!scene.get_root().occluded(vis)){
 						//TODO: multiple importance sampling?
 						float weight = 1.f / (i + j + 2 - num_spec_verts[i + j + 2]);
 						float geom_term = std::abs(w.dot(n_c)) * std::abs(w.dot(n_l)) / p_l.distance_sqr(p_c);
@@ -1,4 +1,5 @@
 #include <array>
+#include <vector>
 #include "scene.h"
 #include "material/material.h"
 #include "lights/light.h"
@@ -6,94 +7,134 @@
 #include "lights/occlusion_tester.h"
 #include "material/bsdf.h"
 #include "renderer/renderer.h"
+#include "linalg/ray_batch.h"
 #include "integrator/path_integrator.h"
 
 PathIntegrator::PathIntegrator(int min_depth, int max_depth) : min_depth(min_depth), max_depth(max_depth){}
 Colorf PathIntegrator::illumination(const Scene &scene, const Renderer &renderer, const RayDifferential &r,
 	DifferentialGeometry &dg, Sampler &sampler, MemoryPool &pool) const
 {
-	//Allocate and generate samples for lights and bsdfs and path directions
-	auto *l_samples_u = pool.alloc_array<std::array<float, 2>>(max_depth + 1);
-	auto *l_samples_comp = pool.alloc_array<float>(max_depth + 1);
-	auto *bsdf_samples_u = pool.alloc_array<std::array<float, 2>>(max_depth + 1);
-	auto *bsdf_samples_comp = pool.alloc_array<float>(max_depth + 1);
-	auto *path_samples_u = pool.alloc_array<std::array<float, 2>>(max_depth + 1);
-	auto *path_samples_comp = pool.alloc_array<float>(max_depth + 1);
-	sampler.get_samples(l_samples_u, max_depth + 1);
-	sampler.get_samples(l_samples_comp, max_depth + 1);
-	sampler.get_samples(bsdf_samples_u, max_depth + 1);
-	sampler.get_samples(bsdf_samples_comp, max_depth + 1);
-	sampler.get_samples(path_samples_u, max_depth + 1);
-	sampler.get_samples(path_samples_comp, max_depth + 1);
-
-	//Path throughput is the current product of bsdf values and geometry terms so far,
-	//divided by their pdfs. illum is the current illumination along the path
-	Colorf path_throughput{1}, illum;
-	//Current ray to find next path point
-	RayDifferential ray{r};
-	//If the last bounce was a specular one
-	bool specular_bounce = false;
-	//The current piece of geometry hit
-	DifferentialGeometry dg_current = dg;
-	for (int bounce = 0; ; ++bounce){
-		//Sample emissive objects on the first ray for directly visible ones or in the case of
-		//specular bounces, as we don't compute them in estimate direct
-		if (bounce == 0 || specular_bounce){
-			const AreaLight *area_light = dg_current.node->get_area_light();
-			if (area_light){
-				illum += path_throughput * area_light->radiance(dg_current.point, dg_current.normal, -ray.d);
-			}
+	PathState path;
+	start_path(path, r, dg, sampler, pool);
+	for (int bounce = 0; shade_vertex(path, bounce, scene, renderer, sampler, pool); ++bounce){
+		//Find the next vertex on the path
+		if (!scene.get_root().intersect(path.ray, path.dg)){
+			//Should do direct sampling of all lights here if specular bounce
+			break;
 		}
-		if (!dg_current.node->get_material()){
-			return illum;
+		path.throughput *= renderer.transmittance(scene, path.ray, sampler, pool);
+	}
+	return path.illum;
+}
+void PathIntegrator::illumination(const Scene &scene, const Renderer &renderer, const RayDifferential *rays,
+	DifferentialGeometry **hits, int n, Colorf *illum, Sampler &sampler, MemoryPool &pool) const
+{
+	std::vector<PathState> paths(n);
+	//Paths still being traced, kept in the order their last rays were traced in
+	std::vector<int> active, order;
+	for (int i = 0; i < n; ++i){
+		if (hits[i]){
+			start_path(paths[i], rays[i], *hits[i], sampler, pool);
+			active.push_back(i);
 		}
-		//Get the hit point information
-		dg_current.compute_differentials(ray);
-		BSDF *bsdf = dg_current.node->get_material()->get_bsdf(dg_current, pool);
-		const Point &p = bsdf->dg.point;
-		const Normal &n = bsdf->dg.normal;
-		Vector w_o = -ray.d;
-
-		//Uniformly sample one of the lights contribution to the point
-		illum += path_throughput * uniform_sample_one_light(scene, renderer, p, n, w_o, *bsdf,
-			LightSample{l_samples_u[bounce], l_samples_comp[bounce]},
-			BSDFSample{bsdf_samples_u[bounce], bsdf_samples_comp[bounce]}, sampler, pool);
-
-		//Determine our new path direction by sampling the BSDF
-		Vector w_i;
-		float pdf_val = 0;
-		BxDFTYPE sampled_type;
-		Colorf f = bsdf->sample(w_o, w_i, path_samples_u[bounce], path_samples_comp[bounce],
-			pdf_val, BxDFTYPE::ALL, &sampled_type);
-		//If there's no further illumination or probability for this path, we can stop
-		if (f.is_black() || pdf_val == 0){
-			break;
+	}
+	RayBatch batch;
+	for (int bounce = 0; !active.empty(); ++bounce){
+		batch.clear();
+		for (int i : active){
+			if (shade_vertex(paths[i], bounce, scene, renderer, sampler, pool)){
+				batch.push(paths[i].ray, i);
+			}
 		}
-		specular_bounce = (sampled_type & BxDFTYPE::SPECULAR) != 0;
-		path_throughput *= f * std::abs(w_i.dot(n)) / pdf_val;
-		ray = RayDifferential{p, w_i, ray, 0.001};
-
-		//Check if we're at a point where we should start considering to terminate the path
-		//or have hit max depth and need to stop
-		if (bounce > min_depth){
-			float cont_prob = std::min(0.5f, path_throughput.luminance());
-			if (sampler.random_float() > cont_prob){
-				break;
+		//Find the next vertices on the paths, tracing the rays sorted by origin and direction
+		batch.sort(order);
+		active.clear();
+		for (int i : order){
+			PathState &path = paths[i];
+			if (scene.get_root().intersect(path.ray, path.dg)){
+				path.throughput *= renderer.transmittance(scene, path.ray, sampler, pool);
+				active.push_back(i);
 			}
-			//Re-weight sum terms accordingly with Russian roulette weight
-			path_throughput /= cont_prob;
 		}
-		if (bounce == max_depth){
-			break;
+	}
+	for (int i = 0; i < n; ++i){
+		illum[i] = hits[i] ? paths[i].illum : Colorf{0};
+	}
+}
+void PathIntegrator::start_path(PathState &path, const RayDifferential &ray, const DifferentialGeometry &dg,
+	Sampler &sampler, MemoryPool &pool) const
+{
+	//Allocate and generate samples for lights and bsdfs and path directions
+	path.l_samples_u = pool.alloc_array<std::array<float, 2>>(max_depth + 1);
+	path.l_samples_comp = pool.alloc_array<float>(max_depth + 1);
+	path.bsdf_samples_u = pool.alloc_array<std::array<float, 2>>(max_depth + 1);
+	path.bsdf_samples_comp = pool.alloc_array<float>(max_depth + 1);
+	path.path_samples_u = pool.alloc_array<std::array<float, 2>>(max_depth + 1);
+	path.path_samples_comp = pool.alloc_array<float>(max_depth + 1);
+	sampler.get_samples(path.l_samples_u, max_depth + 1);
+	sampler.get_samples(path.l_samples_comp, max_depth + 1);
+	sampler.get_samples(path.bsdf_samples_u, max_depth + 1);
+	sampler.get_samples(path.bsdf_samples_comp, max_depth + 1);
+	sampler.get_samples(path.path_samples_u, max_depth + 1);
+	sampler.get_samples(path.path_samples_comp, max_depth + 1);
+	path.throughput = Colorf{1};
+	path.illum = Colorf{0};
+	path.ray = ray;
+	path.dg = dg;
+	path.specular_bounce = false;
+}
+bool PathIntegrator::shade_vertex(PathState &path, int bounce, const Scene &scene, const Renderer &renderer,
+	Sampler &sampler, MemoryPool &pool) const
+{
+	DifferentialGeometry &dg_current = path.dg;
+	//Sample emissive objects on the first ray for directly visible ones or in the case of
+	//specular bounces, as we don't compute them in estimate direct
+	if (bounce == 0 || path.specular_bounce){
+		const AreaLight *area_light = dg_current.node->get_area_light();
+		if (area_light){
+			path.illum += path.throughput * area_light->radiance(dg_current.point, dg_current.normal, -path.ray.d);
 		}
+	}
+	if (!dg_current.node->get_material()){
+		return false;
+	}
+	//Get the hit point information
+	dg_current.compute_differentials(path.ray);
+	BSDF *bsdf = dg_current.node->get_material()->get_bsdf(dg_current, pool);
+	const Point &p = bsdf->dg.point;
+	const Normal &n = bsdf->dg.normal;
+	Vector w_o = -path.ray.d;
 
-		//Find the next vertex on the path
-		if (!scene.get_root().intersect(ray, dg_current)){
-			//Should do direct sampling of all lights here if specular bounce
-			break;
+	//Uniformly sample one of the lights contribution to the point
+	path.illum += path.throughput * uniform_sample_one_light(scene, renderer, p, n, w_o, *bsdf,
+		LightSample{path.l_samples_u[bounce], path.l_samples_comp[bounce]},
+		BSDFSample{path.bsdf_samples_u[bounce], path.bsdf_samples_comp[bounce]}, sampler, pool);
+
+	//Determine our new path direction by sampling the BSDF
+	Vector w_i;
+	float pdf_val = 0;
+	BxDFTYPE sampled_type;
+	Colorf f = bsdf->sample(w_o, w_i, path.path_samples_u[bounce], path.path_samples_comp[bounce],
+		pdf_val, BxDFTYPE::ALL, &sampled_type);
+	//If there's no further illumination or probability for this path, we can stop
+	if (f.is_black() || pdf_val == 0){
+		return false;
+	}
+	path.specular_bounce = (sampled_type & BxDFTYPE::SPECULAR) != 0;
+	path.throughput *= f * std::abs(w_i.dot(n)) / pdf_val;
+	path.ray = RayDifferential{p, w_i, path.ray, 0.001};
+	path.ray.origin_geom = bsdf->dg.geom;
+
+	//Check if we're at a point where we should start considering to terminate the path
+	//or have hit max depth and need to stop
+	if (bounce > min_depth){
+		float cont_prob = std::min(0.5f, path.throughput.luminance());
+		if (sampler.random_float() > cont_prob){
+			return false;
 		}
-		path_throughput *= renderer.transmittance(scene, ray, sampler, pool);
+		//Re-weight sum terms accordingly with Russian roulette weight
+		path.throughput /= cont_prob;
 	}
-	return illum;
+	return bounce != max_depth;
 }
 
@@ -1,4 +1,7 @@
 #include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
 #include <chrono>
 #include <random>
 #include <array>
@@ -6,6 +9,7 @@
 #include "scene.h"
 #include "linalg/ray.h"
 #include "geometry/differential_geometry.h"
+#include "geometry/mesh_proxy.h"
 #include "memory_pool.h"
 #include "samplers/ld_sampler.h"
 #include "lights/light.h"
@@ -66,6 +70,9 @@ void PhotonMapIntegrator::ShootingTask::shoot(){
 			trace_photon(ray, weight, caustic_done, indirect_done, *sampler, pool);
 			pool.free_blocks();
 		}
+		//The photons only keep the positions they hit so the proxy meshes this batch
+		//reached can be evicted again while the other threads keep shooting
+		MeshProxy::release_pinned();
 		int num_caustic = integrator.num_caustic.fetch_add(batch_size, std::memory_order_acq_rel) + batch_size;
 		int num_indirect = integrator.num_indirect.fetch_add(batch_size, std::memory_order_acq_rel) + batch_size;
 		integrator.num_direct.fetch_add(batch_size, std::memory_order_acq_rel);
@@ -157,6 +164,7 @@ void PhotonMapIntegrator::ShootingTask::trace_photon(const RayDifferential &r, C
 			break;
 		}
 		ray = RayDifferential{dg.point, w_i, ray, 0.001};
+		ray.origin_geom = dg.geom;
 	}
 }
 
@@ -322,6 +330,53 @@ void PhotonMapIntegrator::preprocess(const Scene &scene){
 	//We're done with the direct map now
 	direct_map = nullptr;
 }
+bool PhotonMapIntegrator::save_state(std::FILE *f) const {
+	const int32_t paths[] = {caustic_paths, indirect_paths};
+	std::fwrite(paths, sizeof(int32_t), 2, f);
+	write_map(f, caustic_map.get());
+	write_map(f, indirect_map.get());
+	write_map(f, radiance_map.get());
+	return std::ferror(f) == 0;
+}
+bool PhotonMapIntegrator::load_state(std::FILE *f, const Scene&){
+	int32_t paths[2];
+	if (std::fread(paths, sizeof(int32_t), 2, f) != 2 || !read_map(f, caustic_map) || !read_map(f, indirect_map)
+		|| !read_map(f, radiance_map))
+	{
+		return false;
+	}
+	caustic_paths = paths[0];
+	indirect_paths = paths[1];
+	num_caustic.store(caustic_paths, std::memory_order_release);
+	num_indirect.store(indirect_paths, std::memory_order_release);
+	std::cout << "PhotonMapIntegrator: restored photon maps from checkpoint" << std::endl;
+	return true;
+}
+template<typename P>
+void PhotonMapIntegrator::write_map(std::FILE *f, const KdPointTree<P> *map){
+	const uint32_t count = map ? map->get_points().size() : 0;
+	std::fwrite(&count, sizeof(uint32_t), 1, f);
+	if (count > 0){
+		std::fwrite(map->get_points().data(), sizeof(P), count, f);
+	}
+}
+template<typename P>
+bool PhotonMapIntegrator::read_map(std::FILE *f, std::unique_ptr<KdPointTree<P>> &map){
+	uint32_t count = 0;
+	if (std::fread(&count, sizeof(uint32_t), 1, f) != 1){
+		return false;
+	}
+	map = nullptr;
+	if (count == 0){
+		return true;
+	}
+	std::vector<P> points(count);
+	if (std::fread(points.data(), sizeof(P), count, f) != count){
+		return false;
+	}
+	map = std::make_unique<KdPointTree<P>>(points);
+	return true;
+}
 Colorf PhotonMapIntegrator::illumination(const Scene &scene, const Renderer &renderer, const RayDifferential &ray,
 	DifferentialGeometry &dg, Sampler &sampler, MemoryPool &pool) const
 {
@@ -66,6 +66,7 @@ Colorf SingleScatteringIntegrator::radiance(const Scene &scene, const Renderer &
 			OcclusionTester occlusion;
 			Vector v;
 			Colorf light_rad = light.sample(p, LightSample{l_samples_u[i], l_samples_comp[i]}, v, pdf_val, occlusion);
+			occlusion.ray.time = ray.time;
 			if (!light_rad.is_black() && pdf_val > 0 && !occlusion.occluded(scene)){
 				Colorf light_direct = light_rad * occlusion.transmittance(scene, renderer, sampler, pool);
 				Colorf s = transmit * scatter * vol->phase(p, w_o, -v) * light_direct * n_lights / pdf_val;
@@ -7,6 +7,20 @@
 #include "integrator/surface_integrator.h"
 
 void SurfaceIntegrator::preprocess(const Scene&){}
+bool SurfaceIntegrator::save_state(std::FILE*) const {
+	return true;
+}
+bool SurfaceIntegrator::load_state(std::FILE*, const Scene &scene){
+	preprocess(scene);
+	return true;
+}
+void SurfaceIntegrator::illumination(const Scene &scene, const Renderer &renderer, const RayDifferential *rays,
+	DifferentialGeometry **hits, int n, Colorf *illum, Sampler &sampler, MemoryPool &pool) const
+{
+	for (int i = 0; i < n; ++i){
+		illum[i] = hits[i] ? illumination(scene, renderer, rays[i], *hits[i], sampler, pool) : Colorf{0};
+	}
+}
 Colorf SurfaceIntegrator::spec_reflect(const RayDifferential &ray, const BSDF &bsdf, const Renderer &renderer,
 	const Scene &scene, Sampler &sampler, MemoryPool &pool)
 {
@@ -25,6 +39,7 @@ Colorf SurfaceIntegrator::spec_reflect(const RayDifferential &ray, const BSDF &b
 		BxDFTYPE(BxDFTYPE::REFLECTION | BxDFTYPE::SPECULAR));
 	if (pdf_val > 0 && !f.is_black() && std::abs(w_i.dot(n)) != 0){
 		RayDifferential refl{p, w_i, ray, 0.001};
+		refl.origin_geom = bsdf.dg.geom;
 		if (ray.has_differentials()){
 			refl.rx = Ray{p + bsdf.dg.dp_dx, w_i, ray, 0.001};
 			refl.ry = Ray{p + bsdf.dg.dp_dy, w_i, ray, 0.001};
@@ -62,6 +77,7 @@ Colorf SurfaceIntegrator::spec_transmit(const RayDifferential &ray, const BSDF &
 	Colorf transmitted{0};
 	if (pdf_val > 0 && !f.is_black() && std::abs(w_i.dot(n)) != 0){
 		RayDifferential refr_ray{p, w_i, ray, 0.001};
+		refr_ray.origin_geom = bsdf.dg.geom;
 		if (ray.has_differentials()){
 			refr_ray.rx = Ray{p + bsdf.dg.dp_dx, w_i, ray, 0.001};
 			refr_ray.ry = Ray{p + bsdf.dg.dp_dy, w_i, ray, 0.001};
@@ -142,6 +158,8 @@ Colorf SurfaceIntegrator::estimate_direct(const Scene &scene, const Renderer &re
 	OcclusionTester occlusion;
 	//Sample the light
 	Colorf li = light.sample(p, l_sample, w_i, pdf_light, occlusion);
+	occlusion.ray.time = bsdf.dg.time;
+	occlusion.ray.origin_geom = bsdf.dg.geom;
 	if (pdf_light > 0 && !li.is_black()){
 		Colorf f = bsdf(w_o, w_i, flags);
 		if (!f.is_black() && !occlusion.occluded(scene)){
@@ -176,6 +194,8 @@ Colorf SurfaceIntegrator::estimate_direct(const Scene &scene, const Renderer &re
 			DifferentialGeometry dg;
 			Colorf li;
 			RayDifferential ray{p, w_i, 0.001};
+			ray.time = bsdf.dg.time;
+			ray.origin_geom = bsdf.dg.geom;
 			if (scene.get_root().intersect(ray, dg)){
 				if (dg.node->get_area_light() == &light){
 					li = dg.node->get_area_light()->radiance(dg.point, dg.normal, -w_i);
@@ -34,6 +34,8 @@ Colorf WhittedIntegrator::illumination(const Scene &scene, const Renderer &rende
 		float pdf_val = 0;
 		OcclusionTester occlusion;
 		Colorf li = l.second->sample(bsdf->dg.point, lsample, w_i, pdf_val, occlusion);
+		occlusion.ray.time = bsdf->dg.time;
+		occlusion.ray.origin_geom = bsdf->dg.geom;
 		//If there's no light or no probability for this sample there's no illumination
 		if (li.luminance() == 0 || pdf_val == 0){
 			continue;
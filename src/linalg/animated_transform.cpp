@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "linalg/animated_transform.h"
 
 AnimatedTransform::AnimatedTransform(const Transform &start_transform, float start_time,
@@ -16,9 +17,11 @@ Transform AnimatedTransform::interpolate(float t) const {
 void AnimatedTransform::interpolate(float t, Transform &transform) const {
 	if (!animated || t <= start_time){
 		transform = start_transform;
+		return;
 	}
 	if (t >= end_time){
 		transform = end_transform;
+		return;
 	}
 	float dt = (t - start_time) / (end_time - start_time);
 	Vector trans = (1 - dt) * translation[0] + dt * translation[1];
@@ -33,16 +36,41 @@ void AnimatedTransform::interpolate(float t, Transform &transform) const {
 }
 BBox AnimatedTransform::motion_bound(const BBox &b) const {
 	if (!animated){
-		return start_transform.inverse()(b);
+		return start_transform(b);
 	}
 	BBox ret;
-	for (int i = 0; i < 128; ++i){
-		float time = lerp(i / 127.f, start_time, end_time);
+	for (int i = 0; i < MOTION_SAMPLES; ++i){
+		float time = lerp(i / (MOTION_SAMPLES - 1.f), start_time, end_time);
 		Transform t = interpolate(time);
 		ret = ret.box_union(t(b));
 	}
 	return ret;
 }
+void AnimatedTransform::linear_motion_bound(const BBox &b, BBox &start, BBox &end) const {
+	start = start_transform(b);
+	end = end_transform(b);
+	if (!animated){
+		return;
+	}
+	//Find how far the box at each time pokes out of the interpolated start and end boxes,
+	//growing both ends by the max amount pushes the interpolated box out by it at every time
+	Vector grow_min, grow_max;
+	for (int i = 1; i < MOTION_SAMPLES - 1; ++i){
+		float dt = i / (MOTION_SAMPLES - 1.f);
+		BBox box = interpolate(lerp(dt, start_time, end_time))(b);
+		for (int a = 0; a < 3; ++a){
+			grow_min[a] = std::max(grow_min[a], lerp(dt, start.min[a], end.min[a]) - box.min[a]);
+			grow_max[a] = std::max(grow_max[a], box.max[a] - lerp(dt, start.max[a], end.max[a]));
+		}
+	}
+	start.min -= grow_min;
+	end.min -= grow_min;
+	start.max += grow_max;
+	end.max += grow_max;
+}
+bool AnimatedTransform::is_animated() const {
+	return animated;
+}
 Point AnimatedTransform::operator()(float t, const Point &p) const {
 	Point out;
 	(*this)(t, p, out);
@@ -85,15 +113,15 @@ void AnimatedTransform::decompose(const Matrix4 &m, Vector &trans, Quaternion &r
 	}
 	mat[3][3] = 1;
 	//Use polar decomposition to extract R and S components
-	float norm = 0;
+	float norm = 1;
 	Matrix4 r = mat;
 	for (int i = 0; i < 100 && norm > 0.001; ++i){
 		Matrix4 r_next = 0.5 * (r + r.transpose().inverse());
 		norm = 0;
-		for (int i = 0; i < 3; ++i){
-			float n = std::abs(r[i][0] - r_next[i][0])
-				+ std::abs(r[i][1] - r_next[i][1])
-				+ std::abs(r[i][2] - r_next[i][2]);
+		for (int j = 0; j < 3; ++j){
+			float n = std::abs(r[j][0] - r_next[j][0])
+				+ std::abs(r[j][1] - r_next[j][1])
+				+ std::abs(r[j][2] - r_next[j][2]);
 			norm = std::max(norm, n);
 		}
 		r = r_next;
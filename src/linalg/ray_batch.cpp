@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <array>
+#include <limits>
+#include "linalg/util.h"
+#include "linalg/ray_batch.h"
+
+//Number of cells along each axis the ray origins are quantized to for their Morton codes,
+//the direction octant is placed in the bits above the code
+const static float ORIGIN_CELLS = 1 << 20;
+const static int OCTANT_SHIFT = 60;
+
+void RayBatch::push(const Ray &ray, int id){
+	const int octant = (ray.d.x < 0) | (ray.d.y < 0) << 1 | (ray.d.z < 0) << 2;
+	entries.push_back(Entry{0, ray.o, octant, id});
+}
+void RayBatch::clear(){
+	entries.clear();
+}
+bool RayBatch::empty() const {
+	return entries.empty();
+}
+size_t RayBatch::size() const {
+	return entries.size();
+}
+void RayBatch::sort(std::vector<int> &order){
+	//Quantize the origins over the bounds of the batch's origins so the rays only spread
+	//over the part of the scene they're actually in
+	Point o_min{std::numeric_limits<float>::infinity()};
+	Point o_max{-std::numeric_limits<float>::infinity()};
+	for (const auto &e : entries){
+		for (int a = 0; a < 3; ++a){
+			o_min[a] = std::min(o_min[a], e.o[a]);
+			o_max[a] = std::max(o_max[a], e.o[a]);
+		}
+	}
+	for (auto &e : entries){
+		std::array<uint64_t, 3> q;
+		for (int a = 0; a < 3; ++a){
+			const float extent = o_max[a] - o_min[a];
+			q[a] = extent > 0 && extent < std::numeric_limits<float>::infinity()
+				? clamp((e.o[a] - o_min[a]) / extent * ORIGIN_CELLS, 0.f, ORIGIN_CELLS - 1) : 0;
+		}
+		e.key = static_cast<uint64_t>(e.octant) << OCTANT_SHIFT | morton3(q[0], q[1], q[2]);
+	}
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b){
+		return a.key < b.key;
+	});
+	order.clear();
+	for (const auto &e : entries){
+		order.push_back(e.id);
+	}
+}
+
@@ -0,0 +1,52 @@
+#include <algorithm>
+#include <limits>
+#include "linalg/ray_packet.h"
+
+RayPacket::RayPacket() : size(0), min_t_bound(0), max_t_bound(std::numeric_limits<float>::infinity()){}
+void RayPacket::set_ray(int i, const Ray &r){
+	for (int a = 0; a < 3; ++a){
+		o[a][i] = r.o[a];
+		d[a][i] = r.d[a];
+	}
+	min_t[i] = r.min_t;
+	max_t[i] = r.max_t;
+	time[i] = r.time;
+}
+Ray RayPacket::ray(int i) const {
+	return Ray{Point{o[0][i], o[1][i], o[2][i]}, Vector{d[0][i], d[1][i], d[2][i]}, min_t[i], max_t[i], 0, time[i]};
+}
+void RayPacket::compute_bounds(){
+	o_min = Point{std::numeric_limits<float>::infinity()};
+	o_max = Point{-std::numeric_limits<float>::infinity()};
+	inv_min = Vector{std::numeric_limits<float>::infinity()};
+	inv_max = Vector{-std::numeric_limits<float>::infinity()};
+	min_t_bound = std::numeric_limits<float>::infinity();
+	for (int a = 0; a < 3; ++a){
+		for (int i = 0; i < size; ++i){
+			inv_d[a][i] = 1 / d[a][i];
+			o_min[a] = std::min(o_min[a], o[a][i]);
+			o_max[a] = std::max(o_max[a], o[a][i]);
+			inv_min[a] = std::min(inv_min[a], inv_d[a][i]);
+			inv_max[a] = std::max(inv_max[a], inv_d[a][i]);
+		}
+		//Unused lanes get rays that never hit anything so SIMD tests over them are harmless
+		for (int i = size; i < MAX_RAYS; ++i){
+			o[a][i] = 0;
+			d[a][i] = 1;
+			inv_d[a][i] = 1;
+		}
+	}
+	for (int i = 0; i < size; ++i){
+		min_t_bound = std::min(min_t_bound, min_t[i]);
+	}
+	for (int i = size; i < MAX_RAYS; ++i){
+		min_t[i] = 1;
+		max_t[i] = 0;
+		time[i] = 0;
+	}
+	update_max_t_bound();
+}
+void RayPacket::update_max_t_bound(){
+	max_t_bound = *std::max_element(max_t.begin(), max_t.begin() + size);
+}
+
@@ -3,6 +3,7 @@
 #include "linalg/vector.h"
 #include "linalg/point.h"
 #include "linalg/ray.h"
+#include "linalg/ray_packet.h"
 #include "linalg/matrix4.h"
 #include "geometry/bbox.h"
 #include "linalg/transform.h"
@@ -199,6 +200,21 @@ void Transform::operator()(const RayDifferential &in, RayDifferential &out) cons
 	(*this)(in.rx, out.rx);
 	(*this)(in.ry, out.ry);
 }
+void Transform::operator()(const RayPacket &in, RayPacket &out) const {
+	out.size = in.size;
+	for (int i = 0; i < in.size; ++i){
+		Point o = (*this)(Point{in.o[0][i], in.o[1][i], in.o[2][i]});
+		Vector d = (*this)(Vector{in.d[0][i], in.d[1][i], in.d[2][i]});
+		for (int a = 0; a < 3; ++a){
+			out.o[a][i] = o[a];
+			out.d[a][i] = d[a];
+		}
+	}
+	out.min_t = in.min_t;
+	out.max_t = in.max_t;
+	out.time = in.time;
+	out.compute_bounds();
+}
 Matrix4 Transform::operator()(const Matrix4 &m) const {
 	Matrix4 a;
 	(*this)(m, a);
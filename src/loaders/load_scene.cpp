@@ -3,6 +3,8 @@
 #include <iostream>
 #include <string>
 #include <array>
+#include <vector>
+#include <unordered_map>
 #include <tinyxml2.h>
 #include "linalg/util.h"
 #include "linalg/vector.h"
@@ -17,6 +19,9 @@
 #include "geometry/cylinder.h"
 #include "geometry/disk.h"
 #include "geometry/cone.h"
+#include "geometry/instance_set.h"
+#include "geometry/sphere_cloud.h"
+#include "geometry/mesh_proxy.h"
 #include "filters/box_filter.h"
 #include "samplers/stratified_sampler.h"
 #include "integrator/path_integrator.h"
@@ -56,6 +61,22 @@ static void load_node(tinyxml2::XMLElement *elem, Node &node, std::stack<Transfo
  */
 static Geometry* get_geometry(const std::string &type, const std::string &name, Scene &scene, const std::string &file,
 	tinyxml2::XMLElement *elem);
+/*
+ * Bake the transforms of nodes placing geometry that no other node places into the
+ * geometry, so meshes used once are moved to world space and their triangles are placed
+ * directly in the scene's BVH instead of being reached through the node
+ */
+static void bake_single_instances(Node &root);
+/*
+ * Read the BVH node layout requested by the element's bvh_layout attribute,
+ * if no layout is specified the binary layout is used
+ */
+static BVH_LAYOUT read_bvh_layout(tinyxml2::XMLElement *elem);
+/*
+ * Read the BVH split method requested by the element's bvh_split attribute,
+ * if no split method is specified SAH is used
+ */
+static SPLIT_METHOD read_bvh_split(tinyxml2::XMLElement *elem);
 
 Scene load_scene(const std::string &file){
 	using namespace tinyxml2;
@@ -100,6 +121,12 @@ Scene load_scene(const std::string &file){
 	RenderTarget render_target{static_cast<size_t>(w), static_cast<size_t>(h),
 		std::move(filter)};
 	Scene scene{std::move(camera), std::move(render_target), std::move(sampler), std::move(renderer)};
+	scene.set_bvh_layout(read_bvh_layout(scene_node));
+	//Meshes loaded by proxies are evicted to keep them in the memory budget, given in MB
+	float mesh_budget = 0;
+	if (scene_node->QueryFloatAttribute("mesh_budget", &mesh_budget) == tinyxml2::XML_SUCCESS && mesh_budget > 0){
+		scene.get_proxy_cache().set_budget(static_cast<size_t>(mesh_budget * 1024 * 1024));
+	}
 	//See if we have any background or environment textures
 	XMLElement *tex = scene_node->FirstChildElement("background");
 	if (tex){
@@ -122,6 +149,7 @@ Scene load_scene(const std::string &file){
 	std::stack<Transform> transform_stack;
 	transform_stack.push(Transform{});
 	load_node(scene_node, scene.get_root(), transform_stack, scene, file);
+	bake_single_instances(scene.get_root());
 	return scene;
 }
 Camera load_camera(tinyxml2::XMLElement *elem, int &w, int &h){
@@ -234,6 +262,25 @@ void load_node(tinyxml2::XMLElement *elem, Node &node, std::stack<Transform> &tr
 					n.get_inv_transform() = Transform{};
 				}
 			}
+			//Moving objects give their transform at the shutter's close in a motion element
+			XMLElement *motion_elem = e->FirstChildElement("motion");
+			if (motion_elem){
+				if (light_elem){
+					std::cerr << "Warning: area lights can't move, ignoring motion of " << name << "\n";
+				}
+				else {
+					Transform end_transform;
+					read_transform(motion_elem, end_transform);
+					n.set_motion(transform_stack.top() * end_transform);
+				}
+			}
+			//Instance sets and particles are moved into world space so the material of each
+			//instance or particle is recorded for its hits
+			if ((type == "instances" || type == "particles") && geom && !n.bake_transform()){
+				std::cout << "Scene error: " << type << " object " << name << " can't move, have an area light,"
+					<< " be placed by more than one object or be scaled non-uniformly" << std::endl;
+				std::exit(1);
+			}
 			//Load any children the node may have
 			if (e->FirstChildElement("object") || e->FirstChildElement("volume_node")){
 				transform_stack.push(n.get_transform());
@@ -289,10 +336,162 @@ Geometry* get_geometry(const std::string &type, const std::string &name, Scene &
 		if (elem->FirstChildElement("light")){
 			full_name += elem->FirstChildElement("light")->Attribute("name");
 		}
-		return cache.add(full_name, std::make_unique<TriMesh>(model_file));
+		float dup_budget = 0.3f;
+		elem->QueryFloatAttribute("bvh_dup_budget", &dup_budget);
+		auto mesh = std::make_unique<TriMesh>(model_file, false, read_bvh_split(elem), dup_budget, read_bvh_layout(elem));
+		//Simplified levels of detail can be generated for rays deep in the path
+		int lod_levels = 0, lod_depth = 2;
+		elem->QueryIntAttribute("lod_levels", &lod_levels);
+		elem->QueryIntAttribute("lod_depth", &lod_depth);
+		if (lod_levels > 0){
+			mesh->generate_lods(lod_levels, lod_depth);
+		}
+		return cache.add(full_name, std::move(mesh));
+	}
+	else if (type == "proxy"){
+		//Proxies only read the binary mesh's bounds, the mesh is loaded when a ray first reaches it
+		std::string model_file = file.substr(0, file.rfind(PATH_SEP) + 1) + name;
+		std::cout << "Creating proxy for model file: " << model_file << std::endl;
+		float dup_budget = 0.3f;
+		elem->QueryFloatAttribute("bvh_dup_budget", &dup_budget);
+		return cache.add(name, std::make_unique<MeshProxy>(model_file, scene.get_proxy_cache(), read_bvh_split(elem),
+			dup_budget, read_bvh_layout(elem)));
+	}
+	else if (type == "instances"){
+		//The instance file refers to the meshes and materials listed in the element by their index
+		const char *instance_file = elem->Attribute("file");
+		if (!instance_file){
+			std::cout << "Scene error: instance set " << name << " needs an instance file" << std::endl;
+			return nullptr;
+		}
+		std::vector<TriMesh*> meshes;
+		for (tinyxml2::XMLElement *m = elem->FirstChildElement("mesh"); m; m = m->NextSiblingElement("mesh")){
+			TriMesh *mesh = nullptr;
+			if (m->Attribute("name")){
+				mesh = dynamic_cast<TriMesh*>(get_geometry("obj", m->Attribute("name"), scene, file, m));
+			}
+			if (!mesh){
+				std::cerr << "Warning: instance set " << name << " mesh " << meshes.size() << " could not be loaded\n";
+			}
+			meshes.push_back(mesh);
+		}
+		std::vector<Material*> materials;
+		for (tinyxml2::XMLElement *m = elem->FirstChildElement("material"); m; m = m->NextSiblingElement("material")){
+			Material *mat = m->Attribute("name") ? scene.get_mat_cache().get(m->Attribute("name")) : nullptr;
+			if (!mat){
+				std::cerr << "Warning: instance set " << name << " material " << materials.size() << " could not be found\n";
+			}
+			materials.push_back(mat);
+		}
+		std::string instances_file = file.substr(0, file.rfind(PATH_SEP) + 1) + instance_file;
+		std::cout << "Loading instances from file: " << instances_file << std::endl;
+		auto set = std::make_unique<InstanceSet>(meshes, materials, name, read_bvh_layout(elem));
+		if (!set->load(instances_file)){
+			std::cout << "Scene error: instance set " << name << " could not be loaded from " << instances_file << std::endl;
+			return nullptr;
+		}
+		return cache.add(name, std::move(set));
+	}
+	else if (type == "particles"){
+		//The particle file refers to the materials listed in the element by their index
+		const char *particle_file = elem->Attribute("file");
+		if (!particle_file){
+			std::cout << "Scene error: particles " << name << " need a particle file" << std::endl;
+			return nullptr;
+		}
+		std::vector<Material*> materials;
+		for (tinyxml2::XMLElement *m = elem->FirstChildElement("material"); m; m = m->NextSiblingElement("material")){
+			Material *mat = m->Attribute("name") ? scene.get_mat_cache().get(m->Attribute("name")) : nullptr;
+			if (!mat){
+				std::cerr << "Warning: particles " << name << " material " << materials.size() << " could not be found\n";
+			}
+			materials.push_back(mat);
+		}
+		std::string particles_file = file.substr(0, file.rfind(PATH_SEP) + 1) + particle_file;
+		std::cout << "Loading particles from file: " << particles_file << std::endl;
+		auto cloud = std::make_unique<SphereCloud>(materials, name);
+		if (!cloud->load(particles_file)){
+			std::cout << "Scene error: particles " << name << " could not be loaded from " << particles_file << std::endl;
+			return nullptr;
+		}
+		return cache.add(name, std::move(cloud));
 	}
 	return nullptr;
 }
+void bake_single_instances(Node &root){
+	std::unordered_map<const Geometry*, int> instances;
+	std::vector<Node*> nodes, todo{&root};
+	while (!todo.empty()){
+		Node *n = todo.back();
+		todo.pop_back();
+		if (n->get_geometry()){
+			++instances[n->get_geometry()];
+			nodes.push_back(n);
+			//Meshes placed by an instance set are shared by its instances
+			const InstanceSet *set = dynamic_cast<const InstanceSet*>(n->get_geometry());
+			if (set){
+				for (const TriMesh *m : set->get_meshes()){
+					instances[m] += 2;
+				}
+			}
+		}
+		for (auto &c : n->get_children()){
+			todo.push_back(c.get());
+		}
+	}
+	int baked = 0;
+	for (Node *n : nodes){
+		if (instances[n->get_geometry()] == 1 && n->bake_transform()){
+			++baked;
+		}
+	}
+	if (baked > 0){
+		std::cout << "Baked " << baked << " single use meshes into world space\n";
+	}
+}
+BVH_LAYOUT read_bvh_layout(tinyxml2::XMLElement *elem){
+	const char *l = elem->Attribute("bvh_layout");
+	if (!l){
+		return BVH_LAYOUT::BINARY;
+	}
+	std::string layout = l;
+	if (layout == "wide4"){
+		return BVH_LAYOUT::WIDE4;
+	}
+	else if (layout == "wide8"){
+		return BVH_LAYOUT::WIDE8;
+	}
+	else if (layout == "compressed4"){
+		return BVH_LAYOUT::COMPRESSED4;
+	}
+	else if (layout == "compressed8"){
+		return BVH_LAYOUT::COMPRESSED8;
+	}
+	else if (layout == "treelet"){
+		return BVH_LAYOUT::TREELET;
+	}
+	else if (layout != "binary"){
+		std::cerr << "Warning: unrecognized BVH layout " << layout << ", using binary\n";
+	}
+	return BVH_LAYOUT::BINARY;
+}
+SPLIT_METHOD read_bvh_split(tinyxml2::XMLElement *elem){
+	const char *s = elem->Attribute("bvh_split");
+	if (!s){
+		return SPLIT_METHOD::SAH;
+	}
+	std::string split = s;
+	if (split == "lbvh"){
+		return SPLIT_METHOD::LBVH;
+	}
+	else if (split == "sbvh"){
+		return SPLIT_METHOD::SBVH;
+	}
+	else if (split != "sah"){
+		std::cerr << "Warning: unrecognized BVH split method " << split << ", using sah\n";
+	}
+	return SPLIT_METHOD::SAH;
+}
 void read_vector(tinyxml2::XMLElement *elem, Vector &v){
 	elem->QueryFloatAttribute("x", &v.x);
 	elem->QueryFloatAttribute("y", &v.y);
@@ -1,6 +1,10 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
 #include "args.h"
 #include "integrator/volume_integrator.h"
 #include "volume/homogeneous_volume.h"
@@ -12,6 +16,7 @@
 #include "geometry/tri_mesh.h"
 #include "loaders/load_scene.h"
 #include "film/render_target.h"
+#include "filters/box_filter.h"
 #include "mesh_preprocess.h"
 #include "driver.h"
 
@@ -25,10 +30,21 @@ const static std::string USAGE =
 -f <file>         - Specify the scene file to render\n\
 -o <out_file>     - Specify the output image file name\n\
 -n <num>          - Optional: specify the number of threads to render with. Default is 1\n\
--bw <num>         - Optional: specify the desired width of blocks to partition the scene into for the threads to work on,\n\
-                    should evenly divide the image width. Default is image width.\n\
--bh <num>         - Optional: specify the desired height of blocks to partition the scene into for the threads to work on,\n\
-                    should evenly divide the image height. Default is image height.\n\
+-bw <num>         - Optional: specify the desired width of blocks to partition the scene into for the threads to work on.\n\
+                    Default is picked from the image size and number of threads.\n\
+-bh <num>         - Optional: specify the desired height of blocks to partition the scene into for the threads to work on.\n\
+                    Default is picked from the image size and number of threads.\n\
+-time <sec>       - Optional: render progressively, making passes over the image until this many seconds have passed\n\
+-error <num>      - Optional: render progressively, making passes over the image until the relative error of each pixel\n\
+                    is below this value. Can be combined with -time to stop at whichever comes first\n\
+-checkpoint <file> - Optional: periodically write a checkpoint of the render to this file so it can be resumed\n\
+-checkpoint_interval <sec> - Optional: seconds between checkpoints. Default is 300\n\
+-resume <file>    - Optional: resume the render from this checkpoint, the scene must be the same one it was taken of.\n\
+                    Checkpoints continue to be written to it unless -checkpoint gives another file\n\
+-tiles <i>/<n>    - Optional: only render the i'th of n tile ranges of the image, so a frame can be split among n\n\
+                    processes. Write each one's output to a .film file and combine them with -merge\n\
+-merge <out_file> [<films>] - Add up the partial .film files rendered with -tiles and save the resolved image\n\
+                    to the output file\n\
 -pmesh [<files>]  - Specify a list of meshes to be run through the the obj -> binary obj (bobj) processor so that they\n\
                     can be loaded faster when doing a render. The renderer will check for bobj files with the same name\n\
                     when trying to load an obj file in a scene.\n"
@@ -39,6 +55,32 @@ const static std::string USAGE =
 + std::string{"-h                - Show this help information\n\
 ----------------------------\n"};
 
+/*
+ * Add up the films passed after -merge <out_file> and save the image
+ */
+static bool merge_films(char **argv, int argc){
+	char **it = std::find(argv, argv + argc, std::string{"-merge"});
+	std::vector<std::string> files{it + 1, argv + argc};
+	if (files.size() < 2){
+		std::cerr << "Error: -merge needs an output file and the films to merge\n";
+		return false;
+	}
+	size_t width = 0, height = 0;
+	if (!RenderTarget::read_film_size(files[1], width, height)){
+		std::cerr << "Error: " << files[1] << " is not a film file\n";
+		return false;
+	}
+	//The films' samples are already filtered so the filter is unused
+	RenderTarget target{width, height, std::make_unique<BoxFilter>(0.5f, 0.5f)};
+	for (size_t i = 1; i < files.size(); ++i){
+		if (!target.add_film(files[i])){
+			return false;
+		}
+	}
+	std::cout << "Merged " << files.size() - 1 << " films into " << files[0] << std::endl;
+	return target.save_image(files[0]);
+}
+
 int main(int argc, char **argv){
 	if (flag(argv, argv + argc, "-h")){
 		std::cout << USAGE;
@@ -48,6 +90,9 @@ int main(int argc, char **argv){
 		batch_process(argv, argc);
 		return 0;
 	}
+	if (flag(argv, argv + argc, "-merge")){
+		return merge_films(argv, argc) ? 0 : 1;
+	}
 	if (!flag(argv, argv + argc, "-f")){
 		std::cerr << "Error: No scene file passed\n"
 			<< USAGE;
@@ -82,15 +127,47 @@ int main(int argc, char **argv){
 	}
 	std::string scene_file = get_param<std::string>(argv, argv + argc, "-f");
 	Scene scene = load_scene(scene_file);
-	scene.get_root().flatten_children();
+	scene.get_root().flatten_children(scene.get_bvh_layout());
 
-	if (bw == -1){
-		bw = scene.get_render_target().get_width();
+	Driver driver{scene, n_threads, bw, bh};
+	if (flag(argv, argv + argc, "-time") || flag(argv, argv + argc, "-error")){
+		float time_budget = 0, target_error = 0;
+		if (flag(argv, argv + argc, "-time")){
+			time_budget = get_param<float>(argv, argv + argc, "-time");
+		}
+		if (flag(argv, argv + argc, "-error")){
+			target_error = get_param<float>(argv, argv + argc, "-error");
+		}
+		driver.set_progressive(time_budget, target_error);
 	}
-	if (bh == -1){
-		bh = scene.get_render_target().get_height();
+	if (flag(argv, argv + argc, "-tiles")){
+		std::string tiles = get_param<std::string>(argv, argv + argc, "-tiles");
+		int tile = 0, count = 0;
+		if (std::sscanf(tiles.c_str(), "%d/%d", &tile, &count) != 2 || count < 1 || tile < 1 || tile > count){
+			std::cerr << "Error: -tiles expects a range <i>/<n> with 1 <= i <= n, got " << tiles << "\n";
+			return 1;
+		}
+		driver.set_tile_range(tile - 1, count);
+	}
+	//Resumed renders keep checkpointing to the file they were resumed from by default
+	std::string checkpoint_file;
+	if (flag(argv, argv + argc, "-resume")){
+		checkpoint_file = get_param<std::string>(argv, argv + argc, "-resume");
+		if (!driver.resume(checkpoint_file)){
+			std::cerr << "Error: failed to resume from checkpoint " << checkpoint_file << "\n";
+			return 1;
+		}
+	}
+	if (flag(argv, argv + argc, "-checkpoint")){
+		checkpoint_file = get_param<std::string>(argv, argv + argc, "-checkpoint");
+	}
+	if (!checkpoint_file.empty()){
+		float interval = 300;
+		if (flag(argv, argv + argc, "-checkpoint_interval")){
+			interval = get_param<float>(argv, argv + argc, "-checkpoint_interval");
+		}
+		driver.set_checkpoint(checkpoint_file, interval);
 	}
-	Driver driver{scene, n_threads, bw, bh};
 
 #ifdef BUILD_PREVIEWER
 	if (flag(argv, argv + argc, "-p")){
@@ -36,6 +36,11 @@ bool process_wobj(const std::string &file){
 	std::fwrite(mesh.texcoords.data(), sizeof(Point), nverts, fout);
 	std::fwrite(mesh.normals.data(), sizeof(Normal), nverts, fout);
 	std::fwrite(mesh.vert_indices.data(), sizeof(int), 3 * ntris, fout);
+	std::vector<Geometry*> ref_tris;
+	mesh.refine(ref_tris);
+	if (!mesh.bvh.write(fout, ref_tris)){
+		std::cout << "Warning: process_wobj failed to write BVH for " << file << std::endl;
+	}
 	std::fclose(fout);
 	return true;
 }
@@ -14,17 +14,31 @@ Renderer::Renderer(std::unique_ptr<SurfaceIntegrator> surface_integrator, std::u
 void Renderer::preprocess(const Scene &scene){
 	surface_integrator->preprocess(scene);
 }
+bool Renderer::save_state(std::FILE *f) const {
+	return surface_integrator->save_state(f);
+}
+bool Renderer::load_state(std::FILE *f, const Scene &scene){
+	return surface_integrator->load_state(f, scene);
+}
 Colorf Renderer::illumination(RayDifferential &ray, const Scene &scene, Sampler &sampler, MemoryPool &pool) const {
 	DifferentialGeometry dg;
-	Colorf illum;
 	if (scene.get_root().intersect(ray, dg)){
-		illum = surface_integrator->illumination(scene, *this, ray, dg, sampler, pool);
+		return illumination(ray, &dg, scene, sampler, pool);
+	}
+	return illumination(ray, nullptr, scene, sampler, pool);
+}
+Colorf Renderer::illumination(RayDifferential &ray, DifferentialGeometry *dg, const Scene &scene,
+	Sampler &sampler, MemoryPool &pool) const
+{
+	Colorf illum;
+	if (dg){
+		illum = surface_integrator->illumination(scene, *this, ray, *dg, sampler, pool);
 	}
 	else if (scene.get_environment()){
 		//TODO: Compute light along the ray coming from lights, eg for things like lightmaps that are wrapped around the scene
-		DifferentialGeometry dg;
-		dg.point = Point{ray.d.x, ray.d.y, ray.d.z};
-		illum = scene.get_environment()->sample(dg);
+		DifferentialGeometry env_dg;
+		env_dg.point = Point{ray.d.x, ray.d.y, ray.d.z};
+		illum = scene.get_environment()->sample(env_dg);
 	}
 	Colorf vol_radiance, transmit{1};
 	if (volume_integrator != nullptr){
@@ -32,6 +46,23 @@ Colorf Renderer::illumination(RayDifferential &ray, const Scene &scene, Sampler
 	}
 	return transmit * illum + vol_radiance;
 }
+void Renderer::illumination(RayDifferential *rays, DifferentialGeometry **hits, int n, const Scene &scene,
+	Sampler &sampler, MemoryPool &pool, Colorf *illum) const
+{
+	surface_integrator->illumination(scene, *this, rays, hits, n, illum, sampler, pool);
+	for (int i = 0; i < n; ++i){
+		if (!hits[i] && scene.get_environment()){
+			DifferentialGeometry env_dg;
+			env_dg.point = Point{rays[i].d.x, rays[i].d.y, rays[i].d.z};
+			illum[i] = scene.get_environment()->sample(env_dg);
+		}
+		if (volume_integrator != nullptr){
+			Colorf transmit{1};
+			const Colorf vol_radiance = volume_integrator->radiance(scene, *this, rays[i], sampler, pool, transmit);
+			illum[i] = transmit * illum[i] + vol_radiance;
+		}
+	}
+}
 Colorf Renderer::transmittance(const Scene &scene, const RayDifferential &ray, Sampler &sampler, MemoryPool &pool) const {
 	return volume_integrator != nullptr ? volume_integrator->transmittance(scene, *this, ray, sampler, pool) : Colorf{1};
 }
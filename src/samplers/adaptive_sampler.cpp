@@ -80,6 +80,9 @@ bool AdaptiveSampler::report_results(const std::vector<Sample> &samples,
 	supersample_px *= 2;
 	return false;
 }
+bool AdaptiveSampler::uses_feedback() const {
+	return true;
+}
 std::vector<std::unique_ptr<Sampler>> AdaptiveSampler::get_subsamplers(int w, int h) const {
 	int x_dim = x_end - x_start;
 	int y_dim = y_end - y_start;
@@ -89,30 +92,25 @@ std::vector<std::unique_ptr<Sampler>> AdaptiveSampler::get_subsamplers(int w, in
 		samplers.emplace_back(std::make_unique<AdaptiveSampler>(*this));
 		return samplers;
 	}
-	//Compute the number of tiles to use in each dimension, we halve the number along x
-	//and double the number along y until we hit an odd number of x tiles (cols) or
-	//until the tiles divide the space about evenly
+	//Compute the number of tiles to use in each dimension, if the tiles don't divide
+	//the space evenly the left over pixels are spread over the tiles
 	int n_cols = x_dim / w;
 	int n_rows = y_dim / h;
-	x_dim /= n_cols;
-	y_dim /= n_rows;
-	//Check & warn if the space hasn't been split up evenly
-	if (x_dim * n_cols != width() || y_dim * n_rows != height()){
-		std::cout << "WARNING: sampler could not be partitioned equally into"
-			<< " samplers of the desired dimensions " << w << " x " << h << std::endl;
-	}
 	std::minstd_rand seed_rng(std::chrono::duration_cast<std::chrono::milliseconds>(
 		std::chrono::high_resolution_clock::now().time_since_epoch()).count());
 	std::uniform_int_distribution<int> seed;
 	for (int j = 0; j < n_rows; ++j){
 		for (int i = 0; i < n_cols; ++i){
-			samplers.emplace_back(std::make_unique<AdaptiveSampler>(i * x_dim + x_start,
-				(i + 1) * x_dim + x_start, j * y_dim + y_start,
-				(j + 1) * y_dim + y_start, min_spp, max_spp, seed(seed_rng)));
+			samplers.emplace_back(std::make_unique<AdaptiveSampler>(i * x_dim / n_cols + x_start,
+				(i + 1) * x_dim / n_cols + x_start, j * y_dim / n_rows + y_start,
+				(j + 1) * y_dim / n_rows + y_start, min_spp, max_spp, seed(seed_rng)));
 		}
 	}
 	return samplers;
 }
+std::unique_ptr<Sampler> AdaptiveSampler::get_subsampler(int xs, int xe, int ys, int ye, int seed) const {
+	return std::make_unique<AdaptiveSampler>(xs, xe, ys, ye, min_spp, max_spp, seed);
+}
 bool AdaptiveSampler::needs_supersampling(const std::vector<Sample>&,
 	const std::vector<RayDifferential>&, const std::vector<Colorf> &colors)
 {
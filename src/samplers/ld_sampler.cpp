@@ -67,30 +67,25 @@ std::vector<std::unique_ptr<Sampler>> LDSampler::get_subsamplers(int w, int h) c
 		samplers.emplace_back(std::make_unique<LDSampler>(*this));
 		return samplers;
 	}
-	//Compute the number of tiles to use in each dimension, we halve the number along x
-	//and double the number along y until we hit an odd number of x tiles (cols) or
-	//until the tiles divide the space about evenly
+	//Compute the number of tiles to use in each dimension, if the tiles don't divide
+	//the space evenly the left over pixels are spread over the tiles
 	int n_cols = x_dim / w;
 	int n_rows = y_dim / h;
-	x_dim /= n_cols;
-	y_dim /= n_rows;
-	//Check & warn if the space hasn't been split up evenly
-	if (x_dim * n_cols != width() || y_dim * n_rows != height()){
-		std::cout << "WARNING: sampler could not be partitioned equally into"
-			<< " samplers of the desired dimensions " << w << " x " << h << std::endl;
-	}
 	std::minstd_rand seed_rng(std::chrono::duration_cast<std::chrono::milliseconds>(
 		std::chrono::high_resolution_clock::now().time_since_epoch()).count());
 	std::uniform_int_distribution<int> seed;
 	for (int j = 0; j < n_rows; ++j){
 		for (int i = 0; i < n_cols; ++i){
-			samplers.emplace_back(std::make_unique<LDSampler>(i * x_dim + x_start,
-				(i + 1) * x_dim + x_start, j * y_dim + y_start,
-				(j + 1) * y_dim + y_start, spp, seed(seed_rng)));
+			samplers.emplace_back(std::make_unique<LDSampler>(i * x_dim / n_cols + x_start,
+				(i + 1) * x_dim / n_cols + x_start, j * y_dim / n_rows + y_start,
+				(j + 1) * y_dim / n_rows + y_start, spp, seed(seed_rng)));
 		}
 	}
 	return samplers;
 }
+std::unique_ptr<Sampler> LDSampler::get_subsampler(int xs, int xe, int ys, int ye, int seed) const {
+	return std::make_unique<LDSampler>(xs, xe, ys, ye, spp, seed);
+}
 void LDSampler::sample1d(float *samples, int n_samples, uint32_t scramble, int offset){
 	for (int i = 0; i < n_samples; ++i){
 		samples[i] = van_der_corput(i + offset, scramble);
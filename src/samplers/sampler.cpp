@@ -11,6 +11,9 @@ Sampler::Sampler(int x_start, int x_end, int y_start, int y_end)
 	: Sampler(x_start, x_end, y_start, y_end, std::chrono::duration_cast<std::chrono::milliseconds>(
 		std::chrono::high_resolution_clock::now().time_since_epoch()).count())
 {}
+void Sampler::reseed(int seed){
+	rng.seed(seed);
+}
 float Sampler::random_float(){
 	return float_distrib(rng);
 }
@@ -19,6 +22,9 @@ bool Sampler::report_results(const std::vector<Sample>&,
 {
 	return true;
 }
+bool Sampler::uses_feedback() const {
+	return false;
+}
 bool Sampler::has_samples(){
 	return y != y_end;
 }
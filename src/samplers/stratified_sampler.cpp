@@ -31,7 +31,7 @@ void StratifiedSampler::get_samples(std::vector<Sample> &samples){
 	auto t = time.begin();
 	auto s = samples.begin();
 	for (; s != samples.end(); ++p, ++l, ++t, ++s){
-		*s = Sample{*p, *l, 0};
+		*s = Sample{*p, *l, *t};
 	}
 	for (auto &s : samples){
 		s.img[0] += x;
@@ -63,30 +63,25 @@ std::vector<std::unique_ptr<Sampler>> StratifiedSampler::get_subsamplers(int w,
 		samplers.emplace_back(std::make_unique<StratifiedSampler>(*this));
 		return samplers;
 	}
-	//Compute the number of tiles to use in each dimension, we halve the number along x
-	//and double the number along y until we hit an odd number of x tiles (cols) or
-	//until the tiles divide the space about evenly
+	//Compute the number of tiles to use in each dimension, if the tiles don't divide
+	//the space evenly the left over pixels are spread over the tiles
 	int n_cols = x_dim / w;
 	int n_rows = y_dim / h;
-	x_dim /= n_cols;
-	y_dim /= n_rows;
-	//Check & warn if the space hasn't been split up evenly
-	if (x_dim * n_cols != width() || y_dim * n_rows != height()){
-		std::cout << "WARNING: sampler could not be partitioned equally into"
-			<< " samplers of the desired dimensions " << w << " x " << h << std::endl;
-	}
 	std::minstd_rand seed_rng(std::chrono::duration_cast<std::chrono::milliseconds>(
 		std::chrono::high_resolution_clock::now().time_since_epoch()).count());
 	std::uniform_int_distribution<int> seed;
 	for (int j = 0; j < n_rows; ++j){
 		for (int i = 0; i < n_cols; ++i){
-			samplers.emplace_back(std::make_unique<StratifiedSampler>(i * x_dim + x_start,
-				(i + 1) * x_dim + x_start, j * y_dim + y_start,
-				(j + 1) * y_dim + y_start, spp, seed(seed_rng)));
+			samplers.emplace_back(std::make_unique<StratifiedSampler>(i * x_dim / n_cols + x_start,
+				(i + 1) * x_dim / n_cols + x_start, j * y_dim / n_rows + y_start,
+				(j + 1) * y_dim / n_rows + y_start, spp, seed(seed_rng)));
 		}
 	}
 	return samplers;
 }
+std::unique_ptr<Sampler> StratifiedSampler::get_subsampler(int xs, int xe, int ys, int ye, int seed) const {
+	return std::make_unique<StratifiedSampler>(xs, xe, ys, ye, spp, seed);
+}
 void StratifiedSampler::sample1d(float *samples, int n_samples, std::minstd_rand &rng){
 	std::uniform_real_distribution<float> distrib;
 	int spp = static_cast<int>(std::sqrt(n_samples));
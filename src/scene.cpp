@@ -1,6 +1,9 @@
 #include <string>
+#include <vector>
+#include <iostream>
 #include "integrator/volume_integrator.h"
 #include "geometry/geometry.h"
+#include "geometry/tri_mesh.h"
 #include "volume/volume_node.h"
 #include "material/material.h"
 #include "lights/light.h"
@@ -9,8 +12,9 @@
 #include "scene.h"
 
 Scene::Scene(Camera camera, RenderTarget target, std::unique_ptr<Sampler> sampler, std::unique_ptr<Renderer> renderer)
-	: camera(std::move(camera)), render_target(std::move(target)), sampler(std::move(sampler)),
-	renderer(std::move(renderer)), root(nullptr, nullptr, Transform{}, "root"), background(nullptr), environment(nullptr)
+	: proxy_cache(std::make_unique<MeshProxyCache>()), camera(std::move(camera)), render_target(std::move(target)), sampler(std::move(sampler)),
+	renderer(std::move(renderer)), root(nullptr, nullptr, Transform{}, "root"), background(nullptr), environment(nullptr),
+	bvh_layout(BVH_LAYOUT::BINARY)
 {}
 GeometryCache& Scene::get_geom_cache(){
 	return geom_cache;
@@ -30,6 +34,9 @@ const LightCache& Scene::get_light_cache() const {
 VolumeCache& Scene::get_volume_cache(){
 	return volume_cache;
 }
+MeshProxyCache& Scene::get_proxy_cache(){
+	return *proxy_cache;
+}
 Camera& Scene::get_camera(){
 	return camera;
 }
@@ -76,3 +83,50 @@ const Texture* Scene::get_environment() const {
 	return environment;
 }
 
+void Scene::set_bvh_layout(BVH_LAYOUT layout){
+	bvh_layout = layout;
+}
+BVH_LAYOUT Scene::get_bvh_layout() const {
+	return bvh_layout;
+}
+Node* Scene::find_node(const std::string &name){
+	//The scene graph is flattened once loaded but search the whole thing in case it's not
+	std::vector<Node*> todo{&root};
+	while (!todo.empty()){
+		Node *n = todo.back();
+		todo.pop_back();
+		if (n->get_name() == name){
+			return n;
+		}
+		for (auto &c : n->get_children()){
+			todo.push_back(c.get());
+		}
+	}
+	return nullptr;
+}
+bool Scene::set_node_transform(const std::string &name, const Transform &t){
+	Node *n = find_node(name);
+	if (!n){
+		std::cerr << "Scene error: no node named " << name << " to move\n";
+		return false;
+	}
+	if (!n->set_transform(t)){
+		std::cerr << "Scene error: node " << name << " has its transform baked into geometry that can't be"
+			<< " baked with the new transform, the node wasn't moved\n";
+		return false;
+	}
+	return true;
+}
+bool Scene::set_mesh_vertices(const std::string &name, const std::vector<Point> &verts,
+	const std::vector<Normal> &norms)
+{
+	TriMesh *mesh = dynamic_cast<TriMesh*>(geom_cache.get(name));
+	if (!mesh){
+		std::cerr << "Scene error: no mesh named " << name << " to update\n";
+		return false;
+	}
+	return mesh->set_vertices(verts, norms);
+}
+void Scene::update_bvh(float rebuild_ratio){
+	root.refit(rebuild_ratio);
+}